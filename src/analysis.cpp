@@ -0,0 +1,274 @@
+#include "analysis.h"
+#include "notation.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <thread>
+
+namespace Chess {
+
+namespace {
+
+struct Job {
+        std::size_t index;
+        std::string fen;
+};
+
+std::string_view trim(std::string_view text) noexcept
+{
+        auto const first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos)
+                return {};
+        auto const last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+}
+
+AnalysisResult analyze(Job job, SearchLimits const& limits)
+{
+        AnalysisResult result {
+                .index = job.index,
+                .fen = std::move(job.fen),
+                .error = {},
+                .best_move = {},
+                .principal_variation = {},
+                .score = 0,
+                .depth = 0,
+                .nodes = 0,
+                .time = {}
+        };
+        std::optional const setup = parse_fen(result.fen);
+        if (!setup) {
+                result.error = "invalid FEN";
+                return result;
+        }
+
+        Game const game(nullptr, *setup);
+        Search search(game);
+        SearchInfo last {};
+        std::optional const best_move = search.run(limits,
+                [&](SearchInfo const& info)
+                {
+                        last = info;
+                }
+        );
+        if (!best_move) {
+                result.error = "no legal moves";
+                return result;
+        }
+
+        result.best_move = to_uci(game.board(), *best_move);
+        // Castling can only be told apart on the board it is made on.
+        Game line = game;
+        for (Move move : last.principal_variation) {
+                result.principal_variation.push_back(to_uci(line.board(), move));
+                line.try_move(move);
+        }
+        result.score = last.score;
+        result.depth = last.depth;
+        result.nodes = last.nodes;
+        result.time = last.time;
+        return result;
+}
+
+void append_json_string(std::string& out, std::string_view text)
+{
+        out += '"';
+        for (char c : text) {
+                if (c == '"' || c == '\\') {
+                        out += '\\';
+                        out += c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof escaped, "\\u%04x", c);
+                        out += escaped;
+                } else {
+                        out += c;
+                }
+        }
+        out += '"';
+}
+
+// A reader thread puts jobs in pending_, the workers put results in done_,
+// and the calling thread hands those to the sink. Every position read
+// counts as in flight until its result is handed over.
+class Pipeline {
+public:
+        Pipeline(std::istream& in, AnalysisOptions const& options) noexcept
+                : in_(in)
+                , limits_(options.limits)
+                , threads_(options.threads != 0 ?
+                           options.threads : std::max(std::thread::hardware_concurrency(), 1u))
+                , max_in_flight_(options.max_in_flight != 0 ?
+                                 options.max_in_flight : 4 * threads_)
+        {}
+
+        void run(AnalysisSink const& sink)
+        {
+                std::vector<std::thread> workers;
+                workers.reserve(threads_);
+                for (unsigned i = 0; i < threads_; ++i)
+                        workers.emplace_back([this] { work(); });
+                std::thread reader([this] { read(); });
+
+                auto const join = [&]
+                {
+                        reader.join();
+                        for (std::thread& worker : workers)
+                                worker.join();
+                };
+                try {
+                        hand_over(sink);
+                } catch (...) {
+                        cancel();
+                        join();
+                        throw;
+                }
+                join();
+        }
+
+private:
+        void read()
+        {
+                std::string line;
+                std::size_t index = 0;
+                while (std::getline(in_, line)) {
+                        std::string_view const fen = trim(line);
+                        if (fen.empty() || fen.front() == '#')
+                                continue;
+
+                        std::unique_lock lock(mutex_);
+                        space_.wait(lock, [this] { return in_flight_ < max_in_flight_ || cancelled_; });
+                        if (cancelled_)
+                                break;
+                        ++in_flight_;
+                        pending_.push_back(Job {index++, std::string(fen)});
+                        work_.notify_one();
+                }
+
+                std::lock_guard lock(mutex_);
+                positions_ = index;
+                read_done_ = true;
+                work_.notify_all();
+                done_ready_.notify_all();
+        }
+
+        void work()
+        {
+                while (true) {
+                        Job job;
+                        {
+                                std::unique_lock lock(mutex_);
+                                work_.wait(lock, [this]
+                                {
+                                        return !pending_.empty() || read_done_ || cancelled_;
+                                });
+                                if (pending_.empty() || cancelled_)
+                                        return;
+                                job = std::move(pending_.front());
+                                pending_.pop_front();
+                        }
+
+                        AnalysisResult result = analyze(std::move(job), limits_);
+
+                        std::lock_guard lock(mutex_);
+                        done_.push_back(std::move(result));
+                        done_ready_.notify_one();
+                }
+        }
+
+        void hand_over(AnalysisSink const& sink)
+        {
+                std::size_t handed_over = 0;
+                while (true) {
+                        AnalysisResult result;
+                        {
+                                std::unique_lock lock(mutex_);
+                                done_ready_.wait(lock, [&]
+                                {
+                                        return !done_.empty() ||
+                                               (read_done_ && handed_over == positions_);
+                                });
+                                if (done_.empty())
+                                        return;
+                                result = std::move(done_.front());
+                                done_.pop_front();
+                                --in_flight_;
+                                space_.notify_one();
+                        }
+
+                        ++handed_over;
+                        sink(result);
+                }
+        }
+
+        // Stops the reader and the workers once the sink throws.
+        void cancel() noexcept
+        {
+                std::lock_guard lock(mutex_);
+                cancelled_ = true;
+                space_.notify_all();
+                work_.notify_all();
+        }
+
+        std::istream& in_;
+        SearchLimits limits_;
+        unsigned threads_;
+        std::size_t max_in_flight_;
+
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable space_;
+        std::condition_variable done_ready_;
+        std::deque<Job> pending_;
+        std::deque<AnalysisResult> done_;
+        std::size_t in_flight_ = 0;
+        std::size_t positions_ = 0;
+        bool read_done_ = false;
+        bool cancelled_ = false;
+};
+
+}
+
+void analyze_positions(std::istream& in, AnalysisOptions const& options,
+                       AnalysisSink const& sink)
+{
+        Pipeline(in, options).run(sink);
+}
+
+std::string to_json(AnalysisResult const& result)
+{
+        using namespace std::string_literals;
+
+        std::string out = "{\"index\": "s + std::to_string(result.index) + ", \"fen\": "s;
+        append_json_string(out, result.fen);
+        if (!result.error.empty()) {
+                out += ", \"error\": "s;
+                append_json_string(out, result.error);
+                return out + '}';
+        }
+
+        out += ", \"bestmove\": "s;
+        append_json_string(out, result.best_move);
+        if (std::abs(result.score) < mate_score - max_search_depth) {
+                out += ", \"score\": {\"cp\": "s + std::to_string(result.score) + '}';
+        } else {
+                int const plies = mate_score - std::abs(result.score);
+                int const moves = (result.score > 0) ? (plies + 1) / 2 : -(plies + 1) / 2;
+                out += ", \"score\": {\"mate\": "s + std::to_string(moves) + '}';
+        }
+        out += ", \"depth\": "s + std::to_string(result.depth) +
+               ", \"nodes\": "s + std::to_string(result.nodes) +
+               ", \"time\": "s + std::to_string(result.time.count()) +
+               ", \"pv\": ["s;
+        for (std::size_t i = 0; i < result.principal_variation.size(); ++i) {
+                if (i != 0)
+                        out += ", "s;
+                append_json_string(out, result.principal_variation[i]);
+        }
+        return out + "]}"s;
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "engine.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Chess {
+
+struct AnalysisResult {
+        // The position's place in the input, counting from zero and skipping
+        // blank and comment lines.
+        std::size_t index;
+        std::string fen;
+        // Why there is no result, empty if there is one.
+        std::string error;
+        // The moves in UCI notation.
+        std::string best_move;
+        std::vector<std::string> principal_variation;
+        // From the point of view of the side on turn.
+        int score;
+        int depth;
+        std::uint64_t nodes;
+        std::chrono::milliseconds time;
+};
+
+struct AnalysisOptions {
+        // Worker threads, zero for one per core.
+        unsigned threads = 0;
+        SearchLimits limits {.depth = 6};
+        // How many positions may be read but not yet handed to the sink.
+        // This bounds the memory whatever the size of the input and however
+        // slow the sink is. Zero for four per thread.
+        std::size_t max_in_flight = 0;
+};
+
+using AnalysisSink = std::function<void(AnalysisResult const&)>;
+
+// Analyzes one FEN per line, skipping blank lines and ones starting with #.
+// A reader thread feeds a pool of workers, each searching its position with
+// its own Search, and the sink is called on the calling thread as results
+// come in, which isn't necessarily the input order. The reader waits while
+// max_in_flight positions are pending.
+void analyze_positions(std::istream& in, AnalysisOptions const& options,
+                       AnalysisSink const& sink);
+
+// One JSON object on a single line, the score given as {"cp": n} or
+// {"mate": n} like in UCI.
+std::string to_json(AnalysisResult const& result);
+
+}
@@ -0,0 +1,84 @@
+#include "analysis.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+int usage(char const* name)
+{
+        std::cerr << "usage: " << name << " [-j threads] [-depth n] [-nodes n]\n"
+                  << "       [-movetime ms] [-queue n] [file]\n"
+                  << "reads FENs from the file, or stdin if there is none or it is -\n";
+        return 2;
+}
+
+}
+
+// Prints a JSON line per position as soon as its search is done, and a
+// summary on stderr.
+int main(int argc, char** argv)
+{
+        using namespace Chess;
+
+        AnalysisOptions options;
+        char const* path = nullptr;
+        for (int arg = 1; arg < argc; ++arg) {
+                auto const option = [&](char const* name)
+                {
+                        return std::strcmp(argv[arg], name) == 0 && arg + 1 < argc;
+                };
+                if (option("-j")) {
+                        options.threads = static_cast<unsigned>(std::strtoul(argv[++arg], nullptr, 10));
+                } else if (option("-depth")) {
+                        options.limits.depth = std::atoi(argv[++arg]);
+                } else if (option("-nodes")) {
+                        options.limits.depth = 0;
+                        options.limits.nodes = std::strtoull(argv[++arg], nullptr, 10);
+                } else if (option("-movetime")) {
+                        options.limits.depth = 0;
+                        options.limits.time = std::chrono::milliseconds(std::atoll(argv[++arg]));
+                } else if (option("-queue")) {
+                        options.max_in_flight = std::strtoull(argv[++arg], nullptr, 10);
+                } else if (!path && (argv[arg][0] != '-' || std::strcmp(argv[arg], "-") == 0)) {
+                        path = argv[arg];
+                } else {
+                        return usage(argv[0]);
+                }
+        }
+
+        std::ifstream file;
+        if (path && std::strcmp(path, "-") != 0) {
+                file.open(path);
+                if (!file) {
+                        std::cerr << path << ": can't open\n";
+                        return 2;
+                }
+        }
+        std::istream& in = file.is_open() ? file : std::cin;
+
+        std::size_t positions = 0;
+        std::size_t errors = 0;
+        auto const start = std::chrono::steady_clock::now();
+        try {
+                analyze_positions(in, options,
+                        [&](AnalysisResult const& result)
+                        {
+                                ++positions;
+                                if (!result.error.empty())
+                                        ++errors;
+                                std::cout << to_json(result) << std::endl;
+                        }
+                );
+        } catch (std::exception const& error) {
+                std::cerr << error.what() << '\n';
+                return 2;
+        }
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << positions << " positions, " << errors << " errors, "
+                  << elapsed.count() << " s\n";
+        return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+#include "archive.h"
+#include "byte_io.h"
+#include "notation.h"
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+
+namespace Chess {
+
+namespace {
+
+char constexpr header_magic[] = "CHESSARC";
+char constexpr index_magic[] = "CHESSIDX";
+std::size_t constexpr magic_size = 8;
+std::uint32_t constexpr version = 2;
+std::size_t constexpr header_size = magic_size + 8;
+std::size_t constexpr footer_size = 16 + magic_size;
+
+// The legal moves in the order the archive indexes them, by their
+// encode_move codes so that the order doesn't depend on move generation.
+MoveList sorted_moves(Game const& game) noexcept
+{
+        MoveList moves = game.valid_moves();
+        std::sort(moves.begin(), moves.end(),
+                [](Move a, Move b)
+                {
+                        return encode_move(a) < encode_move(b);
+                }
+        );
+        return moves;
+}
+
+std::optional<Game> starting_game(std::string_view fen)
+{
+        if (fen.empty())
+                return Game(nullptr);
+        std::optional const setup = parse_fen(fen);
+        if (!setup)
+                return std::nullopt;
+        return Game(nullptr, *setup);
+}
+
+// The index of the move among the legal ones, which is then made.
+std::optional<unsigned> index_move(Game& game, Move move)
+{
+        MoveList const moves = sorted_moves(game);
+        auto const found = std::find(moves.begin(), moves.end(), move);
+        if (found == moves.end() || !game.try_move(move))
+                return std::nullopt;
+        return static_cast<unsigned>(found - moves.begin());
+}
+
+}
+
+GameResult parse_result(std::string_view text) noexcept
+{
+        if (text == "1-0")
+                return GameResult::light_wins;
+        if (text == "0-1")
+                return GameResult::dark_wins;
+        if (text == "1/2-1/2")
+                return GameResult::draw;
+        return GameResult::unknown;
+}
+
+std::string_view to_string(GameResult result) noexcept
+{
+        switch (result) {
+                case GameResult::light_wins:
+                        return "1-0";
+                case GameResult::dark_wins:
+                        return "0-1";
+                case GameResult::draw:
+                        return "1/2-1/2";
+                default:
+                        return "*";
+        }
+}
+
+ArchiveWriter::ArchiveWriter(std::ostream& out)
+        : out_(out)
+{
+        record_.clear();
+        put_text(record_, std::string_view(header_magic, magic_size));
+        put_fixed<std::uint32_t>(record_, version);
+        put_fixed<std::uint32_t>(record_, 0);
+        out_.write(reinterpret_cast<char const*>(record_.data()),
+                   static_cast<std::streamsize>(record_.size()));
+        offset_ = record_.size();
+}
+
+std::optional<std::size_t> ArchiveWriter::add_game(std::vector<PgnTag> const& tags,
+                                                   std::string_view fen,
+                                                   std::vector<Move> const& moves,
+                                                   GameResult result)
+{
+        std::optional game = starting_game(fen);
+        if (!game)
+                return std::nullopt;
+        indexes_.clear();
+        for (Move move : moves) {
+                std::optional const index = index_move(*game, move);
+                if (!index)
+                        return std::nullopt;
+                indexes_.push_back(static_cast<std::uint8_t>(*index));
+        }
+        return write_game(tags, fen, result);
+}
+
+bool ArchiveWriter::add_pgn_game(PgnGame const& game)
+{
+        auto const fen = game.tag("FEN");
+        std::optional replayed = starting_game(fen);
+        if (!replayed)
+                return false;
+        indexes_.clear();
+        for (auto const san : game.main_line) {
+                std::optional const move = parse_san(*replayed, san);
+                std::optional const index = move ? index_move(*replayed, *move) : std::nullopt;
+                if (!index)
+                        return false;
+                indexes_.push_back(static_cast<std::uint8_t>(*index));
+        }
+
+        // The FEN tag is kept in its own field.
+        std::vector<PgnTag> tags;
+        tags.reserve(game.tags.size());
+        std::copy_if(game.tags.cbegin(), game.tags.cend(), std::back_inserter(tags),
+                [](PgnTag const& tag)
+                {
+                        return tag.name != "FEN" && tag.name != "SetUp";
+                }
+        );
+        write_game(tags, fen, parse_result(game.result));
+        return true;
+}
+
+std::size_t ArchiveWriter::write_game(std::vector<PgnTag> const& tags, std::string_view fen,
+                                      GameResult result)
+{
+        record_.clear();
+        put_u8(record_, static_cast<unsigned>(result));
+        put_u8(record_, fen.empty() ? 0 : 1);
+        put_varint(record_, indexes_.size());
+        put_varint(record_, tags.size());
+        for (PgnTag const& tag : tags) {
+                put_varint(record_, tag.name.size());
+                put_text(record_, tag.name);
+                put_varint(record_, tag.value.size());
+                put_text(record_, tag.value);
+        }
+        if (!fen.empty()) {
+                put_varint(record_, fen.size());
+                put_text(record_, fen);
+        }
+        record_.insert(record_.end(), indexes_.cbegin(), indexes_.cend());
+
+        out_.write(reinterpret_cast<char const*>(record_.data()),
+                   static_cast<std::streamsize>(record_.size()));
+        offsets_.push_back(offset_);
+        offset_ += record_.size();
+        return offsets_.size() - 1;
+}
+
+void ArchiveWriter::finish()
+{
+        record_.clear();
+        for (std::uint64_t offset : offsets_)
+                put_fixed(record_, offset);
+        put_fixed(record_, offset_);
+        put_fixed<std::uint64_t>(record_, offsets_.size());
+        put_text(record_, std::string_view(index_magic, magic_size));
+        out_.write(reinterpret_cast<char const*>(record_.data()),
+                   static_cast<std::streamsize>(record_.size()));
+        out_.flush();
+}
+
+ArchiveReader::ArchiveReader(MappedFile file)
+        : file_(std::move(file))
+{
+        data_ = file_->text();
+        open();
+}
+
+ArchiveReader::ArchiveReader(std::string_view data)
+        : data_(data)
+{
+        open();
+}
+
+void ArchiveReader::open()
+{
+        auto const bytes = reinterpret_cast<unsigned char const*>(data_.data());
+        if (data_.size() < header_size + footer_size ||
+            data_.substr(0, magic_size) != std::string_view(header_magic, magic_size) ||
+            data_.substr(data_.size() - magic_size) != std::string_view(index_magic, magic_size)) {
+                throw std::runtime_error("not a game archive");
+        }
+        if (get_fixed<std::uint32_t>(bytes + magic_size) != version)
+                throw std::runtime_error("unsupported game archive version");
+
+        auto const footer = bytes + data_.size() - footer_size;
+        auto const index_offset = get_fixed<std::uint64_t>(footer);
+        auto const count = get_fixed<std::uint64_t>(footer + 8);
+        auto const index_space = data_.size() - footer_size;
+        if (index_offset < header_size || index_offset > index_space ||
+            count != (index_space - index_offset) / 8 ||
+            (index_space - index_offset) % 8 != 0) {
+                throw std::runtime_error("damaged game archive index");
+        }
+        index_ = bytes + index_offset;
+        size_ = count;
+}
+
+std::size_t ArchiveReader::size() const noexcept
+{
+        return size_;
+}
+
+bool ArchiveReader::read(std::size_t index, ArchivedGame& game) const
+{
+        std::optional<Game> replayed;
+        return read(index, game, replayed);
+}
+
+std::optional<Game> ArchiveReader::replay(std::size_t index) const
+{
+        ArchivedGame archived;
+        std::optional<Game> game;
+        if (!read(index, archived, game))
+                return std::nullopt;
+        return game;
+}
+
+bool ArchiveReader::read(std::size_t index, ArchivedGame& game,
+                         std::optional<Game>& replayed) const
+{
+        if (index >= size_)
+                return false;
+        auto const offset = get_fixed<std::uint64_t>(index_ + 8 * index);
+        if (offset < header_size || offset >= data_.size())
+                return false;
+
+        ByteReader in(reinterpret_cast<unsigned char const*>(data_.data()), data_.size(), offset);
+        unsigned result = 0;
+        unsigned flags = 0;
+        std::uint64_t plies = 0;
+        std::uint64_t tag_count = 0;
+        if (!in.u8(result) || !in.u8(flags) || !in.varint(plies) || !in.varint(tag_count))
+                return false;
+        if (result > static_cast<unsigned>(GameResult::draw) || plies > in.remaining() ||
+            tag_count > in.remaining()) {
+                return false;
+        }
+        game.result = static_cast<GameResult>(result);
+
+        game.tags.clear();
+        for (std::uint64_t i = 0; i < tag_count; ++i) {
+                std::uint64_t name_length = 0;
+                std::uint64_t value_length = 0;
+                PgnTag tag;
+                if (!in.varint(name_length) || !in.text(name_length, tag.name) ||
+                    !in.varint(value_length) || !in.text(value_length, tag.value)) {
+                        return false;
+                }
+                game.tags.push_back(tag);
+        }
+
+        game.fen = std::string_view();
+        if (flags & 1) {
+                std::uint64_t length = 0;
+                if (!in.varint(length) || !in.text(length, game.fen))
+                        return false;
+        }
+
+        // The indexes only mean something on the board they were taken on,
+        // so the game is played along.
+        replayed = starting_game(game.fen);
+        if (!replayed)
+                return false;
+        game.moves.clear();
+        game.moves.reserve(plies);
+        for (std::uint64_t i = 0; i < plies; ++i) {
+                unsigned move_index = 0;
+                if (!in.u8(move_index))
+                        return false;
+                MoveList const moves = sorted_moves(*replayed);
+                if (move_index >= static_cast<unsigned>(moves.size()))
+                        return false;
+                Move const move = moves[static_cast<int>(move_index)];
+                replayed->try_move(move);
+                game.moves.push_back(move);
+        }
+        return true;
+}
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "chess.h"
+#include "mapped_file.h"
+#include "pgn.h"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+// A binary archive of games. Each game is stored as a small header and a
+// byte per ply, and an index of game offsets at the end of the file gives
+// constant time access to any game:
+//
+//     "CHESSARC" version:u32 reserved:u32
+//     games...
+//     offsets:u64[count] index_offset:u64 count:u64 "CHESSIDX"
+//
+// A game is result:u8 flags:u8 plies:varint tag_count:varint, the tags as
+// name_length:varint name value_length:varint value, the FEN as
+// length:varint fen if flags has bit 0 set, and then each move as a u8,
+// its index among the legal moves of its position sorted by encode_move
+// code. All numbers are little endian.
+
+enum class GameResult : std::uint8_t {
+        unknown,
+        light_wins,
+        dark_wins,
+        draw
+};
+
+GameResult parse_result(std::string_view text) noexcept;
+std::string_view to_string(GameResult result) noexcept;
+
+class ArchiveWriter {
+public:
+        explicit ArchiveWriter(std::ostream& out);
+
+        // The FEN is left empty for games from the starting position. Tags
+        // are kept whole. Returns the game's index, or nothing and writes
+        // nothing if the FEN doesn't parse or a move isn't legal.
+        std::optional<std::size_t> add_game(std::vector<PgnTag> const& tags,
+                                            std::string_view fen,
+                                            std::vector<Move> const& moves,
+                                            GameResult result);
+        // Returns false and writes nothing if the main line isn't legal.
+        bool add_pgn_game(PgnGame const& game);
+        // Writes the index. Nothing can be added afterwards.
+        void finish();
+
+private:
+        std::size_t write_game(std::vector<PgnTag> const& tags, std::string_view fen,
+                               GameResult result);
+
+        std::ostream& out_;
+        std::uint64_t offset_ = 0;
+        std::vector<std::uint64_t> offsets_;
+        std::vector<unsigned char> record_;
+        // The moves of the game being added, as written.
+        std::vector<std::uint8_t> indexes_;
+};
+
+// Views into the archive, valid as long as the reader is.
+struct ArchivedGame {
+        GameResult result;
+        std::vector<PgnTag> tags;
+        std::string_view fen;
+        std::vector<Move> moves;
+};
+
+class ArchiveReader {
+public:
+        // Both throw std::runtime_error if the data isn't an archive. The
+        // data must outlive the reader.
+        explicit ArchiveReader(MappedFile file);
+        explicit ArchiveReader(std::string_view data);
+
+        std::size_t size() const noexcept;
+        // Returns false if the game's record is damaged. The moves are
+        // played to read them, since each is stored by its index among the
+        // legal ones, so a damaged archive can't hold an illegal move.
+        bool read(std::size_t index, ArchivedGame& game) const;
+        // The game as read.
+        std::optional<Game> replay(std::size_t index) const;
+
+private:
+        void open();
+        bool read(std::size_t index, ArchivedGame& game, std::optional<Game>& replayed) const;
+
+        std::optional<MappedFile> file_;
+        std::string_view data_;
+        unsigned char const* index_ = nullptr;
+        std::size_t size_ = 0;
+};
+
+}
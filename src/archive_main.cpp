@@ -0,0 +1,105 @@
+#include "archive.h"
+#include "notation.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+int usage(char const* name)
+{
+        std::cerr << "usage: " << name << " pack <in.pgn> <out.archive>\n"
+                  << "       " << name << " show <in.archive> <index>\n";
+        return 2;
+}
+
+int pack(char const* pgn_path, char const* archive_path)
+{
+        using namespace Chess;
+
+        MappedFile const file(pgn_path);
+        file.advise_sequential();
+        std::ofstream out(archive_path, std::ios::binary);
+        if (!out) {
+                std::cerr << archive_path << ": can't open for writing\n";
+                return 2;
+        }
+
+        ArchiveWriter writer(out);
+        PgnReader reader(file.text());
+        PgnGame game;
+        std::size_t games = 0;
+        std::size_t skipped = 0;
+        while (reader.next(game)) {
+                if (!writer.add_pgn_game(game)) {
+                        std::cerr << "skipping invalid game " << games + skipped << '\n';
+                        ++skipped;
+                        continue;
+                }
+                ++games;
+        }
+        writer.finish();
+        std::cerr << games << " games packed, " << skipped << " skipped, "
+                  << file.size() << " bytes in, " << out.tellp() << " bytes out\n";
+        return out ? 0 : 1;
+}
+
+// Prints the game as PGN.
+int show(char const* archive_path, std::size_t index)
+{
+        using namespace Chess;
+
+        ArchiveReader const reader(MappedFile {archive_path});
+        ArchivedGame archived;
+        if (!reader.read(index, archived)) {
+                std::cerr << "no game " << index << '\n';
+                return 1;
+        }
+        for (PgnTag const& tag : archived.tags)
+                std::cout << '[' << tag.name << " \"" << tag.value << "\"]\n";
+        if (!archived.fen.empty())
+                std::cout << "[SetUp \"1\"]\n[FEN \"" << archived.fen << "\"]\n";
+        std::cout << '\n';
+
+        Game game(nullptr);
+        if (!archived.fen.empty())
+                game = Game(nullptr, *parse_fen(archived.fen));
+        int fullmove = game.setup().fullmove_number;
+        bool first = true;
+        for (Move move : archived.moves) {
+                if (game.on_turn() == Side::light)
+                        std::cout << fullmove << ". ";
+                else if (first)
+                        std::cout << fullmove << "... ";
+                std::cout << to_san(game, move) << ' ';
+                if (!game.try_move(move)) {
+                        std::cerr << "illegal move in game " << index << '\n';
+                        return 1;
+                }
+                if (game.on_turn() == Side::light)
+                        ++fullmove;
+                first = false;
+        }
+        std::cout << to_string(archived.result) << '\n';
+        return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+        if (argc < 4)
+                return usage(argv[0]);
+        std::string const command = argv[1];
+        try {
+                if (command == "pack")
+                        return pack(argv[2], argv[3]);
+                if (command == "show")
+                        return show(argv[2], std::strtoull(argv[3], nullptr, 10));
+        } catch (std::exception const& error) {
+                std::cerr << error.what() << '\n';
+                return 2;
+        }
+        return usage(argv[0]);
+}
@@ -0,0 +1,50 @@
+#include "retrograde.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Usage: chess_bitbase [-j threads] <directory> <signature>...
+// Solves the tables, like KPvK, and the ones they depend on, and writes
+// each to <directory> as Syzygy <signature>.rtbw and .rtbz files, see
+// write_solved_table.
+int main(int argc, char** argv)
+{
+        using namespace Chess;
+
+        RetrogradeOptions options;
+        int arg = 1;
+        if (arg + 1 < argc && std::strcmp(argv[arg], "-j") == 0) {
+                options.threads = static_cast<unsigned>(std::strtoul(argv[arg + 1], nullptr, 10));
+                arg += 2;
+        }
+        if (argc - arg < 2) {
+                std::cerr << "usage: " << argv[0] << " [-j threads] <directory> <signature>...\n";
+                return 2;
+        }
+        std::string const directory = argv[arg++];
+
+        auto const start = std::chrono::steady_clock::now();
+        options.progress = [&](std::string_view signature, int pass, std::uint64_t decided)
+        {
+                std::chrono::duration<double> const elapsed =
+                        std::chrono::steady_clock::now() - start;
+                std::cerr << signature << " pass " << pass << ": " << decided
+                          << " decided, " << elapsed.count() << " s\n";
+        };
+
+        SolvedTables solved;
+        for (; arg < argc; ++arg) {
+                if (!solve_table(argv[arg], options, solved)) {
+                        std::cerr << argv[arg] << ": can't be generated\n";
+                        return 2;
+                }
+        }
+        for (auto const& [signature, table] : solved) {
+                if (!write_solved_table(directory, signature, table)) {
+                        std::cerr << directory << '/' << signature << ": can't be written\n";
+                        return 2;
+                }
+        }
+        return 0;
+}
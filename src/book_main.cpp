@@ -0,0 +1,75 @@
+#include "mapped_file.h"
+#include "notation.h"
+#include "polyglot.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+int usage(char const* name)
+{
+        std::cerr << "usage: " << name << " build <in.pgn> <out.bin> [threads] [plies]\n"
+                  << "       " << name << " probe <book.bin> <fen>\n";
+        return 2;
+}
+
+int build(int argc, char** argv)
+{
+        using namespace Chess;
+
+        BookOptions options;
+        if (argc > 4)
+                options.threads = static_cast<unsigned>(std::strtoul(argv[4], nullptr, 10));
+        if (argc > 5)
+                options.max_plies = std::atoi(argv[5]);
+
+        MappedFile const file(argv[2]);
+        file.advise_sequential();
+        std::ofstream out(argv[3], std::ios::binary);
+        if (!out) {
+                std::cerr << argv[3] << ": can't open for writing\n";
+                return 2;
+        }
+        std::size_t const entries = build_book(file.text(), options, out);
+        std::cerr << entries << " entries\n";
+        return out ? 0 : 1;
+}
+
+// Lists the book moves of a position with their weights.
+int probe(char** argv)
+{
+        using namespace Chess;
+
+        std::optional const setup = parse_fen(argv[3]);
+        if (!setup) {
+                std::cerr << "invalid FEN\n";
+                return 2;
+        }
+        PolyglotBook const book(MappedFile {argv[2]});
+        std::vector<BookEntry> entries;
+        book.find(polyglot_key(*setup), entries);
+        for (BookEntry const& entry : entries)
+                std::cout << to_uci(setup->board, entry.move) << ' ' << entry.weight << '\n';
+        return entries.empty() ? 1 : 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+        if (argc < 4)
+                return usage(argv[0]);
+        std::string const command = argv[1];
+        try {
+                if (command == "build")
+                        return build(argc, argv);
+                if (command == "probe")
+                        return probe(argv);
+        } catch (std::exception const& error) {
+                std::cerr << error.what() << '\n';
+                return 2;
+        }
+        return usage(argv[0]);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+// Little endian building blocks for the binary formats.
+
+inline void put_u8(std::vector<unsigned char>& out, unsigned value)
+{
+        out.push_back(static_cast<unsigned char>(value));
+}
+
+template <class T>
+void put_fixed(std::vector<unsigned char>& out, T value)
+{
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+                out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+inline void put_varint(std::vector<unsigned char>& out, std::uint64_t value)
+{
+        while (value >= 0x80) {
+                out.push_back(static_cast<unsigned char>(value | 0x80));
+                value >>= 7;
+        }
+        out.push_back(static_cast<unsigned char>(value));
+}
+
+inline void put_text(std::vector<unsigned char>& out, std::string_view text)
+{
+        out.insert(out.end(), text.cbegin(), text.cend());
+}
+
+template <class T>
+T get_fixed(unsigned char const* in) noexcept
+{
+        T value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+                value |= static_cast<T>(in[i]) << (8 * i);
+        return value;
+}
+
+// Reads without going past the end of the data. Each read returns false
+// if the data ends first.
+class ByteReader {
+public:
+        ByteReader(unsigned char const* data, std::size_t size, std::size_t pos = 0) noexcept
+                : data_(data)
+                , size_(size)
+                , pos_(pos)
+        {}
+
+        std::size_t pos() const noexcept
+        {
+                return pos_;
+        }
+
+        std::size_t remaining() const noexcept
+        {
+                return size_ - pos_;
+        }
+
+        bool u8(unsigned& value) noexcept
+        {
+                if (pos_ >= size_)
+                        return false;
+                value = data_[pos_++];
+                return true;
+        }
+
+        template <class T>
+        bool fixed(T& value) noexcept
+        {
+                if (remaining() < sizeof(T))
+                        return false;
+                value = get_fixed<T>(data_ + pos_);
+                pos_ += sizeof(T);
+                return true;
+        }
+
+        bool varint(std::uint64_t& value) noexcept
+        {
+                value = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                        unsigned byte = 0;
+                        if (!u8(byte))
+                                return false;
+                        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                        if ((byte & 0x80) == 0)
+                                return true;
+                }
+                return false;
+        }
+
+        bool text(std::uint64_t length, std::string_view& value) noexcept
+        {
+                if (remaining() < length)
+                        return false;
+                value = std::string_view(reinterpret_cast<char const*>(data_ + pos_), length);
+                pos_ += length;
+                return true;
+        }
+
+        bool bytes(std::uint64_t length, unsigned char const*& value) noexcept
+        {
+                if (remaining() < length)
+                        return false;
+                value = data_ + pos_;
+                pos_ += length;
+                return true;
+        }
+
+        // Skips to the next multiple of alignment.
+        bool align(std::size_t alignment) noexcept
+        {
+                std::size_t const skip = (alignment - pos_ % alignment) % alignment;
+                if (remaining() < skip)
+                        return false;
+                pos_ += skip;
+                return true;
+        }
+
+private:
+        unsigned char const* data_;
+        std::size_t size_;
+        std::size_t pos_;
+};
+
+}
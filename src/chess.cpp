@@ -1,8 +1,14 @@
 #include "chess.h"
+#include "byte_io.h"
+#include "zobrist.h"
 #include <algorithm>
+#include <bitset>
 #include <utility>
 #include <cmath>
+#include <cstdlib>
 #include <cassert>
+#include <limits>
+#include <memory>
 
 namespace Chess {
 
@@ -22,33 +28,39 @@ int constexpr right_bishop_x = 5;
 int constexpr queen_x = 3;
 int constexpr king_x = 4;
 
+int square_index(Position pos) noexcept
+{
+        return pos.y * board_size + pos.x;
+}
+
+Position square_position(int index) noexcept
+{
+        return Position {index % board_size, index / board_size};
+}
+
+bool is_on_board(Position pos) noexcept
+{
+        return pos.x >= 0 && pos.x < board_size && pos.y >= 0 && pos.y < board_size;
+}
+
+int side_index(Side side) noexcept
+{
+        assert(side != Side::none);
+        return (side == Side::light) ? 0 : 1;
+}
+
 // FIXME Have king_movement_rule, other_rules, all()
-bool move_is_valid(Side on_turn, Board const& board,
-                   std::vector<Rule> const& rules,
+bool move_is_valid(Side on_turn, Board const& board, RulesWrapper rules,
                    MoveHistory const& move_history, Move move)
 {
-        auto const rules_without =
-        [&](Rule const& rule)
-        {
-                std::vector<Rule> result = rules;
-                auto const i = std::remove_if(
-                        result.begin(), result.end(),
-                        [&](Rule const& other)
-                        {
-                                return &rule == &other;
-                        }
-                );
-                result.erase(i, result.end());
-                return result;
-        };
-
-        return std::any_of(rules.cbegin(), rules.cend(),
-                [&](Rule const& rule)
-                {
-                        return rule(on_turn, board, rules_without(rule),
-                                    move_history, move);
+        for (std::size_t i = 0; i < rules.rules.size(); ++i) {
+                if (!rules.excludes(i) &&
+                    rules.rules[i](on_turn, board, rules.without(i),
+                                   move_history, move)) {
+                        return true;
                 }
-        );
+        }
+        return false;
 }
 
 // Max distance of 0 means there is no distance restriction.
@@ -96,7 +108,8 @@ auto diagonal_pattern(int max_distance = 0) noexcept
 {
         return [max_distance](Board const& board, Move move) noexcept
         {
-                auto const [from, to] = move;
+                Position const from = move.from;
+                Position const to = move.to;
                 int const d = std::abs(from.x - to.x);
                 if (d == std::abs(from.y - to.y) &&
                     (max_distance == 0 || d <= max_distance)) {
@@ -124,6 +137,50 @@ auto star_pattern(int max_distance = 0) noexcept
         };
 }
 
+int home_rank_y(Side side) noexcept
+{
+        assert(side != Side::none);
+        return (side == Side::light) ? board_size - 1 : 0;
+}
+
+int pawn_rank_y(Side side) noexcept
+{
+        assert(side != Side::none);
+        return (side == Side::light) ? board_size - 2 : 1;
+}
+
+bool reaches_last_rank(Piece piece, Move move) noexcept
+{
+        return piece.kind == Piece::Kind::pawn &&
+               move.to.y == home_rank_y(opposite_side(piece.side));
+}
+
+// No promotion on a pawn reaching the last rank means a queen, see
+// with_default_promotion.
+bool promotion_is_valid(Piece src, Move move) noexcept
+{
+        switch (move.promotion) {
+                case Piece::Kind::none:
+                        return true;
+                case Piece::Kind::queen:
+                case Piece::Kind::rook:
+                case Piece::Kind::bishop:
+                case Piece::Kind::knight:
+                        return reaches_last_rank(src, move);
+                default:
+                        return false;
+        }
+}
+
+Move with_default_promotion(Board const& board, Move move) noexcept
+{
+        if (move.promotion == Piece::Kind::none &&
+            reaches_last_rank(board[move.from.y][move.from.x], move)) {
+                move.promotion = Piece::Kind::queen;
+        }
+        return move;
+}
+
 template <class Callback>
 Rule rule(Callback const& callback)
 {
@@ -133,10 +190,12 @@ Rule rule(Callback const& callback)
                 if (on_turn == Side::none)
                         return false;
                 Piece src = board[move.from.y][move.from.x];
-                if (src.kind == Piece::Kind::none || src.side != on_turn)
+                if (src.kind == Piece::Kind::none || src.side != on_turn ||
+                    !promotion_is_valid(src, move)) {
                         return false;
+                }
                 Piece dst = board[move.to.y][move.to.x];
-                return callback(src, dst, board, rules_wrapper.rules, move_history, move);
+                return callback(src, dst, board, rules_wrapper, move_history, move);
         };
 }
 
@@ -145,7 +204,7 @@ Rule rule(Piece::Kind kind, Callback const& callback)
 {
         return rule(
                 [kind, callback](Piece src, Piece dst, Board const& board,
-                                 std::vector<Rule> const& rules,
+                                 RulesWrapper rules,
                                  MoveHistory const& move_history, Move move)
                 {
                         return src.kind == kind &&
@@ -160,48 +219,31 @@ Rule movement_rule(Piece::Kind piece_kind, MovementPattern pattern)
         return rule(
                 piece_kind,
                 [pattern](Piece src, Piece dst, Board const& board,
-                          std::vector<Rule> const&, MoveHistory const&, Move move)
+                          RulesWrapper, MoveHistory const&, Move move)
                 {
                         return src.side != dst.side && pattern(board, move);
                 }
         );
 }
 
-bool field_is_under_attack(Side side, Board const& board,
-                           std::vector<Rule> const& rules,
-                           MoveHistory const& move_history,
+// Whether any piece of the attacker side could move onto the field.
+bool field_is_under_attack(Side attacker, Board const& board, PieceLists const& pieces,
+                           RulesWrapper rules, MoveHistory const& move_history,
                            Position field_position)
 {
-        for (int x = 0; x < board_size; ++x) {
-                for (int y = 0; y < board_size; ++y) {
-                        Position const pos {x, y};
-                        Move const move {.from = pos, .to = field_position};
-                        if (move_is_valid(side, board, rules, move_history, move))
-                                return true;
-                }
+        for (int square : pieces.of(attacker)) {
+                Move const move {.from = square_position(square), .to = field_position};
+                if (move_is_valid(attacker, board, rules, move_history, move))
+                        return true;
         }
         return false;
 }
 
+// Moving into an attacked field is ruled out together with every other
+// move that leaves the king in check, see move_is_legal.
 Rule king_movement_rule()
 {
-        return rule(
-                Piece::Kind::king,
-                [](Piece src, Piece dst, Board const& board,
-                   std::vector<Rule> const& rules,
-                   MoveHistory const& move_history, Move move)
-                {
-                        bool different_side = (src.side != dst.side);
-                        bool patten = star_pattern(1)(board, move);
-                        bool under_attack = !field_is_under_attack(src.side, board, rules,
-                                                                   move_history, move.to);
-
-                        return src.side != dst.side &&
-                               star_pattern(1)(board, move) &&
-                               !field_is_under_attack(src.side, board, rules,
-                                                      move_history, move.to);
-                }
-        );
+        return movement_rule(Piece::Kind::king, star_pattern(1));
 }
 
 Rule rook_movement_rule()
@@ -222,7 +264,7 @@ Rule bishop_movement_rule()
 Rule pawn_movement_rule()
 {
         return rule(
-                [](Piece src, Piece dst, Board const& board, std::vector<Rule> const&,
+                [](Piece src, Piece dst, Board const& board, RulesWrapper,
                    MoveHistory const& move_history, Move move)
                 {
                         if (src.kind != Piece::Kind::pawn || dst.side == src.side)
@@ -232,18 +274,24 @@ Rule pawn_movement_rule()
                         int const dy = move.to.y - move.from.y;
                         int const y_direction = (src.side == Side::light) ? -1 : 1;
                         if (dst != Piece::none()) {
-                                // En passant?
                                 return dy == y_direction && std::abs(dx) == 1;
                         } else if (dx == 0) {
+                                if (dy == y_direction)
+                                        return true;
                                 bool const piece_was_moved =
+                                        move.from.y != pawn_rank_y(src.side) ||
                                         move_history.piece_was_moved(move.from);
                                 bool const blocked =
                                         board[move.from.y + y_direction][move.from.x] !=
                                         Piece::none();
-                                return dy == y_direction ||
-                                       (!piece_was_moved &&
-                                        !blocked &&
-                                        dy == y_direction * 2);
+                                return !piece_was_moved &&
+                                       !blocked &&
+                                       dy == y_direction * 2;
+                        } else if (dy == y_direction && std::abs(dx) == 1) {
+                                std::optional const en_passant_position =
+                                        move_history.en_passant_position(board);
+                                return en_passant_position &&
+                                       *en_passant_position == move.to;
                         }
 
                         return false;
@@ -254,7 +302,7 @@ Rule pawn_movement_rule()
 Rule knight_movement_rule()
 {
         return rule(
-                [](Piece src, Piece dst, Board const&, std::vector<Rule> const&,
+                [](Piece src, Piece dst, Board const&, RulesWrapper,
                    MoveHistory const&, Move move)
                 {
                         if (src.kind != Piece::Kind::knight || dst.side == src.side)
@@ -266,18 +314,6 @@ Rule knight_movement_rule()
         );
 }
 
-int home_rank_y(Side side) noexcept
-{
-        assert(side != Side::none);
-        return (side == Side::light) ? board_size - 1 : 0;
-}
-
-int pawn_rank_y(Side side) noexcept
-{
-        assert(side != Side::none);
-        return (side == Side::light) ? board_size - 2 : 1;
-}
-
 Position castling_rook_position(Move move) noexcept
 {
         return (move.to.x == king_x) ? move.from : move.to;
@@ -291,25 +327,24 @@ Position castling_king_position(Move move) noexcept
 Rule castling_rule()
 {
         return rule(
-                [](Piece src, Piece dst, Board const& board, std::vector<Rule> const&,
+                [](Piece src, Piece dst, Board const& board, RulesWrapper,
                    MoveHistory const& move_history, Move move)
                 {
-                        auto const king_or_rook =
-                        [](Piece const piece)
-                        {
-                                return piece.kind == Piece::Kind::king ||
-                                       piece.kind == Piece::Kind::rook;
-                        };
-
                         if (src.side != dst.side ||
-                            !king_or_rook(src) ||
-                            !king_or_rook(dst) ||
                             move_history.piece_was_moved(move.from) ||
                             move_history.piece_was_moved(move.to)) {
                                 return false;
                         }
 
                         auto const [x, y] = castling_rook_position(move);
+                        Position const king_position = castling_king_position(move);
+                        if (board[y][x].kind != Piece::Kind::rook ||
+                            board[king_position.y][king_position.x].kind != Piece::Kind::king ||
+                            king_position != Position {king_x, home_rank_y(src.side)} ||
+                            y != king_position.y) {
+                                return false;
+                        }
+
                         if (x == left_rook_x) {
                                 return board[y][left_knight_x] == Piece::none() &&
                                        board[y][left_bishop_x] == Piece::none() &&
@@ -324,54 +359,187 @@ Rule castling_rule()
         );
 }
 
-std::optional<Position> find_piece(Board const& board, Piece piece) noexcept
+// TODO Refactor: factor out the nested loop, it's bloody annoying
+
+bool is_castling(Board const& board, Move move) noexcept
 {
-        for (int x = 0; x < board_size; ++x) {
-                for (int y = 0; y < board_size; ++y) {
-                        if (board[y][x] == piece)
-                                return Position {x, y};
-                }
+        return board[move.from.y][move.from.x].side == board[move.to.y][move.to.x].side;
+}
+
+// Only valid moves can be told apart like this.
+bool is_en_passant(Board const& board, Move move) noexcept
+{
+        return board[move.from.y][move.from.x].kind == Piece::Kind::pawn &&
+               move.from.x != move.to.x &&
+               board[move.to.y][move.to.x] == Piece::none();
+}
+
+bool king_is_attacked(Side side, Board const& board, PieceLists const& pieces,
+                      RulesWrapper rules, MoveHistory const& move_history) noexcept
+{
+        std::optional const king_position = pieces.king(side);
+        return king_position &&
+               field_is_under_attack(opposite_side(side), board, pieces, rules,
+                                     move_history, *king_position);
+}
+
+// A valid move is legal if it doesn't leave the king in check. The king
+// also can't castle out of or through an attacked field.
+bool move_is_legal(Side on_turn, Board const& board, PieceLists const& pieces,
+                   RulesWrapper rules, MoveHistory const& move_history, Move move) noexcept
+{
+        Board after = board;
+        PieceLists after_pieces = pieces;
+        if (is_castling(board, move)) {
+                if (king_is_attacked(on_turn, board, pieces, rules, move_history))
+                        return false;
+                CastlingMove const castling_move(move);
+                Move const king_move = castling_move.king_move();
+                int const dx = normalize(king_move.to.x - king_move.from.x);
+                Board passing = board;
+                PieceLists passing_pieces = pieces;
+                Move const passing_move {
+                        .from = king_move.from,
+                        .to = Position {king_move.from.x + dx, king_move.from.y}
+                };
+                passing_move.apply(passing, &passing_pieces);
+                if (king_is_attacked(on_turn, passing, passing_pieces, rules, move_history))
+                        return false;
+                castling_move.apply(after, &after_pieces);
+        } else if (is_en_passant(board, move)) {
+                EnPassantMove(move).apply(after, &after_pieces);
+        } else {
+                move.apply(after, &after_pieces);
         }
-        return std::nullopt;
+        return !king_is_attacked(on_turn, after, after_pieces, rules, move_history);
 }
 
-// TODO Refactor: factor out the nested loop, it's bloody annoying
+Piece::Kind constexpr promotion_kinds[] {
+        Piece::Kind::queen,
+        Piece::Kind::knight,
+        Piece::Kind::rook,
+        Piece::Kind::bishop
+};
 
-bool piece_is_trapped(Side side, Board const& board, std::vector<Rule> const& rules,
-                      MoveHistory const& move_history, Position piece_position) noexcept
+void add_valid_moves(Side on_turn, Board const& board, PieceLists const& pieces,
+                     RulesWrapper rules, MoveHistory const& move_history,
+                     MoveList& moves) noexcept
 {
-        for (int x = 0; x < board_size; ++x) {
-                for (int y = 0; y < board_size; ++y) {
-                        Position const pos {x, y};
-                        Move const move {.from = piece_position, .to = pos};
-                        if (move_is_valid(side, board, rules, move_history, move))
-                                return false;
+        for (int square : pieces.of(on_turn)) {
+                auto const [from_x, from_y] = square_position(square);
+                for (int to_y = 0; to_y < board_size; ++to_y) {
+                        for (int to_x = 0; to_x < board_size; ++to_x) {
+                                Move const move {
+                                        .from = {from_x, from_y},
+                                        .to = {to_x, to_y}
+                                };
+                                // Castling can be asked for from either
+                                // side, but is only listed from the king.
+                                if (!move_is_valid(on_turn, board, rules,
+                                                   move_history, move) ||
+                                    (is_castling(board, move) &&
+                                     board[from_y][from_x].kind !=
+                                     Piece::Kind::king)) {
+                                        continue;
+                                }
+                                if (reaches_last_rank(board[from_y][from_x],
+                                                      move)) {
+                                        for (auto const kind : promotion_kinds) {
+                                                Move promotion = move;
+                                                promotion.promotion = kind;
+                                                moves.push_back(promotion);
+                                        }
+                                } else {
+                                        moves.push_back(move);
+                                }
+                        }
                 }
         }
-        return true;
+
+        for (int i = 0; i < moves.size();) {
+                if (move_is_legal(on_turn, board, pieces, rules, move_history, moves[i]))
+                        ++i;
+                else
+                        moves.swap_remove(i);
+        }
 }
 
-Side winner(Board const& board, std::vector<Rule> const& rules,
-            MoveHistory const& move_history) noexcept
+
+unsigned constexpr no_square = 0xff;
+std::uint64_t constexpr max_int = std::numeric_limits<int>::max();
+unsigned constexpr serialized_version = 2;
+
+unsigned encode_piece(Piece piece) noexcept
 {
-        auto const side_won =
-        [&](Side side)
-        {
-                Piece const king {.kind = Piece::Kind::king, .side = side};
-                std::optional king_position = find_piece(board, king);
-                assert(king_position);
-                return field_is_under_attack(side, board, rules,
-                                             move_history, *king_position) &&
-                       piece_is_trapped(side, board, rules, move_history, *king_position);
+        return static_cast<unsigned>(piece.kind) | static_cast<unsigned>(piece.side) << 3;
+}
+
+bool decode_piece(unsigned code, Piece& piece) noexcept
+{
+        unsigned const kind = code & 7;
+        unsigned const side = code >> 3;
+        if (kind > static_cast<unsigned>(Piece::Kind::bishop) ||
+            side > static_cast<unsigned>(Side::dark)) {
+                return false;
+        }
+        piece = Piece {
+                .kind = static_cast<Piece::Kind>(kind),
+                .side = static_cast<Side>(side)
         };
+        return true;
+}
 
-        if (side_won(Side::light))
-                return Side::light;
-        if (side_won(Side::dark))
-                return Side::dark;
-        return Side::none;
+bool decode_side(unsigned code, Side& side) noexcept
+{
+        if (code > static_cast<unsigned>(Side::dark))
+                return false;
+        side = static_cast<Side>(code);
+        return true;
+}
+
+bool is_castling_pair(Move move) noexcept
+{
+        return move.from.x == king_x && move.from.y == move.to.y &&
+               (move.from.y == 0 || move.from.y == board_size - 1) &&
+               (move.to.x == left_rook_x || move.to.x == right_rook_x);
+}
+
+// The castling rights, numbered as in CastlingRights, that are lost once
+// anything happens on the square.
+unsigned castling_rights_lost(Position position) noexcept
+{
+        if (position.y != home_rank_y(Side::light) && position.y != home_rank_y(Side::dark))
+                return 0;
+        unsigned const side_rights = (position.y == home_rank_y(Side::light)) ? 0b0011 : 0b1100;
+        unsigned const kingside = 0b0101;
+        unsigned const queenside = 0b1010;
+        switch (position.x) {
+                case king_x:
+                        return side_rights;
+                case right_rook_x:
+                        return side_rights & kingside;
+                case left_rook_x:
+                        return side_rights & queenside;
+                default:
+                        return 0;
+        }
+}
+
+unsigned castling_bits(CastlingRights rights) noexcept
+{
+        auto const [light_kingside, light_queenside, dark_kingside, dark_queenside] = rights;
+        return (light_kingside ? 1u : 0u) | (light_queenside ? 2u : 0u) |
+               (dark_kingside ? 4u : 0u) | (dark_queenside ? 8u : 0u);
 }
 
+// A position can't come back before both sides have moved twice.
+int constexpr min_repetition_distance = 4;
+int constexpr fifty_move_plies = 100;
+int constexpr seventy_five_move_plies = 150;
+// Positions seen before, not counting the current one.
+int constexpr threefold_repetitions = 2;
+int constexpr fivefold_repetitions = 4;
+
 }
 
 Side opposite_side(Side side) noexcept
@@ -400,19 +568,123 @@ bool operator!=(Piece p1, Piece p2) noexcept
         return !(p1 == p2);
 }
 
-Piece Move::apply(Board& board) const noexcept
+bool operator==(Move m1, Move m2) noexcept
+{
+        return m1.from == m2.from && m1.to == m2.to && m1.promotion == m2.promotion;
+}
+
+bool operator!=(Move m1, Move m2) noexcept
+{
+        return !(m1 == m2);
+}
+
+std::uint16_t encode_move(Move move) noexcept
+{
+        auto const square = [](Position pos) { return pos.x + 8 * pos.y; };
+        return static_cast<std::uint16_t>(square(move.from) + 64 * square(move.to) +
+                                          4096 * static_cast<int>(move.promotion));
+}
+
+Move decode_move(std::uint16_t code) noexcept
+{
+        auto const position = [](int square) { return Position {square % 8, square / 8}; };
+        return Move {
+                .from = position(code % 64),
+                .to = position(code / 64 % 64),
+                .promotion = static_cast<Piece::Kind>(code / 4096)
+        };
+}
+
+PieceLists::PieceLists(Board const& board) noexcept
+{
+        slots_.fill(-1);
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        if (board[y][x].side != Side::none)
+                                add(Position {x, y}, board[y][x]);
+                }
+        }
+}
+
+PieceLists::Squares const& PieceLists::of(Side side) const noexcept
+{
+        return lists_[side_index(side)];
+}
+
+std::optional<Position> PieceLists::king(Side side) const noexcept
+{
+        int const square = kings_[side_index(side)];
+        if (square < 0)
+                return std::nullopt;
+        return square_position(square);
+}
+
+void PieceLists::add(Position pos, Piece piece) noexcept
+{
+        int const square = square_index(pos);
+        int const side = side_index(piece.side);
+        Squares& list = lists_[side];
+        slots_[square] = static_cast<std::int8_t>(list.size);
+        sides_[square] = static_cast<std::int8_t>(side);
+        list.squares[list.size++] = static_cast<std::int8_t>(square);
+        if (piece.kind == Piece::Kind::king)
+                kings_[side] = static_cast<std::int8_t>(square);
+}
+
+void PieceLists::remove(Position pos) noexcept
+{
+        int const square = square_index(pos);
+        int const slot = slots_[square];
+        if (slot < 0)
+                return;
+        int const side = sides_[square];
+        Squares& list = lists_[side];
+        std::int8_t const last = list.squares[--list.size];
+        list.squares[slot] = last;
+        slots_[last] = static_cast<std::int8_t>(slot);
+        slots_[square] = -1;
+        if (kings_[side] == square)
+                kings_[side] = -1;
+}
+
+void PieceLists::move(Position from, Position to) noexcept
+{
+        remove(to);
+        int const from_square = square_index(from);
+        int const to_square = square_index(to);
+        int const slot = slots_[from_square];
+        if (slot < 0)
+                return;
+        int const side = sides_[from_square];
+        lists_[side].squares[slot] = static_cast<std::int8_t>(to_square);
+        slots_[to_square] = static_cast<std::int8_t>(slot);
+        sides_[to_square] = static_cast<std::int8_t>(side);
+        slots_[from_square] = -1;
+        if (kings_[side] == from_square)
+                kings_[side] = static_cast<std::int8_t>(to_square);
+}
+
+Piece Move::apply(Board& board, PieceLists* pieces) const noexcept
 {
         auto const eaten_piece = board[to.y][to.x];
+        if (pieces)
+                pieces->move(from, to);
         board[to.y][to.x] = board[from.y][from.x];
         board[from.y][from.x] = Piece::none();
+        if (promotion != Piece::Kind::none)
+                board[to.y][to.x].kind = promotion;
         return eaten_piece;
 }
 
-void Move::undo(Board& board, Piece eaten_piece) const noexcept
+void Move::undo(Board& board, Piece eaten_piece, PieceLists* pieces) const noexcept
 {
         Move const opposite_move {.from = to, .to = from};
-        opposite_move.apply(board);
+        opposite_move.apply(board, pieces);
         board[to.y][to.x] = eaten_piece;
+        if (pieces && eaten_piece.side != Side::none)
+                pieces->add(to, eaten_piece);
+        if (promotion != Piece::Kind::none)
+                board[from.y][from.x].kind = Piece::Kind::pawn;
 }
 
 CastlingMove::CastlingMove(Move move) noexcept
@@ -452,16 +724,51 @@ Move CastlingMove::king_move() const noexcept
         return king_move_;
 }
 
-void CastlingMove::apply(Board& board) const noexcept
+void CastlingMove::apply(Board& board, PieceLists* pieces) const noexcept
 {
-        rook_move_.apply(board);
-        king_move_.apply(board);
+        rook_move_.apply(board, pieces);
+        king_move_.apply(board, pieces);
 }
 
-void CastlingMove::undo(Board& board) const noexcept
+void CastlingMove::undo(Board& board, PieceLists* pieces) const noexcept
 {
-        rook_move_.undo(board, Piece::none());
-        king_move_.undo(board, Piece::none());
+        rook_move_.undo(board, Piece::none(), pieces);
+        king_move_.undo(board, Piece::none(), pieces);
+}
+
+EnPassantMove::EnPassantMove(Move move) noexcept
+        : move_(move)
+{}
+
+Move EnPassantMove::move() const noexcept
+{
+        return move_;
+}
+
+Position EnPassantMove::eaten_pawn_position() const noexcept
+{
+        return Position {move_.to.x, move_.from.y};
+}
+
+void EnPassantMove::apply(Board& board, PieceLists* pieces) const noexcept
+{
+        move_.apply(board, pieces);
+        auto const [x, y] = eaten_pawn_position();
+        board[y][x] = Piece::none();
+        if (pieces)
+                pieces->remove(eaten_pawn_position());
+}
+
+void EnPassantMove::undo(Board& board, PieceLists* pieces) const noexcept
+{
+        move_.undo(board, Piece::none(), pieces);
+        auto const [x, y] = eaten_pawn_position();
+        board[y][x] = Piece {
+                .kind = Piece::Kind::pawn,
+                .side = opposite_side(board[move_.from.y][move_.from.x].side)
+        };
+        if (pieces)
+                pieces->add(eaten_pawn_position(), board[y][x]);
 }
 
 void MoveHistory::add_move(Move move, Piece eaten_piece)
@@ -474,56 +781,200 @@ void MoveHistory::add_castling_move(CastlingMove castling_move)
         add_action(castling_move);
 }
 
-bool MoveHistory::undo_move(Board& board) noexcept
+void MoveHistory::add_en_passant_move(EnPassantMove en_passant_move)
 {
-        struct UndoVisitor {
-                Board& board;
+        add_action(en_passant_move);
+}
 
-                void operator()(NormalMove normal_move) const noexcept
-                {
-                        normal_move.move.undo(board, normal_move.eaten_piece);
-                }
+MoveHistory::MoveHistory()
+{
+        checkpoints_.reserve(max_checkpoints);
+}
 
-                void operator()(CastlingMove castling_move) const noexcept
-                {
-                        castling_move.undo(board);
-                }
+MoveHistory::MoveHistory(Setup const& setup)
+        : initial_en_passant_position_(setup.en_passant_position)
+        , initial_halfmove_clock_(setup.halfmove_clock)
+{
+        checkpoints_.reserve(max_checkpoints);
+        auto const mark_moved =
+        [&](bool can_castle, int x, int y) noexcept
+        {
+                if (!can_castle)
+                        initially_moved_ |= std::uint64_t(1) << (y * board_size + x);
         };
 
-        if (last_action_ != actions_.cbegin()) {
-                --last_action_;
-                std::visit(UndoVisitor {board}, *last_action_);
-                return true;
+        auto const [light_kingside, light_queenside, dark_kingside, dark_queenside] =
+                setup.castling_rights;
+        int const light_y = home_rank_y(Side::light);
+        int const dark_y = home_rank_y(Side::dark);
+        mark_moved(light_kingside, right_rook_x, light_y);
+        mark_moved(light_queenside, left_rook_x, light_y);
+        mark_moved(dark_kingside, right_rook_x, dark_y);
+        mark_moved(dark_queenside, left_rook_x, dark_y);
+}
+
+bool MoveHistory::append_move(Board& board, Side side, Move move, PieceLists* pieces)
+{
+        if (!is_on_board(move.from) || !is_on_board(move.to))
+                return false;
+        Action action = NormalMove {
+                with_default_promotion(board, move),
+                board[move.to.y][move.to.x]
+        };
+        if (is_castling_pair(move) && is_castling(board, move))
+                action = CastlingMove(move);
+        else if (is_en_passant(board, move))
+                action = EnPassantMove(move);
+        if (!action_fits(board, action, side))
+                return false;
+        redo_action(board, action, pieces);
+        add_action(std::move(action));
+        checkpoint(board);
+        return true;
+}
+
+bool MoveHistory::undo_move(Board& board, PieceLists* pieces) noexcept
+{
+        Node const& node = nodes_[current_];
+        if (node.parent < 0)
+                return false;
+        undo_action(board, node.action, pieces);
+        current_ = node.parent;
+        checkpoint(board);
+        return true;
+}
+
+MoveHistory::Mark MoveHistory::mark() const noexcept
+{
+        return Mark {
+                .nodes = static_cast<int>(nodes_.size()),
+                .selected_child = nodes_[current_].selected_child
+        };
+}
+
+// Nodes added since the mark come last, so the one of the move is the
+// last of all once those tried after it are gone.
+void MoveHistory::forget_move(Board& board, Mark mark, PieceLists* pieces) noexcept
+{
+        int const node = current_;
+        int const parent = nodes_[node].parent;
+        assert(parent >= 0);
+        undo_action(board, nodes_[node].action, pieces);
+        if (node >= mark.nodes) {
+                assert(node + 1 == static_cast<int>(nodes_.size()));
+                unlink(node);
+                nodes_.pop_back();
         }
-        return false;
+        nodes_[parent].selected_child = mark.selected_child;
+        current_ = parent;
 }
 
-bool MoveHistory::redo_move(Board& board) noexcept
+bool MoveHistory::redo_move(Board& board, PieceLists* pieces) noexcept
 {
-        struct RedoVisitor {
-                Board& board;
+        int const next = nodes_[current_].selected_child;
+        if (next < 0)
+                return false;
+        redo_action(board, nodes_[next].action, pieces);
+        current_ = next;
+        checkpoint(board);
+        return true;
+}
 
-                void operator()(NormalMove normal_move) const noexcept
-                {
-                        normal_move.move.apply(board);
-                }
+bool MoveHistory::seek(Board& board, int ply, PieceLists* pieces) noexcept
+{
+        if (ply < 0)
+                return false;
+        // The current position is on the line, so the target is either
+        // behind it or ahead along the selected variations.
+        int target = current_;
+        while (nodes_[target].ply > ply)
+                target = nodes_[target].parent;
+        while (nodes_[target].ply < ply) {
+                target = nodes_[target].selected_child;
+                if (target < 0)
+                        return false;
+        }
 
-                void operator()(CastlingMove castling_move) const noexcept
-                {
-                        castling_move.apply(board);
+        // A checkpoint on the way to the target saves steps if it is closer.
+        int const steps = std::abs(ply - plies());
+        int start = target;
+        while (start >= 0 && nodes_[start].checkpoint < 0 && ply - nodes_[start].ply < steps)
+                start = nodes_[start].parent;
+        if (start >= 0 && nodes_[start].checkpoint >= 0 && ply - nodes_[start].ply < steps) {
+                CompactBoard const& compact = checkpoints_[nodes_[start].checkpoint].board;
+                for (int i = 0; i < board_size * board_size; ++i) {
+                        unsigned const code = compact[i / 2] >> (i % 2 * 4) & 0xF;
+                        Piece& piece = board[i / board_size][i % board_size];
+                        if (code == 0) {
+                                piece = Piece::none();
+                        } else {
+                                piece.kind = static_cast<Piece::Kind>((code - 1) % 6 + 1);
+                                piece.side = (code > 6) ? Side::dark : Side::light;
+                        }
                 }
-        };
+                if (pieces)
+                        *pieces = PieceLists(board);
+                current_ = start;
+        }
 
-        if (last_action_ != actions_.cend()) {
-                std::visit(RedoVisitor {board}, *last_action_);
-                ++last_action_;
-                return true;
+        while (plies() > ply)
+                undo_move(board, pieces);
+        while (plies() < ply)
+                redo_move(board, pieces);
+        return true;
+}
+
+// Squares are 0 when empty, the kind from 1 to 6 for light and 7 to 12 for
+// dark, two to a byte.
+void MoveHistory::checkpoint(Board const& board) noexcept
+{
+        Node& node = nodes_[current_];
+        if (node.ply % checkpoint_interval != 0 || node.checkpoint >= 0)
+                return;
+        std::size_t slot = checkpoints_.size();
+        if (slot < max_checkpoints && slot < checkpoints_.capacity()) {
+                checkpoints_.push_back(Checkpoint {.board = {}, .node = current_});
+        } else if (!checkpoints_.empty()) {
+                slot = checkpoint_to_replace();
+                if (slot == oldest_checkpoint_)
+                        oldest_checkpoint_ = (oldest_checkpoint_ + 1) % checkpoints_.size();
+                nodes_[checkpoints_[slot].node].checkpoint = -1;
+                checkpoints_[slot].node = current_;
+        } else {
+                return;
         }
-        return false;
+        node.checkpoint = static_cast<int>(slot);
+        CompactBoard& compact = checkpoints_[slot].board;
+        compact.fill(0);
+        for (int i = 0; i < board_size * board_size; ++i) {
+                Piece const piece = board[i / board_size][i % board_size];
+                unsigned code = 0;
+                if (piece.side != Side::none) {
+                        code = static_cast<unsigned>(piece.kind) +
+                               (piece.side == Side::dark ? 6 : 0);
+                }
+                compact[i / 2] |= static_cast<std::uint8_t>(code << (i % 2 * 4));
+        }
+}
+
+bool MoveHistory::has_checkpoint(int ply) const noexcept
+{
+        if (ply < 0)
+                return false;
+        int node = current_;
+        while (nodes_[node].ply > ply)
+                node = nodes_[node].parent;
+        while (node >= 0 && nodes_[node].ply < ply)
+                node = nodes_[node].selected_child;
+        return node >= 0 && nodes_[node].checkpoint >= 0;
 }
 
 bool MoveHistory::piece_was_moved(Position piece_position) const noexcept
 {
+        auto const [x, y] = piece_position;
+        if (initially_moved_ & (std::uint64_t(1) << (y * board_size + x)))
+                return true;
+
         struct Visitor {
                 Position piece_position;
 
@@ -537,27 +988,537 @@ bool MoveHistory::piece_was_moved(Position piece_position) const noexcept
                         return castling_move.king_move().to == piece_position ||
                                castling_move.rook_move().to == piece_position;
                 }
-        };
 
-        return std::any_of(actions_.cbegin(), actions_.cend(),
-                [&](Action action) noexcept
+                bool operator()(EnPassantMove en_passant_move) const noexcept
                 {
-                        return std::visit(Visitor {piece_position}, action);
+                        return en_passant_move.move().to == piece_position;
                 }
-        );
+        };
+
+        for (int i = current_; nodes_[i].parent >= 0; i = nodes_[i].parent) {
+                if (std::visit(Visitor {piece_position}, nodes_[i].action))
+                        return true;
+        }
+        return false;
 }
 
-void MoveHistory::add_action(Action action)
+// The field a pawn skipped over with a double step in the last move.
+std::optional<Position> MoveHistory::en_passant_position(Board const& board) const noexcept
 {
-        if (last_action_ != actions_.cend())
-                actions_.erase(last_action_, actions_.cend());
-        actions_.push_back(std::move(action));
-        last_action_ = actions_.cend();
+        if (current_ == 0)
+                return initial_en_passant_position_;
+        auto const* normal_move = std::get_if<NormalMove>(&nodes_[current_].action);
+        if (!normal_move)
+                return std::nullopt;
+        auto const [from, to, promotion] = normal_move->move;
+        if (board[to.y][to.x].kind != Piece::Kind::pawn || std::abs(to.y - from.y) != 2)
+                return std::nullopt;
+        return Position {to.x, (from.y + to.y) / 2};
 }
 
-Board default_starting_board() noexcept
+int MoveHistory::halfmove_clock(Board const& board) const noexcept
 {
-        Board board {Piece::none()};
+        // The moved piece is found by taking the moves back on a copy.
+        Board before = board;
+        int clock = 0;
+        for (int i = current_; nodes_[i].parent >= 0; i = nodes_[i].parent, ++clock) {
+                Action const& action = nodes_[i].action;
+                if (std::holds_alternative<EnPassantMove>(action))
+                        return clock;
+                if (auto const* normal_move = std::get_if<NormalMove>(&action)) {
+                        auto const [from, to, promotion] = normal_move->move;
+                        if (normal_move->eaten_piece != Piece::none() ||
+                            before[to.y][to.x].kind == Piece::Kind::pawn ||
+                            promotion != Piece::Kind::none) {
+                                return clock;
+                        }
+                }
+                undo_action(before, action);
+        }
+        return clock + initial_halfmove_clock_;
+}
+
+int MoveHistory::plies() const noexcept
+{
+        return nodes_[current_].ply;
+}
+
+int MoveHistory::line_plies() const noexcept
+{
+        int last = current_;
+        while (nodes_[last].selected_child >= 0)
+                last = nodes_[last].selected_child;
+        return nodes_[last].ply;
+}
+
+int MoveHistory::changed_squares(std::array<Position, 4>& squares) const noexcept
+{
+        struct Visitor {
+                std::array<Position, 4>& squares;
+
+                int operator()(NormalMove normal_move) const noexcept
+                {
+                        squares[0] = normal_move.move.from;
+                        squares[1] = normal_move.move.to;
+                        return 2;
+                }
+
+                int operator()(CastlingMove castling_move) const noexcept
+                {
+                        squares[0] = castling_move.king_move().from;
+                        squares[1] = castling_move.king_move().to;
+                        squares[2] = castling_move.rook_move().from;
+                        squares[3] = castling_move.rook_move().to;
+                        return 4;
+                }
+
+                int operator()(EnPassantMove en_passant_move) const noexcept
+                {
+                        squares[0] = en_passant_move.move().from;
+                        squares[1] = en_passant_move.move().to;
+                        squares[2] = en_passant_move.eaten_pawn_position();
+                        return 3;
+                }
+        };
+
+        if (current_ == 0)
+                return 0;
+        return std::visit(Visitor {squares}, nodes_[current_].action);
+}
+
+int MoveHistory::variations() const noexcept
+{
+        int count = 0;
+        for (int i = nodes_[current_].first_child; i >= 0; i = nodes_[i].next_sibling)
+                ++count;
+        return count;
+}
+
+bool MoveHistory::select_variation(int index) noexcept
+{
+        int child = nodes_[current_].first_child;
+        for (; child >= 0 && index > 0; --index)
+                child = nodes_[child].next_sibling;
+        if (child < 0 || index < 0)
+                return false;
+        nodes_[current_].selected_child = child;
+        return true;
+}
+
+void MoveHistory::promote_line() noexcept
+{
+        for (int i = current_; nodes_[i].parent >= 0; i = nodes_[i].parent) {
+                Node& parent = nodes_[nodes_[i].parent];
+                if (parent.first_child == i)
+                        continue;
+                unlink(i);
+                nodes_[i].previous_sibling = -1;
+                nodes_[i].next_sibling = parent.first_child;
+                nodes_[parent.first_child].previous_sibling = i;
+                parent.first_child = i;
+        }
+}
+
+// version:u8 initially_moved:u64 en_passant:u8 halfmove_clock:varint
+// count:varint cursor:varint and then the moves, parents before children
+// and siblings in order. Each is its parent as a varint, 0 for the first
+// position and i for the i-th move, and three bytes for the move: the kind
+// and eaten piece, with the top bit set if redo follows it, followed by
+// the move. Castling is stored as the king and rook squares.
+void MoveHistory::serialize(std::vector<unsigned char>& out) const
+{
+        struct Visitor {
+                std::vector<unsigned char>& out;
+                unsigned selected;
+
+                void operator()(NormalMove normal_move) const
+                {
+                        put_u8(out, 0 | encode_piece(normal_move.eaten_piece) << 2 | selected);
+                        put_fixed(out, encode_move(normal_move.move));
+                }
+
+                void operator()(CastlingMove castling_move) const
+                {
+                        put_u8(out, 1 | selected);
+                        put_fixed(out, encode_move(Move {
+                                .from = castling_move.king_move().from,
+                                .to = castling_move.rook_move().from
+                        }));
+                }
+
+                void operator()(EnPassantMove en_passant_move) const
+                {
+                        put_u8(out, 2 | selected);
+                        put_fixed(out, encode_move(en_passant_move.move()));
+                }
+        };
+
+        // The arena is numbered again in depth-first order, which keeps the
+        // siblings in order when they are appended on loading.
+        std::vector<int> order;
+        std::vector<int> numbers(nodes_.size());
+        order.reserve(nodes_.size());
+        std::vector<int> stack {0};
+        while (!stack.empty()) {
+                int const node = stack.back();
+                stack.pop_back();
+                numbers[node] = static_cast<int>(order.size());
+                order.push_back(node);
+                std::size_t const first = stack.size();
+                for (int i = nodes_[node].first_child; i >= 0; i = nodes_[i].next_sibling)
+                        stack.push_back(i);
+                std::reverse(stack.begin() + first, stack.end());
+        }
+
+        out.reserve(out.size() + 24 + 4 * nodes_.size());
+        put_u8(out, serialized_version);
+        put_fixed(out, initially_moved_);
+        put_u8(out, initial_en_passant_position_ ?
+                    static_cast<unsigned>(initial_en_passant_position_->x +
+                                          8 * initial_en_passant_position_->y) :
+                    no_square);
+        put_varint(out, static_cast<std::uint64_t>(initial_halfmove_clock_));
+        put_varint(out, nodes_.size() - 1);
+        put_varint(out, static_cast<std::uint64_t>(numbers[current_]));
+        for (auto i = order.cbegin() + 1; i != order.cend(); ++i) {
+                Node const& node = nodes_[*i];
+                put_varint(out, static_cast<std::uint64_t>(numbers[node.parent]));
+                unsigned const selected = (nodes_[node.parent].selected_child == *i) ? 0x80 : 0;
+                std::visit(Visitor {out, selected}, node.action);
+        }
+}
+
+// Version 1 histories were a single line, with no parents and no selected
+// bits.
+std::size_t MoveHistory::deserialize(unsigned char const* data, std::size_t size)
+{
+        ByteReader in(data, size);
+        unsigned version = 0;
+        MoveHistory history;
+        unsigned en_passant = 0;
+        std::uint64_t halfmove_clock = 0;
+        std::uint64_t count = 0;
+        std::uint64_t cursor = 0;
+        if (!in.u8(version) || version == 0 || version > serialized_version ||
+            !in.fixed(history.initially_moved_) || !in.u8(en_passant) ||
+            !in.varint(halfmove_clock) || !in.varint(count) || !in.varint(cursor)) {
+                return 0;
+        }
+        std::size_t const move_size = (version == 1) ? 3 : 4;
+        if ((en_passant >= 64 && en_passant != no_square) || halfmove_clock > max_int ||
+            cursor > count || count > in.remaining() / move_size) {
+                return 0;
+        }
+        if (en_passant != no_square) {
+                int const square = static_cast<int>(en_passant);
+                history.initial_en_passant_position_ = Position {square % 8, square / 8};
+        }
+        history.initial_halfmove_clock_ = static_cast<int>(halfmove_clock);
+
+        history.nodes_.reserve(count + 1);
+        history.checkpoints_.reserve(max_checkpoints);
+        for (std::uint64_t i = 0; i < count; ++i) {
+                std::uint64_t parent = i;
+                if (version > 1 && (!in.varint(parent) || parent > i))
+                        return 0;
+                unsigned kind = 0;
+                std::uint16_t code = 0;
+                if (!in.u8(kind) || !in.fixed(code))
+                        return 0;
+                Move const move = decode_move(code);
+                if (move.promotion > Piece::Kind::bishop)
+                        return 0;
+
+                Piece eaten_piece = Piece::none();
+                int const parent_node = static_cast<int>(parent);
+                switch (kind & 3) {
+                        case 0:
+                                if (!decode_piece((kind & 0x7F) >> 2, eaten_piece))
+                                        return 0;
+                                history.append_child(parent_node, NormalMove {move, eaten_piece});
+                                break;
+                        case 1:
+                                if (!is_castling_pair(move))
+                                        return 0;
+                                history.append_child(parent_node, CastlingMove(move));
+                                break;
+                        case 2:
+                                history.append_child(parent_node, EnPassantMove(move));
+                                break;
+                        default:
+                                return 0;
+                }
+                if (kind & 0x80)
+                        history.nodes_[parent_node].selected_child = static_cast<int>(i + 1);
+        }
+
+        // Redo has to lead back to the cursor.
+        history.current_ = static_cast<int>(cursor);
+        for (int i = history.current_; i != 0; i = history.nodes_[i].parent)
+                history.nodes_[history.nodes_[i].parent].selected_child = i;
+
+        *this = std::move(history);
+        return in.pos();
+}
+
+void MoveHistory::undo_action(Board& board, Action const& action, PieceLists* pieces) noexcept
+{
+        struct UndoVisitor {
+                Board& board;
+                PieceLists* pieces;
+
+                void operator()(NormalMove normal_move) const noexcept
+                {
+                        normal_move.move.undo(board, normal_move.eaten_piece, pieces);
+                }
+
+                void operator()(CastlingMove castling_move) const noexcept
+                {
+                        castling_move.undo(board, pieces);
+                }
+
+                void operator()(EnPassantMove en_passant_move) const noexcept
+                {
+                        en_passant_move.undo(board, pieces);
+                }
+        };
+
+        std::visit(UndoVisitor {board, pieces}, action);
+}
+
+void MoveHistory::redo_action(Board& board, Action const& action, PieceLists* pieces) noexcept
+{
+        struct RedoVisitor {
+                Board& board;
+                PieceLists* pieces;
+
+                void operator()(NormalMove normal_move) const noexcept
+                {
+                        normal_move.move.apply(board, pieces);
+                }
+
+                void operator()(CastlingMove castling_move) const noexcept
+                {
+                        castling_move.apply(board, pieces);
+                }
+
+                void operator()(EnPassantMove en_passant_move) const noexcept
+                {
+                        en_passant_move.apply(board, pieces);
+                }
+        };
+
+        std::visit(RedoVisitor {board, pieces}, action);
+}
+
+bool MoveHistory::action_fits(Board const& board, Action const& action, Side side) noexcept
+{
+        struct Visitor {
+                Board const& board;
+                Side side;
+
+                Piece at(Position position) const noexcept
+                {
+                        return board[position.y][position.x];
+                }
+
+                bool operator()(NormalMove normal_move) const noexcept
+                {
+                        auto const [from, to, promotion] = normal_move.move;
+                        Piece const piece = at(from);
+                        Piece const eaten_piece = normal_move.eaten_piece;
+                        return piece.side == side && !(from == to) && at(to) == eaten_piece &&
+                               eaten_piece.side != side && eaten_piece.kind != Piece::Kind::king &&
+                               (promotion != Piece::Kind::none) ==
+                                       reaches_last_rank(piece, normal_move.move);
+                }
+
+                bool operator()(CastlingMove castling_move) const noexcept
+                {
+                        Move const king_move = castling_move.king_move();
+                        Move const rook_move = castling_move.rook_move();
+                        auto const free =
+                        [&](Position position) noexcept
+                        {
+                                return at(position) == Piece::none() ||
+                                       position == king_move.from || position == rook_move.from;
+                        };
+                        return king_move.from.y == home_rank_y(side) &&
+                               at(king_move.from) == Piece {.kind = Piece::Kind::king, .side = side} &&
+                               at(rook_move.from) == Piece {.kind = Piece::Kind::rook, .side = side} &&
+                               free(king_move.to) && free(rook_move.to);
+                }
+
+                bool operator()(EnPassantMove en_passant_move) const noexcept
+                {
+                        auto const [from, to, promotion] = en_passant_move.move();
+                        int const forward = (side == Side::light) ? -1 : 1;
+                        return at(from) == Piece {.kind = Piece::Kind::pawn, .side = side} &&
+                               at(to) == Piece::none() &&
+                               at(en_passant_move.eaten_pawn_position()) ==
+                                       Piece {.kind = Piece::Kind::pawn, .side = opposite_side(side)} &&
+                               std::abs(to.x - from.x) == 1 && to.y - from.y == forward &&
+                               promotion == Piece::Kind::none;
+                }
+        };
+
+        return std::visit(Visitor {board, side}, action);
+}
+
+bool MoveHistory::fits(Board const& board, Side first_on_turn) const noexcept
+{
+        // Putting back the pawn an en passant capture took needs the pawn
+        // that took it.
+        Board first = board;
+        for (int i = current_; i != 0; i = nodes_[i].parent) {
+                auto const* en_passant_move = std::get_if<EnPassantMove>(&nodes_[i].action);
+                if (en_passant_move) {
+                        Position const to = en_passant_move->move().to;
+                        if (first[to.y][to.x].side == Side::none)
+                                return false;
+                }
+                undo_action(first, nodes_[i].action);
+        }
+
+        // Then every move forward, depth first, each taken back once its
+        // variations are done.
+        Board at = first;
+        bool reached = false;
+        int node = 0;
+        while (true) {
+                if (node == current_)
+                        reached = (at == board);
+                int next = nodes_[node].first_child;
+                while (next < 0 && node != 0) {
+                        undo_action(at, nodes_[node].action);
+                        next = nodes_[node].next_sibling;
+                        node = nodes_[node].parent;
+                }
+                if (next < 0)
+                        break;
+                Side const side = (nodes_[node].ply % 2 == 0) ? first_on_turn :
+                                                                 opposite_side(first_on_turn);
+                if (!action_fits(at, nodes_[next].action, side))
+                        return false;
+                redo_action(at, nodes_[next].action);
+                node = next;
+        }
+        return reached;
+}
+
+void MoveHistory::add_action(Action action)
+{
+        // Only called for actions of the same kind.
+        struct SameVisitor {
+                Action const& other;
+
+                bool operator()(NormalMove normal_move) const noexcept
+                {
+                        return std::get<NormalMove>(other).move == normal_move.move;
+                }
+
+                bool operator()(CastlingMove castling_move) const noexcept
+                {
+                        auto const& other_move = std::get<CastlingMove>(other);
+                        return other_move.king_move() == castling_move.king_move() &&
+                               other_move.rook_move() == castling_move.rook_move();
+                }
+
+                bool operator()(EnPassantMove en_passant_move) const noexcept
+                {
+                        return std::get<EnPassantMove>(other).move() == en_passant_move.move();
+                }
+        };
+
+        checkpoints_.reserve(max_checkpoints);
+        // A move played here before goes back into its variation.
+        Node& node = nodes_[current_];
+        for (int i = node.first_child; i >= 0; i = nodes_[i].next_sibling) {
+                Action const& played = nodes_[i].action;
+                if (played.index() == action.index() &&
+                    std::visit(SameVisitor {action}, played)) {
+                        node.selected_child = i;
+                        current_ = i;
+                        return;
+                }
+        }
+        append_child(current_, std::move(action));
+        current_ = nodes_[current_].last_child;
+        nodes_[nodes_[current_].parent].selected_child = current_;
+}
+
+// Redo follows the first child until another is selected.
+void MoveHistory::append_child(int parent, Action action)
+{
+        int const child = static_cast<int>(nodes_.size());
+        nodes_.push_back(Node {
+                .action = std::move(action),
+                .parent = parent,
+                .previous_sibling = nodes_[parent].last_child,
+                .ply = nodes_[parent].ply + 1
+        });
+        Node& node = nodes_[parent];
+        if (node.last_child >= 0)
+                nodes_[node.last_child].next_sibling = child;
+        else
+                node.first_child = child;
+        node.last_child = child;
+        if (node.selected_child < 0)
+                node.selected_child = child;
+}
+
+// Seek only starts from checkpoints on the selected line, so one off it
+// goes first, and of those one off the main line too, like those of
+// variations tried and left. With every checkpoint on the line the
+// oldest goes.
+std::size_t MoveHistory::checkpoint_to_replace() const noexcept
+{
+        std::bitset<max_checkpoints> on_line;
+        std::bitset<max_checkpoints> on_main_line;
+        for (int i = current_; i >= 0; i = nodes_[i].parent) {
+                if (nodes_[i].checkpoint >= 0)
+                        on_line.set(static_cast<std::size_t>(nodes_[i].checkpoint));
+        }
+        for (int i = nodes_[current_].selected_child; i >= 0; i = nodes_[i].selected_child) {
+                if (nodes_[i].checkpoint >= 0)
+                        on_line.set(static_cast<std::size_t>(nodes_[i].checkpoint));
+        }
+        for (int i = 0; i >= 0; i = nodes_[i].first_child) {
+                if (nodes_[i].checkpoint >= 0)
+                        on_main_line.set(static_cast<std::size_t>(nodes_[i].checkpoint));
+        }
+
+        std::optional<std::size_t> off_line;
+        for (std::size_t slot = 0; slot < checkpoints_.size(); ++slot) {
+                if (on_line[slot])
+                        continue;
+                if (!on_main_line[slot])
+                        return slot;
+                if (!off_line)
+                        off_line = slot;
+        }
+        return off_line.value_or(oldest_checkpoint_);
+}
+
+// Takes the node out of its parent's children, leaving the node's own
+// links as they were.
+void MoveHistory::unlink(int node) noexcept
+{
+        Node const& child = nodes_[node];
+        Node& parent = nodes_[child.parent];
+        if (child.previous_sibling >= 0)
+                nodes_[child.previous_sibling].next_sibling = child.next_sibling;
+        else
+                parent.first_child = child.next_sibling;
+        if (child.next_sibling >= 0)
+                nodes_[child.next_sibling].previous_sibling = child.previous_sibling;
+        else
+                parent.last_child = child.previous_sibling;
+}
+
+Board default_starting_board() noexcept
+{
+        Board board {Piece::none()};
 
         auto const add_pawn_rank =
         [&](Side side) noexcept
@@ -617,46 +1578,182 @@ std::vector<Rule> default_rules()
         };
 }
 
-Game::Game(GameOver game_over) noexcept
+Setup default_setup() noexcept
+{
+        return Setup {
+                .board = default_starting_board(),
+                .on_turn = Side::light,
+                .castling_rights = {true, true, true, true},
+                .en_passant_position = std::nullopt,
+                .halfmove_clock = 0,
+                .fullmove_number = 1
+        };
+}
+
+RuleSet make_rule_set(std::vector<Rule> rules)
+{
+        assert(rules.size() <= 32);
+        return std::make_shared<std::vector<Rule> const>(std::move(rules));
+}
+
+RuleSet const& standard_rules()
+{
+        static RuleSet const rules = make_rule_set(default_rules());
+        return rules;
+}
+
+Game::Game(GameOver game_over, RuleSet rules) noexcept
         : game_over_(std::move(game_over))
-{}
+        , rules_(std::move(rules))
+{
+        reset_plies();
+        fill_destinations();
+}
+
+Game::Game(GameOver game_over, Setup const& setup, RuleSet rules) noexcept
+        : game_over_(std::move(game_over))
+        , board_(setup.board)
+        , rules_(std::move(rules))
+        , move_history_(setup)
+        , on_turn_(setup.on_turn)
+        , first_on_turn_(setup.on_turn)
+        , first_fullmove_number_(setup.fullmove_number)
+{
+        reset_plies();
+        update_over(false);
+}
+
+bool Game::is_legal(Move move) const noexcept
+{
+        if (over_ || !is_on_board(move.from) || !is_on_board(move.to))
+                return false;
+        return (legal_destinations(move.from) >> square_index(move.to) & 1) &&
+               promotion_is_valid(board_[move.from.y][move.from.x], move);
+}
+
+std::uint64_t Game::legal_destinations(Position from) const noexcept
+{
+        if (over_ || !is_on_board(from))
+                return 0;
+        return destination_masks()[square_index(from)];
+}
 
 bool Game::try_move(Move move)
 {
-        if (move_is_valid(on_turn_, board_, rules_, move_history_, move)) {
-                Piece const src = board_[move.from.y][move.from.x];
-                Piece const dst = board_[move.to.y][move.to.x];
-                if (src.side == dst.side)
-                        castling(move);
-                else
-                        normal_move(move);
-                Side const w = winner(board_, rules_, move_history_);
-                if (w != Side::none) {
-                        on_turn_ = Side::none;
-                        game_over_(w);
-                } else {
-                        toggle_turn();
-                }
+        if (is_legal(move)) {
+                play(move);
+                move_history_.checkpoint(board_);
+                update_over(true);
                 return true;
         }
         return false;
 }
 
+bool Game::make_move(Move move, TriedMove& tried)
+{
+        if (!is_legal(move))
+                return false;
+        tried.history = move_history_.mark();
+        tried.destinations = destinations_;
+        play(move);
+        update_over(false);
+        return true;
+}
+
+void Game::unmake_move(TriedMove const& tried)
+{
+        move_history_.forget_move(board_, tried.history, &pieces_);
+        toggle_turn();
+        // The plies past here were those of the move.
+        plies_.resize(static_cast<std::size_t>(move_history_.plies()) + 1);
+        // Back to where the move was legal, so the game is open.
+        destinations_ = tried.destinations;
+        over_ = false;
+        winner_ = Side::none;
+}
+
+bool Game::append_moves(std::vector<Move> const& moves)
+{
+        if (over_)
+                return moves.empty();
+        // The line past here may be another one now.
+        plies_.resize(static_cast<std::size_t>(move_history_.plies()) + 1);
+        bool fits = true;
+        for (Move move : moves) {
+                Board const before = board_;
+                if (!move_history_.append_move(board_, on_turn_, move, &pieces_)) {
+                        fits = false;
+                        break;
+                }
+                toggle_turn();
+                push_ply(before);
+        }
+        update_over(true);
+        return fits;
+}
+
 void Game::undo_move()
 {
-        if (move_history_.undo_move(board_))
+        if (move_history_.undo_move(board_, &pieces_)) {
                 toggle_turn();
+                update_over(false);
+        }
 }
 
 void Game::redo_move()
 {
-        if (move_history_.redo_move(board_))
+        Board const before = board_;
+        if (move_history_.redo_move(board_, &pieces_)) {
+                toggle_turn();
+                if (plies_.size() <= static_cast<std::size_t>(move_history_.plies()))
+                        push_ply(before);
+                update_over(false);
+        }
+}
+
+bool Game::seek(int ply)
+{
+        if (ply < 0 || ply > move_history_.line_plies())
+                return false;
+        // Jumps as far as the plies are known and steps the rest.
+        int const current = move_history_.plies();
+        int const known = std::min(ply, static_cast<int>(plies_.size()) - 1);
+        move_history_.seek(board_, known, &pieces_);
+        if ((current - known) % 2 != 0)
+                toggle_turn();
+        Board before = board_;
+        while (move_history_.plies() < ply) {
+                move_history_.redo_move(board_, &pieces_);
                 toggle_turn();
+                push_ply(before);
+                before = board_;
+        }
+        update_over(false);
+        return true;
+}
+
+int Game::variations() const noexcept
+{
+        return move_history_.variations();
+}
+
+bool Game::select_variation(int index)
+{
+        if (!move_history_.select_variation(index))
+                return false;
+        // The plies past here were those of the old line.
+        plies_.resize(static_cast<std::size_t>(move_history_.plies()) + 1);
+        return true;
+}
+
+void Game::promote_line() noexcept
+{
+        move_history_.promote_line();
 }
 
 Side Game::on_turn() const noexcept
 {
-        return on_turn_;
+        return over_ ? Side::none : on_turn_;
 }
 
 Board Game::board() const noexcept
@@ -664,21 +1761,349 @@ Board Game::board() const noexcept
         return board_;
 }
 
+MoveList Game::valid_moves() const noexcept
+{
+        MoveList moves;
+        if (over_)
+                return moves;
+        DestinationMasks const& masks = destination_masks();
+        for (int from = 0; from < board_size * board_size; ++from) {
+                if (masks[from] == 0)
+                        continue;
+                Position const from_pos = square_position(from);
+                Piece const piece = board_[from_pos.y][from_pos.x];
+                for (int to = 0; to < board_size * board_size; ++to) {
+                        if (!(masks[from] >> to & 1))
+                                continue;
+                        Move const move {.from = from_pos, .to = square_position(to)};
+                        // Castling is only listed from the king.
+                        if (piece.kind != Piece::Kind::king && is_castling(board_, move))
+                                continue;
+                        if (reaches_last_rank(piece, move)) {
+                                for (auto const kind : promotion_kinds) {
+                                        Move promotion = move;
+                                        promotion.promotion = kind;
+                                        moves.push_back(promotion);
+                                }
+                        } else {
+                                moves.push_back(move);
+                        }
+                }
+        }
+        return moves;
+}
+
+bool Game::in_check() const noexcept
+{
+        return king_is_attacked(on_turn_, board_, pieces_, *rules_, move_history_);
+}
+
+Setup Game::setup() const noexcept
+{
+        auto const can_castle =
+        [&](Side side, int rook_x) noexcept
+        {
+                int const y = home_rank_y(side);
+                Piece const king {.kind = Piece::Kind::king, .side = side};
+                Piece const rook {.kind = Piece::Kind::rook, .side = side};
+                return board_[y][king_x] == king &&
+                       board_[y][rook_x] == rook &&
+                       !move_history_.piece_was_moved(Position {king_x, y}) &&
+                       !move_history_.piece_was_moved(Position {rook_x, y});
+        };
+
+        int const plies = move_history_.plies() + (first_on_turn_ == Side::dark ? 1 : 0);
+        return Setup {
+                .board = board_,
+                .on_turn = on_turn_,
+                .castling_rights = {
+                        .light_kingside = can_castle(Side::light, right_rook_x),
+                        .light_queenside = can_castle(Side::light, left_rook_x),
+                        .dark_kingside = can_castle(Side::dark, right_rook_x),
+                        .dark_queenside = can_castle(Side::dark, left_rook_x)
+                },
+                .en_passant_position = move_history_.en_passant_position(board_),
+                .halfmove_clock = halfmove_clock(),
+                .fullmove_number = first_fullmove_number_ + plies / 2
+        };
+}
+
+void Game::set_game_over(GameOver game_over) noexcept
+{
+        game_over_ = game_over;
+}
+
+RuleSet const& Game::rules() const noexcept
+{
+        return rules_;
+}
+
+std::uint64_t Game::key() const noexcept
+{
+        return plies_[move_history_.plies()].key;
+}
+
+int Game::halfmove_clock() const noexcept
+{
+        return plies_[move_history_.plies()].halfmove_clock;
+}
+
+int Game::repetitions() const noexcept
+{
+        int const last = move_history_.plies();
+        int const first = std::max(last - plies_[last].halfmove_clock, 0);
+        int count = 0;
+        for (int i = last - min_repetition_distance; i >= first; i -= 2) {
+                if (plies_[i].key == plies_[last].key)
+                        ++count;
+        }
+        return count;
+}
+
+bool Game::is_draw() const noexcept
+{
+        return halfmove_clock() >= fifty_move_plies || repetitions() >= threefold_repetitions;
+}
+
+bool Game::claim_draw()
+{
+        if (over_ || !is_draw())
+                return false;
+        over_ = true;
+        winner_ = Side::none;
+        if (game_over_)
+                game_over_(Side::none);
+        return true;
+}
+
+Side Game::winner() const noexcept
+{
+        return over_ ? winner_ : Side::none;
+}
+
+Ending Game::ending() const noexcept
+{
+        if (!over_)
+                return Ending::none;
+        if (is_stuck())
+                return in_check() ? Ending::checkmate : Ending::stalemate;
+        if (repetitions() >= fivefold_repetitions)
+                return Ending::fivefold_repetition;
+        if (halfmove_clock() >= seventy_five_move_plies)
+                return Ending::seventy_five_move_rule;
+        return halfmove_clock() >= fifty_move_plies ? Ending::fifty_move_rule :
+                                                      Ending::threefold_repetition;
+}
+
+// board:u8[64] on_turn:u8 over:u8 first_on_turn:u8 first_fullmove_number:varint
+// and then the history.
+void Game::serialize(std::vector<unsigned char>& out) const
+{
+        for (auto const& row : board_) {
+                for (Piece piece : row)
+                        put_u8(out, encode_piece(piece));
+        }
+        put_u8(out, static_cast<unsigned>(on_turn_));
+        put_u8(out, over_ ? 1 : 0);
+        put_u8(out, static_cast<unsigned>(first_on_turn_));
+        put_varint(out, static_cast<std::uint64_t>(first_fullmove_number_));
+        move_history_.serialize(out);
+}
+
+std::size_t Game::deserialize(unsigned char const* data, std::size_t size)
+{
+        ByteReader in(data, size);
+        Board board;
+        for (auto& row : board) {
+                for (Piece& piece : row) {
+                        unsigned code = 0;
+                        if (!in.u8(code) || !decode_piece(code, piece))
+                                return 0;
+                }
+        }
+
+        unsigned on_turn = 0;
+        unsigned over = 0;
+        unsigned first_on_turn = 0;
+        std::uint64_t first_fullmove_number = 0;
+        Side on_turn_side = Side::none;
+        Side first_on_turn_side = Side::none;
+        if (!in.u8(on_turn) || !decode_side(on_turn, on_turn_side) ||
+            !in.u8(over) || over > 1 ||
+            !in.u8(first_on_turn) || !decode_side(first_on_turn, first_on_turn_side) ||
+            !in.varint(first_fullmove_number) || first_fullmove_number > max_int) {
+                return 0;
+        }
+
+        MoveHistory move_history;
+        std::size_t const history_size =
+                move_history.deserialize(data + in.pos(), in.remaining());
+        int const plies = move_history.plies();
+        if (history_size == 0 || on_turn_side == Side::none || first_on_turn_side == Side::none ||
+            (on_turn_side == first_on_turn_side) != (plies % 2 == 0) ||
+            !move_history.fits(board, first_on_turn_side)) {
+                return 0;
+        }
+
+        // From the first position the keys are worked out along the line
+        // as far as the saved one, a few squares a move.
+        board_ = board;
+        move_history_ = std::move(move_history);
+        move_history_.seek(board_, 0);
+        pieces_ = PieceLists(board_);
+        on_turn_ = first_on_turn_side;
+        first_on_turn_ = first_on_turn_side;
+        first_fullmove_number_ = static_cast<int>(first_fullmove_number);
+        reset_plies();
+        Board before = board_;
+        while (move_history_.plies() < plies) {
+                move_history_.redo_move(board_, &pieces_);
+                toggle_turn();
+                push_ply(before);
+                before = board_;
+        }
+        over_ = over != 0;
+        fill_destinations();
+        // A game over for anything but checkmate was drawn.
+        winner_ = (over_ && is_stuck() && in_check()) ? opposite_side(on_turn_) : Side::none;
+        return in.pos() + history_size;
+}
+
 void Game::toggle_turn() noexcept
 {
         on_turn_ = opposite_side(on_turn_);
 }
 
+Game::DestinationMasks const& Game::destination_masks() const noexcept
+{
+        return destinations_;
+}
+
+void Game::fill_destinations() noexcept
+{
+        MoveList moves;
+        add_valid_moves(on_turn_, board_, pieces_, *rules_, move_history_, moves);
+        destinations_.fill(0);
+        for (Move move : moves) {
+                destinations_[square_index(move.from)] |= std::uint64_t(1) << square_index(move.to);
+                if (is_castling(board_, move))
+                        destinations_[square_index(move.to)] |= std::uint64_t(1) << square_index(move.from);
+        }
+}
+
+bool Game::is_stuck() const noexcept
+{
+        return std::all_of(destinations_.begin(), destinations_.end(),
+                [](std::uint64_t mask)
+                {
+                        return mask == 0;
+                }
+        );
+}
+
+void Game::update_over(bool report)
+{
+        fill_destinations();
+        bool const stuck = is_stuck();
+        winner_ = (stuck && in_check()) ? opposite_side(on_turn_) : Side::none;
+        over_ = stuck || halfmove_clock() >= seventy_five_move_plies ||
+                repetitions() >= fivefold_repetitions;
+        if (over_ && report && game_over_)
+                game_over_(winner_);
+}
+
+// Updates the key from the squares the last move changed, which saves
+// telling castling, en passant and promotions apart.
+void Game::push_ply(Board const& before)
+{
+        Ply const last = plies_.back();
+        Ply ply = last;
+        ply.key ^= light_on_turn_key();
+        bool irreversible = false;
+        std::array<Position, 4> squares;
+        int const changed = move_history_.changed_squares(squares);
+        for (int i = 0; i < changed; ++i) {
+                Position const position = squares[i];
+                Piece const old_piece = before[position.y][position.x];
+                Piece const new_piece = board_[position.y][position.x];
+                if (old_piece == new_piece)
+                        continue;
+                ply.key ^= piece_key(old_piece, position) ^ piece_key(new_piece, position);
+                ply.castling_rights &= ~castling_rights_lost(position);
+                // A pawn moved or something was taken.
+                irreversible = irreversible ||
+                               old_piece.kind == Piece::Kind::pawn ||
+                               (old_piece != Piece::none() && new_piece != Piece::none());
+        }
+        for (int right = 0; right < 4; ++right) {
+                if ((last.castling_rights ^ ply.castling_rights) & (1u << right))
+                        ply.key ^= castling_key(right);
+        }
+
+        if (last.en_passant_file >= 0)
+                ply.key ^= en_passant_key(last.en_passant_file);
+        std::optional const en_passant_position = move_history_.en_passant_position(board_);
+        ply.en_passant_file = en_passant_counts(board_, on_turn_, en_passant_position) ?
+                en_passant_position->x : -1;
+        if (ply.en_passant_file >= 0)
+                ply.key ^= en_passant_key(ply.en_passant_file);
+
+        ply.halfmove_clock = irreversible ? 0 : last.halfmove_clock + 1;
+        plies_.push_back(ply);
+}
+
+// Hashes the first position from scratch, which is where the game must be.
+void Game::reset_plies()
+{
+        move_history_.checkpoint(board_);
+
+        plies_.assign(1, Ply {
+                .key = 0,
+                .halfmove_clock = move_history_.halfmove_clock(board_),
+                .castling_rights = 0,
+                .en_passant_file = -1
+        });
+        Setup const first = setup();
+        std::optional const en_passant_position = first.en_passant_position;
+        plies_[0].key = zobrist_key(first);
+        plies_[0].castling_rights = castling_bits(first.castling_rights);
+        if (en_passant_counts(board_, on_turn_, en_passant_position))
+                plies_[0].en_passant_file = en_passant_position->x;
+}
+
+// Makes a legal move and adds it to the history.
+void Game::play(Move move)
+{
+        Board const before = board_;
+        if (is_castling(board_, move))
+                castling(move);
+        else if (is_en_passant(board_, move))
+                en_passant(move);
+        else
+                normal_move(with_default_promotion(board_, move));
+        toggle_turn();
+        // The line past the move may be another one now.
+        plies_.resize(move_history_.plies());
+        push_ply(before);
+}
+
 void Game::castling(Move move) noexcept
 {
         CastlingMove castling_move(move);
-        castling_move.apply(board_);
+        castling_move.apply(board_, &pieces_);
         move_history_.add_castling_move(castling_move);
 }
 
+void Game::en_passant(Move move) noexcept
+{
+        EnPassantMove en_passant_move(move);
+        en_passant_move.apply(board_, &pieces_);
+        move_history_.add_en_passant_move(en_passant_move);
+}
+
 void Game::normal_move(Move move) noexcept
 {
-        auto const eaten_piece = move.apply(board_);
+        auto const eaten_piece = move.apply(board_, &pieces_);
         move_history_.add_move(move, eaten_piece);
 }
 
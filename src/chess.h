@@ -1,12 +1,18 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <variant>
+#include <optional>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
 
 /**
  * What's left:
- * test checkmate checking, rule for saying where the king can really jump,
  * mouse control, optionally highlighting valid fields with a macro
  */
 
@@ -60,12 +66,139 @@ template <class T, auto W, auto H>
 using Matrix = std::array<std::array<T, W>, H>;
 using Board = Matrix<Piece, board_size, board_size>;
 
+// Where each side's pieces stand and where its king is, so that code
+// looking for them touches a few entries rather than the whole board. The
+// moves keep it up to date when they are given one.
+class PieceLists {
+public:
+        struct Squares {
+                // Indices y * board_size + x, in no particular order.
+                std::array<std::int8_t, board_size * board_size> squares;
+                int size = 0;
+
+                std::int8_t const* begin() const noexcept
+                {
+                        return squares.data();
+                }
+
+                std::int8_t const* end() const noexcept
+                {
+                        return squares.data() + size;
+                }
+        };
+
+        explicit PieceLists(Board const& board) noexcept;
+
+        Squares const& of(Side side) const noexcept;
+        std::optional<Position> king(Side side) const noexcept;
+        void add(Position pos, Piece piece) noexcept;
+        void remove(Position pos) noexcept;
+        // Takes whatever stood at to off first.
+        void move(Position from, Position to) noexcept;
+
+private:
+        std::array<Squares, 2> lists_ {};
+        // Where each square is in its side's list, -1 if it is empty.
+        std::array<std::int8_t, board_size * board_size> slots_;
+        std::array<std::int8_t, board_size * board_size> sides_ {};
+        std::array<std::int8_t, 2> kings_ {-1, -1};
+};
+
 struct Move {
         Position from;
         Position to;
+        // What a pawn reaching the last rank turns into, none otherwise.
+        Piece::Kind promotion = Piece::Kind::none;
 
-        Piece apply(Board& board) const noexcept;
-        void undo(Board& board, Piece eaten_piece) const noexcept;
+        Piece apply(Board& board, PieceLists* pieces = nullptr) const noexcept;
+        void undo(Board& board, Piece eaten_piece, PieceLists* pieces = nullptr) const noexcept;
+};
+
+bool operator==(Move m1, Move m2) noexcept;
+bool operator!=(Move m1, Move m2) noexcept;
+
+// from + 64 * to + 4096 * promotion, with squares numbered x + 8 * y. Used
+// by the binary formats.
+std::uint16_t encode_move(Move move) noexcept;
+Move decode_move(std::uint16_t code) noexcept;
+
+// No legal chess position has more than 218 moves.
+int constexpr max_moves = 256;
+
+// Fixed capacity list, so enumerating moves never touches the heap.
+class MoveList {
+public:
+        Move* begin() noexcept
+        {
+                return moves_.data();
+        }
+
+        Move* end() noexcept
+        {
+                return moves_.data() + size_;
+        }
+
+        Move const* begin() const noexcept
+        {
+                return moves_.data();
+        }
+
+        Move const* end() const noexcept
+        {
+                return moves_.data() + size_;
+        }
+
+        Move& operator[](int index) noexcept
+        {
+                assert(index >= 0 && index < size_);
+                return moves_[index];
+        }
+
+        Move operator[](int index) const noexcept
+        {
+                assert(index >= 0 && index < size_);
+                return moves_[index];
+        }
+
+        int size() const noexcept
+        {
+                return size_;
+        }
+
+        bool empty() const noexcept
+        {
+                return size_ == 0;
+        }
+
+        void push_back(Move move) noexcept
+        {
+                assert(size_ < max_moves);
+                moves_[size_++] = move;
+        }
+
+        // Doesn't preserve the order, the last move takes the removed one's place.
+        void swap_remove(int index) noexcept
+        {
+                assert(index >= 0 && index < size_);
+                moves_[index] = moves_[--size_];
+        }
+
+        void clear() noexcept
+        {
+                size_ = 0;
+        }
+
+        // Puts the first count moves in order, the rest are left unspecified.
+        template <class Compare>
+        void partial_sort(int count, Compare const& compare)
+        {
+                count = std::min(count, size_);
+                std::partial_sort(begin(), begin() + count, end(), compare);
+        }
+
+private:
+        std::array<Move, max_moves> moves_;
+        int size_ = 0;
 };
 
 class CastlingMove {
@@ -74,21 +207,128 @@ public:
 
         Move rook_move() const noexcept;
         Move king_move() const noexcept;
-        void apply(Board& board) const noexcept;
-        void undo(Board& board) const noexcept;
+        void apply(Board& board, PieceLists* pieces = nullptr) const noexcept;
+        void undo(Board& board, PieceLists* pieces = nullptr) const noexcept;
 
 private:
         Move rook_move_;
         Move king_move_;
 };
 
+class EnPassantMove {
+public:
+        explicit EnPassantMove(Move move) noexcept;
+
+        Move move() const noexcept;
+        Position eaten_pawn_position() const noexcept;
+        void apply(Board& board, PieceLists* pieces = nullptr) const noexcept;
+        void undo(Board& board, PieceLists* pieces = nullptr) const noexcept;
+
+private:
+        Move move_;
+};
+
+struct CastlingRights {
+        bool light_kingside;
+        bool light_queenside;
+        bool dark_kingside;
+        bool dark_queenside;
+};
+
+// Everything needed to start a game from some position, as described by FEN.
+struct Setup {
+        Board board;
+        Side on_turn;
+        CastlingRights castling_rights;
+        std::optional<Position> en_passant_position;
+        int halfmove_clock;
+        int fullmove_number;
+};
+
+Setup default_setup() noexcept;
+
+// The moves of a game as a tree of variations. Making a move after taking
+// some back starts a new variation next to the old one rather than
+// replacing it. Redoing follows the selected variation at every position,
+// the line through those is the one undo, redo and seek move along.
 class MoveHistory {
 public:
+        MoveHistory();
+        // Pieces that can't castle any more are treated as moved.
+        explicit MoveHistory(Setup const& setup);
+
+        // Goes to the move's position, adding it as the last variation if
+        // it wasn't played here before.
         void add_move(Move move, Piece eaten_piece);
         void add_castling_move(CastlingMove castling_move);
-        bool undo_move(Board& board) noexcept;
-        bool redo_move(Board& board) noexcept;
+        void add_en_passant_move(EnPassantMove en_passant_move);
+        // The bulk path for moves checked before, like those of archived
+        // games: makes the move on the board and adds it, telling castling
+        // and en passant apart by the board, if it fits there (see fits).
+        // The rules aren't looked at.
+        bool append_move(Board& board, Side side, Move move, PieceLists* pieces = nullptr);
+        bool undo_move(Board& board, PieceLists* pieces = nullptr) noexcept;
+        bool redo_move(Board& board, PieceLists* pieces = nullptr) noexcept;
+
+        // Where the tree stood in a position, so that a move tried from
+        // there can be forgotten again.
+        struct Mark {
+                int nodes;
+                int selected_child;
+        };
+
+        Mark mark() const noexcept;
+        // Undoes the move to the current position and leaves the tree as
+        // mark, taken before the move was added, found it: the node is
+        // removed if the move added it and the variation selected then is
+        // selected again. Moves tried after it must be forgotten first, and
+        // no checkpoint is taken, so forgetting never allocates.
+        void forget_move(Board& board, Mark mark, PieceLists* pieces = nullptr) noexcept;
+        // Goes to the position after the first ply moves of the line, from
+        // the board at the nearest checkpoint or from the current one,
+        // whichever takes fewer steps. False if the line is shorter.
+        bool seek(Board& board, int ply, PieceLists* pieces = nullptr) noexcept;
+        // Keeps a copy of the board if the current ply is one that seek can
+        // start from. undo_move, redo_move and seek do this by themselves,
+        // whoever adds moves should call it after each. Past
+        // max_checkpoints a copy makes room, see checkpoint_to_replace.
+        void checkpoint(Board const& board) noexcept;
+        // Whether seek can start from a copy of the board at that ply of
+        // the line.
+        bool has_checkpoint(int ply) const noexcept;
         bool piece_was_moved(Position piece_position) const noexcept;
+        std::optional<Position> en_passant_position(Board const& board) const noexcept;
+        // Moves since the last capture or pawn move.
+        int halfmove_clock(Board const& board) const noexcept;
+        int plies() const noexcept;
+        // The plies of the line, up to where redoing stops.
+        int line_plies() const noexcept;
+        // The squares the move to the current position changed. Returns
+        // how many there are.
+        int changed_squares(std::array<Position, 4>& squares) const noexcept;
+
+        // Moves played from the current position, the main one first.
+        int variations() const noexcept;
+        // Makes redo follow another of them. False if there is no such one.
+        bool select_variation(int index) noexcept;
+        // Makes the line up to the current position the main one, first
+        // among its siblings at every move.
+        void promote_line() noexcept;
+
+        // Appends a compact image of the whole tree, the selected
+        // variations and the cursor included.
+        void serialize(std::vector<unsigned char>& out) const;
+        // Replaces the history in one go, without checking the moves against
+        // the rules. Returns how many bytes were read, or 0 if the data is
+        // damaged, in which case the history is left as it was.
+        std::size_t deserialize(unsigned char const* data, std::size_t size);
+        // Whether the moves fit board, the board of the current position:
+        // the line leads back from it to a first position where the sides
+        // take turns from first_on_turn, every move of the tree moves a
+        // piece of the side on turn and takes what is there, and the line
+        // leads to board again. The rules aren't looked at, this only
+        // makes sure undo and redo keep boards and piece lists sound.
+        bool fits(Board const& board, Side first_on_turn) const noexcept;
 
 private:
         struct NormalMove {
@@ -96,52 +336,241 @@ private:
                 Piece eaten_piece;
         };
 
-        using Action = std::variant<NormalMove, CastlingMove>;
-        using Actions = std::vector<Action>;
+        using Action = std::variant<NormalMove, CastlingMove, EnPassantMove>;
+        // A board at four bits per square.
+        using CompactBoard = std::array<std::uint8_t, board_size * board_size / 2>;
+
+        // The position after a move. Nodes live in one array and link to
+        // each other by index, so copies of the history stay valid and
+        // nothing is ever freed one by one.
+        struct Node {
+                // Unused in the root, which stands for the first position.
+                Action action;
+                int parent = -1;
+                int first_child = -1;
+                int last_child = -1;
+                int previous_sibling = -1;
+                int next_sibling = -1;
+                int selected_child = -1;
+                int ply = 0;
+                // Into checkpoints_, -1 for none.
+                int checkpoint = -1;
+        };
 
-        void add_action(Action action);
+        struct Checkpoint {
+                CompactBoard board;
+                // The node it was taken at.
+                int node;
+        };
+
+        // Plies between checkpoints, so seek replays at most this many
+        // moves less one.
+        static int constexpr checkpoint_interval = 16;
+        // Room for the checkpoints is reserved up front and when moves are
+        // added, so that taking one never allocates. A copied history has
+        // none until then, and replaces checkpoints instead.
+        static std::size_t constexpr max_checkpoints = 64;
 
-        Actions actions_;
-        Actions::const_iterator last_action_ = actions_.cend();
+        void add_action(Action action);
+        void append_child(int parent, Action action);
+        void unlink(int node) noexcept;
+        std::size_t checkpoint_to_replace() const noexcept;
+        static void undo_action(Board& board, Action const& action,
+                                PieceLists* pieces = nullptr) noexcept;
+        static void redo_action(Board& board, Action const& action,
+                                PieceLists* pieces = nullptr) noexcept;
+        static bool action_fits(Board const& board, Action const& action, Side side) noexcept;
+
+        std::vector<Node> nodes_ = std::vector<Node>(1);
+        // The node of the current position.
+        int current_ = 0;
+        std::vector<Checkpoint> checkpoints_;
+        // The checkpoint to give up next once all of them are on the line.
+        std::size_t oldest_checkpoint_ = 0;
+        std::uint64_t initially_moved_ = 0;
+        std::optional<Position> initial_en_passant_position_;
+        int initial_halfmove_clock_ = 0;
 };
 
 struct RulesWrapper;
 using Rule = std::function<bool(Side on_turn, Board const& board,
                                 RulesWrapper rules_wrapper,
                                 MoveHistory const& move_history, Move move)>;
+// A view of the rules with some of them left out, so that rules can
+// consult the others without copying them.
 struct RulesWrapper {
         RulesWrapper(std::vector<Rule> const& rules)
                 : rules(rules)
-        {}
+        {
+                assert(rules.size() <= 32);
+        }
+
+        RulesWrapper without(std::size_t index) const noexcept
+        {
+                RulesWrapper result = *this;
+                result.excluded |= std::uint32_t(1) << index;
+                return result;
+        }
+
+        bool excludes(std::size_t index) const noexcept
+        {
+                return excluded & (std::uint32_t(1) << index);
+        }
 
         std::vector<Rule> const& rules;
+        std::uint32_t excluded = 0;
 };
 
 Board default_starting_board() noexcept;
 std::vector<Rule> default_rules();
 
+// Rules never change once a game uses them, so any number of games can
+// share one set instead of each holding copies of the closures.
+using RuleSet = std::shared_ptr<std::vector<Rule> const>;
+
+RuleSet make_rule_set(std::vector<Rule> rules);
+// The default rules, built on first use and shared by every game that
+// isn't given a set of its own.
+RuleSet const& standard_rules();
+
+// Called with Side::none when the game ends in a draw.
 using GameOver = void (*)(Side winner);
 
+// Why a game is over. The last two are draws a player claimed.
+enum class Ending {
+        none,
+        checkmate,
+        stalemate,
+        fivefold_repetition,
+        seventy_five_move_rule,
+        threefold_repetition,
+        fifty_move_rule
+};
+
 class Game {
 public:
-        explicit Game(GameOver game_over) noexcept;
-
+        explicit Game(GameOver game_over, RuleSet rules = standard_rules()) noexcept;
+        Game(GameOver game_over, Setup const& setup,
+             RuleSet rules = standard_rules()) noexcept;
+
+        bool is_legal(Move move) const noexcept;
+        // Bit y * board_size + x is set for each square (x, y) the piece at
+        // from can legally move to. Castling shows from both the king and
+        // the rook.
+        std::uint64_t legal_destinations(Position from) const noexcept;
         bool try_move(Move move);
+        // Plays moves checked before, like those of archived games, without
+        // asking the rules about each: only whether it fits the board, see
+        // MoveHistory::append_move, and whether the game is over at the
+        // end. Stops at the first move that doesn't fit and returns false.
+        bool append_moves(std::vector<Move> const& moves);
         void undo_move();
         void redo_move();
+
+        // Legal destinations by origin square, see legal_destinations.
+        using DestinationMasks = std::array<std::uint64_t, board_size * board_size>;
+
+        // What unmake_move needs to take back a move of make_move. The
+        // legal moves before it are kept here, on the search's stack, so
+        // that unmaking costs no move generation.
+        struct TriedMove {
+                MoveHistory::Mark history;
+                DestinationMasks destinations;
+        };
+
+        // For search: plays a legal move like try_move, but without telling
+        // game_over, and unmake_move takes it back again leaving the
+        // history as if it was never played. Moves made after it must be
+        // unmade first. Neither allocates once the history has grown
+        // to the depth looked at.
+        bool make_move(Move move, TriedMove& tried);
+        void unmake_move(TriedMove const& tried);
+        // Undoes or redoes moves until ply moves of the line are made.
+        // False if the line is shorter.
+        bool seek(int ply);
+        // Moves tried from the current position, the main one first, and
+        // the one to redo along. See MoveHistory.
+        int variations() const noexcept;
+        bool select_variation(int index);
+        void promote_line() noexcept;
         Side on_turn() const noexcept;
         Board board() const noexcept;
+        MoveList valid_moves() const noexcept;
+        bool in_check() const noexcept;
+        Setup setup() const noexcept;
+        void set_game_over(GameOver game_over) noexcept;
+        RuleSet const& rules() const noexcept;
+
+        // The Zobrist key of the position, kept up to date move by move.
+        std::uint64_t key() const noexcept;
+        // Moves since the last capture or pawn move.
+        int halfmove_clock() const noexcept;
+        // How often the position occurred before. Only the positions since
+        // the last capture or pawn move with the same side on turn are
+        // looked at, since no earlier one can come back.
+        int repetitions() const noexcept;
+        // Threefold repetition or fifty moves without a capture or a pawn
+        // move, which let either player claim a draw. The game goes on
+        // until one does, or until fivefold repetition or seventy-five
+        // moves end it by themselves.
+        bool is_draw() const noexcept;
+        // Ends the game in a draw if is_draw, calling game_over about it.
+        bool claim_draw();
+        // Once the game is over, the side that checkmated, or Side::none
+        // for a draw.
+        Side winner() const noexcept;
+        Ending ending() const noexcept;
+
+        // The board and the history, for checkpointing live games. Loading
+        // keeps the game over callback and the rules, and rejects histories
+        // that don't fit the board, see MoveHistory::fits.
+        void serialize(std::vector<unsigned char>& out) const;
+        std::size_t deserialize(unsigned char const* data, std::size_t size);
 
 private:
+        // What the draw rules need to know about each position of the game.
+        struct Ply {
+                std::uint64_t key;
+                int halfmove_clock;
+                // One bit per right, in the order of CastlingRights.
+                unsigned castling_rights;
+                // -1 unless an en passant capture is possible.
+                int en_passant_file;
+        };
+
         void toggle_turn() noexcept;
+        DestinationMasks const& destination_masks() const noexcept;
+        void fill_destinations() noexcept;
+        // No legal move in the current position.
+        bool is_stuck() const noexcept;
+        // Works the legal moves out for a new position and whether it ends
+        // the game, calling game_over about it if report is set. Only
+        // checkmate, stalemate, fivefold repetition and seventy-five moves
+        // do; the other draws wait for claim_draw.
+        void update_over(bool report);
+        void push_ply(Board const& before);
+        void reset_plies();
+        void play(Move move);
         void castling(Move move) noexcept;
+        void en_passant(Move move) noexcept;
         void normal_move(Move move) noexcept;
 
         GameOver game_over_;
         Board board_ = default_starting_board();
-        std::vector<Rule> rules_ = default_rules();
+        PieceLists pieces_ {board_};
+        RuleSet rules_;
         MoveHistory move_history_;
+        // From the first position along the line, as far as it was played
+        // or redone, so the current one is at move_history_.plies().
+        std::vector<Ply> plies_;
+        // The legal moves of the current position, worked out whenever the
+        // position changes so that reading a game never writes to it.
+        DestinationMasks destinations_ {};
         Side on_turn_ = Side::light;
+        bool over_ = false;
+        Side winner_ = Side::none;
+        Side first_on_turn_ = Side::light;
+        int first_fullmove_number_ = 1;
 };
 
 }
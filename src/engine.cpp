@@ -0,0 +1,336 @@
+#include "engine.h"
+#include "tablebase.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace Chess {
+
+namespace {
+
+int piece_value(Piece::Kind kind) noexcept
+{
+        switch (kind) {
+                case Piece::Kind::pawn: return 100;
+                case Piece::Kind::knight: return 320;
+                case Piece::Kind::bishop: return 330;
+                case Piece::Kind::rook: return 500;
+                case Piece::Kind::queen: return 900;
+                default: return 0;
+        }
+}
+
+// From 0 in the corners to 12 in the middle of the board.
+int centralization(Position pos) noexcept
+{
+        return 14 - std::abs(2 * pos.x - 7) - std::abs(2 * pos.y - 7);
+}
+
+int positional_value(Piece piece, Position pos) noexcept
+{
+        switch (piece.kind) {
+                case Piece::Kind::pawn: {
+                        int const advance = (piece.side == Side::light) ?
+                                board_size - 2 - pos.y : pos.y - 1;
+                        return 6 * advance + ((pos.x == 3 || pos.x == 4) ? 10 : 0);
+                }
+                case Piece::Kind::knight: return 3 * centralization(pos);
+                case Piece::Kind::bishop: return 2 * centralization(pos);
+                case Piece::Kind::queen: return centralization(pos);
+                default: return 0;
+        }
+}
+
+bool is_capture(Board const& board, Move move) noexcept
+{
+        Piece const src = board[move.from.y][move.from.x];
+        Piece const dst = board[move.to.y][move.to.x];
+        return (dst != Piece::none() && dst.side != src.side) ||
+               (src.kind == Piece::Kind::pawn && move.from.x != move.to.x);
+}
+
+// Most valuable victim first, least valuable attacker among equal victims.
+int capture_order(Board const& board, Move move) noexcept
+{
+        if (!is_capture(board, move))
+                return move.promotion == Piece::Kind::none ? 0 : piece_value(move.promotion);
+        Piece const dst = board[move.to.y][move.to.x];
+        int const victim = (dst == Piece::none()) ? piece_value(Piece::Kind::pawn) :
+                                                    piece_value(dst.kind);
+        int const attacker = piece_value(board[move.from.y][move.from.x].kind);
+        return 10 * victim - attacker + piece_value(move.promotion);
+}
+
+std::uint64_t count_leaves(Game& game, int depth, std::atomic<bool> const* stop)
+{
+        MoveList const moves = game.valid_moves();
+        if (depth <= 1)
+                return moves.size();
+        std::uint64_t nodes = 0;
+        for (Move move : moves) {
+                if (stop && stop->load(std::memory_order_relaxed))
+                        break;
+                Game::TriedMove tried;
+                game.make_move(move, tried);
+                nodes += count_leaves(game, depth - 1, stop);
+                game.unmake_move(tried);
+        }
+        return nodes;
+}
+
+}
+
+int evaluate(Board const& board, Side on_turn) noexcept
+{
+        int score = 0;
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        Piece const piece = board[y][x];
+                        if (piece == Piece::none())
+                                continue;
+                        int const value = piece_value(piece.kind) +
+                                          positional_value(piece, Position {x, y});
+                        score += (piece.side == on_turn) ? value : -value;
+                }
+        }
+        return score;
+}
+
+std::uint64_t perft(Game game, int depth, std::atomic<bool> const* stop)
+{
+        if (depth <= 0)
+                return 1;
+        game.set_game_over(nullptr);
+        return count_leaves(game, depth, stop);
+}
+
+Search::Search(Game const& game)
+        : game_(game)
+{
+        game_.set_game_over(nullptr);
+}
+
+std::optional<Move> Search::run(SearchLimits limits, SearchReport const& report)
+{
+        // Cleared on the way out rather than here, so that a stop sent
+        // before the worker thread gets this far is not lost.
+        struct Reset {
+                Search& search;
+                ~Reset()
+                {
+                        search.stopped_ = false;
+                        search.deadline_ = 0;
+                }
+        } const reset {*this};
+
+        limits_ = limits;
+        start_ = Clock::now();
+        nodes_ = 0;
+        if (limits_.time.count() > 0)
+                set_time_limit(limits_.time);
+
+        MoveList const root_moves = game_.valid_moves();
+        if (root_moves.empty())
+                return std::nullopt;
+
+        // Something to play even if stopped right away.
+        std::optional<Move> best_move = root_moves[0];
+        int const max_depth = (limits_.depth > 0) ?
+                std::min(limits_.depth, max_search_depth - 1) : max_search_depth - 1;
+        for (int depth = 1; depth <= max_depth; ++depth) {
+                int const score = negamax(depth, 0, -mate_score - 1, mate_score + 1);
+                if (stopped_)
+                        break;
+
+                previous_pv_.clear();
+                for (int i = 0; i < pv_length_[0]; ++i)
+                        previous_pv_.push_back(pv_[0][i]);
+                best_move = previous_pv_[0];
+                if (report)
+                        report(SearchInfo {depth, score, nodes_, elapsed(), previous_pv_});
+                if (std::abs(score) >= mate_score - max_search_depth)
+                        break;
+        }
+        return best_move;
+}
+
+void Search::stop() noexcept
+{
+        stopped_ = true;
+}
+
+void Search::set_time_limit(std::chrono::milliseconds time) noexcept
+{
+        auto const deadline = Clock::now() + time;
+        deadline_ = deadline.time_since_epoch().count();
+}
+
+void Search::set_tablebase(Tablebase const* tablebase) noexcept
+{
+        tablebase_ = tablebase;
+}
+
+// Wins closer to the root score higher. Cursed wins are draws, the
+// fifty-move rule gets in their way.
+std::optional<int> Search::probe_tablebase(int ply)
+{
+        if (!tablebase_)
+                return std::nullopt;
+        Board const board = game_.board();
+        int pieces = 0;
+        for (auto const& row : board) {
+                pieces += static_cast<int>(std::count_if(row.cbegin(), row.cend(),
+                        [](Piece piece)
+                        {
+                                return piece != Piece::none();
+                        }
+                ));
+        }
+        if (pieces > tablebase_->max_pieces())
+                return std::nullopt;
+
+        std::optional const wdl = tablebase_->probe_wdl(game_);
+        if (!wdl)
+                return std::nullopt;
+        switch (*wdl) {
+                case Wdl::win:
+                        return tablebase_win_score - ply;
+                case Wdl::loss:
+                        return -tablebase_win_score + ply;
+                default:
+                        return 0;
+        }
+}
+
+int Search::negamax(int depth, int ply, int alpha, int beta)
+{
+        pv_length_[ply] = ply;
+        if (should_stop())
+                return 0;
+        ++nodes_;
+
+        // Draws that can be claimed are taken. A single repetition already
+        // scores as one, whatever can be done from the position could have
+        // been done the first time.
+        if (ply > 0 && (game_.is_draw() || game_.repetitions() > 0))
+                return 0;
+
+        MoveList moves = game_.valid_moves();
+        if (moves.empty())
+                return game_.in_check() ? -mate_score + ply : 0;
+        if (ply > 0) {
+                if (std::optional const score = probe_tablebase(ply))
+                        return *score;
+        }
+        if (depth <= 0 || ply >= max_search_depth - 1)
+                return quiescence(ply, alpha, beta);
+
+        order_moves(moves, ply);
+        for (Move move : moves) {
+                Game::TriedMove tried;
+                game_.make_move(move, tried);
+                int const score = -negamax(depth - 1, ply + 1, -beta, -alpha);
+                game_.unmake_move(tried);
+                if (stopped_)
+                        return 0;
+                if (score >= beta)
+                        return score;
+                if (score > alpha) {
+                        alpha = score;
+                        pv_[ply][ply] = move;
+                        for (int i = ply + 1; i < pv_length_[ply + 1]; ++i)
+                                pv_[ply][i] = pv_[ply + 1][i];
+                        pv_length_[ply] = std::max(pv_length_[ply + 1], ply + 1);
+                }
+        }
+        return alpha;
+}
+
+int Search::quiescence(int ply, int alpha, int beta)
+{
+        pv_length_[ply] = ply;
+        if (should_stop())
+                return 0;
+        ++nodes_;
+
+        // Draws that can be claimed are taken. A single repetition already
+        // scores as one, whatever can be done from the position could have
+        // been done the first time.
+        if (ply > 0 && (game_.is_draw() || game_.repetitions() > 0))
+                return 0;
+
+        MoveList moves = game_.valid_moves();
+        if (moves.empty())
+                return game_.in_check() ? -mate_score + ply : 0;
+
+        Board const board = game_.board();
+        int const stand_pat = evaluate(board, game_.on_turn());
+        if (stand_pat >= beta || ply >= max_search_depth - 1)
+                return stand_pat;
+        alpha = std::max(alpha, stand_pat);
+
+        for (int i = 0; i < moves.size();) {
+                if (is_capture(board, moves[i]))
+                        ++i;
+                else
+                        moves.swap_remove(i);
+        }
+        order_moves(moves, ply);
+        for (Move move : moves) {
+                Game::TriedMove tried;
+                game_.make_move(move, tried);
+                int const score = -quiescence(ply + 1, -beta, -alpha);
+                game_.unmake_move(tried);
+                if (stopped_)
+                        return 0;
+                if (score >= beta)
+                        return score;
+                if (score > alpha) {
+                        alpha = score;
+                        pv_[ply][ply] = move;
+                        for (int i = ply + 1; i < pv_length_[ply + 1]; ++i)
+                                pv_[ply][i] = pv_[ply + 1][i];
+                        pv_length_[ply] = std::max(pv_length_[ply + 1], ply + 1);
+                }
+        }
+        return alpha;
+}
+
+// The move the previous iteration found at this ply goes first, then
+// captures and promotions.
+void Search::order_moves(MoveList& moves, int ply) const
+{
+        Board const board = game_.board();
+        std::optional<Move> const pv_move = (ply < previous_pv_.size()) ?
+                std::optional(previous_pv_[ply]) : std::nullopt;
+        auto const order =
+        [&](Move move) noexcept
+        {
+                return (move == pv_move) ? mate_score : capture_order(board, move);
+        };
+
+        moves.partial_sort(moves.size(),
+                [&](Move m1, Move m2) noexcept
+                {
+                        return order(m1) > order(m2);
+                }
+        );
+}
+
+bool Search::should_stop() noexcept
+{
+        if (stopped_)
+                return true;
+        auto const deadline = deadline_.load();
+        if ((limits_.nodes != 0 && nodes_ >= limits_.nodes) ||
+            (deadline != 0 && Clock::now().time_since_epoch().count() >= deadline)) {
+                stopped_ = true;
+        }
+        return stopped_;
+}
+
+std::chrono::milliseconds Search::elapsed() const noexcept
+{
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_);
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "chess.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+namespace Chess {
+
+int constexpr max_search_depth = 64;
+int constexpr mate_score = 100000;
+// Below any mate score, so mates found by search are still preferred.
+int constexpr tablebase_win_score = mate_score - 2 * max_search_depth;
+
+class Tablebase;
+
+// Zero means no limit.
+struct SearchLimits {
+        int depth = 0;
+        std::uint64_t nodes = 0;
+        std::chrono::milliseconds time {0};
+};
+
+struct SearchInfo {
+        int depth;
+        int score;
+        std::uint64_t nodes;
+        std::chrono::milliseconds time;
+        MoveList principal_variation;
+};
+
+using SearchReport = std::function<void(SearchInfo const& info)>;
+
+// Positive scores are good for the side on turn.
+int evaluate(Board const& board, Side on_turn) noexcept;
+
+// Counts the leaf nodes of the legal move tree. Setting stop from another
+// thread ends the count early, with only part of the tree counted.
+std::uint64_t perft(Game game, int depth, std::atomic<bool> const* stop = nullptr);
+
+// Iterative deepening alpha-beta search. stop and set_time_limit may be
+// called from other threads while run is in progress. A stop or a time
+// limit set before run applies to it, and run clears both when it returns,
+// so that a search can be run again.
+class Search {
+public:
+        explicit Search(Game const& game);
+
+        std::optional<Move> run(SearchLimits limits, SearchReport const& report);
+        void stop() noexcept;
+        void set_time_limit(std::chrono::milliseconds time) noexcept;
+        // Positions in the tables aren't searched any further.
+        void set_tablebase(Tablebase const* tablebase) noexcept;
+
+private:
+        using Clock = std::chrono::steady_clock;
+
+        int negamax(int depth, int ply, int alpha, int beta);
+        int quiescence(int ply, int alpha, int beta);
+        void order_moves(MoveList& moves, int ply) const;
+        std::optional<int> probe_tablebase(int ply);
+        bool should_stop() noexcept;
+        std::chrono::milliseconds elapsed() const noexcept;
+
+        Game game_;
+        SearchLimits limits_;
+        Clock::time_point start_;
+        std::atomic<bool> stopped_ {false};
+        // Time since the clock's epoch, zero if there is no deadline.
+        std::atomic<Clock::rep> deadline_ {0};
+        std::uint64_t nodes_ = 0;
+        std::array<std::array<Move, max_search_depth>, max_search_depth> pv_;
+        std::array<int, max_search_depth> pv_length_;
+        MoveList previous_pv_;
+        Tablebase const* tablebase_ = nullptr;
+};
+
+}
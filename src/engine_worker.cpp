@@ -0,0 +1,86 @@
+#include "engine_worker.h"
+
+namespace Chess {
+
+EngineWorker::EngineWorker(SearchLimits limits, Wake wake)
+        : limits_(limits)
+        , wake_(std::move(wake))
+        , thread_([this] { run(); })
+{}
+
+EngineWorker::~EngineWorker()
+{
+        {
+                std::lock_guard lock(mutex_);
+                stopping_ = true;
+                if (search_)
+                        search_->stop();
+                changed_.notify_one();
+        }
+        thread_.join();
+}
+
+std::uint64_t EngineWorker::analyze(std::shared_ptr<Game const> position)
+{
+        std::lock_guard lock(mutex_);
+        next_ = std::move(position);
+        if (search_)
+                search_->stop();
+        changed_.notify_one();
+        return ++serial_;
+}
+
+std::optional<EngineUpdate> EngineWorker::poll()
+{
+        return updates_.try_pop();
+}
+
+void EngineWorker::run()
+{
+        while (true) {
+                std::shared_ptr<Game const> position;
+                std::uint64_t serial = 0;
+                {
+                        std::unique_lock lock(mutex_);
+                        changed_.wait(lock, [this] { return next_ || stopping_; });
+                        if (stopping_)
+                                return;
+                        position = std::move(next_);
+                        serial = serial_;
+                }
+
+                Search search(*position);
+                {
+                        std::lock_guard lock(mutex_);
+                        // Replaced before it started.
+                        if (next_ || stopping_)
+                                continue;
+                        search_ = &search;
+                }
+                search.run(limits_, [&](SearchInfo const& info)
+                {
+                        if (info.principal_variation.empty())
+                                return;
+                        updates_.try_push(EngineUpdate {
+                                .position = serial,
+                                .best_move = info.principal_variation[0],
+                                .score = info.score,
+                                .depth = info.depth,
+                                .nodes = info.nodes
+                        });
+                        if (wake_)
+                                wake_();
+                });
+                std::lock_guard lock(mutex_);
+                search_ = nullptr;
+        }
+}
+
+std::shared_ptr<Game const> snapshot(Game const& game)
+{
+        auto copy = std::make_shared<Game>(game);
+        copy->set_game_over(nullptr);
+        return copy;
+}
+
+}
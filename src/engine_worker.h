@@ -0,0 +1,67 @@
+#pragma once
+
+#include "engine.h"
+#include "spsc_queue.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace Chess {
+
+struct EngineUpdate {
+        // Which call to analyze it is about.
+        std::uint64_t position;
+        Move best_move;
+        // From the point of view of the side on turn.
+        int score;
+        int depth;
+        std::uint64_t nodes;
+};
+
+// Analyzes positions on a thread of its own, for a user interface that has
+// to keep drawing while the engine thinks. Positions come in as snapshots
+// the worker only reads, and updates go out through a queue that neither
+// side ever waits on.
+class EngineWorker {
+public:
+        // Called on the worker's thread after every update, so the interface
+        // can wake up and poll.
+        using Wake = std::function<void()>;
+
+        explicit EngineWorker(SearchLimits limits, Wake wake = {});
+        ~EngineWorker();
+        EngineWorker(EngineWorker const&) = delete;
+        EngineWorker& operator=(EngineWorker const&) = delete;
+
+        // Drops the position being analyzed for this one and returns the
+        // number its updates carry. Null just stops.
+        std::uint64_t analyze(std::shared_ptr<Game const> position);
+        // Only from one thread, the one analyze is called from.
+        std::optional<EngineUpdate> poll();
+
+private:
+        void run();
+
+        SearchLimits limits_;
+        Wake wake_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::shared_ptr<Game const> next_;
+        std::uint64_t serial_ = 0;
+        bool stopping_ = false;
+        // The search in progress, so analyze can stop it.
+        Search* search_ = nullptr;
+        // Updates beyond the capacity are dropped until the interface polls.
+        SpscQueue<EngineUpdate, 64> updates_;
+        // Last, so it starts once everything else is there.
+        std::thread thread_;
+};
+
+// A copy of the game that doesn't report the end of the game to anyone.
+std::shared_ptr<Game const> snapshot(Game const& game);
+
+}
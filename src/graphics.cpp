@@ -1,5 +1,6 @@
 #include "graphics.h"
 #include <cassert>
+#include <vector>
 
 namespace Chess {
 
@@ -56,24 +57,19 @@ void draw_field(Sdl::Renderer& renderer, Position pos, Sdl::Color color)
         Sdl::render_rect(renderer, field_dst_rect(pos), color);
 }
 
-void draw_background(Sdl::Renderer& renderer, Position pos)
+bool is_light_field(Position pos) noexcept
 {
-        Sdl::Color constexpr light {.r = 0xD1, .g = 0x8B, .b = 0x47, .a = 0xFF};
-        Sdl::Color constexpr dark {.r = 0xFF, .g = 0xCE, .b = 0x9E, .a = 0xFF};
-        auto const color = ((pos.x + pos.y) % 2 == 0) ? light : dark;
-        draw_field(renderer, pos, color);
+        return (pos.x + pos.y) % 2 == 0;
 }
 
-void draw_piece(Sdl::Renderer& renderer,
-                Sdl::Texture& pieces,
-                Piece piece,
-                Position pos)
+Sdl::Rect whole_board() noexcept
 {
-        if (piece != Piece::none()) {
-                Sdl::Rect const src = field_src_rect(piece);
-                Sdl::Rect const dst = field_dst_rect(pos);
-                Sdl::render_copy(renderer, pieces, src, dst);
-        }
+        return Sdl::Rect {
+                .x = 0,
+                .y = 0,
+                .w = field_width * board_size,
+                .h = field_height * board_size
+        };
 }
 
 }
@@ -110,17 +106,97 @@ void draw_piece_selector(Sdl::Renderer& renderer, PieceSelector selector, Side o
         draw_selected_position();
 }
 
-void draw_board(Sdl::Renderer& renderer, Sdl::Texture& pieces, Board const& board)
+void draw_legal_destinations(Sdl::Renderer& renderer, std::uint64_t destinations)
+{
+        Sdl::Color constexpr transparent_green {
+                .r = 0x00, .g = 0xC0, .b = 0x00, .a = 0x40
+        };
+        std::vector<Sdl::Rect> fields;
+        for (int i = 0; i < board_size * board_size; ++i) {
+                if (destinations >> i & 1)
+                        fields.push_back(field_dst_rect(Position {i % board_size, i / board_size}));
+        }
+        Sdl::render_rects(renderer, fields, transparent_green);
+}
+
+void draw_engine_hint(Sdl::Renderer& renderer, Move move)
 {
+        Sdl::Color constexpr transparent_blue {
+                .r = 0x00, .g = 0x60, .b = 0xFF, .a = 0x40
+        };
+        Sdl::render_rects(renderer, {field_dst_rect(move.from), field_dst_rect(move.to)},
+                          transparent_blue);
+}
+
+BoardRenderer::BoardRenderer(Sdl::Renderer& renderer, Sdl::Texture& pieces, BoardTheme theme)
+        : renderer_(renderer)
+        , pieces_(pieces)
+        , theme_(theme)
+        , background_(Sdl::create_target_texture(renderer,
+                                                 field_width * board_size,
+                                                 field_height * board_size))
+        , cache_(Sdl::create_target_texture(renderer,
+                                            field_width * board_size,
+                                            field_height * board_size))
+{}
+
+void BoardRenderer::draw(Board const& board)
+{
+        if (!background_drawn_)
+                draw_background();
+
+        {
+                // Grouped so the changed squares take two draw calls.
+                std::vector<Sdl::Copy> field_copies;
+                std::vector<Sdl::Copy> piece_copies;
+                for (int x = 0; x < board_size; ++x) {
+                        for (int y = 0; y < board_size; ++y) {
+                                auto const piece = board[y][x];
+                                if (drawn_ && (*drawn_)[y][x] == piece)
+                                        continue;
+                                Sdl::Rect const dst = field_dst_rect(Position {x, y});
+                                field_copies.push_back({dst, dst});
+                                if (piece != Piece::none())
+                                        piece_copies.push_back({field_src_rect(piece), dst});
+                        }
+                }
+
+                Sdl::RenderTargetGuard _(renderer_, *cache_);
+                Sdl::render_copies(renderer_, *background_, field_copies);
+                Sdl::render_copies(renderer_, pieces_, piece_copies);
+        }
+        drawn_ = board;
+
+        Sdl::render_copy(renderer_, *cache_, whole_board(), whole_board());
+}
+
+void BoardRenderer::set_theme(BoardTheme theme) noexcept
+{
+        theme_ = theme;
+        invalidate();
+}
+
+void BoardRenderer::invalidate() noexcept
+{
+        background_drawn_ = false;
+        drawn_.reset();
+}
+
+void BoardRenderer::draw_background()
+{
+        std::vector<Sdl::Rect> light_fields;
+        std::vector<Sdl::Rect> dark_fields;
         for (int x = 0; x < board_size; ++x) {
                 for (int y = 0; y < board_size; ++y) {
-                        auto const piece = board[y][x];
                         Position const pos {x, y};
-                        draw_background(renderer, pos);
-                        draw_piece(renderer, pieces, piece, pos);
+                        (is_light_field(pos) ? light_fields : dark_fields).push_back(field_dst_rect(pos));
                 }
         }
-}
 
+        Sdl::RenderTargetGuard _(renderer_, *background_);
+        Sdl::render_rects(renderer_, light_fields, theme_.light);
+        Sdl::render_rects(renderer_, dark_fields, theme_.dark);
+        background_drawn_ = true;
 }
 
+}
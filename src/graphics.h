@@ -3,6 +3,7 @@
 #include "ui.h"
 #include "sdl++.h"
 #include "chess.h"
+#include <optional>
 #include <unordered_map>
 
 namespace Chess {
@@ -11,7 +12,39 @@ int constexpr field_width = 60;
 int constexpr field_height = 60;
 
 void draw_piece_selector(Sdl::Renderer& renderer, PieceSelector selector, Side on_turn);
-void draw_board(Sdl::Renderer& renderer, Sdl::Texture& pieces, Board const& board);
+// Marks the squares set in a mask from Game::legal_destinations.
+void draw_legal_destinations(Sdl::Renderer& renderer, std::uint64_t destinations);
+// Marks the squares of the move the engine likes best.
+void draw_engine_hint(Sdl::Renderer& renderer, Move move);
 
-}
+struct BoardTheme {
+        Sdl::Color light {.r = 0xD1, .g = 0x8B, .b = 0x47, .a = 0xFF};
+        Sdl::Color dark {.r = 0xFF, .g = 0xCE, .b = 0x9E, .a = 0xFF};
+};
+
+// Keeps the drawn board in a texture, so a frame only redraws the squares
+// that changed since the last one and then copies the whole board at once.
+// The empty checkerboard is drawn once into a texture of its own, which
+// changed squares are copied back from.
+class BoardRenderer {
+public:
+        BoardRenderer(Sdl::Renderer& renderer, Sdl::Texture& pieces, BoardTheme theme = {});
+
+        void draw(Board const& board);
+        void set_theme(BoardTheme theme) noexcept;
+        // Redraws everything next time, for when the textures got lost.
+        void invalidate() noexcept;
 
+private:
+        void draw_background();
+
+        Sdl::Renderer& renderer_;
+        Sdl::Texture& pieces_;
+        BoardTheme theme_;
+        Sdl::UniqueTexture background_;
+        bool background_drawn_ = false;
+        Sdl::UniqueTexture cache_;
+        std::optional<Board> drawn_;
+};
+
+}
@@ -0,0 +1,211 @@
+#include "ingest.h"
+#include "notation.h"
+#include "pgn.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Chess {
+
+namespace {
+
+struct Batch {
+        std::size_t sequence;
+        std::size_t first_index;
+        // Views into the text, one per game.
+        std::vector<std::string_view> games;
+        std::vector<IngestResult> results;
+};
+
+IngestResult check_game(std::string_view text, std::size_t index, PgnGame& pgn_game)
+{
+        using namespace std::string_literals;
+
+        IngestResult result {index, 0, false, std::string(), std::string()};
+        PgnReader reader(text);
+        if (!reader.next(pgn_game)) {
+                result.error = "no game";
+                return result;
+        }
+
+        Replay const replayed = replay(pgn_game);
+        result.plies = replayed.plies;
+        result.valid = replayed.complete;
+        result.fen = to_fen(replayed.game.setup());
+        if (replayed.complete)
+                return result;
+
+        auto const fen = pgn_game.tag("FEN");
+        if (!fen.empty() && !parse_fen(fen)) {
+                result.error = "invalid FEN "s + std::string(fen);
+                result.fen.clear();
+        } else {
+                auto const move = pgn_game.main_line[static_cast<std::size_t>(replayed.plies)];
+                result.error = "illegal move "s + std::string(move) +
+                               " at ply "s + std::to_string(replayed.plies + 1);
+        }
+        return result;
+}
+
+// The splitter hands batches to the workers through pending_, and the
+// workers hand them back through done_, where the merger puts them in order.
+class Pipeline {
+public:
+        Pipeline(std::string_view text, IngestOptions const& options) noexcept
+                : text_(text)
+                , threads_(options.threads != 0 ?
+                           options.threads : std::max(std::thread::hardware_concurrency(), 1u))
+                , batch_size_(std::max<std::size_t>(options.batch_size, 1))
+                , max_in_flight_(options.max_batches_in_flight != 0 ?
+                                 options.max_batches_in_flight : 4 * threads_)
+        {}
+
+        void run(IngestSink const& sink)
+        {
+                std::vector<std::thread> workers;
+                workers.reserve(threads_);
+                for (unsigned i = 0; i < threads_; ++i)
+                        workers.emplace_back([this] { work(); });
+                std::thread splitter([this] { split(); });
+
+                auto const join = [&]
+                {
+                        splitter.join();
+                        for (std::thread& worker : workers)
+                                worker.join();
+                };
+                try {
+                        merge(sink);
+                } catch (...) {
+                        cancel();
+                        join();
+                        throw;
+                }
+                join();
+        }
+
+private:
+        void split()
+        {
+                PgnReader reader(text_);
+                PgnGame game;
+                std::size_t sequence = 0;
+                std::size_t index = 0;
+                bool more = true;
+                while (more) {
+                        Batch batch {sequence, index, {}, {}};
+                        batch.games.reserve(batch_size_);
+                        while (batch.games.size() < batch_size_ && (more = reader.next(game)))
+                                batch.games.push_back(game.text);
+                        index += batch.games.size();
+                        if (batch.games.empty())
+                                break;
+
+                        std::unique_lock lock(mutex_);
+                        space_.wait(lock, [this] { return in_flight_ < max_in_flight_ || cancelled_; });
+                        if (cancelled_)
+                                break;
+                        ++in_flight_;
+                        ++sequence;
+                        pending_.push_back(std::move(batch));
+                        work_.notify_one();
+                }
+
+                std::lock_guard lock(mutex_);
+                batches_ = sequence;
+                split_done_ = true;
+                work_.notify_all();
+                done_ready_.notify_all();
+        }
+
+        void work()
+        {
+                PgnGame pgn_game;
+                while (true) {
+                        Batch batch;
+                        {
+                                std::unique_lock lock(mutex_);
+                                work_.wait(lock, [this] { return !pending_.empty() || split_done_; });
+                                if (pending_.empty())
+                                        return;
+                                batch = std::move(pending_.front());
+                                pending_.pop_front();
+                        }
+
+                        batch.results.reserve(batch.games.size());
+                        for (std::size_t i = 0; i < batch.games.size(); ++i) {
+                                batch.results.push_back(
+                                        check_game(batch.games[i], batch.first_index + i, pgn_game)
+                                );
+                        }
+
+                        std::lock_guard lock(mutex_);
+                        done_.emplace(batch.sequence, std::move(batch));
+                        done_ready_.notify_one();
+                }
+        }
+
+        void merge(IngestSink const& sink)
+        {
+                std::size_t next = 0;
+                while (true) {
+                        Batch batch;
+                        {
+                                std::unique_lock lock(mutex_);
+                                done_ready_.wait(lock, [&]
+                                {
+                                        return (!done_.empty() && done_.begin()->first == next) ||
+                                               (split_done_ && next == batches_);
+                                });
+                                if (done_.empty() || done_.begin()->first != next)
+                                        return;
+                                batch = std::move(done_.begin()->second);
+                                done_.erase(done_.begin());
+                                --in_flight_;
+                                space_.notify_one();
+                        }
+
+                        ++next;
+                        for (IngestResult const& result : batch.results)
+                                sink(result);
+                }
+        }
+
+        // Stops the splitter once the sink throws. The workers finish what
+        // was already split.
+        void cancel() noexcept
+        {
+                std::lock_guard lock(mutex_);
+                cancelled_ = true;
+                space_.notify_all();
+        }
+
+        std::string_view text_;
+        unsigned threads_;
+        std::size_t batch_size_;
+        std::size_t max_in_flight_;
+
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable space_;
+        std::condition_variable done_ready_;
+        std::deque<Batch> pending_;
+        std::map<std::size_t, Batch> done_;
+        std::size_t in_flight_ = 0;
+        std::size_t batches_ = 0;
+        bool split_done_ = false;
+        bool cancelled_ = false;
+};
+
+}
+
+void ingest_pgn(std::string_view text, IngestOptions const& options, IngestSink const& sink)
+{
+        Pipeline(text, options).run(sink);
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace Chess {
+
+struct IngestResult {
+        // The game's position in the text, counting from zero.
+        std::size_t index;
+        // How many main line moves were played.
+        int plies;
+        bool valid;
+        // The position after the last move that was played.
+        std::string fen;
+        // Why the game is invalid, empty for valid games.
+        std::string error;
+};
+
+struct IngestOptions {
+        // Worker threads replaying games, zero for one per core.
+        unsigned threads = 0;
+        // How many games a worker takes at once.
+        std::size_t batch_size = 64;
+        // How many batches may be split but not yet handed out, which bounds
+        // the memory held by results waiting on a slower batch.
+        std::size_t max_batches_in_flight = 0;
+};
+
+using IngestSink = std::function<void(IngestResult const&)>;
+
+// Validates every game in a PGN text by replaying it. One thread splits the
+// text at game boundaries and a pool of workers, each with its own Game,
+// parses and replays batches of games. The sink is called on the calling
+// thread, once per game, in the order the games appear in the text.
+void ingest_pgn(std::string_view text, IngestOptions const& options, IngestSink const& sink);
+
+}
@@ -0,0 +1,53 @@
+#include "ingest.h"
+#include "mapped_file.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <system_error>
+
+// Usage: chess_ingest <file.pgn> [threads]
+// Prints one line per game: its index, "ok" and the final position, or
+// "invalid" and the reason, then a summary on stderr.
+int main(int argc, char** argv)
+{
+        using namespace Chess;
+
+        if (argc < 2) {
+                std::cerr << "usage: " << argv[0] << " <file.pgn> [threads]\n";
+                return 2;
+        }
+
+        IngestOptions options;
+        if (argc > 2)
+                options.threads = static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10));
+
+        try {
+                MappedFile const file(argv[1]);
+                file.advise_sequential();
+
+                std::size_t games = 0;
+                std::size_t invalid = 0;
+                auto const start = std::chrono::steady_clock::now();
+                ingest_pgn(file.text(), options,
+                        [&](IngestResult const& result)
+                        {
+                                ++games;
+                                std::cout << result.index << ' ';
+                                if (result.valid) {
+                                        std::cout << "ok " << result.fen << '\n';
+                                } else {
+                                        ++invalid;
+                                        std::cout << "invalid " << result.error << '\n';
+                                }
+                        }
+                );
+                std::chrono::duration<double> const elapsed =
+                        std::chrono::steady_clock::now() - start;
+                std::cerr << games << " games, " << invalid << " invalid, "
+                          << elapsed.count() << " s\n";
+                return invalid == 0 ? 0 : 1;
+        } catch (std::system_error const& error) {
+                std::cerr << argv[1] << ": " << error.what() << '\n';
+                return 2;
+        }
+}
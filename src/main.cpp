@@ -2,7 +2,11 @@
 #include "sdl++.h"
 #include "chess.h"
 #include "graphics.h"
-#include <cassert>
+#include "engine_worker.h"
+#include "notation.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 namespace {
@@ -10,19 +14,63 @@ namespace {
 unsigned constexpr window_width = Chess::field_width * Chess::board_size;
 unsigned constexpr window_height = Chess::field_height * Chess::board_size;
 
-template <class Redraw, class KeyDown>
-void main_loop(Redraw const& redraw, KeyDown const& key_down)
+// How long the loop sleeps at most when nothing happens.
+int constexpr idle_timeout = 250;
+
+std::string engine_title(Chess::Board const& board, Chess::EngineUpdate const& update)
+{
+        using namespace std::string_literals;
+
+        std::string score;
+        if (std::abs(update.score) < Chess::mate_score - Chess::max_search_depth) {
+                char pawns[16];
+                std::snprintf(pawns, sizeof pawns, "%+.2f", update.score / 100.);
+                score = pawns;
+        } else {
+                int const plies = Chess::mate_score - std::abs(update.score);
+                int const moves = (plies + 1) / 2;
+                score = "mate "s + std::to_string(update.score > 0 ? moves : -moves);
+        }
+        return "chess - depth "s + std::to_string(update.depth) + ", "s + score + ", "s +
+               Chess::to_uci(board, update.best_move);
+}
+
+// Sleeps until events arrive and redraws only after one of them changed
+// what is shown. key_down and wake_up return whether they did, targets_reset
+// is called when the renderer lost the contents of its target textures.
+template <class Redraw, class KeyDown, class TargetsReset, class WakeUp>
+void main_loop(Redraw const& redraw,
+               KeyDown const& key_down,
+               TargetsReset const& targets_reset,
+               WakeUp const& wake_up)
 {
         auto quit = false;
+        auto dirty = true;
         while (!quit) {
-                redraw();
-                while (std::optional<Sdl::Event> const event = Sdl::poll_event()) {
+                if (dirty) {
+                        redraw();
+                        dirty = false;
+                }
+                std::optional<Sdl::Event> event = Sdl::wait_event(idle_timeout);
+                // Everything that queued up is handled before the next frame.
+                for (; event && !quit; event = Sdl::poll_event()) {
                         switch (event->type) {
                                 case Sdl::Events::quit:
                                         quit = true;
                                         break;
                                 case Sdl::Events::key_down:
-                                        key_down(event->key.keysym.sym);
+                                        dirty = key_down(event->key.keysym.sym) || dirty;
+                                        break;
+                                case Sdl::Events::window:
+                                        // Exposed, resized or restored.
+                                        dirty = true;
+                                        break;
+                                case Sdl::Events::render_targets_reset:
+                                        targets_reset();
+                                        dirty = true;
+                                        break;
+                                case Sdl::Events::wake_up:
+                                        dirty = wake_up() || dirty;
                                         break;
                         }
                 }
@@ -49,20 +97,43 @@ int main(int, char**)
         [](Chess::Side winner)
         {
                 // FIXME What's up with message boxes?
-                assert(winner != Chess::Side::none);
-                std::string const winner_str = (winner == Chess::Side::light) ?
-                        "Light"s : "Dark"s;
-                Sdl::message_box("Game over"s, winner_str + " won."s);
-                std::cout << (winner_str + " won.\n"s);
+                std::string const result_str =
+                        (winner == Chess::Side::none) ? "Draw."s :
+                        (winner == Chess::Side::light) ? "Light won."s : "Dark won."s;
+                Sdl::message_box("Game over"s, result_str);
+                std::cout << (result_str + "\n"s);
         };
 
         Chess::Game game(game_over);
+        Chess::BoardRenderer board_renderer(*renderer, *pieces);
+
+        // Thinks about the position on the board while the loop keeps
+        // drawing. Updates about earlier positions are ignored.
+        Chess::EngineWorker engine(Chess::SearchLimits {.time = std::chrono::seconds(10)},
+                                   Sdl::push_wake_up);
+        std::uint64_t analyzed = 0;
+        std::optional<Chess::EngineUpdate> hint;
+        auto const game_changed =
+        [&]
+        {
+                bool const over = game.on_turn() == Chess::Side::none;
+                analyzed = engine.analyze(over ? nullptr : Chess::snapshot(game));
+                hint.reset();
+                Sdl::set_window_title(*window, "chess"s);
+        };
+        game_changed();
 
         auto const redraw =
         [&]
         {
                 Sdl::render_clear(*renderer);
-                Chess::draw_board(*renderer, *pieces, game.board());
+                board_renderer.draw(game.board());
+                if (hint)
+                        Chess::draw_engine_hint(*renderer, hint->best_move);
+                if (std::optional const selected = selector.selected_position()) {
+                        Chess::draw_legal_destinations(*renderer,
+                                                       game.legal_destinations(*selected));
+                }
                 Chess::draw_piece_selector(*renderer, selector, game.on_turn());
                 Sdl::render_present(*renderer);
         };
@@ -74,28 +145,49 @@ int main(int, char**)
                 switch (keycode) {
                         case Sdl::Keycodes::left:
                                 selector.move_left();
-                                break;
+                                return true;
                         case Sdl::Keycodes::right:
                                 selector.move_right();
-                                break;
+                                return true;
                         case Sdl::Keycodes::up:
                                 selector.move_up();
-                                break;
+                                return true;
                         case Sdl::Keycodes::down:
                                 selector.move_down();
-                                break;
+                                return true;
                         case Sdl::Keycodes::space:
-                                if (std::optional move = selector.select())
-                                        game.try_move(*move);
-                                break;
+                                if (std::optional move = selector.select()) {
+                                        if (game.try_move(*move))
+                                                game_changed();
+                                }
+                                return true;
                         case Sdl::Keycodes::u:
                                 game.undo_move();
-                                break;
+                                game_changed();
+                                return true;
                         case Sdl::Keycodes::r:
                                 game.redo_move();
-                                break;
+                                game_changed();
+                                return true;
+                        default:
+                                return false;
+                }
+        };
+
+        auto const wake_up =
+        [&]
+        {
+                auto changed = false;
+                while (std::optional const update = engine.poll()) {
+                        if (update->position != analyzed)
+                                continue;
+                        hint = update;
+                        changed = true;
                 }
+                if (changed)
+                        Sdl::set_window_title(*window, engine_title(game.board(), *hint));
+                return changed;
         };
 
-        main_loop(redraw, key_down);
+        main_loop(redraw, key_down, [&] { board_renderer.invalidate(); }, wake_up);
 }
@@ -0,0 +1,85 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Chess {
+
+namespace {
+
+// Closes fd, if there is one, once errno has been read.
+[[noreturn]] void throw_error(std::string const& path, int fd = -1)
+{
+        int const error = errno;
+        if (fd >= 0)
+                close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+}
+
+}
+
+MappedFile::MappedFile(std::string const& path)
+{
+        int const fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                throw_error(path);
+
+        struct stat status;
+        if (fstat(fd, &status) < 0)
+                throw_error(path, fd);
+
+        size_ = static_cast<std::size_t>(status.st_size);
+        if (size_ != 0) {
+                data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data_ == MAP_FAILED) {
+                        data_ = nullptr;
+                        throw_error(path, fd);
+                }
+        }
+        close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+        if (data_)
+                munmap(data_, size_);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr))
+        , size_(std::exchange(other.size_, 0))
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+}
+
+unsigned char const* MappedFile::data() const noexcept
+{
+        return static_cast<unsigned char const*>(data_);
+}
+
+std::size_t MappedFile::size() const noexcept
+{
+        return size_;
+}
+
+std::string_view MappedFile::text() const noexcept
+{
+        return std::string_view(static_cast<char const*>(data_), size_);
+}
+
+void MappedFile::advise_sequential() const noexcept
+{
+        if (data_)
+                madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace Chess {
+
+// A read-only memory mapping of a whole file. Throws std::system_error
+// if the file can't be opened or mapped.
+class MappedFile {
+public:
+        explicit MappedFile(std::string const& path);
+        ~MappedFile();
+        MappedFile(MappedFile const&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        unsigned char const* data() const noexcept;
+        std::size_t size() const noexcept;
+        std::string_view text() const noexcept;
+        // Tells the kernel the file is going to be read front to back.
+        void advise_sequential() const noexcept;
+
+private:
+        void* data_ = nullptr;
+        std::size_t size_ = 0;
+};
+
+}
@@ -0,0 +1,425 @@
+#include "notation.h"
+#include <charconv>
+
+namespace Chess {
+
+namespace {
+
+char promotion_char(Piece::Kind kind) noexcept
+{
+        switch (kind) {
+                case Piece::Kind::queen: return 'q';
+                case Piece::Kind::rook: return 'r';
+                case Piece::Kind::bishop: return 'b';
+                case Piece::Kind::knight: return 'n';
+                default: return '\0';
+        }
+}
+
+std::optional<Piece::Kind> parse_kind(char c) noexcept
+{
+        switch (c) {
+                case 'K': return Piece::Kind::king;
+                case 'Q': return Piece::Kind::queen;
+                case 'R': return Piece::Kind::rook;
+                case 'B': return Piece::Kind::bishop;
+                case 'N': return Piece::Kind::knight;
+                default: return std::nullopt;
+        }
+}
+
+char piece_char(Piece piece) noexcept
+{
+        char const c = [&]
+        {
+                switch (piece.kind) {
+                        case Piece::Kind::king: return 'k';
+                        case Piece::Kind::queen: return 'q';
+                        case Piece::Kind::rook: return 'r';
+                        case Piece::Kind::bishop: return 'b';
+                        case Piece::Kind::knight: return 'n';
+                        case Piece::Kind::pawn: return 'p';
+                        default: return '\0';
+                }
+        }();
+        return (piece.side == Side::light) ? c - 'a' + 'A' : c;
+}
+
+std::optional<Piece> parse_piece(char c) noexcept
+{
+        bool const light = (c >= 'A' && c <= 'Z');
+        char const lower = light ? c - 'A' + 'a' : c;
+        Piece piece {
+                .kind = Piece::Kind::none,
+                .side = light ? Side::light : Side::dark
+        };
+        switch (lower) {
+                case 'k': piece.kind = Piece::Kind::king; break;
+                case 'q': piece.kind = Piece::Kind::queen; break;
+                case 'r': piece.kind = Piece::Kind::rook; break;
+                case 'b': piece.kind = Piece::Kind::bishop; break;
+                case 'n': piece.kind = Piece::Kind::knight; break;
+                case 'p': piece.kind = Piece::Kind::pawn; break;
+                default: return std::nullopt;
+        }
+        return piece;
+}
+
+std::string_view next_field(std::string_view& text) noexcept
+{
+        auto const begin = std::min(text.find_first_not_of(' '), text.size());
+        text.remove_prefix(begin);
+        auto const end = std::min(text.find(' '), text.size());
+        auto const field = text.substr(0, end);
+        text.remove_prefix(end);
+        return field;
+}
+
+bool parse_board(std::string_view text, Board& board) noexcept
+{
+        board = Board {Piece::none()};
+        int x = 0;
+        int y = 0;
+        int kings[3] {};
+        for (char const c : text) {
+                if (c == '/') {
+                        if (x != board_size || ++y == board_size)
+                                return false;
+                        x = 0;
+                } else if (c >= '1' && c <= '8') {
+                        x += c - '0';
+                        if (x > board_size)
+                                return false;
+                } else if (std::optional const piece = parse_piece(c)) {
+                        bool const last_rank = (y == 0 || y == board_size - 1);
+                        if (x == board_size ||
+                            (piece->kind == Piece::Kind::pawn && last_rank)) {
+                                return false;
+                        }
+                        if (piece->kind == Piece::Kind::king)
+                                ++kings[static_cast<int>(piece->side)];
+                        board[y][x++] = *piece;
+                } else {
+                        return false;
+                }
+        }
+        return x == board_size && y == board_size - 1 &&
+               kings[static_cast<int>(Side::light)] == 1 &&
+               kings[static_cast<int>(Side::dark)] == 1;
+}
+
+bool parse_castling_rights(std::string_view text, CastlingRights& rights) noexcept
+{
+        rights = CastlingRights {false, false, false, false};
+        if (text == "-")
+                return true;
+        for (char const c : text) {
+                switch (c) {
+                        case 'K': rights.light_kingside = true; break;
+                        case 'Q': rights.light_queenside = true; break;
+                        case 'k': rights.dark_kingside = true; break;
+                        case 'q': rights.dark_queenside = true; break;
+                        default: return false;
+                }
+        }
+        return !text.empty();
+}
+
+bool parse_number(std::string_view text, int& number) noexcept
+{
+        auto const [end, error] = std::from_chars(text.data(),
+                                                  text.data() + text.size(),
+                                                  number);
+        return error == std::errc() && end == text.data() + text.size() && number >= 0;
+}
+
+char* write_number(int number, char* out) noexcept
+{
+        return std::to_chars(out, out + 12, number).ptr;
+}
+
+}
+
+std::string to_string(Position pos)
+{
+        return std::string {
+                static_cast<char>('a' + pos.x),
+                static_cast<char>('0' + board_size - pos.y)
+        };
+}
+
+std::optional<Position> parse_position(std::string_view text) noexcept
+{
+        if (text.size() != 2 ||
+            text[0] < 'a' || text[0] >= 'a' + board_size ||
+            text[1] < '1' || text[1] >= '1' + board_size) {
+                return std::nullopt;
+        }
+        return Position {text[0] - 'a', board_size - (text[1] - '0')};
+}
+
+std::string to_uci(Board const& board, Move move)
+{
+        Piece const src = board[move.from.y][move.from.x];
+        Piece const dst = board[move.to.y][move.to.x];
+        if (src.side != Side::none && src.side == dst.side)
+                move = CastlingMove(move).king_move();
+
+        std::string result = to_string(move.from) + to_string(move.to);
+        if (char const c = promotion_char(move.promotion))
+                result += c;
+        return result;
+}
+
+std::optional<Move> parse_uci(Game const& game, std::string_view text)
+{
+        Board const board = game.board();
+        for (Move move : game.valid_moves()) {
+                if (to_uci(board, move) == text)
+                        return move;
+        }
+        return std::nullopt;
+}
+
+std::string to_san(Game const& game, Move move)
+{
+        Board const board = game.board();
+        Piece const src = board[move.from.y][move.from.x];
+        Piece const dst = board[move.to.y][move.to.x];
+        MoveList const moves = game.valid_moves();
+
+        std::string result;
+        if (src.side == dst.side) {
+                result = (move.to.x < move.from.x) == (src.kind == Piece::Kind::king) ?
+                        "O-O-O" : "O-O";
+        } else if (src.kind == Piece::Kind::pawn) {
+                if (move.from.x != move.to.x) {
+                        result += static_cast<char>('a' + move.from.x);
+                        result += 'x';
+                }
+                result += to_string(move.to);
+                if (char const c = promotion_char(move.promotion)) {
+                        result += '=';
+                        result += c - 'a' + 'A';
+                }
+        } else {
+                result += piece_char(Piece {.kind = src.kind, .side = Side::light});
+                bool ambiguous = false;
+                bool same_file = false;
+                bool same_rank = false;
+                for (Move other : moves) {
+                        if (other.to != move.to || other.from == move.from ||
+                            board[other.from.y][other.from.x] != src) {
+                                continue;
+                        }
+                        ambiguous = true;
+                        same_file = same_file || other.from.x == move.from.x;
+                        same_rank = same_rank || other.from.y == move.from.y;
+                }
+                std::string const from = to_string(move.from);
+                if (ambiguous && (!same_file || same_rank))
+                        result += from[0];
+                if (ambiguous && same_file)
+                        result += from[1];
+                if (dst != Piece::none())
+                        result += 'x';
+                result += to_string(move.to);
+        }
+
+        Game after = game;
+        after.set_game_over(nullptr);
+        after.try_move(move);
+        if (after.in_check())
+                result += after.valid_moves().empty() ? '#' : '+';
+        return result;
+}
+
+std::optional<Move> parse_san(Game const& game, std::string_view text) noexcept
+{
+        Side const side = game.on_turn();
+        if (side == Side::none)
+                return std::nullopt;
+        while (!text.empty() && std::string_view("+#!?").find(text.back()) !=
+                                std::string_view::npos) {
+                text.remove_suffix(1);
+        }
+
+        Board const board = game.board();
+        int const home_y = (side == Side::light) ? board_size - 1 : 0;
+        auto const castling =
+        [&](int rook_x) -> std::optional<Move>
+        {
+                Move const move {.from = {4, home_y}, .to = {rook_x, home_y}};
+                return game.is_legal(move) ? std::optional(move) : std::nullopt;
+        };
+        if (text == "O-O" || text == "0-0")
+                return castling(board_size - 1);
+        if (text == "O-O-O" || text == "0-0-0")
+                return castling(0);
+
+        Piece::Kind kind = Piece::Kind::pawn;
+        if (!text.empty()) {
+                if (std::optional const parsed = parse_kind(text.front())) {
+                        kind = *parsed;
+                        text.remove_prefix(1);
+                }
+        }
+
+        Piece::Kind promotion = Piece::Kind::none;
+        if (kind == Piece::Kind::pawn && !text.empty()) {
+                if (std::optional const parsed = parse_kind(text.back())) {
+                        promotion = *parsed;
+                        text.remove_suffix(1);
+                        if (!text.empty() && text.back() == '=')
+                                text.remove_suffix(1);
+                }
+        }
+
+        if (text.size() < 2)
+                return std::nullopt;
+        std::optional const to = parse_position(text.substr(text.size() - 2));
+        if (!to)
+                return std::nullopt;
+        text.remove_suffix(2);
+        if (!text.empty() && (text.back() == 'x' || text.back() == ':'))
+                text.remove_suffix(1);
+
+        // What's left is the disambiguation, a file, a rank or both.
+        std::optional<int> from_x;
+        std::optional<int> from_y;
+        for (char const c : text) {
+                if (c >= 'a' && c < 'a' + board_size)
+                        from_x = c - 'a';
+                else if (c >= '1' && c < '1' + board_size)
+                        from_y = board_size - (c - '0');
+                else
+                        return std::nullopt;
+        }
+
+        std::optional<Move> result;
+        Piece const piece {.kind = kind, .side = side};
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        if (board[y][x] != piece ||
+                            (from_x && *from_x != x) ||
+                            (from_y && *from_y != y)) {
+                                continue;
+                        }
+                        Move const move {
+                                .from = {x, y},
+                                .to = *to,
+                                .promotion = promotion
+                        };
+                        if (game.is_legal(move)) {
+                                if (result)
+                                        return std::nullopt;
+                                result = move;
+                        }
+                }
+        }
+        return result;
+}
+
+std::optional<Setup> parse_fen(std::string_view text) noexcept
+{
+        Setup setup;
+        if (!parse_board(next_field(text), setup.board))
+                return std::nullopt;
+
+        auto const side = next_field(text);
+        if (side == "w")
+                setup.on_turn = Side::light;
+        else if (side == "b")
+                setup.on_turn = Side::dark;
+        else
+                return std::nullopt;
+
+        if (!parse_castling_rights(next_field(text), setup.castling_rights))
+                return std::nullopt;
+
+        auto const en_passant = next_field(text);
+        if (en_passant == "-") {
+                setup.en_passant_position = std::nullopt;
+        } else {
+                setup.en_passant_position = parse_position(en_passant);
+                int const y = (setup.on_turn == Side::light) ? 2 : board_size - 3;
+                if (!setup.en_passant_position || setup.en_passant_position->y != y)
+                        return std::nullopt;
+        }
+
+        setup.halfmove_clock = 0;
+        setup.fullmove_number = 1;
+        auto const halfmove_clock = next_field(text);
+        if (!halfmove_clock.empty() &&
+            !parse_number(halfmove_clock, setup.halfmove_clock)) {
+                return std::nullopt;
+        }
+        auto const fullmove_number = next_field(text);
+        if (!fullmove_number.empty() &&
+            !parse_number(fullmove_number, setup.fullmove_number)) {
+                return std::nullopt;
+        }
+        setup.fullmove_number = std::max(setup.fullmove_number, 1);
+        return setup;
+}
+
+char* write_fen(Setup const& setup, char* out) noexcept
+{
+        for (int y = 0; y < board_size; ++y) {
+                int empty = 0;
+                for (int x = 0; x < board_size; ++x) {
+                        Piece const piece = setup.board[y][x];
+                        if (piece == Piece::none()) {
+                                ++empty;
+                                continue;
+                        }
+                        if (empty != 0)
+                                *out++ = static_cast<char>('0' + empty);
+                        empty = 0;
+                        *out++ = piece_char(piece);
+                }
+                if (empty != 0)
+                        *out++ = static_cast<char>('0' + empty);
+                if (y != board_size - 1)
+                        *out++ = '/';
+        }
+
+        *out++ = ' ';
+        *out++ = (setup.on_turn == Side::dark) ? 'b' : 'w';
+
+        *out++ = ' ';
+        auto const [light_kingside, light_queenside, dark_kingside, dark_queenside] =
+                setup.castling_rights;
+        char* const rights = out;
+        if (light_kingside)
+                *out++ = 'K';
+        if (light_queenside)
+                *out++ = 'Q';
+        if (dark_kingside)
+                *out++ = 'k';
+        if (dark_queenside)
+                *out++ = 'q';
+        if (out == rights)
+                *out++ = '-';
+
+        *out++ = ' ';
+        if (setup.en_passant_position) {
+                *out++ = static_cast<char>('a' + setup.en_passant_position->x);
+                *out++ = static_cast<char>('0' + board_size - setup.en_passant_position->y);
+        } else {
+                *out++ = '-';
+        }
+
+        *out++ = ' ';
+        out = write_number(setup.halfmove_clock, out);
+        *out++ = ' ';
+        return write_number(setup.fullmove_number, out);
+}
+
+std::string to_fen(Setup const& setup)
+{
+        char buffer[max_fen_length];
+        return std::string(buffer, write_fen(setup, buffer));
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "chess.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Chess {
+
+std::string to_string(Position pos);
+std::optional<Position> parse_position(std::string_view text) noexcept;
+
+// Long algebraic notation as used by UCI, e.g. e2e4, e1g1 or e7e8q.
+// Castling is written as the king's move.
+std::string to_uci(Board const& board, Move move);
+std::optional<Move> parse_uci(Game const& game, std::string_view text);
+
+// Standard algebraic notation, e.g. Nbd7, exd6, O-O or e8=Q+. Parsing
+// ignores check marks and annotations like !?.
+std::string to_san(Game const& game, Move move);
+std::optional<Move> parse_san(Game const& game, std::string_view text) noexcept;
+
+// Forsyth-Edwards Notation. Parsing doesn't allocate, the clocks may be
+// left out and default to 0 and 1.
+std::optional<Setup> parse_fen(std::string_view text) noexcept;
+
+std::size_t constexpr max_fen_length = 128;
+
+// Writes at most max_fen_length characters, returns the end of the output.
+char* write_fen(Setup const& setup, char* out) noexcept;
+std::string to_fen(Setup const& setup);
+
+}
@@ -0,0 +1,432 @@
+#include "pgn.h"
+#include "notation.h"
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace Chess {
+
+namespace {
+
+bool is_space(char c) noexcept
+{
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+bool ends_symbol(char c) noexcept
+{
+        return is_space(c) || std::strchr("{}();$!?[]", c) != nullptr;
+}
+
+bool is_digit(char c) noexcept
+{
+        return c >= '0' && c <= '9';
+}
+
+enum class ParseResult {
+        game,
+        // The text ended in the middle of a game, but more of it may follow.
+        incomplete,
+        // There are no more games in the text.
+        none
+};
+
+// Parses the game at the start of the text into game, and sets consumed
+// to the length of the game's text.
+class GameParser {
+public:
+        GameParser(std::string_view text, bool at_end, PgnGame& game) noexcept
+                : text_(text)
+                , at_end_(at_end)
+                , game_(game)
+        {}
+
+        ParseResult parse(std::size_t& consumed) noexcept
+        {
+                game_.clear();
+                std::size_t begin = std::string_view::npos;
+                bool in_movetext = false;
+                int depth = 0;
+                while (true) {
+                        while (pos_ < text_.size() && is_space(text_[pos_]))
+                                ++pos_;
+                        if (pos_ == text_.size())
+                                break;
+
+                        char const c = text_[pos_];
+                        if (c == '%' && (pos_ == 0 || text_[pos_ - 1] == '\n')) {
+                                if (!skip_line())
+                                        return ParseResult::incomplete;
+                                continue;
+                        }
+                        if (begin == std::string_view::npos)
+                                begin = pos_;
+
+                        if (c == '[' && depth == 0) {
+                                // A game that is missing its result.
+                                if (in_movetext)
+                                        return finish(begin, consumed);
+                                if (!tag())
+                                        return ParseResult::incomplete;
+                                continue;
+                        }
+
+                        in_movetext = true;
+                        bool complete = true;
+                        switch (c) {
+                                case '{':
+                                        complete = braced_comment();
+                                        break;
+                                case ';':
+                                        complete = line_comment();
+                                        break;
+                                case '(':
+                                        ++depth;
+                                        add_token(PgnToken::Kind::variation_start, 1);
+                                        break;
+                                case ')':
+                                        depth = std::max(depth - 1, 0);
+                                        add_token(PgnToken::Kind::variation_end, 1);
+                                        break;
+                                case '$':
+                                        complete = nag(1);
+                                        break;
+                                case '!':
+                                case '?':
+                                        complete = nag(0);
+                                        break;
+                                case '*':
+                                        if (depth == 0) {
+                                                game_.result = text_.substr(pos_++, 1);
+                                                return finish(begin, consumed);
+                                        }
+                                        ++pos_;
+                                        break;
+                                case '[':
+                                case ']':
+                                case '}':
+                                        ++pos_;
+                                        break;
+                                default:
+                                        bool result = false;
+                                        complete = symbol(depth, result);
+                                        if (complete && result)
+                                                return finish(begin, consumed);
+                                        break;
+                        }
+                        if (!complete)
+                                return ParseResult::incomplete;
+                }
+
+                if (!at_end_)
+                        return ParseResult::incomplete;
+                if (begin == std::string_view::npos)
+                        return ParseResult::none;
+                return finish(begin, consumed);
+        }
+
+private:
+        ParseResult finish(std::size_t begin, std::size_t& consumed) noexcept
+        {
+                game_.text = text_.substr(begin, pos_ - begin);
+                consumed = pos_;
+                return ParseResult::game;
+        }
+
+        // Each of these returns false if the text ends before the element
+        // does and more text may follow.
+
+        bool skip_line() noexcept
+        {
+                auto const end = text_.find('\n', pos_);
+                if (end == std::string_view::npos) {
+                        pos_ = text_.size();
+                        return at_end_;
+                }
+                pos_ = end + 1;
+                return true;
+        }
+
+        bool tag() noexcept
+        {
+                std::size_t i = pos_ + 1;
+                auto const at = [&](std::size_t index) noexcept
+                {
+                        return index < text_.size() ? text_[index] : '\0';
+                };
+
+                while (is_space(at(i)))
+                        ++i;
+                std::size_t const name_begin = i;
+                while (i < text_.size() && !is_space(text_[i]) &&
+                       text_[i] != '"' && text_[i] != ']') {
+                        ++i;
+                }
+                std::size_t const name_end = i;
+                while (is_space(at(i)))
+                        ++i;
+
+                std::size_t value_begin = i;
+                std::size_t value_end = i;
+                if (at(i) == '"') {
+                        value_begin = ++i;
+                        while (i < text_.size() && text_[i] != '"') {
+                                if (text_[i] == '\\')
+                                        ++i;
+                                ++i;
+                        }
+                        value_end = std::min(i, text_.size());
+                        ++i;
+                }
+                while (i < text_.size() && text_[i] != ']' && text_[i] != '\n')
+                        ++i;
+                if (i >= text_.size() && !at_end_)
+                        return false;
+
+                game_.tags.push_back(PgnTag {
+                        .name = text_.substr(name_begin, name_end - name_begin),
+                        .value = text_.substr(value_begin, value_end - value_begin)
+                });
+                pos_ = std::min(i + 1, text_.size());
+                return true;
+        }
+
+        bool braced_comment() noexcept
+        {
+                auto const end = text_.find('}', pos_);
+                if (end == std::string_view::npos && !at_end_)
+                        return false;
+                auto const comment_end = std::min(end, text_.size());
+                game_.movetext.push_back(PgnToken {
+                        .kind = PgnToken::Kind::comment,
+                        .text = text_.substr(pos_ + 1, comment_end - pos_ - 1)
+                });
+                pos_ = std::min(comment_end + 1, text_.size());
+                return true;
+        }
+
+        bool line_comment() noexcept
+        {
+                auto const end = text_.find('\n', pos_);
+                if (end == std::string_view::npos && !at_end_)
+                        return false;
+                auto const comment_end = std::min(end, text_.size());
+                game_.movetext.push_back(PgnToken {
+                        .kind = PgnToken::Kind::comment,
+                        .text = text_.substr(pos_ + 1, comment_end - pos_ - 1)
+                });
+                pos_ = comment_end;
+                return true;
+        }
+
+        // Either $ and a number, or a run of ! and ?.
+        bool nag(std::size_t prefix) noexcept
+        {
+                std::size_t end = pos_ + prefix;
+                if (prefix == 0) {
+                        while (end < text_.size() && (text_[end] == '!' || text_[end] == '?'))
+                                ++end;
+                } else {
+                        while (end < text_.size() && is_digit(text_[end]))
+                                ++end;
+                }
+                if (end == text_.size() && !at_end_)
+                        return false;
+                add_token(PgnToken::Kind::nag, end - pos_);
+                return true;
+        }
+
+        bool symbol(int depth, bool& result) noexcept
+        {
+                std::size_t end = pos_;
+                while (end < text_.size() && !ends_symbol(text_[end]))
+                        ++end;
+                if (end == text_.size() && !at_end_)
+                        return false;
+
+                auto text = text_.substr(pos_, end - pos_);
+                pos_ = end;
+                if (text == "1-0" || text == "0-1" || text == "1/2-1/2") {
+                        if (depth == 0) {
+                                game_.result = text;
+                                result = true;
+                        }
+                        return true;
+                }
+
+                // Move numbers, possibly stuck to the move like 12.e4 or 12...e5
+                std::size_t digits = 0;
+                while (digits < text.size() && is_digit(text[digits]))
+                        ++digits;
+                if (digits != 0 && digits < text.size() && text[digits] == '.') {
+                        text.remove_prefix(digits);
+                        while (!text.empty() && text.front() == '.')
+                                text.remove_prefix(1);
+                } else if (digits == text.size()) {
+                        return true;
+                }
+
+                if (!text.empty()) {
+                        game_.movetext.push_back(PgnToken {
+                                .kind = PgnToken::Kind::move,
+                                .text = text
+                        });
+                        if (depth == 0)
+                                game_.main_line.push_back(text);
+                }
+                return true;
+        }
+
+        void add_token(PgnToken::Kind kind, std::size_t length) noexcept
+        {
+                game_.movetext.push_back(PgnToken {
+                        .kind = kind,
+                        .text = text_.substr(pos_, length)
+                });
+                pos_ += length;
+        }
+
+        std::string_view text_;
+        bool at_end_;
+        PgnGame& game_;
+        std::size_t pos_ = 0;
+};
+
+}
+
+std::string_view PgnGame::tag(std::string_view name) const noexcept
+{
+        for (PgnTag const& tag : tags) {
+                if (tag.name == name)
+                        return tag.value;
+        }
+        return std::string_view();
+}
+
+void PgnGame::clear() noexcept
+{
+        tags.clear();
+        movetext.clear();
+        main_line.clear();
+        result = std::string_view();
+        text = std::string_view();
+}
+
+PgnReader::PgnReader(std::string_view text) noexcept
+        : text_(text)
+{}
+
+PgnReader::PgnReader(std::istream& in, std::size_t chunk_size)
+        : in_(&in)
+        , chunk_size_(chunk_size)
+{
+        buffer_.resize(chunk_size_);
+}
+
+bool PgnReader::next(PgnGame& game)
+{
+        while (true) {
+                bool const at_end = !in_;
+                std::size_t consumed = 0;
+                switch (GameParser(text_, at_end, game).parse(consumed)) {
+                        case ParseResult::game:
+                                text_.remove_prefix(consumed);
+                                return true;
+                        case ParseResult::none:
+                                text_ = std::string_view();
+                                return false;
+                        case ParseResult::incomplete:
+                                read_chunk();
+                                break;
+                }
+        }
+}
+
+// Moves what is left to the front of the buffer and appends a chunk. The
+// buffer only grows past the chunk size for games longer than that.
+bool PgnReader::read_chunk()
+{
+        std::size_t const kept = text_.size();
+        if (kept != 0)
+                std::memmove(buffer_.data(), text_.data(), kept);
+        if (buffer_.size() < kept + chunk_size_)
+                buffer_.resize(kept + chunk_size_);
+
+        in_->read(buffer_.data() + kept, static_cast<std::streamsize>(chunk_size_));
+        auto const read = static_cast<std::size_t>(in_->gcount());
+        text_ = std::string_view(buffer_.data(), kept + read);
+        if (read < chunk_size_)
+                in_ = nullptr;
+        return read != 0;
+}
+
+Replay replay(PgnGame const& pgn_game)
+{
+        Replay result {Game(nullptr), 0, true};
+        if (auto const fen = pgn_game.tag("FEN"); !fen.empty()) {
+                std::optional const setup = parse_fen(fen);
+                if (!setup) {
+                        result.complete = false;
+                        return result;
+                }
+                result.game = Game(nullptr, *setup);
+        }
+
+        for (auto const san : pgn_game.main_line) {
+                std::optional const move = parse_san(result.game, san);
+                if (!move || !result.game.try_move(*move)) {
+                        result.complete = false;
+                        break;
+                }
+                ++result.plies;
+        }
+        return result;
+}
+
+void write_pgn(std::ostream& out, std::vector<PgnTag> const& tags, Setup const& start,
+               std::vector<Move> const& moves, std::string_view result)
+{
+        std::size_t constexpr max_line = 79;
+
+        for (PgnTag const& tag : tags)
+                out << '[' << tag.name << " \"" << tag.value << "\"]\n";
+        std::string const fen = to_fen(start);
+        if (fen != to_fen(default_setup()))
+                out << "[SetUp \"1\"]\n[FEN \"" << fen << "\"]\n";
+        out << '\n';
+
+        std::string line;
+        auto const add =
+        [&](std::string const& word)
+        {
+                if (!line.empty() && line.size() + 1 + word.size() > max_line) {
+                        out << line << '\n';
+                        line.clear();
+                }
+                if (!line.empty())
+                        line += ' ';
+                line += word;
+        };
+
+        Game game(nullptr, start);
+        int fullmove = start.fullmove_number;
+        bool first = true;
+        for (Move move : moves) {
+                if (!game.is_legal(move))
+                        break;
+                if (game.on_turn() == Side::light)
+                        add(std::to_string(fullmove) + '.');
+                else if (first)
+                        add(std::to_string(fullmove) + "...");
+                add(to_san(game, move));
+                game.try_move(move);
+                if (game.on_turn() == Side::light)
+                        ++fullmove;
+                first = false;
+        }
+        add(std::string(result));
+        out << line << "\n\n";
+}
+
+}
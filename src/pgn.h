@@ -0,0 +1,85 @@
+#pragma once
+
+#include "chess.h"
+#include <cstddef>
+#include <iosfwd>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+struct PgnTag {
+        std::string_view name;
+        // As written, without unescaping.
+        std::string_view value;
+};
+
+struct PgnToken {
+        enum class Kind {
+                move,
+                comment,
+                nag,
+                variation_start,
+                variation_end
+        };
+
+        Kind kind;
+        std::string_view text;
+};
+
+// Views into the reader's text, valid until the reader moves on. The
+// vectors keep their capacity between games, so reading a game
+// usually doesn't allocate.
+struct PgnGame {
+        std::vector<PgnTag> tags;
+        // Everything between the tags and the result, in order.
+        std::vector<PgnToken> movetext;
+        // The moves outside of variations.
+        std::vector<std::string_view> main_line;
+        std::string_view result;
+        std::string_view text;
+
+        std::string_view tag(std::string_view name) const noexcept;
+        void clear() noexcept;
+};
+
+// Pulls games one by one out of either a text that is entirely in memory,
+// like a mapped file, or a stream read in fixed-size chunks.
+class PgnReader {
+public:
+        static std::size_t constexpr default_chunk_size = 1 << 16;
+
+        explicit PgnReader(std::string_view text) noexcept;
+        explicit PgnReader(std::istream& in, std::size_t chunk_size = default_chunk_size);
+
+        // Returns false once there are no more games.
+        bool next(PgnGame& game);
+
+private:
+        bool read_chunk();
+
+        std::string_view text_;
+        std::istream* in_ = nullptr;
+        std::vector<char> buffer_;
+        std::size_t chunk_size_ = 0;
+};
+
+struct Replay {
+        Game game;
+        // How many main line moves were played.
+        int plies;
+        // Whether all of them were legal.
+        bool complete;
+};
+
+// Plays the main line from the FEN tag, or from the starting position if
+// there is none.
+Replay replay(PgnGame const& pgn_game);
+
+// Writes a game in export format: the tags, SetUp and FEN if the game
+// doesn't start from the initial position, and the moves in SAN wrapped
+// before 80 columns. Stops at the first illegal move.
+void write_pgn(std::ostream& out, std::vector<PgnTag> const& tags, Setup const& start,
+               std::vector<Move> const& moves, std::string_view result);
+
+}
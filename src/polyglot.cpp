@@ -0,0 +1,319 @@
+#include "polyglot.h"
+#include "notation.h"
+#include "pgn.h"
+#include "zobrist.h"
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+namespace Chess {
+
+namespace {
+
+std::size_t constexpr entry_size = 16;
+
+// Polyglot numbers ranks from the light side, the board from the dark one.
+int rank_of(Position pos) noexcept
+{
+        return board_size - 1 - pos.y;
+}
+
+Position position_of(int file, int rank) noexcept
+{
+        return Position {file, board_size - 1 - rank};
+}
+
+int promotion_code(Piece::Kind kind) noexcept
+{
+        switch (kind) {
+                case Piece::Kind::knight:
+                        return 1;
+                case Piece::Kind::bishop:
+                        return 2;
+                case Piece::Kind::rook:
+                        return 3;
+                case Piece::Kind::queen:
+                        return 4;
+                default:
+                        return 0;
+        }
+}
+
+Piece::Kind constexpr promotion_kinds[] = {
+        Piece::Kind::none,
+        Piece::Kind::knight,
+        Piece::Kind::bishop,
+        Piece::Kind::rook,
+        Piece::Kind::queen
+};
+
+template <class T>
+T get_big_endian(unsigned char const* in) noexcept
+{
+        T value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+                value = static_cast<T>(value << 8 | in[i]);
+        return value;
+}
+
+template <class T>
+void put_big_endian(std::ostream& out, T value)
+{
+        char bytes[sizeof(T)];
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+                bytes[i] = static_cast<char>(value >> (8 * (sizeof(T) - 1 - i)));
+        out.write(bytes, sizeof(T));
+}
+
+// One occurrence of a move in a game, before they are added up.
+struct BookMove {
+        std::uint64_t key;
+        std::uint16_t move;
+        std::uint16_t score;
+};
+
+bool book_order(BookMove const& m1, BookMove const& m2) noexcept
+{
+        return m1.key < m2.key || (m1.key == m2.key && m1.move < m2.move);
+}
+
+void add_book_moves(std::string_view game_text, int max_plies, PgnGame& pgn_game,
+                    std::vector<BookMove>& book_moves)
+{
+        PgnReader reader(game_text);
+        if (!reader.next(pgn_game))
+                return;
+
+        Game game(nullptr);
+        if (auto const fen = pgn_game.tag("FEN"); !fen.empty()) {
+                std::optional const setup = parse_fen(fen);
+                if (!setup)
+                        return;
+                game = Game(nullptr, *setup);
+        }
+
+        Side winner = Side::none;
+        if (pgn_game.result == "1-0")
+                winner = Side::light;
+        else if (pgn_game.result == "0-1")
+                winner = Side::dark;
+
+        int plies = 0;
+        for (auto const san : pgn_game.main_line) {
+                if (plies++ == max_plies)
+                        break;
+                std::optional const move = parse_san(game, san);
+                if (!move)
+                        break;
+                Side const mover = game.on_turn();
+                std::uint16_t const score =
+                        (winner == Side::none) ? 1 : (winner == mover) ? 2 : 0;
+                book_moves.push_back(BookMove {
+                        game.key(),
+                        to_polyglot_move(*move),
+                        score
+                });
+                if (!game.try_move(*move))
+                        break;
+        }
+}
+
+}
+
+std::uint64_t polyglot_key(Setup const& setup) noexcept
+{
+        return zobrist_key(setup);
+}
+
+std::uint16_t to_polyglot_move(Move move) noexcept
+{
+        return static_cast<std::uint16_t>(move.to.x |
+                                          rank_of(move.to) << 3 |
+                                          move.from.x << 6 |
+                                          rank_of(move.from) << 9 |
+                                          promotion_code(move.promotion) << 12);
+}
+
+Move from_polyglot_move(std::uint16_t code) noexcept
+{
+        int const promotion = code >> 12 & 7;
+        return Move {
+                .from = position_of(code >> 6 & 7, code >> 9 & 7),
+                .to = position_of(code & 7, code >> 3 & 7),
+                .promotion = promotion < 5 ? promotion_kinds[promotion] : Piece::Kind::none
+        };
+}
+
+PolyglotBook::PolyglotBook(MappedFile file)
+        : file_(std::move(file))
+{
+        data_ = file_->text();
+        check_size();
+}
+
+PolyglotBook::PolyglotBook(std::string_view data)
+        : data_(data)
+{
+        check_size();
+}
+
+void PolyglotBook::check_size() const
+{
+        if (data_.size() % entry_size != 0)
+                throw std::runtime_error("not a Polyglot book");
+}
+
+std::size_t PolyglotBook::size() const noexcept
+{
+        return data_.size() / entry_size;
+}
+
+BookEntry PolyglotBook::entry(std::size_t index) const noexcept
+{
+        auto const bytes =
+                reinterpret_cast<unsigned char const*>(data_.data()) + index * entry_size;
+        return BookEntry {
+                .key = get_big_endian<std::uint64_t>(bytes),
+                .move = from_polyglot_move(get_big_endian<std::uint16_t>(bytes + 8)),
+                .weight = get_big_endian<std::uint16_t>(bytes + 10),
+                .learn = get_big_endian<std::uint32_t>(bytes + 12)
+        };
+}
+
+void PolyglotBook::find(std::uint64_t key, std::vector<BookEntry>& entries) const
+{
+        entries.clear();
+        auto const key_at = [&](std::size_t index) noexcept
+        {
+                auto const bytes = reinterpret_cast<unsigned char const*>(data_.data());
+                return get_big_endian<std::uint64_t>(bytes + index * entry_size);
+        };
+
+        std::size_t low = 0;
+        std::size_t high = size();
+        while (low < high) {
+                std::size_t const middle = low + (high - low) / 2;
+                if (key_at(middle) < key)
+                        low = middle + 1;
+                else
+                        high = middle;
+        }
+        for (std::size_t i = low; i < size() && key_at(i) == key; ++i)
+                entries.push_back(entry(i));
+}
+
+std::optional<Move> PolyglotBook::pick(Game const& game, std::mt19937_64& random) const
+{
+        if (game.on_turn() == Side::none)
+                return std::nullopt;
+
+        std::vector<BookEntry> entries;
+        find(game.key(), entries);
+        // Another position may share the key, so the moves are checked.
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                [&](BookEntry const& entry)
+                {
+                        return entry.weight == 0 || !game.is_legal(entry.move);
+                }
+        ), entries.end());
+        if (entries.empty())
+                return std::nullopt;
+
+        std::uint64_t total = 0;
+        for (BookEntry const& entry : entries)
+                total += entry.weight;
+        std::uniform_int_distribution<std::uint64_t> distribution(0, total - 1);
+        std::uint64_t chosen = distribution(random);
+        for (BookEntry const& entry : entries) {
+                if (chosen < entry.weight)
+                        return entry.move;
+                chosen -= entry.weight;
+        }
+        return entries.back().move;
+}
+
+std::size_t build_book(std::string_view pgn_text, BookOptions const& options,
+                       std::ostream& out)
+{
+        std::vector<std::string_view> games;
+        {
+                PgnReader reader(pgn_text);
+                PgnGame game;
+                while (reader.next(game))
+                        games.push_back(game.text);
+        }
+
+        // Each thread replays its own contiguous share of the games.
+        unsigned const threads = std::max(1u, std::min<unsigned>(
+                options.threads != 0 ? options.threads : std::thread::hardware_concurrency(),
+                static_cast<unsigned>(std::max<std::size_t>(games.size(), 1))));
+        std::vector<std::vector<BookMove>> shares(threads);
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (unsigned t = 0; t < threads; ++t) {
+                workers.emplace_back(
+                        [&, t]
+                        {
+                                PgnGame pgn_game;
+                                std::size_t const begin = games.size() * t / threads;
+                                std::size_t const end = games.size() * (t + 1) / threads;
+                                for (std::size_t i = begin; i < end; ++i) {
+                                        add_book_moves(games[i], options.max_plies, pgn_game,
+                                                       shares[t]);
+                                }
+                                std::sort(shares[t].begin(), shares[t].end(), book_order);
+                        }
+                );
+        }
+        for (std::thread& worker : workers)
+                worker.join();
+
+        // The sorted shares are merged, adding up the scores of equal moves.
+        std::vector<BookMove> all;
+        for (auto& share : shares) {
+                auto const middle = static_cast<std::ptrdiff_t>(all.size());
+                all.insert(all.end(), share.cbegin(), share.cend());
+                share = std::vector<BookMove>();
+                std::inplace_merge(all.begin(), all.begin() + middle, all.end(), book_order);
+        }
+
+        struct Total {
+                std::uint64_t key;
+                std::uint16_t move;
+                std::uint64_t score;
+        };
+        std::vector<Total> totals;
+        for (std::size_t i = 0; i < all.size();) {
+                std::size_t j = i;
+                std::uint64_t score = 0;
+                for (; j < all.size() && all[j].key == all[i].key && all[j].move == all[i].move; ++j)
+                        score += all[j].score;
+                if (score != 0 && j - i >= static_cast<std::size_t>(std::max(options.min_games, 1)))
+                        totals.push_back(Total {all[i].key, all[i].move, score});
+                i = j;
+        }
+
+        std::uint64_t max_score = 0;
+        for (Total const& total : totals)
+                max_score = std::max(max_score, total.score);
+        // Polyglot readers list a position's moves best first.
+        std::stable_sort(totals.begin(), totals.end(),
+                [](Total const& t1, Total const& t2)
+                {
+                        return t1.key < t2.key || (t1.key == t2.key && t1.score > t2.score);
+                }
+        );
+        for (Total const& total : totals) {
+                std::uint64_t weight = total.score;
+                if (max_score > 0xffff)
+                        weight = std::max<std::uint64_t>(weight * 0xffff / max_score, 1);
+                put_big_endian(out, total.key);
+                put_big_endian(out, total.move);
+                put_big_endian(out, static_cast<std::uint16_t>(weight));
+                put_big_endian(out, std::uint32_t(0));
+        }
+        return totals.size();
+}
+
+}
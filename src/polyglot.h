@@ -0,0 +1,70 @@
+#pragma once
+
+#include "chess.h"
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+// Position hash in the Polyglot key scheme: one random number per piece on
+// a square, per castling right, per en passant file and for light to move.
+// The en passant file only counts when a pawn could actually take there.
+std::uint64_t polyglot_key(Setup const& setup) noexcept;
+
+// Polyglot move codes, to file, to rank, from file and from rank in three
+// bits each and the promotion above them. Castling is the king taking its
+// own rook, which is also how Move describes it.
+std::uint16_t to_polyglot_move(Move move) noexcept;
+Move from_polyglot_move(std::uint16_t code) noexcept;
+
+struct BookEntry {
+        std::uint64_t key;
+        Move move;
+        std::uint16_t weight;
+        std::uint32_t learn;
+};
+
+// A Polyglot opening book: 16 byte big endian entries sorted by key.
+class PolyglotBook {
+public:
+        // Both throw std::runtime_error if the size isn't a whole number of
+        // entries. The data must outlive the book.
+        explicit PolyglotBook(MappedFile file);
+        explicit PolyglotBook(std::string_view data);
+
+        std::size_t size() const noexcept;
+        // The entries for the position, found by binary search.
+        void find(std::uint64_t key, std::vector<BookEntry>& entries) const;
+        // A legal book move picked at random in proportion to the weights.
+        std::optional<Move> pick(Game const& game, std::mt19937_64& random) const;
+
+private:
+        BookEntry entry(std::size_t index) const noexcept;
+        void check_size() const;
+
+        std::optional<MappedFile> file_;
+        std::string_view data_;
+};
+
+struct BookOptions {
+        // Zero for one thread per core.
+        unsigned threads = 0;
+        // Only moves up to this ply of each game go into the book.
+        int max_plies = 24;
+        // Moves played fewer times are left out.
+        int min_games = 1;
+};
+
+// Builds a book from every game in a PGN text and writes it out. Each
+// move scores 2 for a win, 1 for a draw or an unknown result and nothing
+// for a loss of the side that played it. Returns the number of entries.
+std::size_t build_book(std::string_view pgn_text, BookOptions const& options,
+                       std::ostream& out);
+
+}
@@ -0,0 +1,573 @@
+#include "retrograde.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+namespace Chess {
+
+namespace {
+
+std::uint8_t constexpr unknown = 0xff;
+std::uint64_t constexpr chunk_size = 1024;
+// Marks the moves in the table that capture or move a pawn, which start
+// the distance to zeroing over.
+std::uint32_t constexpr zeroing_child = std::uint32_t(1) << 31;
+
+// The order pieces are listed in a signature.
+char constexpr piece_order[] = "KQRBNP";
+Piece::Kind constexpr piece_kinds[] = {
+        Piece::Kind::king,
+        Piece::Kind::queen,
+        Piece::Kind::rook,
+        Piece::Kind::bishop,
+        Piece::Kind::knight,
+        Piece::Kind::pawn
+};
+
+int letter_rank(char letter) noexcept
+{
+        for (int i = 0; piece_order[i]; ++i) {
+                if (piece_order[i] == letter)
+                        return i;
+        }
+        return -1;
+}
+
+// The pieces of a signature, the stronger side's first, as kinds and
+// whether they belong to it.
+struct SignaturePieces {
+        std::array<Piece::Kind, max_tablebase_pieces> kinds;
+        std::array<bool, max_tablebase_pieces> strong;
+        int count = 0;
+};
+
+bool parse_signature(std::string_view signature, SignaturePieces& pieces) noexcept
+{
+        auto const separator = signature.find('v');
+        if (separator == std::string_view::npos)
+                return false;
+        pieces.count = 0;
+        bool strong = true;
+        int previous = 0;
+        for (std::size_t i = 0; i < signature.size(); ++i) {
+                if (i == separator) {
+                        strong = false;
+                        previous = 0;
+                        continue;
+                }
+                int const rank = letter_rank(signature[i]);
+                // One king per side, first, then the rest in order.
+                bool const first = (i == 0 || i == separator + 1);
+                if (rank < 0 || (rank == 0) != first || rank < previous ||
+                    pieces.count == max_tablebase_pieces) {
+                        return false;
+                }
+                previous = rank;
+                pieces.kinds[pieces.count] = piece_kinds[rank];
+                pieces.strong[pieces.count] = strong;
+                ++pieces.count;
+        }
+        return separator > 0 && separator + 1 < signature.size();
+}
+
+std::string side_pieces(Board const& board, Side side)
+{
+        std::string pieces;
+        for (int i = 0; piece_order[i]; ++i) {
+                for (auto const& row : board) {
+                        for (Piece piece : row) {
+                                if (piece.side == side && piece.kind == piece_kinds[i])
+                                        pieces += piece_order[i];
+                        }
+                }
+        }
+        return pieces;
+}
+
+// The index of a board with the table's pieces. Pieces of a kind are
+// taken in the order of their squares, with the board flipped when the
+// colours are swapped.
+std::uint64_t position_index(SignaturePieces const& pieces, Board const& board, Side on_turn,
+                             bool swapped) noexcept
+{
+        Side const strong_side = swapped ? Side::dark : Side::light;
+        std::uint64_t index = 0;
+        std::uint64_t used = 0;
+        for (int i = 0; i < pieces.count; ++i) {
+                Side const side = pieces.strong[i] ? strong_side : opposite_side(strong_side);
+                Piece const wanted {.kind = pieces.kinds[i], .side = side};
+                int square = -1;
+                for (int s = 0; s < board_size * board_size && square < 0; ++s) {
+                        int const x = s % board_size;
+                        int const y = swapped ? board_size - 1 - s / board_size : s / board_size;
+                        if (!(used & (std::uint64_t(1) << s)) && board[y][x] == wanted)
+                                square = s;
+                }
+                used |= std::uint64_t(1) << square;
+                index = index * 64 + static_cast<std::uint64_t>(square);
+        }
+        return index * 2 + (on_turn == strong_side ? 0 : 1);
+}
+
+std::uint8_t value_of(Wdl wdl) noexcept
+{
+        return static_cast<std::uint8_t>(wdl);
+}
+
+// Runs body(chunk) for every chunk on all threads, handing the chunks out
+// one at a time so that slow ones don't hold a thread's share back.
+template <class Body>
+void for_each_chunk(std::uint64_t chunks, unsigned threads, Body const& body)
+{
+        std::atomic<std::uint64_t> next {0};
+        auto const work = [&]
+        {
+                for (std::uint64_t chunk = next++; chunk < chunks; chunk = next++)
+                        body(chunk);
+        };
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; ++i)
+                workers.emplace_back(work);
+        work();
+        for (std::thread& worker : workers)
+                worker.join();
+}
+
+void sort_pieces(std::string& pieces)
+{
+        std::sort(pieces.begin(), pieces.end(),
+                [](char p1, char p2)
+                {
+                        return std::string_view(piece_order).find(p1) <
+                               std::string_view(piece_order).find(p2);
+                }
+        );
+}
+
+// The tables a capture or a promotion can lead to.
+std::vector<std::string> dependencies(std::string_view signature)
+{
+        auto const separator = signature.find('v');
+        std::string const sides[] = {
+                std::string(signature.substr(0, separator)),
+                std::string(signature.substr(separator + 1))
+        };
+        std::vector<std::string> result;
+        auto const add = [&](std::string light, std::string dark)
+        {
+                sort_pieces(light);
+                sort_pieces(dark);
+                result.push_back(table_signature(light, dark));
+        };
+        for (int side = 0; side < 2; ++side) {
+                std::string const& own = sides[side];
+                std::string const& other = sides[1 - side];
+                for (std::size_t i = 1; i < own.size(); ++i) {
+                        std::string captured = own;
+                        captured.erase(i, 1);
+                        add(captured, other);
+                        if (own[i] != 'P')
+                                continue;
+                        for (char const promotion : {'Q', 'R', 'B', 'N'}) {
+                                std::string promoted = own;
+                                promoted[i] = promotion;
+                                add(promoted, other);
+                        }
+                }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+}
+
+bool has_pawn_on_back_rank(Board const& board) noexcept
+{
+        for (int y : {0, board_size - 1}) {
+                for (Piece piece : board[y]) {
+                        if (piece.kind == Piece::Kind::pawn)
+                                return true;
+                }
+        }
+        return false;
+}
+
+class Solver {
+public:
+        Solver(std::string_view signature, RetrogradeOptions const& options,
+               SolvedTables const& solved, unsigned threads)
+                : signature_(signature)
+                , options_(options)
+                , solved_(solved)
+                , threads_(threads)
+                , size_(table_size(signature))
+                , chunks_((size_ + chunk_size - 1) / chunk_size)
+                , values_(size_, unknown)
+                , has_draw_(size_, 0)
+                , mated_(size_, 0)
+                , children_(chunks_)
+        {
+                parse_signature(signature, pieces_);
+        }
+
+        SolvedTable solve()
+        {
+                std::atomic<std::uint64_t> decided {0};
+                for_each_chunk(chunks_, threads_, [&](std::uint64_t chunk)
+                {
+                        decided += expand(chunk);
+                });
+                report(0, decided);
+
+                std::vector<std::uint8_t> next;
+                for (int pass = 1; decided != 0; ++pass) {
+                        next = values_;
+                        decided = 0;
+                        for_each_chunk(chunks_, threads_, [&](std::uint64_t chunk)
+                        {
+                                decided += propagate(chunk, next);
+                        });
+                        values_.swap(next);
+                        report(pass, decided);
+                }
+                for (std::uint8_t& value : values_) {
+                        if (value == unknown)
+                                value = value_of(Wdl::draw);
+                }
+
+                SolvedTable result {std::vector<Wdl>(size_), std::vector<std::uint16_t>(size_, 0)};
+                for_each_chunk(chunks_, threads_, [&](std::uint64_t chunk)
+                {
+                        start_dtz(chunk, result.dtz);
+                });
+                std::vector<std::uint16_t> next_dtz;
+                decided = 1;
+                for (std::uint16_t plies = 1; decided != 0; ++plies) {
+                        next_dtz = result.dtz;
+                        decided = 0;
+                        for_each_chunk(chunks_, threads_, [&](std::uint64_t chunk)
+                        {
+                                decided += propagate_dtz(chunk, plies, result.dtz, next_dtz);
+                        });
+                        result.dtz.swap(next_dtz);
+                }
+
+                // The fifty-move rule is only looked at through the
+                // distance to zeroing, within the table.
+                for (std::uint64_t i = 0; i < size_; ++i) {
+                        auto const wdl = static_cast<Wdl>(values_[i]);
+                        bool const cursed = result.dtz[i] > 100;
+                        result.values[i] = (cursed && wdl == Wdl::win) ? Wdl::cursed_win :
+                                           (cursed && wdl == Wdl::loss) ? Wdl::blessed_loss : wdl;
+                }
+                return result;
+        }
+
+private:
+        // The positions of a chunk and where their moves lead within the
+        // table, as offsets into one array.
+        struct Children {
+                std::vector<std::uint32_t> begin;
+                std::vector<std::uint32_t> indexes;
+        };
+
+        void report(int pass, std::uint64_t decided) const
+        {
+                if (options_.progress)
+                        options_.progress(signature_, pass, decided);
+        }
+
+        // Generates the moves of every position in the chunk and decides the
+        // ones settled by their moves alone. Returns how many were decided.
+        std::uint64_t expand(std::uint64_t chunk)
+        {
+                Children& children = children_[chunk];
+                std::uint64_t const first = chunk * chunk_size;
+                std::uint64_t const last = std::min(first + chunk_size, size_);
+                children.begin.reserve(last - first + 1);
+                std::uint64_t decided = 0;
+                for (std::uint64_t i = first; i < last; ++i) {
+                        auto const begin = static_cast<std::uint32_t>(children.indexes.size());
+                        children.begin.push_back(begin);
+                        values_[i] = expand_position(i, children.indexes);
+                        if (values_[i] != unknown) {
+                                children.indexes.resize(begin);
+                                ++decided;
+                        }
+                }
+                children.begin.push_back(static_cast<std::uint32_t>(children.indexes.size()));
+                return decided;
+        }
+
+        std::uint8_t expand_position(std::uint64_t index, std::vector<std::uint32_t>& children)
+        {
+                std::optional const setup = table_setup(signature_, index);
+                if (!setup || has_pawn_on_back_rank(setup->board))
+                        return value_of(Wdl::invalid);
+
+                // The side that just moved can't be left in check.
+                Setup flipped = *setup;
+                flipped.on_turn = opposite_side(setup->on_turn);
+                if (Game(nullptr, flipped).in_check())
+                        return value_of(Wdl::invalid);
+
+                Game const game(nullptr, *setup);
+                MoveList const moves = game.valid_moves();
+                auto const own_begin = children.size();
+                if (moves.empty()) {
+                        mated_[index] = game.in_check();
+                        return value_of(game.in_check() ? Wdl::loss : Wdl::draw);
+                }
+
+                // Checkmates are found when their own positions are expanded,
+                // so the moves are made on the board alone. Only captures and
+                // promotions leave the table.
+                for (Move move : moves) {
+                        Setup child = *setup;
+                        bool const pawn = setup->board[move.from.y][move.from.x].kind == Piece::Kind::pawn;
+                        bool const leaves = child.board[move.to.y][move.to.x] != Piece::none() ||
+                                            (pawn && (move.to.y == 0 || move.to.y == board_size - 1));
+                        move.apply(child.board);
+                        child.on_turn = opposite_side(setup->on_turn);
+                        if (!leaves) {
+                                auto const child_index = static_cast<std::uint32_t>(
+                                        position_index(pieces_, child.board, child.on_turn, false));
+                                children.push_back(child_index | (pawn ? zeroing_child : 0));
+                                continue;
+                        }
+                        std::optional const child_index = table_index(child);
+                        auto const table = solved_.find(child_index->signature);
+                        switch (table->second.values[child_index->index]) {
+                                case Wdl::loss:
+                                case Wdl::blessed_loss:
+                                        return value_of(Wdl::win);
+                                case Wdl::draw:
+                                        has_draw_[index] = 1;
+                                        break;
+                                default:
+                                        break;
+                        }
+                }
+                if (children.size() == own_begin)
+                        return value_of(has_draw_[index] ? Wdl::draw : Wdl::loss);
+                return unknown;
+        }
+
+        // A position is won once one of its moves leads to a lost one, and
+        // lost once all of them lead to won ones.
+        std::uint64_t propagate(std::uint64_t chunk, std::vector<std::uint8_t>& next) const
+        {
+                Children const& children = children_[chunk];
+                std::uint64_t const first = chunk * chunk_size;
+                std::uint64_t const last = std::min(first + chunk_size, size_);
+                std::uint64_t decided = 0;
+                for (std::uint64_t i = first; i < last; ++i) {
+                        if (values_[i] != unknown)
+                                continue;
+                        bool all_won = !has_draw_[i];
+                        bool any_lost = false;
+                        auto const begin = children.begin[i - first];
+                        auto const end = children.begin[i - first + 1];
+                        for (auto c = begin; c != end && !any_lost; ++c) {
+                                std::uint8_t const value = values_[children.indexes[c] & ~zeroing_child];
+                                any_lost = (value == value_of(Wdl::loss));
+                                all_won = all_won && value == value_of(Wdl::win);
+                        }
+                        if (any_lost || all_won) {
+                                next[i] = value_of(any_lost ? Wdl::win : Wdl::loss);
+                                ++decided;
+                        }
+                }
+                return decided;
+        }
+
+        // Wins and losses decided by their moves alone, mates and wins by a
+        // pawn move or into a mate are a ply from zeroing. So are losses
+        // whose every move zeroes.
+        void start_dtz(std::uint64_t chunk, std::vector<std::uint16_t>& dtz) const
+        {
+                Children const& children = children_[chunk];
+                std::uint64_t const first = chunk * chunk_size;
+                std::uint64_t const last = std::min(first + chunk_size, size_);
+                for (std::uint64_t i = first; i < last; ++i) {
+                        auto const wdl = static_cast<Wdl>(values_[i]);
+                        if (wdl != Wdl::win && wdl != Wdl::loss)
+                                continue;
+                        // Every move in the table zeroes, or a pawn move or
+                        // a mate wins.
+                        bool zeroes = true;
+                        bool won_now = false;
+                        auto const begin = children.begin[i - first];
+                        auto const end = children.begin[i - first + 1];
+                        for (auto c = begin; c != end; ++c) {
+                                std::uint32_t const child = children.indexes[c] & ~zeroing_child;
+                                bool const zeroing = children.indexes[c] & zeroing_child;
+                                zeroes = zeroes && zeroing;
+                                won_now = won_now || (values_[child] == value_of(Wdl::loss) &&
+                                                      (zeroing || mated_[child]));
+                        }
+                        if (begin == end || (wdl == Wdl::win ? won_now : zeroes))
+                                dtz[i] = 1;
+                }
+        }
+
+        // A win is a ply further from zeroing than the nearest loss its
+        // moves lead to, a loss a ply further than the farthest win.
+        std::uint64_t propagate_dtz(std::uint64_t chunk, std::uint16_t plies,
+                                    std::vector<std::uint16_t> const& dtz,
+                                    std::vector<std::uint16_t>& next) const
+        {
+                Children const& children = children_[chunk];
+                std::uint64_t const first = chunk * chunk_size;
+                std::uint64_t const last = std::min(first + chunk_size, size_);
+                std::uint64_t decided = 0;
+                for (std::uint64_t i = first; i < last; ++i) {
+                        auto const wdl = static_cast<Wdl>(values_[i]);
+                        if (dtz[i] != 0 || (wdl != Wdl::win && wdl != Wdl::loss))
+                                continue;
+                        bool any_lost = false;
+                        bool all_won = true;
+                        auto const begin = children.begin[i - first];
+                        auto const end = children.begin[i - first + 1];
+                        for (auto c = begin; c != end; ++c) {
+                                if (children.indexes[c] & zeroing_child)
+                                        continue;
+                                std::uint32_t const child = children.indexes[c];
+                                any_lost = any_lost || (dtz[child] == plies &&
+                                                        values_[child] == value_of(Wdl::loss));
+                                all_won = all_won && dtz[child] != 0;
+                        }
+                        if (wdl == Wdl::win ? any_lost : all_won) {
+                                next[i] = static_cast<std::uint16_t>(plies + 1);
+                                ++decided;
+                        }
+                }
+                return decided;
+        }
+
+        std::string signature_;
+        SignaturePieces pieces_;
+        RetrogradeOptions const& options_;
+        SolvedTables const& solved_;
+        unsigned threads_;
+        std::uint64_t size_;
+        std::uint64_t chunks_;
+        std::vector<std::uint8_t> values_;
+        std::vector<std::uint8_t> has_draw_;
+        std::vector<std::uint8_t> mated_;
+        std::vector<Children> children_;
+};
+
+}
+
+std::optional<TableIndex> table_index(Setup const& setup)
+{
+        auto const [light_kingside, light_queenside, dark_kingside, dark_queenside] =
+                setup.castling_rights;
+        if (light_kingside || light_queenside || dark_kingside || dark_queenside ||
+            setup.en_passant_position || setup.on_turn == Side::none) {
+                return std::nullopt;
+        }
+
+        std::string const light = side_pieces(setup.board, Side::light);
+        std::string const dark = side_pieces(setup.board, Side::dark);
+        if (light.size() + dark.size() > static_cast<std::size_t>(max_tablebase_pieces))
+                return std::nullopt;
+        TableIndex result {table_signature(light, dark), 0};
+        SignaturePieces pieces;
+        if (!parse_signature(result.signature, pieces))
+                return std::nullopt;
+        bool const swapped = result.signature.compare(0, light.size() + 1, light + 'v') != 0;
+        result.index = position_index(pieces, setup.board, setup.on_turn, swapped);
+        return result;
+}
+
+std::uint64_t table_size(std::string_view signature) noexcept
+{
+        SignaturePieces pieces;
+        if (!parse_signature(signature, pieces))
+                return 0;
+        return std::uint64_t(2) << (6 * pieces.count);
+}
+
+std::optional<Setup> table_setup(std::string_view signature, std::uint64_t index)
+{
+        SignaturePieces pieces;
+        if (!parse_signature(signature, pieces) || index >= table_size(signature))
+                return std::nullopt;
+
+        Setup setup {
+                .board = Board {Piece::none()},
+                .on_turn = (index % 2 == 0) ? Side::light : Side::dark,
+                .castling_rights = {false, false, false, false},
+                .en_passant_position = std::nullopt,
+                .halfmove_clock = 0,
+                .fullmove_number = 1
+        };
+        index /= 2;
+        for (int i = pieces.count - 1; i >= 0; --i) {
+                int const square = static_cast<int>(index % 64);
+                index /= 64;
+                Piece& piece = setup.board[square / board_size][square % board_size];
+                if (piece != Piece::none())
+                        return std::nullopt;
+                piece = Piece {
+                        .kind = pieces.kinds[i],
+                        .side = pieces.strong[i] ? Side::light : Side::dark
+                };
+        }
+        return setup;
+}
+
+bool solve_table(std::string_view signature, RetrogradeOptions const& options,
+                 SolvedTables& solved)
+{
+        if (solved.find(signature) != solved.cend())
+                return true;
+        auto const separator = signature.find('v');
+        bool const pawns_on_both_sides = signature.find('P') < separator &&
+                                         signature.find('P', separator) != std::string_view::npos;
+        if (table_size(signature) == 0 || pawns_on_both_sides ||
+            signature.size() - 1 > static_cast<std::size_t>(max_retrograde_pieces)) {
+                return false;
+        }
+
+        for (std::string const& dependency : dependencies(signature)) {
+                if (!solve_table(dependency, options, solved))
+                        return false;
+        }
+
+        unsigned const threads = options.threads != 0 ?
+                options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+        solved.emplace(std::string(signature),
+                       Solver(signature, options, solved, threads).solve());
+        return true;
+}
+
+bool write_solved_table(std::string const& directory, std::string_view signature,
+                        SolvedTable const& table)
+{
+        SignaturePieces pieces;
+        if (!parse_signature(signature, pieces) || pieces.count < min_tablebase_pieces)
+                return true;
+        TableWriter writer(signature);
+        for (std::uint64_t i = 0; i < table.values.size(); ++i) {
+                Wdl const wdl = table.values[i];
+                if (wdl == Wdl::invalid)
+                        continue;
+                bool const losing = wdl == Wdl::loss || wdl == Wdl::blessed_loss;
+                int const dtz = table.dtz[i];
+                writer.add(*table_setup(signature, i), wdl, losing ? -dtz : dtz);
+        }
+        std::string const path = directory + '/' + std::string(signature);
+        std::ofstream wdl(path + ".rtbw", std::ios::binary);
+        writer.write_wdl(wdl);
+        wdl.close();
+        std::ofstream dtz(path + ".rtbz", std::ios::binary);
+        writer.write_dtz(dtz);
+        dtz.close();
+        return !wdl.fail() && !dtz.fail();
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "tablebase.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+// A position's place in the solver's tables, which give every piece its
+// own square rather than reducing symmetric positions like the Syzygy
+// files do. The signature names the stronger side's pieces first, like
+// KRvK, and positions where dark is the stronger side are looked up with
+// the colours swapped.
+struct TableIndex {
+        std::string signature;
+        std::uint64_t index;
+};
+
+// Tables only cover positions without castling rights or en passant.
+std::optional<TableIndex> table_index(Setup const& setup);
+// How many positions the table for a signature has, 0 if it isn't valid.
+std::uint64_t table_size(std::string_view signature) noexcept;
+// The inverse of table_index, none if the pieces overlap.
+std::optional<Setup> table_setup(std::string_view signature, std::uint64_t index);
+
+struct SolvedTable {
+        // By table_index.
+        std::vector<Wdl> values;
+        // Plies to the next capture or pawn move, or to mate, for the wins
+        // and losses, as Tablebase::probe_dtz counts them but unsigned.
+        std::vector<std::uint16_t> dtz;
+};
+
+using SolvedTables = std::map<std::string, SolvedTable, std::less<>>;
+
+struct RetrogradeOptions {
+        // Zero for one thread per core.
+        unsigned threads = 0;
+        // Called after each pass with the signature, the pass number and how
+        // many positions were decided in it.
+        std::function<void(std::string_view, int, std::uint64_t)> progress;
+};
+
+int constexpr max_retrograde_pieces = 4;
+
+// Solves the table for a signature by retrograde analysis, after the
+// tables its captures and promotions lead to, which are added to solved
+// as well. Every position's moves are generated once by the rules engine,
+// in parallel, and wins and losses are then propagated back from the
+// checkmates pass by pass until nothing changes. What is left is drawn.
+// The distances to zeroing are propagated the same way afterwards, and
+// wins that take more than a hundred plies to the next capture or pawn
+// move are cursed.
+//
+// Up to max_retrograde_pieces pieces, and pawns on one side only, since
+// the tables can't hold en passant rights. Returns false for signatures
+// outside of that.
+bool solve_table(std::string_view signature, RetrogradeOptions const& options,
+                 SolvedTables& solved);
+
+// Writes a solved table to <directory>/<signature>.rtbw and .rtbz. Bare
+// kings are drawn without a table, so nothing is written for them. False
+// if a file can't be written.
+bool write_solved_table(std::string const& directory, std::string_view signature,
+                        SolvedTable const& table);
+
+}
@@ -46,6 +46,19 @@ RendererColorGuard::~RendererColorGuard()
         set_render_color(renderer_, previous_color_);
 }
 
+RenderTargetGuard::RenderTargetGuard(Renderer& renderer, Texture& target)
+        : renderer_(renderer)
+        , previous_target_(SDL_GetRenderTarget(&renderer))
+{
+        if (SDL_SetRenderTarget(&renderer_, &target) < 0)
+                throw Error();
+}
+
+RenderTargetGuard::~RenderTargetGuard()
+{
+        SDL_SetRenderTarget(&renderer_, previous_target_);
+}
+
 UniqueWindow create_window(std::string const& title, int width, int height)
 {
         UniqueWindow window(SDL_CreateWindow(title.c_str(),
@@ -70,7 +83,7 @@ void set_blend_mode(Renderer& renderer)
 
 UniqueRenderer create_renderer(Window& window, Color color)
 {
-        UniqueRenderer renderer(SDL_CreateRenderer(&window, -1, 0));
+        UniqueRenderer renderer(SDL_CreateRenderer(&window, -1, SDL_RENDERER_TARGETTEXTURE));
 
         if (!renderer)
                 throw Error();
@@ -128,6 +141,56 @@ void render_copy(Renderer& renderer,
         }
 }
 
+void render_rects(Renderer& renderer, std::vector<Rect> const& rects, Color color)
+{
+        if (rects.empty())
+                return;
+        RendererColorGuard _(renderer, color);
+        if (SDL_RenderFillRects(&renderer, rects.data(), static_cast<int>(rects.size())) < 0)
+                throw Error();
+}
+
+void render_copies(Renderer& renderer, Texture& texture, std::vector<Copy> const& copies)
+{
+        if (copies.empty())
+                return;
+        Dimensions const size = texture_dimensions(texture);
+        auto const width = static_cast<float>(size.width);
+        auto const height = static_cast<float>(size.height);
+
+        // Two triangles per copy, sharing the corners.
+        std::vector<SDL_Vertex> vertices;
+        std::vector<int> indices;
+        vertices.reserve(copies.size() * 4);
+        indices.reserve(copies.size() * 6);
+        for (Copy const& copy : copies) {
+                Rect const& src = copy.source;
+                Rect const& dst = copy.destination;
+                auto const first = static_cast<int>(vertices.size());
+                for (int corner = 0; corner < 4; ++corner) {
+                        int const right = corner & 1;
+                        int const bottom = corner >> 1;
+                        vertices.push_back(SDL_Vertex {
+                                .position = {
+                                        .x = static_cast<float>(dst.x + right * dst.w),
+                                        .y = static_cast<float>(dst.y + bottom * dst.h)
+                                },
+                                .color = white,
+                                .tex_coord = {
+                                        .x = static_cast<float>(src.x + right * src.w) / width,
+                                        .y = static_cast<float>(src.y + bottom * src.h) / height
+                                }
+                        });
+                }
+                for (int corner : {0, 1, 2, 2, 1, 3})
+                        indices.push_back(first + corner);
+        }
+        if (SDL_RenderGeometry(&renderer, &texture,
+                               vertices.data(), static_cast<int>(vertices.size()),
+                               indices.data(), static_cast<int>(indices.size())) < 0)
+                throw Error();
+}
+
 UniqueTexture load_texture(Renderer& renderer, std::string path)
 {
         UniqueTexture texture(IMG_LoadTexture(&renderer, path.c_str()));
@@ -136,6 +199,18 @@ UniqueTexture load_texture(Renderer& renderer, std::string path)
         return texture;
 }
 
+UniqueTexture create_target_texture(Renderer& renderer, int width, int height)
+{
+        UniqueTexture texture(SDL_CreateTexture(&renderer,
+                                                SDL_PIXELFORMAT_RGBA8888,
+                                                SDL_TEXTUREACCESS_TARGET,
+                                                width,
+                                                height));
+        if (!texture)
+                throw Error();
+        return texture;
+}
+
 Dimensions texture_dimensions(Texture& texture)
 {
         Dimensions dimensions;
@@ -169,6 +244,26 @@ std::optional<Event> poll_event()
         return std::nullopt;
 }
 
+std::optional<Event> wait_event(int timeout)
+{
+        Event event;
+        if (SDL_WaitEventTimeout(&event, timeout))
+                return event;
+        return std::nullopt;
+}
+
+void push_wake_up()
+{
+        Event event {};
+        event.type = Events::wake_up;
+        SDL_PushEvent(&event);
+}
+
+void set_window_title(Window& window, std::string const& title)
+{
+        SDL_SetWindowTitle(&window, title.c_str());
+}
+
 void message_box(std::string const& title, std::string const& message)
 {
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION,
@@ -6,6 +6,7 @@
 #include <string>
 #include <exception>
 #include <optional>
+#include <vector>
 
 namespace Sdl {
 
@@ -14,6 +15,9 @@ using EventType = SDL_EventType;
 namespace Events {
         auto constexpr quit = SDL_QUIT;
         auto constexpr key_down = SDL_KEYDOWN;
+        auto constexpr window = SDL_WINDOWEVENT;
+        auto constexpr render_targets_reset = SDL_RENDER_TARGETS_RESET;
+        auto constexpr wake_up = SDL_USEREVENT;
 }
 
 using Keycode = SDL_Keycode;
@@ -84,6 +88,21 @@ private:
         Color previous_color_;
 };
 
+// Sends drawing to a texture for as long as it lives.
+class RenderTargetGuard {
+public:
+        RenderTargetGuard(Renderer& renderer, Texture& target);
+        ~RenderTargetGuard();
+        RenderTargetGuard(RenderTargetGuard const&) = delete;
+        RenderTargetGuard(RenderTargetGuard&&) = delete;
+        RenderTargetGuard& operator=(RenderTargetGuard const&) = delete;
+        RenderTargetGuard& operator=(RenderTargetGuard&&) = delete;
+
+private:
+        Renderer& renderer_;
+        Texture* previous_target_;
+};
+
 struct Dimensions {
         int width;
         int height;
@@ -110,11 +129,28 @@ void render_copy(Renderer& Renderer,
                  Flip flip=Flip::none,
                  double angle=0.);
 
+struct Copy {
+        Rect source;
+        Rect destination;
+};
+
+// Batched versions of the above, one draw call for all rectangles of a
+// color or all copies from a texture.
+void render_rects(Renderer& renderer, std::vector<Rect> const& rects, Color color);
+void render_copies(Renderer& renderer, Texture& texture, std::vector<Copy> const& copies);
+
 UniqueTexture load_texture(Renderer& Renderer, std::string path);
+// A texture that can be drawn to through RenderTargetGuard.
+UniqueTexture create_target_texture(Renderer& renderer, int width, int height);
 Dimensions texture_dimensions(Texture& texture);
 Dimensions renderer_dimensions(Sdl::Renderer& Renderer);
 Ticks get_ticks() noexcept;
 std::optional<Event> poll_event();
+// Sleeps until there is an event or the timeout in milliseconds passes.
+std::optional<Event> wait_event(int timeout);
+// Queues a wake_up event. Safe to call from any thread.
+void push_wake_up();
+void set_window_title(Window& window, std::string const& title);
 void message_box(std::string const& title, std::string const& message);
 
 }
@@ -0,0 +1,357 @@
+#include "selfplay.h"
+#include "notation.h"
+#include "pgn.h"
+#include "tablebase.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace Chess {
+
+namespace {
+
+using std::chrono::milliseconds;
+using Clock = std::chrono::steady_clock;
+
+// Kept back from every move's share of the clock for the bookkeeping
+// around the search.
+milliseconds constexpr move_overhead {10};
+// Two-sided 95% quantile of the normal distribution.
+double constexpr confidence_z = 1.959964;
+
+std::string_view trim(std::string_view text) noexcept
+{
+        auto const first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos)
+                return {};
+        auto const last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+}
+
+// The board, side on turn, castling and en passant fields of an EPD line.
+std::string_view epd_position(std::string_view line) noexcept
+{
+        std::size_t end = 0;
+        for (int field = 0; field < 4; ++field) {
+                auto const start = line.find_first_not_of(" \t", end);
+                if (start == std::string_view::npos)
+                        return {};
+                end = std::min(line.find_first_of(" \t", start), line.size());
+        }
+        return line.substr(0, end);
+}
+
+std::vector<Opening> read_pgn_openings(std::string_view text)
+{
+        std::vector<Opening> openings;
+        PgnReader reader(text);
+        PgnGame pgn_game;
+        while (reader.next(pgn_game)) {
+                Opening opening {default_setup(), {}};
+                if (auto const fen = pgn_game.tag("FEN"); !fen.empty()) {
+                        std::optional const setup = parse_fen(fen);
+                        if (!setup)
+                                continue;
+                        opening.setup = *setup;
+                }
+                Game game(nullptr, opening.setup);
+                bool complete = true;
+                for (auto const san : pgn_game.main_line) {
+                        std::optional const move = parse_san(game, san);
+                        if (!move || !game.try_move(*move)) {
+                                complete = false;
+                                break;
+                        }
+                        opening.moves.push_back(*move);
+                }
+                if (complete)
+                        openings.push_back(std::move(opening));
+        }
+        return openings;
+}
+
+std::vector<Opening> read_epd_openings(std::string_view text)
+{
+        std::vector<Opening> openings;
+        while (!text.empty()) {
+                auto const end = std::min(text.find('\n'), text.size());
+                std::string_view const line = trim(text.substr(0, end));
+                text.remove_prefix(std::min(end + 1, text.size()));
+                if (line.empty() || line.front() == '#')
+                        continue;
+                if (std::optional const setup = parse_fen(epd_position(line)))
+                        openings.push_back(Opening {*setup, {}});
+        }
+        return openings;
+}
+
+double elo_of(double score) noexcept
+{
+        score = std::clamp(score, 1e-6, 1 - 1e-6);
+        return 400 * std::log10(score / (1 - score));
+}
+
+double score_of(double elo) noexcept
+{
+        return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+// The mean and variance of a single game's score.
+std::pair<double, double> score_moments(Score const& score) noexcept
+{
+        auto const n = static_cast<double>(score.games());
+        if (n == 0)
+                return {0.5, 0};
+        auto const wins = static_cast<double>(score.wins);
+        auto const draws = static_cast<double>(score.draws);
+        auto const losses = static_cast<double>(score.losses);
+        double const mean = (wins + draws / 2) / n;
+        double const variance = (wins * (1 - mean) * (1 - mean) +
+                                 draws * (0.5 - mean) * (0.5 - mean) +
+                                 losses * mean * mean) / n;
+        return {mean, variance};
+}
+
+PlayerOptions const& player(SelfplayOptions const& options, bool first_is_light,
+                            Side side) noexcept
+{
+        return (side == Side::light) == first_is_light ? options.first : options.second;
+}
+
+GameResult win_for(Side side) noexcept
+{
+        return side == Side::light ? GameResult::light_wins : GameResult::dark_wins;
+}
+
+// The PGN Termination tag for a game that ended on the board.
+char const* termination(Ending ending) noexcept
+{
+        switch (ending) {
+                case Ending::checkmate:
+                        return "checkmate";
+                case Ending::stalemate:
+                        return "stalemate";
+                case Ending::fivefold_repetition:
+                        return "fivefold repetition";
+                case Ending::seventy_five_move_rule:
+                        return "seventy-five-move rule";
+                case Ending::threefold_repetition:
+                        return "threefold repetition";
+                case Ending::fifty_move_rule:
+                        return "fifty-move rule";
+                default:
+                        return "";
+        }
+}
+
+// Mirrors the share of the clock the UCI engine would take.
+SearchLimits move_limits(PlayerOptions const& player, milliseconds remaining)
+{
+        SearchLimits limits = player.limits;
+        TimeControl const& time_control = player.time_control;
+        if (time_control.base.count() == 0)
+                return limits;
+        milliseconds time = remaining / 30 + time_control.increment / 2;
+        time = std::min(time, remaining - move_overhead);
+        time = std::max(time, milliseconds(1));
+        limits.time = limits.time.count() > 0 ? std::min(limits.time, time) : time;
+        return limits;
+}
+
+PlayedGame play_game(std::size_t index, Opening const& opening,
+                     SelfplayOptions const& options)
+{
+        PlayedGame played {
+                .index = index,
+                .first_is_light = (index % 2 == 0),
+                .start = opening.setup,
+                .moves = {},
+                .result = GameResult::unknown,
+                .termination = {}
+        };
+        Game game(nullptr, opening.setup);
+        for (Move move : opening.moves) {
+                game.try_move(move);
+                played.moves.push_back(move);
+        }
+
+        milliseconds clocks[] = {
+                player(options, played.first_is_light, Side::light).time_control.base,
+                player(options, played.first_is_light, Side::dark).time_control.base
+        };
+        for (int plies = 0;; ++plies) {
+                Side const on_turn = game.on_turn();
+                // Both players claim a draw as soon as they can.
+                if (on_turn == Side::none || game.claim_draw()) {
+                        Side const winner = game.winner();
+                        played.result = (winner == Side::none) ? GameResult::draw : win_for(winner);
+                        played.termination = termination(game.ending());
+                        break;
+                }
+                if (options.tablebase) {
+                        if (std::optional const winner = options.tablebase->adjudicate(game)) {
+                                played.result = (*winner == Side::none) ?
+                                        GameResult::draw : win_for(*winner);
+                                played.termination = "tablebase";
+                                break;
+                        }
+                }
+                if (plies >= options.max_plies) {
+                        played.result = GameResult::draw;
+                        played.termination = "move limit";
+                        break;
+                }
+
+                PlayerOptions const& to_move = player(options, played.first_is_light, on_turn);
+                milliseconds& clock = clocks[on_turn == Side::light ? 0 : 1];
+                Search search(game);
+                auto const start = Clock::now();
+                std::optional const move = search.run(move_limits(to_move, clock), nullptr);
+                if (to_move.time_control.base.count() > 0) {
+                        clock -= std::chrono::duration_cast<milliseconds>(Clock::now() - start);
+                        if (clock.count() < 0) {
+                                played.result = win_for(opposite_side(on_turn));
+                                played.termination = "time forfeit";
+                                break;
+                        }
+                        clock += to_move.time_control.increment;
+                }
+                game.try_move(*move);
+                played.moves.push_back(*move);
+        }
+        return played;
+}
+
+}
+
+std::vector<Opening> read_openings(std::string_view text)
+{
+        std::string_view const content = trim(text);
+        if (!content.empty() && content.front() == '[')
+                return read_pgn_openings(text);
+        return read_epd_openings(text);
+}
+
+std::size_t Score::games() const noexcept
+{
+        return wins + losses + draws;
+}
+
+void Score::add(PlayedGame const& game) noexcept
+{
+        switch (game.result) {
+                case GameResult::light_wins:
+                        ++(game.first_is_light ? wins : losses);
+                        break;
+                case GameResult::dark_wins:
+                        ++(game.first_is_light ? losses : wins);
+                        break;
+                default:
+                        ++draws;
+                        break;
+        }
+}
+
+EloEstimate estimate_elo(Score const& score) noexcept
+{
+        auto const [mean, variance] = score_moments(score);
+        double const margin = score.games() == 0 ? 0 :
+                confidence_z * std::sqrt(variance / static_cast<double>(score.games()));
+        return EloEstimate {
+                .elo = elo_of(mean),
+                .lower = elo_of(mean - margin),
+                .upper = elo_of(mean + margin)
+        };
+}
+
+SprtStatus sprt_status(Score const& score, Sprt const& sprt) noexcept
+{
+        auto const [mean, variance] = score_moments(score);
+        double const score0 = score_of(sprt.elo0);
+        double const score1 = score_of(sprt.elo1);
+        double const llr = variance == 0 ? 0 :
+                static_cast<double>(score.games()) * (score1 - score0) *
+                (2 * mean - score0 - score1) / (2 * variance);
+        return SprtStatus {
+                .llr = llr,
+                .lower = std::log(sprt.beta / (1 - sprt.alpha)),
+                .upper = std::log((1 - sprt.beta) / sprt.alpha)
+        };
+}
+
+void write_played_game(std::ostream& out, PlayedGame const& game,
+                       SelfplayOptions const& options)
+{
+        std::string const round = std::to_string(game.index + 1);
+        std::string const& light = player(options, game.first_is_light, Side::light).name;
+        std::string const& dark = player(options, game.first_is_light, Side::dark).name;
+        std::string_view const result = to_string(game.result);
+        std::vector<PgnTag> const tags = {
+                {"Event", "Selfplay"},
+                {"Site", "?"},
+                {"Date", "????.??.??"},
+                {"Round", round},
+                {"White", light},
+                {"Black", dark},
+                {"Result", result},
+                {"Termination", game.termination}
+        };
+        write_pgn(out, tags, game.start, game.moves, result);
+}
+
+Score run_selfplay(std::vector<Opening> const& openings, SelfplayOptions const& options,
+                   SelfplaySink const& sink)
+{
+        Opening const start_position {default_setup(), {}};
+        unsigned threads = options.concurrency != 0 ?
+                options.concurrency : std::max(std::thread::hardware_concurrency(), 1u);
+        threads = static_cast<unsigned>(std::min<std::size_t>(threads, options.games));
+
+        std::atomic<std::size_t> next {0};
+        std::atomic<bool> stopped {false};
+        std::mutex mutex;
+        Score score;
+        std::exception_ptr error;
+        auto const work = [&]
+        {
+                for (std::size_t i = next++; i < options.games && !stopped; i = next++) {
+                        Opening const& opening = openings.empty() ?
+                                start_position : openings[i / 2 % openings.size()];
+                        PlayedGame const game = play_game(i, opening, options);
+
+                        std::lock_guard const lock(mutex);
+                        // Games that finish after the test stopped don't count.
+                        if (stopped)
+                                return;
+                        score.add(game);
+                        try {
+                                if (sink)
+                                        sink(game, score);
+                        } catch (...) {
+                                error = std::current_exception();
+                                stopped = true;
+                                return;
+                        }
+                        if (options.sprt) {
+                                SprtStatus const status = sprt_status(score, *options.sprt);
+                                if (status.llr <= status.lower || status.llr >= status.upper)
+                                        stopped = true;
+                        }
+                }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; ++i)
+                workers.emplace_back(work);
+        work();
+        for (std::thread& worker : workers)
+                worker.join();
+        if (error)
+                std::rethrow_exception(error);
+        return score;
+}
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "archive.h"
+#include "chess.h"
+#include "engine.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+class Tablebase;
+
+// A starting position and the moves played from it.
+struct Opening {
+        Setup setup;
+        std::vector<Move> moves;
+};
+
+// Openings from the main lines of a PGN text if it starts with a tag, from
+// EPD lines otherwise, of which only the four position fields are used.
+// Games and lines that don't parse are skipped.
+std::vector<Opening> read_openings(std::string_view text);
+
+struct TimeControl {
+        // No clock if zero.
+        std::chrono::milliseconds base {0};
+        std::chrono::milliseconds increment {0};
+};
+
+struct PlayerOptions {
+        std::string name;
+        // Applied to every move, on top of the clock if there is one.
+        SearchLimits limits;
+        TimeControl time_control;
+};
+
+// Sequential probability ratio test of elo1 against elo0.
+struct Sprt {
+        double elo0 = 0;
+        double elo1 = 5;
+        double alpha = 0.05;
+        double beta = 0.05;
+};
+
+struct SelfplayOptions {
+        // Games played at once, one per thread. Zero for one per core.
+        unsigned concurrency = 0;
+        // Each opening is played twice in a row, with colours swapped.
+        std::size_t games = 2;
+        PlayerOptions first;
+        PlayerOptions second;
+        // Games still going after this many plies are drawn.
+        int max_plies = 400;
+        // Positions in these tables are adjudicated, if not null.
+        Tablebase const* tablebase = nullptr;
+        // Stops as soon as the test accepts either hypothesis.
+        std::optional<Sprt> sprt;
+};
+
+struct PlayedGame {
+        std::size_t index;
+        bool first_is_light;
+        Setup start;
+        // The opening moves included.
+        std::vector<Move> moves;
+        GameResult result;
+        // Like "checkmate" or "threefold repetition".
+        std::string termination;
+};
+
+// From the first player's point of view.
+struct Score {
+        std::size_t wins = 0;
+        std::size_t losses = 0;
+        std::size_t draws = 0;
+
+        std::size_t games() const noexcept;
+        void add(PlayedGame const& game) noexcept;
+};
+
+struct EloEstimate {
+        double elo;
+        // The 95% confidence interval.
+        double lower;
+        double upper;
+};
+
+EloEstimate estimate_elo(Score const& score) noexcept;
+
+struct SprtStatus {
+        double llr;
+        // Accept elo0 at or below lower, elo1 at or above upper.
+        double lower;
+        double upper;
+};
+
+// The log likelihood ratio under the normal approximation of the score.
+SprtStatus sprt_status(Score const& score, Sprt const& sprt) noexcept;
+
+// Writes a game as PGN, with the players and its termination as tags.
+void write_played_game(std::ostream& out, PlayedGame const& game,
+                       SelfplayOptions const& options);
+
+// Called with every game as it finishes and the score so far.
+using SelfplaySink = std::function<void(PlayedGame const&, Score const&)>;
+
+// Plays the games, the openings taken in turn, from the starting position if
+// there are none. Every thread plays one game at a time with a fresh Search
+// per move, so games share nothing but the openings and the tables. The
+// sink is called under a lock, in the order the games finish. Returns the
+// final score.
+Score run_selfplay(std::vector<Opening> const& openings, SelfplayOptions const& options,
+                   SelfplaySink const& sink);
+
+}
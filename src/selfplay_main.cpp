@@ -0,0 +1,188 @@
+#include "mapped_file.h"
+#include "selfplay.h"
+#include "tablebase.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+int usage(char const* name)
+{
+        std::cerr << "usage: " << name << " [-games n] [-concurrency n] [-openings file]\n"
+                  << "       [-pgnout file] [-maxplies n] [-tablebase dir]\n"
+                  << "       [-sprt elo0 elo1 alpha beta] <first> <second>\n"
+                  << "players are comma separated settings, like\n"
+                  << "name=new,depth=6,nodes=100000,movetime=50,tc=10+0.1\n"
+                  << "with the time control in seconds\n";
+        return 2;
+}
+
+std::chrono::milliseconds seconds(char const* text)
+{
+        return std::chrono::milliseconds(std::llround(std::strtod(text, nullptr) * 1000));
+}
+
+// Returns false on an unknown setting.
+bool parse_player(std::string const& text, Chess::PlayerOptions& player)
+{
+        std::size_t start = 0;
+        while (start < text.size()) {
+                std::size_t const end = std::min(text.find(',', start), text.size());
+                std::string const setting = text.substr(start, end - start);
+                start = end + 1;
+                std::size_t const equals = setting.find('=');
+                if (equals == std::string::npos)
+                        return false;
+                std::string const key = setting.substr(0, equals);
+                std::string const value = setting.substr(equals + 1);
+                if (key == "name") {
+                        player.name = value;
+                } else if (key == "depth") {
+                        player.limits.depth = std::atoi(value.c_str());
+                } else if (key == "nodes") {
+                        player.limits.nodes = std::strtoull(value.c_str(), nullptr, 10);
+                } else if (key == "movetime") {
+                        player.limits.time = std::chrono::milliseconds(std::atoll(value.c_str()));
+                } else if (key == "tc") {
+                        std::size_t const plus = value.find('+');
+                        player.time_control.base = seconds(value.c_str());
+                        if (plus != std::string::npos)
+                                player.time_control.increment = seconds(value.c_str() + plus + 1);
+                } else {
+                        return false;
+                }
+        }
+        // Something has to end the search.
+        if (player.limits.depth == 0 && player.limits.nodes == 0 &&
+            player.limits.time.count() == 0 && player.time_control.base.count() == 0) {
+                player.limits.depth = 4;
+        }
+        return true;
+}
+
+}
+
+// Plays engine settings against each other and prints the score, the Elo
+// difference with its 95% interval and the games per hour.
+int main(int argc, char** argv)
+{
+        using namespace Chess;
+
+        SelfplayOptions options;
+        char const* openings_path = nullptr;
+        char const* pgn_path = nullptr;
+        char const* tablebase_path = nullptr;
+        std::vector<std::string> players;
+        for (int arg = 1; arg < argc; ++arg) {
+                auto const option = [&](char const* name, int values)
+                {
+                        return std::strcmp(argv[arg], name) == 0 && arg + values < argc;
+                };
+                if (option("-games", 1)) {
+                        options.games = std::strtoull(argv[++arg], nullptr, 10);
+                } else if (option("-concurrency", 1)) {
+                        options.concurrency = static_cast<unsigned>(std::strtoul(argv[++arg], nullptr, 10));
+                } else if (option("-openings", 1)) {
+                        openings_path = argv[++arg];
+                } else if (option("-pgnout", 1)) {
+                        pgn_path = argv[++arg];
+                } else if (option("-maxplies", 1)) {
+                        options.max_plies = std::atoi(argv[++arg]);
+                } else if (option("-tablebase", 1)) {
+                        tablebase_path = argv[++arg];
+                } else if (option("-sprt", 4)) {
+                        options.sprt = Sprt {
+                                .elo0 = std::strtod(argv[arg + 1], nullptr),
+                                .elo1 = std::strtod(argv[arg + 2], nullptr),
+                                .alpha = std::strtod(argv[arg + 3], nullptr),
+                                .beta = std::strtod(argv[arg + 4], nullptr)
+                        };
+                        arg += 4;
+                } else if (argv[arg][0] != '-') {
+                        players.push_back(argv[arg]);
+                } else {
+                        return usage(argv[0]);
+                }
+        }
+        if (players.size() != 2)
+                return usage(argv[0]);
+        options.first.name = "first";
+        options.second.name = "second";
+        if (!parse_player(players[0], options.first) ||
+            !parse_player(players[1], options.second)) {
+                return usage(argv[0]);
+        }
+
+        try {
+                std::vector<Opening> openings;
+                if (openings_path) {
+                        MappedFile const file(openings_path);
+                        openings = read_openings(file.text());
+                        std::cerr << openings.size() << " openings\n";
+                }
+                std::unique_ptr<Tablebase> tablebase;
+                if (tablebase_path) {
+                        tablebase = std::make_unique<Tablebase>(tablebase_path);
+                        options.tablebase = tablebase.get();
+                }
+                std::ofstream pgn_out;
+                if (pgn_path) {
+                        pgn_out.open(pgn_path);
+                        if (!pgn_out) {
+                                std::cerr << pgn_path << ": can't open for writing\n";
+                                return 2;
+                        }
+                }
+
+                auto const start = std::chrono::steady_clock::now();
+                Score const score = run_selfplay(openings, options,
+                        [&](PlayedGame const& game, Score const& score)
+                        {
+                                if (pgn_path)
+                                        write_played_game(pgn_out, game, options);
+                                std::cerr << "game " << game.index + 1 << ": "
+                                          << to_string(game.result) << " (" << game.termination
+                                          << "), " << score.wins << " - " << score.losses
+                                          << " - " << score.draws << '\n';
+                        }
+                );
+                std::chrono::duration<double> const elapsed =
+                        std::chrono::steady_clock::now() - start;
+
+                EloEstimate const elo = estimate_elo(score);
+                double const points = static_cast<double>(score.wins) +
+                                      static_cast<double>(score.draws) / 2;
+                std::cout << std::fixed << std::setprecision(1)
+                          << "Score of " << options.first.name << " vs " << options.second.name
+                          << ": " << score.wins << " - " << score.losses << " - "
+                          << score.draws << " [" << std::setprecision(3)
+                          << points / static_cast<double>(std::max<std::size_t>(score.games(), 1))
+                          << "] " << score.games() << '\n'
+                          << std::setprecision(1)
+                          << "Elo difference: " << elo.elo << " [" << elo.lower << ", "
+                          << elo.upper << "]\n";
+                if (options.sprt) {
+                        SprtStatus const status = sprt_status(score, *options.sprt);
+                        std::cout << std::setprecision(2) << "SPRT: llr " << status.llr
+                                  << " (" << status.lower << ", " << status.upper << ")"
+                                  << (status.llr >= status.upper ? ", H1 accepted" :
+                                      status.llr <= status.lower ? ", H0 accepted" : "")
+                                  << '\n';
+                }
+                std::cout << std::setprecision(0) << "Games per hour: "
+                          << static_cast<double>(score.games()) * 3600 /
+                             std::max(elapsed.count(), 1e-3)
+                          << '\n';
+                return 0;
+        } catch (std::exception const& error) {
+                std::cerr << error.what() << '\n';
+                return 2;
+        }
+}
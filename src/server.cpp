@@ -0,0 +1,443 @@
+#include "server.h"
+#include "notation.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Chess {
+
+namespace {
+
+// IDs are generation:32 slot:24 shard:8, so a closed game's ID doesn't
+// reach the game that reuses its slot.
+unsigned constexpr max_shards = 256;
+unsigned constexpr shard_bits = 8;
+unsigned constexpr slot_bits = 24;
+std::uint32_t constexpr max_slots = std::uint32_t(1) << slot_bits;
+
+enum class Command {
+        new_game,
+        move,
+        undo,
+        state,
+        fen,
+        moves,
+        close
+};
+
+std::optional<Command> parse_command(std::string_view text) noexcept
+{
+        std::pair<std::string_view, Command> constexpr commands[] = {
+                {"new", Command::new_game},
+                {"move", Command::move},
+                {"undo", Command::undo},
+                {"state", Command::state},
+                {"fen", Command::fen},
+                {"moves", Command::moves},
+                {"close", Command::close}
+        };
+        for (auto const& [name, command] : commands) {
+                if (text == name)
+                        return command;
+        }
+        return std::nullopt;
+}
+
+// Splits off the text up to the next space.
+std::string_view next_word(std::string_view& text) noexcept
+{
+        auto const start = std::min(text.find_first_not_of(' '), text.size());
+        text.remove_prefix(start);
+        auto const end = std::min(text.find(' '), text.size());
+        std::string_view const word = text.substr(0, end);
+        text.remove_prefix(end);
+        return word;
+}
+
+std::optional<std::uint64_t> parse_id(std::string_view text) noexcept
+{
+        std::uint64_t id = 0;
+        auto const [end, error] = std::from_chars(text.data(), text.data() + text.size(), id);
+        if (error != std::errc() || end != text.data() + text.size() || text.empty())
+                return std::nullopt;
+        return id;
+}
+
+std::string game_state(Game const& game)
+{
+        switch (game.on_turn()) {
+                case Side::light:
+                        return "light";
+                case Side::dark:
+                        return "dark";
+                default:
+                        break;
+        }
+        switch (game.winner()) {
+                case Side::light:
+                        return "1-0";
+                case Side::dark:
+                        return "0-1";
+                default:
+                        return "1/2-1/2";
+        }
+}
+
+void write_all(int fd, std::string_view text)
+{
+        while (!text.empty()) {
+                ssize_t const written = ::write(fd, text.data(), text.size());
+                if (written < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        throw std::system_error(errno, std::generic_category(), "write");
+                }
+                text.remove_prefix(static_cast<std::size_t>(written));
+        }
+}
+
+}
+
+struct GameServer::Shard {
+        struct Request {
+                std::string tag;
+                Command command;
+                std::uint64_t id;
+                std::string argument;
+                Reply reply;
+        };
+
+        struct Slot {
+                Game game {nullptr};
+                std::uint32_t generation = 0;
+                bool open = false;
+        };
+
+        explicit Shard(unsigned index)
+                : index(index)
+                , thread([this] { run(); })
+        {}
+
+        ~Shard()
+        {
+                {
+                        std::lock_guard lock(mutex);
+                        stopping = true;
+                        ready.notify_one();
+                }
+                thread.join();
+        }
+
+        void push(Request request)
+        {
+                std::lock_guard lock(mutex);
+                queue.push_back(std::move(request));
+                ready.notify_one();
+        }
+
+        // Takes the whole queue at once, so the lock is held once per batch
+        // rather than once per request.
+        void run()
+        {
+                std::vector<Request> batch;
+                while (true) {
+                        {
+                                std::unique_lock lock(mutex);
+                                ready.wait(lock, [this] { return !queue.empty() || stopping; });
+                                if (queue.empty())
+                                        return;
+                                batch.swap(queue);
+                        }
+                        for (Request& request : batch) {
+                                std::string const reply = request.tag + ' ' + handle(request);
+                                try {
+                                        request.reply(reply);
+                                } catch (...) {
+                                        // The connection is gone, the games stay.
+                                }
+                        }
+                        batch.clear();
+                }
+        }
+
+        std::string handle(Request const& request)
+        {
+                using namespace std::string_literals;
+
+                if (request.command == Command::new_game)
+                        return new_game(request.argument);
+
+                Slot* const slot = find(request.id);
+                if (!slot)
+                        return "error unknown game"s;
+                Game& game = slot->game;
+                switch (request.command) {
+                        case Command::move: {
+                                std::optional const move = parse_uci(game, request.argument);
+                                if (!move || !game.try_move(*move))
+                                        return "error illegal move"s;
+                                // Draws are claimed for the players as
+                                // soon as they can be.
+                                game.claim_draw();
+                                return "ok "s + game_state(game);
+                        }
+                        case Command::undo:
+                                game.undo_move();
+                                return "ok "s + game_state(game);
+                        case Command::state:
+                                return "ok "s + game_state(game);
+                        case Command::fen:
+                                return "ok "s + to_fen(game.setup());
+                        case Command::moves: {
+                                std::string result = "ok"s;
+                                Board const board = game.board();
+                                for (Move move : game.valid_moves())
+                                        result += ' ' + to_uci(board, move);
+                                return result;
+                        }
+                        case Command::close:
+                                // Lets go of the history right away rather
+                                // than when the slot is reused.
+                                slot->game = Game(nullptr);
+                                slot->open = false;
+                                ++slot->generation;
+                                free_slots.push_back(slot_index(request.id));
+                                --open_games;
+                                return "ok"s;
+                        default:
+                                return "error unknown command"s;
+                }
+        }
+
+        std::string new_game(std::string_view fen)
+        {
+                using namespace std::string_literals;
+
+                std::optional const setup = fen.empty() ? default_setup() : parse_fen(fen);
+                if (!setup)
+                        return "error invalid FEN"s;
+                std::uint32_t index = 0;
+                if (!free_slots.empty()) {
+                        index = free_slots.back();
+                        free_slots.pop_back();
+                } else if (slots.size() < max_slots) {
+                        index = static_cast<std::uint32_t>(slots.size());
+                        slots.emplace_back();
+                } else {
+                        return "error too many games"s;
+                }
+                Slot& slot = slots[index];
+                slot.game = Game(nullptr, *setup);
+                slot.open = true;
+                ++open_games;
+                std::uint64_t const id = std::uint64_t(slot.generation) << (slot_bits + shard_bits) |
+                                         std::uint64_t(index) << shard_bits | this->index;
+                return "ok "s + std::to_string(id);
+        }
+
+        static std::uint32_t slot_index(std::uint64_t id) noexcept
+        {
+                return static_cast<std::uint32_t>(id >> shard_bits) & (max_slots - 1);
+        }
+
+        Slot* find(std::uint64_t id) noexcept
+        {
+                std::uint32_t const index = slot_index(id);
+                if (index >= slots.size())
+                        return nullptr;
+                Slot& slot = slots[index];
+                auto const generation = static_cast<std::uint32_t>(id >> (slot_bits + shard_bits));
+                if (!slot.open || slot.generation != generation)
+                        return nullptr;
+                return &slot;
+        }
+
+        unsigned index;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<Request> queue;
+        bool stopping = false;
+        // Only touched by the shard's thread.
+        std::vector<Slot> slots;
+        std::vector<std::uint32_t> free_slots;
+        std::atomic<std::size_t> open_games {0};
+        // Last, so it starts once everything else is there.
+        std::thread thread;
+};
+
+GameServer::GameServer(unsigned shards)
+{
+        if (shards == 0)
+                shards = std::max(std::thread::hardware_concurrency(), 1u);
+        shards = std::min(shards, max_shards);
+        shards_.reserve(shards);
+        for (unsigned i = 0; i < shards; ++i)
+                shards_.push_back(std::make_unique<Shard>(i));
+}
+
+GameServer::~GameServer() = default;
+
+void GameServer::submit(std::string_view line, Reply reply)
+{
+        using namespace std::string_literals;
+
+        if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+        std::string_view const tag = next_word(line);
+        std::optional const command = parse_command(next_word(line));
+        if (!command) {
+                reply(std::string(tag) + " error unknown command"s);
+                return;
+        }
+
+        Shard::Request request {std::string(tag), *command, 0, {}, std::move(reply)};
+        std::size_t shard = 0;
+        if (*command == Command::new_game) {
+                shard = next_shard_++ % shards_.size();
+        } else {
+                std::optional const id = parse_id(next_word(line));
+                shard = id ? (*id & (max_shards - 1)) : shards_.size();
+                if (shard >= shards_.size()) {
+                        request.reply(request.tag + " error unknown game"s);
+                        return;
+                }
+                request.id = *id;
+        }
+        auto const start = std::min(line.find_first_not_of(' '), line.size());
+        request.argument = std::string(line.substr(start));
+        shards_[shard]->push(std::move(request));
+}
+
+std::size_t GameServer::games() const noexcept
+{
+        std::size_t count = 0;
+        for (auto const& shard : shards_)
+                count += shard->open_games;
+        return count;
+}
+
+void serve_connection(GameServer& server, int in_fd, int out_fd)
+{
+        // Shared with the replies, which may outlive the read loop.
+        struct Connection {
+                int out_fd;
+                std::mutex mutex;
+                std::condition_variable answered;
+                std::size_t pending = 0;
+                bool broken = false;
+        };
+        auto const connection = std::make_shared<Connection>();
+        connection->out_fd = out_fd;
+
+        auto const reply = [connection](std::string const& line)
+        {
+                std::lock_guard lock(connection->mutex);
+                if (!connection->broken) {
+                        try {
+                                write_all(connection->out_fd, line + '\n');
+                        } catch (std::system_error const&) {
+                                connection->broken = true;
+                        }
+                }
+                --connection->pending;
+                connection->answered.notify_all();
+        };
+
+        std::vector<char> buffer(1 << 16);
+        std::string partial;
+        while (true) {
+                ssize_t const size = ::read(in_fd, buffer.data(), buffer.size());
+                if (size < 0 && errno == EINTR)
+                        continue;
+                if (size <= 0)
+                        break;
+                partial.append(buffer.data(), static_cast<std::size_t>(size));
+                std::size_t start = 0;
+                for (auto end = partial.find('\n'); end != std::string::npos;
+                     end = partial.find('\n', start)) {
+                        std::string_view const line(partial.data() + start, end - start);
+                        start = end + 1;
+                        if (line.empty())
+                                continue;
+                        {
+                                std::lock_guard lock(connection->mutex);
+                                ++connection->pending;
+                        }
+                        server.submit(line, reply);
+                }
+                partial.erase(0, start);
+        }
+
+        std::unique_lock lock(connection->mutex);
+        connection->answered.wait(lock, [&] { return connection->pending == 0; });
+}
+
+void serve_unix_socket(GameServer& server, std::string const& path)
+{
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof address.sun_path)
+                throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        int const listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+                throw std::system_error(errno, std::generic_category(), "socket");
+        ::unlink(path.c_str());
+        if (::bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof address) < 0 ||
+            ::listen(listener, SOMAXCONN) < 0) {
+                int const error = errno;
+                ::close(listener);
+                throw std::system_error(error, std::generic_category(), path);
+        }
+
+        // Finished connections are joined whenever another one comes in,
+        // so that only the open ones keep a thread.
+        struct Connection {
+                std::thread thread;
+                std::shared_ptr<std::atomic<bool>> done;
+        };
+        std::vector<Connection> connections;
+        while (true) {
+                int const fd = ::accept(listener, nullptr, nullptr);
+                if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                                continue;
+                        int const error = errno;
+                        ::close(listener);
+                        for (Connection& connection : connections)
+                                connection.thread.join();
+                        throw std::system_error(error, std::generic_category(), "accept");
+                }
+                for (std::size_t i = 0; i < connections.size();) {
+                        if (connections[i].done->load()) {
+                                connections[i].thread.join();
+                                connections[i] = std::move(connections.back());
+                                connections.pop_back();
+                        } else {
+                                ++i;
+                        }
+                }
+                auto const done = std::make_shared<std::atomic<bool>>(false);
+                connections.push_back(Connection {
+                        .thread = std::thread([&server, fd, done]
+                        {
+                                serve_connection(server, fd, fd);
+                                ::close(fd);
+                                *done = true;
+                        }),
+                        .done = done
+                });
+        }
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "chess.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Chess {
+
+// Hosts many games at once. Games are spread over shards by ID, each shard
+// a thread that alone touches its games, so requests for different shards
+// never wait on each other. A shard keeps its games in a pool of slots that
+// are reused once a game is closed, and every game points at the same
+// shared rules.
+//
+// Requests are lines of the form "<tag> <command> [arguments]", answered
+// with "<tag> ok [result]" or "<tag> error <reason>":
+//
+//     new [fen]         the ID of a new game
+//     move <id> <uci>   the state after the move, with any draw that can
+//                       be claimed claimed
+//     undo <id>         the state after taking a move back
+//     state <id>        light or dark for the side on turn, or the result
+//     fen <id>          the position
+//     moves <id>        the legal moves in UCI notation
+//     close <id>        nothing, the ID is invalid afterwards
+//
+// The tag is up to the client and lets it pipeline requests, since replies
+// about games on different shards can come back in any order.
+class GameServer {
+public:
+        using Reply = std::function<void(std::string const& line)>;
+
+        // Zero for one shard per core.
+        explicit GameServer(unsigned shards = 0);
+        ~GameServer();
+        GameServer(GameServer const&) = delete;
+        GameServer& operator=(GameServer const&) = delete;
+
+        // Queues the request on its game's shard. The reply is called from
+        // the shard's thread, or right away for requests that don't parse.
+        void submit(std::string_view line, Reply reply);
+        // Open games, counted as the shards get to the requests.
+        std::size_t games() const noexcept;
+
+private:
+        struct Shard;
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        // Spreads new games over the shards in turn.
+        std::atomic<std::uint64_t> next_shard_ {0};
+};
+
+// Reads requests from in_fd until it closes and writes the replies to
+// out_fd, returning once every request has been answered.
+void serve_connection(GameServer& server, int in_fd, int out_fd);
+
+// Accepts connections on a Unix domain socket at path, each served on its
+// own thread. Only returns by throwing std::system_error.
+void serve_unix_socket(GameServer& server, std::string const& path);
+
+}
@@ -0,0 +1,232 @@
+#include "server.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+int usage(char const* name)
+{
+        std::cerr << "usage: " << name << " stdio [shards]\n"
+                  << "       " << name << " listen <socket> [shards]\n"
+                  << "       " << name << " load <socket> [connections] [games] [plies]\n";
+        return 2;
+}
+
+int connect_to(std::string const& path)
+{
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof address.sun_path)
+                throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        int const fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 ||
+            ::connect(fd, reinterpret_cast<sockaddr const*>(&address), sizeof address) < 0) {
+                int const error = errno;
+                if (fd >= 0)
+                        ::close(fd);
+                throw std::system_error(error, std::generic_category(), path);
+        }
+        return fd;
+}
+
+// Blocking line I/O on a socket.
+class LineChannel {
+public:
+        explicit LineChannel(int fd) noexcept
+                : fd_(fd)
+        {}
+
+        void send(std::string_view text)
+        {
+                while (!text.empty()) {
+                        ssize_t const written = ::write(fd_, text.data(), text.size());
+                        if (written < 0 && errno == EINTR)
+                                continue;
+                        if (written < 0)
+                                throw std::system_error(errno, std::generic_category(), "write");
+                        text.remove_prefix(static_cast<std::size_t>(written));
+                }
+        }
+
+        std::string receive()
+        {
+                while (true) {
+                        auto const end = buffer_.find('\n', start_);
+                        if (end != std::string::npos) {
+                                std::string line = buffer_.substr(start_, end - start_);
+                                start_ = end + 1;
+                                return line;
+                        }
+                        buffer_.erase(0, start_);
+                        start_ = 0;
+                        char chunk[1 << 14];
+                        ssize_t const size = ::read(fd_, chunk, sizeof chunk);
+                        if (size < 0 && errno == EINTR)
+                                continue;
+                        if (size <= 0)
+                                throw std::system_error(size < 0 ? errno : ECONNRESET,
+                                                        std::generic_category(), "read");
+                        buffer_.append(chunk, static_cast<std::size_t>(size));
+                }
+        }
+
+private:
+        int fd_;
+        std::string buffer_;
+        std::size_t start_ = 0;
+};
+
+struct LoadGame {
+        std::string id;
+        int plies = 0;
+        bool over = false;
+        std::vector<std::string> moves;
+};
+
+// The words of a reply after its tag and "ok".
+std::vector<std::string> reply_words(std::string const& line)
+{
+        std::vector<std::string> words;
+        std::size_t start = 0;
+        while (start < line.size()) {
+                auto const end = std::min(line.find(' ', start), line.size());
+                if (end > start)
+                        words.push_back(line.substr(start, end - start));
+                start = end + 1;
+        }
+        if (words.size() < 2 || words[1] != "ok")
+                throw std::runtime_error("bad reply: " + line);
+        words.erase(words.begin(), words.begin() + 2);
+        return words;
+}
+
+// Plays random games over one connection, every round sending one request
+// per live game before reading the replies, which are matched by tag.
+std::size_t play_load(std::string const& path, int games, int max_plies, unsigned seed)
+{
+        int const fd = connect_to(path);
+        LineChannel channel(fd);
+        std::mt19937 random(seed);
+        std::vector<LoadGame> live(static_cast<std::size_t>(games));
+        std::size_t requests = 0;
+
+        auto const round = [&](auto const& request, auto const& answer)
+        {
+                std::string batch;
+                std::size_t sent = 0;
+                for (std::size_t i = 0; i < live.size(); ++i) {
+                        if (live[i].over)
+                                continue;
+                        batch += std::to_string(i) + ' ' + request(live[i]) + '\n';
+                        ++sent;
+                }
+                channel.send(batch);
+                requests += sent;
+                for (std::size_t i = 0; i < sent; ++i) {
+                        std::string const line = channel.receive();
+                        std::size_t const index = std::stoul(line);
+                        answer(live.at(index), reply_words(line));
+                }
+                return sent;
+        };
+
+        round([](LoadGame const&) { return std::string("new"); },
+              [](LoadGame& game, std::vector<std::string> const& words) { game.id = words.at(0); });
+        while (true) {
+                round([](LoadGame const& game) { return "moves " + game.id; },
+                      [](LoadGame& game, std::vector<std::string> const& words) { game.moves = words; });
+                std::size_t const sent = round(
+                        [&](LoadGame const& game)
+                        {
+                                if (game.moves.empty() || game.plies >= max_plies)
+                                        return "close " + game.id;
+                                std::uniform_int_distribution<std::size_t> pick(0, game.moves.size() - 1);
+                                return "move " + game.id + ' ' + game.moves[pick(random)];
+                        },
+                        [&](LoadGame& game, std::vector<std::string> const& words)
+                        {
+                                if (game.moves.empty() || game.plies >= max_plies)
+                                        game.over = true;
+                                else
+                                        ++game.plies;
+                                (void) words;
+                        }
+                );
+                if (sent == 0)
+                        break;
+        }
+        ::close(fd);
+        return requests;
+}
+
+int load(char const* path, unsigned connections, int games, int max_plies)
+{
+        auto const start = std::chrono::steady_clock::now();
+        std::vector<std::thread> clients;
+        std::vector<std::size_t> requests(connections);
+        for (unsigned i = 0; i < connections; ++i) {
+                clients.emplace_back([&, i]
+                {
+                        try {
+                                requests[i] = play_load(path, games, max_plies, i);
+                        } catch (std::exception const& error) {
+                                std::cerr << "client " << i << ": " << error.what() << '\n';
+                        }
+                });
+        }
+        std::size_t total = 0;
+        for (unsigned i = 0; i < connections; ++i) {
+                clients[i].join();
+                total += requests[i];
+        }
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << connections * static_cast<unsigned>(games) << " games, " << total
+                  << " requests, " << elapsed.count() << " s, "
+                  << static_cast<double>(total) / elapsed.count() << " requests/s\n";
+        return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+        using namespace Chess;
+
+        if (argc < 2)
+                return usage(argv[0]);
+        std::string const command = argv[1];
+        try {
+                if (command == "stdio") {
+                        GameServer server(argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 0);
+                        serve_connection(server, STDIN_FILENO, STDOUT_FILENO);
+                        return 0;
+                }
+                if (command == "listen" && argc > 2) {
+                        GameServer server(argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 0);
+                        serve_unix_socket(server, argv[2]);
+                        return 0;
+                }
+                if (command == "load" && argc > 2) {
+                        return load(argv[2],
+                                    argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 4,
+                                    argc > 4 ? std::atoi(argv[4]) : 250,
+                                    argc > 5 ? std::atoi(argv[5]) : 80);
+                }
+        } catch (std::exception const& error) {
+                std::cerr << error.what() << '\n';
+                return 2;
+        }
+        return usage(argv[0]);
+}
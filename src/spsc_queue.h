@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace Chess {
+
+// A bounded queue between exactly one producer thread and one consumer
+// thread that never blocks or takes a lock. The indices only grow, so full
+// and empty are told apart without wasting a slot.
+template <class T, std::size_t capacity>
+class SpscQueue {
+        static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0,
+                      "the capacity must be a power of two");
+
+public:
+        // Producer only. False if the queue is full.
+        bool try_push(T value)
+        {
+                std::size_t const tail = tail_.load(std::memory_order_relaxed);
+                if (tail - head_.load(std::memory_order_acquire) == capacity)
+                        return false;
+                items_[tail % capacity] = std::move(value);
+                tail_.store(tail + 1, std::memory_order_release);
+                return true;
+        }
+
+        // Consumer only.
+        std::optional<T> try_pop()
+        {
+                std::size_t const head = head_.load(std::memory_order_relaxed);
+                if (head == tail_.load(std::memory_order_acquire))
+                        return std::nullopt;
+                std::optional<T> value = std::move(items_[head % capacity]);
+                head_.store(head + 1, std::memory_order_release);
+                return value;
+        }
+
+private:
+        std::array<T, capacity> items_ {};
+        // On lines of their own, so the two threads don't keep taking the
+        // cache line from each other.
+        alignas(64) std::atomic<std::size_t> head_ {0};
+        alignas(64) std::atomic<std::size_t> tail_ {0};
+};
+
+}
@@ -0,0 +1,1576 @@
+#include "tablebase.h"
+#include "byte_io.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <dirent.h>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+
+namespace Chess {
+
+namespace {
+
+// Syzygy numbers the squares from a1 = 0 to h8 = 63 and the pieces from
+// 1 for a light pawn to 6 for a light king, the dark ones 8 higher. A
+// table's light side is the first side of its signature.
+int constexpr pawn_code = 1;
+int constexpr king_code = 6;
+int constexpr dark_code = 8;
+int constexpr max_pieces = max_tablebase_pieces;
+
+unsigned char constexpr wdl_magic[] = {0x71, 0xe8, 0x23, 0x5d};
+unsigned char constexpr dtz_magic[] = {0xd7, 0x66, 0x0c, 0xa5};
+std::string_view constexpr wdl_suffix = ".rtbw";
+std::string_view constexpr dtz_suffix = ".rtbz";
+
+// The first byte of a file.
+unsigned constexpr split_flag = 1;
+unsigned constexpr pawns_flag = 2;
+// The first byte of a sub-table.
+unsigned constexpr stm_flag = 1;
+unsigned constexpr mapped_flag = 2;
+unsigned constexpr win_plies_flag = 4;
+unsigned constexpr loss_plies_flag = 8;
+unsigned constexpr wide_flag = 16;
+unsigned constexpr single_value_flag = 128;
+
+// A tree entry is a leaf when its right half is this.
+int constexpr leaf = 0xfff;
+
+// What the writer uses: 64 byte blocks, a sparse index entry every 1024
+// values and codes of at most 24 bits.
+int constexpr block_size_log2 = 6;
+int constexpr span_log2 = 10;
+int constexpr max_code_length = 24;
+
+// The order pieces are listed in a signature, by code.
+char constexpr piece_letters[] = "KQRBNP";
+int constexpr letter_codes[] = {6, 5, 4, 3, 2, 1};
+
+// The Syzygy files are named with the side with more pieces first, or
+// else the one whose pieces are stronger, compared from the strongest
+// down. Each side's pieces are listed like KRP.
+bool dark_is_stronger(std::string_view light, std::string_view dark) noexcept
+{
+        if (light.size() != dark.size())
+                return dark.size() > light.size();
+        std::string_view const letters = piece_letters;
+        for (std::size_t i = 0; i < light.size(); ++i) {
+                if (light[i] != dark[i])
+                        return letters.find(dark[i]) < letters.find(light[i]);
+        }
+        return false;
+}
+
+int file_of(int square) noexcept
+{
+        return square & 7;
+}
+
+int rank_of(int square) noexcept
+{
+        return square >> 3;
+}
+
+// Above the a1-h8 diagonal positive, on it 0 and below it negative.
+int off_diagonal(int square) noexcept
+{
+        return rank_of(square) - file_of(square);
+}
+
+bool kings_touch(int square1, int square2) noexcept
+{
+        return std::abs(file_of(square1) - file_of(square2)) <= 1 &&
+               std::abs(rank_of(square1) - rank_of(square2)) <= 1;
+}
+
+int piece_code(Piece piece) noexcept
+{
+        int const type = [&]
+        {
+                switch (piece.kind) {
+                        case Piece::Kind::pawn:
+                                return 1;
+                        case Piece::Kind::knight:
+                                return 2;
+                        case Piece::Kind::bishop:
+                                return 3;
+                        case Piece::Kind::rook:
+                                return 4;
+                        case Piece::Kind::queen:
+                                return 5;
+                        case Piece::Kind::king:
+                                return 6;
+                        default:
+                                return 0;
+                }
+        }();
+        return (type != 0 && piece.side == Side::dark) ? type + dark_code : type;
+}
+
+Piece board_piece(Board const& board, int square) noexcept
+{
+        return board[board_size - 1 - rank_of(square)][file_of(square)];
+}
+
+// How many pieces there are of each code, and the key they make.
+using PieceCounts = std::array<int, 16>;
+
+std::uint64_t material_key(PieceCounts const& counts) noexcept
+{
+        std::uint64_t key = 0;
+        for (int code = 0; code < 16; ++code)
+                key |= static_cast<std::uint64_t>(counts[code]) << (4 * code);
+        return key;
+}
+
+PieceCounts swap_colours(PieceCounts const& counts) noexcept
+{
+        PieceCounts swapped {};
+        for (int code = 0; code < 16; ++code)
+                swapped[code ^ dark_code] = counts[code];
+        return swapped;
+}
+
+// The tables the encoding of positions uses, as the Syzygy generator
+// builds them.
+struct Maps {
+        // The squares below the a1-h8 diagonal, 0 to 27.
+        std::array<int, 64> b1h1h7 {};
+        // The a1-d1-d4 triangle, the squares off the diagonal first.
+        std::array<int, 64> a1d1d4 {};
+        // The 462 ways to place two kings that aren't mirror images,
+        // by the first one's place in the triangle.
+        std::array<std::array<int, 64>, 10> kings {};
+        // Ways to pick k of n squares, by k and n.
+        std::array<std::array<std::uint64_t, 64>, 6> binomial {};
+        // a2 to h7 as 47 down to 0, the squares nearest to the a and h
+        // files and the first rank highest.
+        std::array<int, 64> pawns {};
+        std::array<std::array<std::uint64_t, 64>, 6> lead_pawn_index {};
+        std::array<std::array<std::uint64_t, 4>, 6> lead_pawns_size {};
+};
+
+Maps make_maps() noexcept
+{
+        Maps maps;
+        int code = 0;
+        for (int square = 0; square < 64; ++square) {
+                if (off_diagonal(square) < 0)
+                        maps.b1h1h7[square] = code++;
+        }
+
+        int constexpr d4 = 27;
+        code = 0;
+        for (int square = 0; square <= d4; ++square) {
+                if (off_diagonal(square) < 0 && file_of(square) <= 3)
+                        maps.a1d1d4[square] = code++;
+        }
+        for (int square = 0; square <= d4; ++square) {
+                if (off_diagonal(square) == 0 && file_of(square) <= 3)
+                        maps.a1d1d4[square] = code++;
+        }
+
+        // With the first king on the diagonal the second isn't above it,
+        // and both on the diagonal come last.
+        int constexpr b1 = 1;
+        code = 0;
+        for (bool both_on_diagonal : {false, true}) {
+                for (int index = 0; index < 10; ++index) {
+                        for (int first = 0; first <= d4; ++first) {
+                                if (maps.a1d1d4[first] != index || (index == 0 && first != b1))
+                                        continue;
+                                for (int second = 0; second < 64; ++second) {
+                                        if (kings_touch(first, second) ||
+                                            (off_diagonal(first) == 0 && off_diagonal(second) > 0)) {
+                                                continue;
+                                        }
+                                        bool const both = off_diagonal(first) == 0 &&
+                                                          off_diagonal(second) == 0;
+                                        if (both == both_on_diagonal)
+                                                maps.kings[index][second] = code++;
+                                }
+                        }
+                }
+        }
+
+        maps.binomial[0][0] = 1;
+        for (int n = 1; n < 64; ++n) {
+                for (int k = 0; k < 6 && k <= n; ++k) {
+                        maps.binomial[k][n] = (k > 0 ? maps.binomial[k - 1][n - 1] : 0) +
+                                              (k < n ? maps.binomial[k][n - 1] : 0);
+                }
+        }
+
+        int available = 47;
+        for (int count = 1; count < 6; ++count) {
+                for (int file = 0; file < 4; ++file) {
+                        std::uint64_t index = 0;
+                        for (int rank = 1; rank < 7; ++rank) {
+                                int const square = rank * 8 + file;
+                                if (count == 1) {
+                                        maps.pawns[square] = available--;
+                                        maps.pawns[square ^ 7] = available--;
+                                }
+                                maps.lead_pawn_index[count][square] = index;
+                                index += maps.binomial[count - 1][maps.pawns[square]];
+                        }
+                        maps.lead_pawns_size[count][file] = index;
+                }
+        }
+        return maps;
+}
+
+Maps const& maps() noexcept
+{
+        static Maps const maps = make_maps();
+        return maps;
+}
+
+// What a table's material decides about its layout. The light pieces
+// are the first side of the signature.
+struct MaterialInfo {
+        std::string signature;
+        PieceCounts counts {};
+        std::uint64_t key = 0;
+        // The key with the colours swapped, the same for a material that
+        // is the same on both sides.
+        std::uint64_t key2 = 0;
+        int pieces = 0;
+        bool has_pawns = false;
+        // Some piece other than a king is the only one of its kind.
+        bool has_unique_pieces = false;
+        // The side with the fewest pawns, if it has any, leads.
+        bool dark_leads = false;
+        // The leading side's pawns, then the other side's.
+        std::array<int, 2> pawn_counts {};
+};
+
+bool parse_material(std::string_view signature, MaterialInfo& info)
+{
+        auto const separator = signature.find('v');
+        if (separator == std::string_view::npos)
+                return false;
+        info = MaterialInfo();
+        info.signature = std::string(signature);
+        for (std::size_t i = 0; i < signature.size(); ++i) {
+                if (i == separator)
+                        continue;
+                char const* const letter = std::char_traits<char>::find(piece_letters, 6, signature[i]);
+                if (!letter)
+                        return false;
+                int const code = letter_codes[letter - piece_letters] + (i > separator ? dark_code : 0);
+                ++info.counts[code];
+                ++info.pieces;
+        }
+        if (info.counts[king_code] != 1 || info.counts[king_code + dark_code] != 1 ||
+            info.pieces < min_tablebase_pieces || info.pieces > max_pieces) {
+                return false;
+        }
+
+        info.key = material_key(info.counts);
+        info.key2 = material_key(swap_colours(info.counts));
+        int const light_pawns = info.counts[pawn_code];
+        int const dark_pawns = info.counts[pawn_code + dark_code];
+        info.has_pawns = light_pawns + dark_pawns > 0;
+        for (int code = pawn_code; code < king_code; ++code) {
+                if (info.counts[code] == 1 || info.counts[code + dark_code] == 1)
+                        info.has_unique_pieces = true;
+        }
+        info.dark_leads = dark_pawns != 0 && (light_pawns == 0 || dark_pawns < light_pawns);
+        info.pawn_counts = info.dark_leads ? std::array {dark_pawns, light_pawns} :
+                                             std::array {light_pawns, dark_pawns};
+        return true;
+}
+
+bool both_sides_have_pawns(MaterialInfo const& info) noexcept
+{
+        return info.has_pawns && info.pawn_counts[1] > 0;
+}
+
+// One table of a file, for one side on turn and, with pawns, one file of
+// the leading pawn. Syzygy calls it pairs data: values are compressed by
+// replacing frequent pairs of symbols by new symbols, and the symbols are
+// then Huffman coded in blocks of a fixed size.
+struct SubTable {
+        unsigned flags = 0;
+        // The pieces in the order they are encoded in, and how they are
+        // grouped.
+        std::array<int, max_pieces> pieces {};
+        std::array<int, max_pieces + 1> group_lengths {};
+        std::array<std::uint64_t, max_pieces + 1> group_factors {};
+        std::uint64_t size = 0;
+
+        std::size_t block_size = 0;
+        std::uint64_t span = 0;
+        std::uint32_t blocks = 0;
+        // The only value if single_value_flag is set.
+        int min_length = 0;
+        int max_length = 0;
+        // Little endian u16 each, the first symbol of each code length.
+        unsigned char const* lowest_symbols = nullptr;
+        // Three bytes per symbol, the two symbols it pairs or a value.
+        unsigned char const* tree = nullptr;
+        int symbols = 0;
+        // Block and offset of every span-th value, 6 bytes each.
+        unsigned char const* sparse_index = nullptr;
+        std::uint64_t sparse_index_size = 0;
+        // Values in each block minus one, u16 each.
+        unsigned char const* block_lengths = nullptr;
+        std::uint64_t block_lengths_size = 0;
+        unsigned char const* data = nullptr;
+        unsigned char const* data_end = nullptr;
+        // The smallest left-aligned code of each length.
+        std::vector<std::uint64_t> bases;
+        // How many values each symbol stands for, minus one.
+        std::vector<std::uint8_t> symbol_lengths;
+        // Where each result's value map starts, for DTZ tables.
+        std::array<std::size_t, 4> map_starts {};
+};
+
+using SubTables = std::array<std::array<SubTable, 4>, 2>;
+
+int tree_left(SubTable const& table, int symbol) noexcept
+{
+        unsigned char const* const entry = table.tree + 3 * symbol;
+        return ((entry[1] & 0xf) << 8) | entry[0];
+}
+
+int tree_right(SubTable const& table, int symbol) noexcept
+{
+        unsigned char const* const entry = table.tree + 3 * symbol;
+        return (entry[2] << 4) | (entry[1] >> 4);
+}
+
+std::uint32_t get_big_endian(unsigned char const* in) noexcept
+{
+        return std::uint32_t(in[0]) << 24 | std::uint32_t(in[1]) << 16 |
+               std::uint32_t(in[2]) << 8 | std::uint32_t(in[3]);
+}
+
+// Splits the pieces into the groups that are encoded together and works
+// out the factor of each group's part of the index. order says where in
+// that the leading group comes and, with pawns on both sides, the other
+// side's pawns.
+bool set_groups(MaterialInfo const& info, SubTable& table, std::array<int, 2> order, int file)
+{
+        Maps const& maps = Chess::maps();
+        PieceCounts counts {};
+        for (int i = 0; i < info.pieces; ++i)
+                ++counts[table.pieces[i]];
+        if (counts != info.counts)
+                return false;
+
+        int n = 0;
+        int first_length = info.has_pawns ? 0 : info.has_unique_pieces ? 3 : 2;
+        table.group_lengths = {};
+        table.group_lengths[0] = 1;
+        for (int i = 1; i < info.pieces; ++i) {
+                if (--first_length > 0 || table.pieces[i] == table.pieces[i - 1])
+                        ++table.group_lengths[n];
+                else
+                        table.group_lengths[++n] = 1;
+        }
+        table.group_lengths[++n] = 0;
+
+        bool const both_pawns = both_sides_have_pawns(info);
+        if (info.has_pawns) {
+                int const lead_code = pawn_code + (info.dark_leads ? dark_code : 0);
+                if (table.pieces[0] != lead_code || table.group_lengths[0] != info.pawn_counts[0] ||
+                    (both_pawns && (table.pieces[info.pawn_counts[0]] != (lead_code ^ dark_code) ||
+                                    table.group_lengths[1] != info.pawn_counts[1]))) {
+                        return false;
+                }
+        }
+
+        int next = both_pawns ? 2 : 1;
+        int free_squares = 64 - table.group_lengths[0] - (both_pawns ? table.group_lengths[1] : 0);
+        std::uint64_t factor = 1;
+        for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+                if (k == order[0]) {
+                        table.group_factors[0] = factor;
+                        factor *= info.has_pawns ? maps.lead_pawns_size[table.group_lengths[0]][file] :
+                                  info.has_unique_pieces ? 31332 : 462;
+                } else if (k == order[1]) {
+                        table.group_factors[1] = factor;
+                        factor *= maps.binomial[table.group_lengths[1]][48 - table.group_lengths[0]];
+                } else {
+                        table.group_factors[next] = factor;
+                        factor *= maps.binomial[table.group_lengths[next]][free_squares];
+                        free_squares -= table.group_lengths[next++];
+                }
+                if (k > 16)
+                        return false;
+        }
+        table.group_factors[n] = factor;
+        table.size = factor;
+        return true;
+}
+
+// Where a position is kept: the sub-table by side on turn and file of
+// the leading pawn, and the index in it.
+struct Location {
+        int side;
+        int file;
+        std::uint64_t index;
+};
+
+// Encodes a position the way the Syzygy tables do. The colours are
+// swapped to make the first side of the signature light, with dark on
+// turn too for materials that are the same on both sides, and then the
+// board is mirrored so that the leading piece, or pawn, is on the left
+// and, without pawns, in the a1-d1-d4 triangle. The board must have the
+// table's pieces, pawns only on the ranks they can stand on, and for a
+// table of two kings and no other unique piece the kings must not touch.
+Location locate(MaterialInfo const& info, SubTables const& tables, int sides,
+                Board const& board, Side on_turn, std::uint64_t key) noexcept
+{
+        Maps const& maps = Chess::maps();
+        bool const flip = key != info.key || (info.key == info.key2 && on_turn == Side::dark);
+        int const flip_code = flip ? dark_code : 0;
+        int const flip_square = flip ? 56 : 0;
+        Location location {(flip ? 1 : 0) ^ (on_turn == Side::dark ? 1 : 0), 0, 0};
+
+        std::array<int, max_pieces> squares {};
+        std::array<int, max_pieces> codes {};
+        int size = 0;
+        int lead_code = 0;
+        auto const by_pawn_map = [&](int square1, int square2)
+        {
+                return maps.pawns[square1] < maps.pawns[square2];
+        };
+        if (info.has_pawns) {
+                lead_code = tables[0][0].pieces[0] ^ flip_code;
+                for (int square = 0; square < 64; ++square) {
+                        if (piece_code(board_piece(board, square)) == lead_code)
+                                squares[size++] = square ^ flip_square;
+                }
+                std::swap(squares[0], *std::max_element(squares.begin(), squares.begin() + size,
+                                                        by_pawn_map));
+                location.file = std::min(file_of(squares[0]), 7 - file_of(squares[0]));
+        }
+        int const lead = size;
+        for (int square = 0; square < 64; ++square) {
+                int const code = piece_code(board_piece(board, square));
+                if (code != 0 && code != lead_code) {
+                        squares[size] = square ^ flip_square;
+                        codes[size++] = code ^ flip_code;
+                }
+        }
+
+        // The pieces go in the order the table lists them in.
+        SubTable const& table = tables[location.side % sides][location.file];
+        for (int i = lead; i < size - 1; ++i) {
+                for (int j = i + 1; j < size; ++j) {
+                        if (table.pieces[i] == codes[j]) {
+                                std::swap(codes[i], codes[j]);
+                                std::swap(squares[i], squares[j]);
+                                break;
+                        }
+                }
+        }
+
+        if (file_of(squares[0]) > 3) {
+                for (int i = 0; i < size; ++i)
+                        squares[i] ^= 7;
+        }
+
+        std::uint64_t index = 0;
+        if (info.has_pawns) {
+                index = maps.lead_pawn_index[lead][squares[0]];
+                std::stable_sort(squares.begin() + 1, squares.begin() + lead, by_pawn_map);
+                for (int i = 1; i < lead; ++i)
+                        index += maps.binomial[i][maps.pawns[squares[i]]];
+        } else {
+                if (rank_of(squares[0]) > 3) {
+                        for (int i = 0; i < size; ++i)
+                                squares[i] ^= 56;
+                }
+                // The first piece of the leading group off the a1-h8
+                // diagonal goes below it.
+                for (int i = 0; i < table.group_lengths[0]; ++i) {
+                        if (off_diagonal(squares[i]) == 0)
+                                continue;
+                        if (off_diagonal(squares[i]) > 0) {
+                                for (int j = i; j < size; ++j)
+                                        squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                        }
+                        break;
+                }
+
+                if (info.has_unique_pieces) {
+                        int const adjust1 = squares[1] > squares[0];
+                        int const adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+                        if (off_diagonal(squares[0]) != 0) {
+                                index = (maps.a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 +
+                                        squares[2] - adjust2;
+                        } else if (off_diagonal(squares[1]) != 0) {
+                                index = (6 * 63 + rank_of(squares[0]) * 28 + maps.b1h1h7[squares[1]]) * 62 +
+                                        squares[2] - adjust2;
+                        } else if (off_diagonal(squares[2]) != 0) {
+                                index = 6 * 63 * 62 + 4 * 28 * 62 + rank_of(squares[0]) * 7 * 28 +
+                                        (rank_of(squares[1]) - adjust1) * 28 + maps.b1h1h7[squares[2]];
+                        } else {
+                                index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+                                        rank_of(squares[0]) * 7 * 6 + (rank_of(squares[1]) - adjust1) * 6 +
+                                        (rank_of(squares[2]) - adjust2);
+                        }
+                } else {
+                        index = maps.kings[maps.a1d1d4[squares[0]]][squares[1]];
+                }
+        }
+
+        // The other groups, each as a combination of the squares left.
+        index *= table.group_factors[0];
+        int group = table.group_lengths[0];
+        bool remaining_pawns = both_sides_have_pawns(info);
+        for (int next = 1; table.group_lengths[next] != 0; ++next) {
+                int const length = table.group_lengths[next];
+                std::stable_sort(squares.begin() + group, squares.begin() + group + length);
+                std::uint64_t combination = 0;
+                for (int i = 0; i < length; ++i) {
+                        int const square = squares[group + i];
+                        auto const below = std::count_if(squares.begin(), squares.begin() + group,
+                                [&](int other)
+                                {
+                                        return square > other;
+                                }
+                        );
+                        combination += maps.binomial[i + 1][square - below - (remaining_pawns ? 8 : 0)];
+                }
+                remaining_pawns = false;
+                index += combination * table.group_factors[next];
+                group += length;
+        }
+        location.index = index;
+        return location;
+}
+
+// The value at an index of a sub-table, -1 if the data doesn't hold it.
+int decompress(SubTable const& table, std::uint64_t index) noexcept
+{
+        if (table.flags & single_value_flag)
+                return table.min_length;
+        if (index >= table.size)
+                return -1;
+
+        // The sparse index finds the block of the index's span's middle,
+        // and the block lengths lead from there to the index.
+        unsigned char const* const entry = table.sparse_index + 6 * (index / table.span);
+        std::uint64_t block = get_fixed<std::uint32_t>(entry);
+        auto offset = static_cast<std::int64_t>(get_fixed<std::uint16_t>(entry + 4)) +
+                      static_cast<std::int64_t>(index % table.span) -
+                      static_cast<std::int64_t>(table.span / 2);
+        auto const block_length = [&](std::uint64_t b)
+        {
+                return static_cast<std::int64_t>(get_fixed<std::uint16_t>(table.block_lengths + 2 * b));
+        };
+        if (block >= table.block_lengths_size)
+                return -1;
+        while (offset < 0) {
+                if (block == 0)
+                        return -1;
+                offset += block_length(--block) + 1;
+        }
+        while (offset > block_length(block)) {
+                offset -= block_length(block++) + 1;
+                if (block >= table.block_lengths_size)
+                        return -1;
+        }
+        if (block >= table.blocks)
+                return -1;
+
+        // Canonical Huffman codes, longer ones numerically smaller, big
+        // endian. Symbols are read until the one covering the offset.
+        unsigned char const* const begin = table.data + block * table.block_size;
+        auto const word = [&](std::size_t at)
+        {
+                return begin + at + 4 <= table.data_end ? get_big_endian(begin + at) : 0;
+        };
+        std::uint64_t buffer = std::uint64_t(word(0)) << 32 | word(4);
+        std::size_t next = 8;
+        int buffered = 64;
+        int symbol = 0;
+        int const lengths = table.max_length - table.min_length + 1;
+        for (;;) {
+                int length = 0;
+                while (buffer < table.bases[length]) {
+                        if (++length == lengths)
+                                return -1;
+                }
+                symbol = static_cast<int>((buffer - table.bases[length]) >>
+                                          (64 - length - table.min_length)) +
+                         get_fixed<std::uint16_t>(table.lowest_symbols + 2 * length);
+                if (symbol >= table.symbols)
+                        return -1;
+                if (offset < table.symbol_lengths[symbol] + 1)
+                        break;
+                offset -= table.symbol_lengths[symbol] + 1;
+                length += table.min_length;
+                buffer <<= length;
+                buffered -= length;
+                if (buffered <= 32) {
+                        buffered += 32;
+                        buffer |= std::uint64_t(word(next)) << (64 - buffered);
+                        next += 4;
+                }
+        }
+
+        // Pairs are adjacent values, so the offset says which half of a
+        // pair holds the value.
+        while (table.symbol_lengths[symbol] != 0) {
+                int const left = tree_left(table, symbol);
+                if (offset < table.symbol_lengths[left] + 1) {
+                        symbol = left;
+                } else {
+                        offset -= table.symbol_lengths[left] + 1;
+                        symbol = tree_right(table, symbol);
+                }
+        }
+        return tree_left(table, symbol);
+}
+
+// How many values each symbol stands for minus one, following the pairs
+// down to the values. Pairs may only refer to symbols that don't refer
+// back to them.
+bool set_symbol_lengths(SubTable& table)
+{
+        enum : std::uint8_t { unvisited, visiting, done };
+        std::vector<std::uint8_t> states(static_cast<std::size_t>(table.symbols), unvisited);
+        std::vector<int> stack;
+        table.symbol_lengths.assign(static_cast<std::size_t>(table.symbols), 0);
+        for (int root = 0; root < table.symbols; ++root) {
+                if (states[root] != unvisited)
+                        continue;
+                stack.push_back(root);
+                while (!stack.empty()) {
+                        int const symbol = stack.back();
+                        int const left = tree_left(table, symbol);
+                        int const right = tree_right(table, symbol);
+                        if (right == leaf) {
+                                states[symbol] = done;
+                                stack.pop_back();
+                                continue;
+                        }
+                        if (left >= table.symbols || right >= table.symbols)
+                                return false;
+                        states[symbol] = visiting;
+                        bool ready = true;
+                        for (int child : {left, right}) {
+                                if (states[child] == visiting)
+                                        return false;
+                                if (states[child] == unvisited) {
+                                        stack.push_back(child);
+                                        ready = false;
+                                }
+                        }
+                        if (!ready)
+                                continue;
+                        int const length = table.symbol_lengths[left] + table.symbol_lengths[right] + 1;
+                        if (length > 255)
+                                return false;
+                        table.symbol_lengths[symbol] = static_cast<std::uint8_t>(length);
+                        states[symbol] = done;
+                        stack.pop_back();
+                }
+        }
+        return true;
+}
+
+bool read_sizes(ByteReader& in, SubTable& table)
+{
+        unsigned flags = 0;
+        if (!in.u8(flags))
+                return false;
+        table.flags = flags;
+        if (table.flags & single_value_flag) {
+                unsigned value = 0;
+                if (!in.u8(value))
+                        return false;
+                table.min_length = static_cast<int>(value);
+                return true;
+        }
+
+        unsigned block_size = 0;
+        unsigned span = 0;
+        unsigned padding = 0;
+        unsigned max_length = 0;
+        unsigned min_length = 0;
+        if (!in.u8(block_size) || !in.u8(span) || !in.u8(padding) || !in.fixed(table.blocks) ||
+            !in.u8(max_length) || !in.u8(min_length) || block_size < 3 || block_size > 30 ||
+            span > 62 || min_length < 1 || max_length < min_length || max_length > 32) {
+                return false;
+        }
+        table.block_size = std::size_t(1) << block_size;
+        table.span = std::uint64_t(1) << span;
+        table.sparse_index_size = (table.size + table.span - 1) / table.span;
+        table.block_lengths_size = std::uint64_t(table.blocks) + padding;
+        table.max_length = static_cast<int>(max_length);
+        table.min_length = static_cast<int>(min_length);
+
+        int const lengths = table.max_length - table.min_length + 1;
+        if (!in.bytes(2 * static_cast<std::uint64_t>(lengths), table.lowest_symbols))
+                return false;
+        auto const lowest = [&](int length)
+        {
+                return static_cast<std::int64_t>(get_fixed<std::uint16_t>(table.lowest_symbols + 2 * length));
+        };
+        table.bases.assign(static_cast<std::size_t>(lengths), 0);
+        for (int i = lengths - 2; i >= 0; --i) {
+                std::int64_t const base = (static_cast<std::int64_t>(table.bases[i + 1]) +
+                                           lowest(i) - lowest(i + 1)) / 2;
+                if (base < 0)
+                        return false;
+                table.bases[i] = static_cast<std::uint64_t>(base);
+        }
+        for (int i = 0; i < lengths; ++i)
+                table.bases[i] <<= 64 - i - table.min_length;
+
+        std::uint16_t symbols = 0;
+        if (!in.fixed(symbols))
+                return false;
+        table.symbols = symbols;
+        return in.bytes(3 * std::uint64_t(symbols) + (symbols & 1), table.tree) &&
+               set_symbol_lengths(table);
+}
+
+// A file holds the pieces' order and grouping of each sub-table, their
+// sizes, the value maps of a DTZ table, then all sparse indexes, all
+// block lengths and all blocks. Every read is checked against the end,
+// so that a damaged file is rejected rather than read past.
+bool read_table(MaterialInfo const& info, bool dtz, unsigned char const* data, std::size_t size,
+                SubTables& tables, unsigned char const*& map, std::size_t& map_size)
+{
+        ByteReader in(data, size);
+        unsigned char const* magic = nullptr;
+        unsigned flags = 0;
+        if (!in.bytes(4, magic) || !std::equal(magic, magic + 4, dtz ? dtz_magic : wdl_magic) ||
+            !in.u8(flags) || bool(flags & pawns_flag) != info.has_pawns ||
+            bool(flags & split_flag) != (info.key != info.key2)) {
+                return false;
+        }
+
+        int const sides = (!dtz && info.key != info.key2) ? 2 : 1;
+        int const files = info.has_pawns ? 4 : 1;
+        bool const both_pawns = both_sides_have_pawns(info);
+        for (int file = 0; file < files; ++file) {
+                unsigned char const* order = nullptr;
+                unsigned char const* pieces = nullptr;
+                if (!in.bytes(both_pawns ? 2 : 1, order) ||
+                    !in.bytes(static_cast<std::uint64_t>(info.pieces), pieces)) {
+                        return false;
+                }
+                for (int side = 0; side < sides; ++side) {
+                        int const shift = side == 0 ? 0 : 4;
+                        SubTable& table = tables[side][file];
+                        for (int i = 0; i < info.pieces; ++i)
+                                table.pieces[i] = (pieces[i] >> shift) & 0xf;
+                        std::array<int, 2> const group_order {
+                                (order[0] >> shift) & 0xf,
+                                both_pawns ? (order[1] >> shift) & 0xf : 0xf
+                        };
+                        if (!set_groups(info, table, group_order, file))
+                                return false;
+                }
+        }
+        if (!in.align(2))
+                return false;
+
+        for (int file = 0; file < files; ++file) {
+                for (int side = 0; side < sides; ++side) {
+                        if (!read_sizes(in, tables[side][file]))
+                                return false;
+                }
+        }
+
+        if (dtz) {
+                std::size_t const map_begin = in.pos();
+                for (int file = 0; file < files; ++file) {
+                        SubTable& table = tables[0][file];
+                        if (!(table.flags & mapped_flag))
+                                continue;
+                        bool const wide = table.flags & wide_flag;
+                        if (wide && !in.align(2))
+                                return false;
+                        for (std::size_t& start : table.map_starts) {
+                                unsigned char const* values = nullptr;
+                                if (wide) {
+                                        std::uint16_t length = 0;
+                                        if (!in.fixed(length) || !in.bytes(2 * std::uint64_t(length), values))
+                                                return false;
+                                } else {
+                                        unsigned length = 0;
+                                        if (!in.u8(length) || !in.bytes(length, values))
+                                                return false;
+                                }
+                                start = static_cast<std::size_t>(values - (data + map_begin)) / (wide ? 2 : 1);
+                        }
+                }
+                if (!in.align(2))
+                        return false;
+                map = data + map_begin;
+                map_size = in.pos() - map_begin;
+        }
+
+        for (int file = 0; file < files; ++file) {
+                for (int side = 0; side < sides; ++side) {
+                        SubTable& table = tables[side][file];
+                        if (!in.bytes(6 * table.sparse_index_size, table.sparse_index))
+                                return false;
+                }
+        }
+        for (int file = 0; file < files; ++file) {
+                for (int side = 0; side < sides; ++side) {
+                        SubTable& table = tables[side][file];
+                        if (!in.bytes(2 * table.block_lengths_size, table.block_lengths))
+                                return false;
+                }
+        }
+        for (int file = 0; file < files; ++file) {
+                for (int side = 0; side < sides; ++side) {
+                        SubTable& table = tables[side][file];
+                        std::uint64_t const length = std::uint64_t(table.blocks) * table.block_size;
+                        if (length == 0)
+                                continue;
+                        if (!in.align(64) || !in.bytes(length, table.data))
+                                return false;
+                        table.data_end = table.data + length;
+                }
+        }
+        return true;
+}
+
+// The plies a DTZ table's value stands for. Values may be mapped through
+// a table per result, and may count moves rather than plies.
+int dtz_plies(SubTable const& table, unsigned char const* map, std::size_t map_size,
+              int value, int wdl) noexcept
+{
+        int constexpr map_by_wdl[] = {1, 3, 0, 2, 0};
+        if (table.flags & mapped_flag) {
+                std::size_t const at = table.map_starts[map_by_wdl[wdl + 2]] + static_cast<std::size_t>(value);
+                if (table.flags & wide_flag)
+                        value = 2 * at + 2 <= map_size ? get_fixed<std::uint16_t>(map + 2 * at) : 0;
+                else
+                        value = at < map_size ? map[at] : 0;
+        }
+        if ((wdl == 2 && !(table.flags & win_plies_flag)) ||
+            (wdl == -2 && !(table.flags & loss_plies_flag)) || wdl == 1 || wdl == -1) {
+                value *= 2;
+        }
+        return value + 1;
+}
+
+int sign(int value) noexcept
+{
+        return (value > 0) - (value < 0);
+}
+
+// The DTZ of a position whose best move captures or moves a pawn.
+int dtz_before_zeroing(int wdl) noexcept
+{
+        switch (wdl) {
+                case 2:
+                        return 1;
+                case 1:
+                        return 101;
+                case -1:
+                        return -101;
+                case -2:
+                        return -1;
+                default:
+                        return 0;
+        }
+}
+
+bool is_capture(Board const& board, Move move) noexcept
+{
+        Piece const piece = board[move.from.y][move.from.x];
+        return board[move.to.y][move.to.x] != Piece::none() ||
+               (piece.kind == Piece::Kind::pawn && move.from.x != move.to.x);
+}
+
+// A game that is over has no side on turn, but the tables still tell
+// checkmate from stalemate by whose turn it was.
+Side side_on_turn(Game const& game) noexcept
+{
+        Side const on_turn = game.on_turn();
+        return on_turn != Side::none ? on_turn : game.setup().on_turn;
+}
+
+bool has_castling_rights(Setup const& setup) noexcept
+{
+        auto const [light_kingside, light_queenside, dark_kingside, dark_queenside] =
+                setup.castling_rights;
+        return light_kingside || light_queenside || dark_kingside || dark_queenside;
+}
+
+bool ends_with(std::string_view text, std::string_view suffix) noexcept
+{
+        return text.size() > suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+}
+
+// The codes in the order the writer encodes them in: the leading pawns
+// and the other side's pawns first, or the kings and, with any, a unique
+// piece, then the rest with equal pieces next to each other.
+std::array<int, max_pieces> writer_order(MaterialInfo const& info) noexcept
+{
+        std::array<int, max_pieces> order {};
+        PieceCounts left = info.counts;
+        int size = 0;
+        auto const take = [&](int code)
+        {
+                order[size++] = code;
+                --left[code];
+        };
+        if (info.has_pawns) {
+                int const lead_code = pawn_code + (info.dark_leads ? dark_code : 0);
+                while (left[lead_code] > 0)
+                        take(lead_code);
+                while (left[lead_code ^ dark_code] > 0)
+                        take(lead_code ^ dark_code);
+        } else {
+                take(king_code);
+                take(king_code + dark_code);
+                for (int code = 0; code < 16 && info.has_unique_pieces && size < 3; ++code) {
+                        if (info.counts[code] == 1 && left[code] == 1)
+                                take(code);
+                }
+        }
+        for (int code = 0; code < 16; ++code) {
+                while (left[code] > 0)
+                        take(code);
+        }
+        return order;
+}
+
+// A sub-table as the writer lays it out.
+struct Compressed {
+        std::vector<unsigned char> sizes;
+        std::vector<unsigned char> sparse_index;
+        std::vector<unsigned char> block_lengths;
+        std::vector<unsigned char> data;
+};
+
+// Code lengths for the used symbols, by Huffman's algorithm. Rare
+// symbols are made less rare until no code is too long.
+std::vector<int> code_lengths(std::vector<std::uint64_t> frequencies)
+{
+        std::size_t const count = frequencies.size();
+        for (;;) {
+                using Node = std::pair<std::uint64_t, std::size_t>;
+                std::priority_queue<Node, std::vector<Node>, std::greater<>> queue;
+                std::vector<std::size_t> parents(2 * count, 0);
+                for (std::size_t i = 0; i < count; ++i)
+                        queue.emplace(frequencies[i], i);
+                std::size_t next = count;
+                while (queue.size() > 1) {
+                        Node const first = queue.top();
+                        queue.pop();
+                        Node const second = queue.top();
+                        queue.pop();
+                        parents[first.second] = next;
+                        parents[second.second] = next;
+                        queue.emplace(first.first + second.first, next++);
+                }
+                std::vector<int> lengths(count, 0);
+                int longest = 0;
+                for (std::size_t i = 0; i < count; ++i) {
+                        for (std::size_t node = i; node != next - 1; node = parents[node])
+                                ++lengths[i];
+                        longest = std::max(longest, lengths[i]);
+                }
+                if (longest <= max_code_length)
+                        return lengths;
+                for (std::uint64_t& frequency : frequencies)
+                        frequency = frequency / 2 + 1;
+        }
+}
+
+class BitWriter {
+public:
+        explicit BitWriter(std::vector<unsigned char>& out) noexcept
+                : out_(out)
+        {}
+
+        void put(std::uint64_t code, int length)
+        {
+                for (int bit = length - 1; bit >= 0; --bit) {
+                        if (used_ == 0)
+                                out_.push_back(0);
+                        if (code >> bit & 1)
+                                out_.back() = static_cast<unsigned char>(out_.back() | 0x80 >> used_);
+                        used_ = (used_ + 1) % 8;
+                }
+        }
+
+private:
+        std::vector<unsigned char>& out_;
+        int used_ = 0;
+};
+
+// Compresses values, one per index, with each value a symbol of its own.
+// Values that are all the same need no blocks at all.
+Compressed compress(std::vector<int> const& values, unsigned flags)
+{
+        Compressed result;
+        std::vector<int> used;
+        for (int value : values) {
+                if (std::find(used.cbegin(), used.cend(), value) == used.cend())
+                        used.push_back(value);
+        }
+        if (used.size() == 1 && used[0] < 256) {
+                put_u8(result.sizes, flags | single_value_flag);
+                put_u8(result.sizes, static_cast<unsigned>(used[0]));
+                return result;
+        }
+        if (used.size() == 1)
+                used.push_back(used[0] == 0 ? 1 : 0);
+        std::sort(used.begin(), used.end());
+
+        std::vector<std::uint64_t> frequencies(used.size(), 0);
+        for (int value : values)
+                ++frequencies[std::lower_bound(used.cbegin(), used.cend(), value) - used.cbegin()];
+        std::vector<int> const lengths = code_lengths(frequencies);
+        int const min_length = *std::min_element(lengths.cbegin(), lengths.cend());
+        int const max_length = *std::max_element(lengths.cbegin(), lengths.cend());
+
+        // Symbols are numbered from the longest codes to the shortest,
+        // which take the numerically largest codes.
+        std::vector<std::size_t> symbols(used.size());
+        for (std::size_t i = 0; i < symbols.size(); ++i)
+                symbols[i] = i;
+        std::stable_sort(symbols.begin(), symbols.end(),
+                [&](std::size_t s1, std::size_t s2)
+                {
+                        return lengths[s1] > lengths[s2];
+                }
+        );
+        int const count = max_length - min_length + 1;
+        std::vector<int> lowest(static_cast<std::size_t>(count), 0);
+        std::vector<int> per_length(static_cast<std::size_t>(count), 0);
+        for (int length : lengths)
+                ++per_length[length - min_length];
+        for (int i = count - 2; i >= 0; --i)
+                lowest[i] = lowest[i + 1] + per_length[i + 1];
+        std::vector<std::uint64_t> bases(static_cast<std::size_t>(count), 0);
+        for (int i = count - 2; i >= 0; --i)
+                bases[i] = (bases[i + 1] + per_length[i + 1]) / 2;
+        std::vector<std::uint64_t> codes(used.size());
+        std::vector<int> next(lowest);
+        std::vector<int> numbers(used.size());
+        for (std::size_t s : symbols) {
+                int const i = lengths[s] - min_length;
+                numbers[s] = next[i]++;
+                codes[s] = bases[i] + static_cast<std::uint64_t>(numbers[s] - lowest[i]);
+        }
+
+        // Each block takes as many codes as fit in it, the rest of it is
+        // padding.
+        std::uint64_t const block_size = std::uint64_t(1) << block_size_log2;
+        std::uint64_t const span = std::uint64_t(1) << span_log2;
+        std::vector<std::size_t> value_symbols(values.size());
+        std::vector<std::uint64_t> block_starts;
+        std::uint64_t bits = 8 * block_size;
+        for (std::size_t i = 0; i < values.size(); ++i) {
+                std::size_t const s = static_cast<std::size_t>(
+                        std::lower_bound(used.cbegin(), used.cend(), values[i]) - used.cbegin());
+                value_symbols[i] = s;
+                if (bits + static_cast<std::uint64_t>(lengths[s]) > 8 * block_size) {
+                        block_starts.push_back(i);
+                        bits = 0;
+                }
+                bits += static_cast<std::uint64_t>(lengths[s]);
+        }
+        auto const blocks = static_cast<std::uint32_t>(block_starts.size());
+        for (std::uint32_t block = 0; block < blocks; ++block) {
+                std::uint64_t const end = block + 1 < blocks ? block_starts[block + 1] : values.size();
+                BitWriter writer(result.data);
+                for (std::uint64_t i = block_starts[block]; i < end; ++i)
+                        writer.put(codes[value_symbols[i]], lengths[value_symbols[i]]);
+                result.data.resize((block + 1) * block_size, 0);
+                put_fixed(result.block_lengths, static_cast<std::uint16_t>(end - block_starts[block] - 1));
+        }
+
+        // Every span-th value's middle, as a block and an offset in it,
+        // the ones past the end as if the last block went on.
+        std::uint64_t const entries = (values.size() + span - 1) / span;
+        std::uint32_t block = 0;
+        for (std::uint64_t k = 0; k < entries; ++k) {
+                std::uint64_t const middle = k * span + span / 2;
+                while (block + 1 < blocks && block_starts[block + 1] <= middle)
+                        ++block;
+                put_fixed(result.sparse_index, block);
+                put_fixed(result.sparse_index, static_cast<std::uint16_t>(middle - block_starts[block]));
+        }
+
+        put_u8(result.sizes, flags);
+        put_u8(result.sizes, block_size_log2);
+        put_u8(result.sizes, span_log2);
+        put_u8(result.sizes, 0);
+        put_fixed(result.sizes, blocks);
+        put_u8(result.sizes, static_cast<unsigned>(max_length));
+        put_u8(result.sizes, static_cast<unsigned>(min_length));
+        for (int low : lowest)
+                put_fixed(result.sizes, static_cast<std::uint16_t>(low));
+        put_fixed(result.sizes, static_cast<std::uint16_t>(used.size()));
+        std::vector<int> by_number(used.size());
+        for (std::size_t s = 0; s < used.size(); ++s)
+                by_number[numbers[s]] = used[s];
+        for (int value : by_number) {
+                put_u8(result.sizes, value & 0xff);
+                put_u8(result.sizes, ((value >> 8) & 0xf) | (leaf & 0xf) << 4);
+                put_u8(result.sizes, leaf >> 4);
+        }
+        if (used.size() % 2 == 1)
+                put_u8(result.sizes, 0);
+        return result;
+}
+
+}
+
+std::string table_signature(std::string_view light, std::string_view dark)
+{
+        std::string signature;
+        signature += dark_is_stronger(light, dark) ? dark : light;
+        signature += 'v';
+        signature += dark_is_stronger(light, dark) ? light : dark;
+        return signature;
+}
+
+struct TableWriter::Layout {
+        MaterialInfo info;
+        int sides = 1;
+        int files = 1;
+        SubTables tables;
+        // Values by side on turn and file, -1 where no position was given.
+        std::array<std::array<std::vector<int>, 4>, 2> wdl;
+        // Only the first side on turn.
+        std::array<std::vector<int>, 4> dtz;
+};
+
+TableWriter::TableWriter(std::string_view signature)
+        : layout_(std::make_unique<Layout>())
+{
+        Layout& layout = *layout_;
+        if (!parse_material(signature, layout.info))
+                throw std::invalid_argument("not a table signature: " + std::string(signature));
+        MaterialInfo const& info = layout.info;
+        layout.sides = info.key != info.key2 ? 2 : 1;
+        layout.files = info.has_pawns ? 4 : 1;
+        std::array<int, 2> const order {0, both_sides_have_pawns(info) ? 1 : 0xf};
+        for (int side = 0; side < 2; ++side) {
+                for (int file = 0; file < layout.files; ++file) {
+                        SubTable& table = layout.tables[side][file];
+                        table.pieces = writer_order(info);
+                        set_groups(info, table, order, file);
+                        layout.wdl[side][file].assign(table.size, -1);
+                        if (side == 0)
+                                layout.dtz[file].assign(table.size, -1);
+                }
+        }
+}
+
+TableWriter::~TableWriter() = default;
+
+void TableWriter::add(Setup const& setup, Wdl wdl, int dtz)
+{
+        Layout& layout = *layout_;
+        MaterialInfo const& info = layout.info;
+        if (has_castling_rights(setup) || setup.en_passant_position ||
+            setup.on_turn == Side::none || wdl == Wdl::invalid) {
+                return;
+        }
+        PieceCounts counts {};
+        int kings[2] = {-1, -1};
+        for (int square = 0; square < 64; ++square) {
+                Piece const piece = board_piece(setup.board, square);
+                int const code = piece_code(piece);
+                ++counts[code];
+                if (piece.kind == Piece::Kind::pawn && (rank_of(square) == 0 || rank_of(square) == 7))
+                        return;
+                if (piece.kind == Piece::Kind::king)
+                        kings[piece.side == Side::dark] = square;
+        }
+        counts[0] = 0;
+        std::uint64_t const key = material_key(counts);
+        if ((key != info.key && key != info.key2) ||
+            (!info.has_pawns && !info.has_unique_pieces && kings_touch(kings[0], kings[1]))) {
+                return;
+        }
+
+        Location const location = locate(info, layout.tables, layout.sides, setup.board,
+                                         setup.on_turn, key);
+        int const value = static_cast<int>(wdl);
+        layout.wdl[location.side % layout.sides][location.file][location.index] = value;
+        if (location.side != 0 || wdl == Wdl::draw)
+                return;
+        int const plies = std::abs(dtz);
+        bool const cursed = wdl == Wdl::cursed_win || wdl == Wdl::blessed_loss;
+        layout.dtz[location.file][location.index] =
+                cursed ? std::max(0, (plies - 101) / 2) : std::max(0, plies - 1);
+}
+
+namespace {
+
+// Entries no position was given take the value before them, or after
+// them at the start, which keeps runs unbroken.
+std::vector<int> filled(std::vector<int> values)
+{
+        auto const first = std::find_if(values.cbegin(), values.cend(),
+                [](int value)
+                {
+                        return value >= 0;
+                }
+        );
+        int previous = first == values.cend() ? 0 : *first;
+        for (int& value : values) {
+                if (value < 0)
+                        value = previous;
+                previous = value;
+        }
+        return values;
+}
+
+void write_file(std::ostream& out, MaterialInfo const& info, bool dtz, int sides, int files,
+                SubTables const& tables, std::array<std::array<Compressed, 4>, 2> const& parts)
+{
+        std::vector<unsigned char> file;
+        put_text(file, std::string_view(reinterpret_cast<char const*>(dtz ? dtz_magic : wdl_magic), 4));
+        put_u8(file, (info.key != info.key2 ? split_flag : 0) | (info.has_pawns ? pawns_flag : 0));
+        bool const both_pawns = both_sides_have_pawns(info);
+        for (int file_index = 0; file_index < files; ++file_index) {
+                put_u8(file, 0);
+                if (both_pawns)
+                        put_u8(file, 1 | 1 << 4);
+                SubTable const& table = tables[0][file_index];
+                for (int i = 0; i < info.pieces; ++i)
+                        put_u8(file, static_cast<unsigned>(table.pieces[i] | table.pieces[i] << 4));
+        }
+        auto const align = [&](std::size_t alignment)
+        {
+                file.resize((file.size() + alignment - 1) / alignment * alignment, 0);
+        };
+        align(2);
+        for (int file_index = 0; file_index < files; ++file_index) {
+                for (int side = 0; side < sides; ++side)
+                        put_text(file, std::string_view(reinterpret_cast<char const*>(parts[side][file_index].sizes.data()),
+                                                        parts[side][file_index].sizes.size()));
+        }
+        if (dtz)
+                align(2);
+        auto const append = [&](std::vector<unsigned char> Compressed::*part)
+        {
+                for (int file_index = 0; file_index < files; ++file_index) {
+                        for (int side = 0; side < sides; ++side) {
+                                std::vector<unsigned char> const& bytes = parts[side][file_index].*part;
+                                file.insert(file.end(), bytes.cbegin(), bytes.cend());
+                        }
+                }
+        };
+        append(&Compressed::sparse_index);
+        append(&Compressed::block_lengths);
+        for (int file_index = 0; file_index < files; ++file_index) {
+                for (int side = 0; side < sides; ++side) {
+                        align(64);
+                        std::vector<unsigned char> const& bytes = parts[side][file_index].data;
+                        file.insert(file.end(), bytes.cbegin(), bytes.cend());
+                }
+        }
+        out.write(reinterpret_cast<char const*>(file.data()), static_cast<std::streamsize>(file.size()));
+}
+
+}
+
+void TableWriter::write_wdl(std::ostream& out) const
+{
+        Layout const& layout = *layout_;
+        std::array<std::array<Compressed, 4>, 2> parts;
+        for (int side = 0; side < layout.sides; ++side) {
+                for (int file = 0; file < layout.files; ++file)
+                        parts[side][file] = compress(filled(layout.wdl[side][file]), 0);
+        }
+        write_file(out, layout.info, false, layout.sides, layout.files, layout.tables, parts);
+}
+
+void TableWriter::write_dtz(std::ostream& out) const
+{
+        Layout const& layout = *layout_;
+        std::array<std::array<Compressed, 4>, 2> parts;
+        for (int file = 0; file < layout.files; ++file)
+                parts[0][file] = compress(filled(layout.dtz[file]), win_plies_flag | loss_plies_flag);
+        write_file(out, layout.info, true, 1, layout.files, layout.tables, parts);
+}
+
+struct Tablebase::Table {
+        MappedFile file;
+        SubTables tables;
+        int sides = 1;
+        unsigned char const* map = nullptr;
+        std::size_t map_size = 0;
+};
+
+struct Tablebase::Material {
+        explicit Material(MaterialInfo info)
+                : info(std::move(info))
+        {}
+
+        MaterialInfo info;
+        // WDL, then DTZ.
+        std::array<bool, 2> exists {};
+        std::array<std::once_flag, 2> mapped;
+        std::array<std::unique_ptr<Table>, 2> tables;
+};
+
+Tablebase::Tablebase(std::string directory)
+        : directory_(std::move(directory))
+{
+        DIR* const dir = opendir(directory_.c_str());
+        if (!dir)
+                return;
+        while (dirent const* entry = readdir(dir)) {
+                std::string_view const name = entry->d_name;
+                bool const dtz = ends_with(name, dtz_suffix);
+                if (!dtz && !ends_with(name, wdl_suffix))
+                        continue;
+                MaterialInfo info;
+                if (!parse_material(name.substr(0, name.size() - wdl_suffix.size()), info))
+                        continue;
+                Material*& material = by_key_[info.key];
+                if (!material) {
+                        max_pieces_ = std::max(max_pieces_, info.pieces);
+                        materials_.push_back(std::make_unique<Material>(std::move(info)));
+                        material = materials_.back().get();
+                        by_key_[material->info.key2] = material;
+                }
+                material->exists[dtz] = true;
+        }
+        closedir(dir);
+}
+
+Tablebase::~Tablebase() = default;
+
+int Tablebase::max_pieces() const noexcept
+{
+        return max_pieces_;
+}
+
+void Tablebase::preload() const
+{
+        for (auto const& material : materials_) {
+                table(*material, false);
+                table(*material, true);
+        }
+}
+
+// Files that can't be opened or aren't tables count as missing.
+Tablebase::Table const* Tablebase::table(Material& material, bool dtz) const
+{
+        std::call_once(material.mapped[dtz], [&]
+        {
+                if (!material.exists[dtz])
+                        return;
+                try {
+                        std::string const path = directory_ + '/' + material.info.signature +
+                                                 std::string(dtz ? dtz_suffix : wdl_suffix);
+                        auto table = std::make_unique<Table>(Table {MappedFile(path), {}, 1, nullptr, 0});
+                        table->sides = (!dtz && material.info.key != material.info.key2) ? 2 : 1;
+                        if (read_table(material.info, dtz, table->file.data(), table->file.size(),
+                                       table->tables, table->map, table->map_size)) {
+                                material.tables[dtz] = std::move(table);
+                        }
+                } catch (std::system_error const&) {
+                }
+        });
+        return material.tables[dtz].get();
+}
+
+Tablebase::Material* Tablebase::material(Board const& board, int& pieces,
+                                         std::uint64_t& key) const noexcept
+{
+        PieceCounts counts {};
+        for (auto const& row : board) {
+                for (Piece piece : row)
+                        ++counts[piece_code(piece)];
+        }
+        pieces = 64 - counts[0];
+        counts[0] = 0;
+        key = material_key(counts);
+        auto const found = by_key_.find(key);
+        return found == by_key_.cend() ? nullptr : found->second;
+}
+
+// The value stored for the position, -2 for a loss to 2 for a win, or
+// its DTZ value given that. A DTZ table may keep the other side on turn
+// instead, then other_side is set.
+std::optional<int> Tablebase::probe_table(Board const& board, Side on_turn, bool dtz, int wdl,
+                                          bool& other_side) const
+{
+        int pieces = 0;
+        std::uint64_t key = 0;
+        Material* const material = this->material(board, pieces, key);
+        if (pieces == 2)
+                return 0;
+        if (!material)
+                return std::nullopt;
+        Table const* const table = this->table(*material, dtz);
+        if (!table)
+                return std::nullopt;
+
+        MaterialInfo const& info = material->info;
+        Location const location = locate(info, table->tables, table->sides, board, on_turn, key);
+        SubTable const& sub_table = table->tables[location.side % table->sides][location.file];
+        if (dtz && static_cast<int>(sub_table.flags & stm_flag) != location.side &&
+            !(info.key == info.key2 && !info.has_pawns)) {
+                other_side = true;
+                return 0;
+        }
+        int const value = decompress(sub_table, location.index);
+        if (value < 0)
+                return std::nullopt;
+        if (!dtz)
+                return value - 2;
+        return dtz_plies(sub_table, table->map, table->map_size, value, wdl);
+}
+
+// The value for the side on turn, -2 for a loss to 2 for a win. Tables
+// may hold anything for positions where a capture is best, so those are
+// played first, and pawn moves too if check_zeroing is set. zeroing_best
+// says whether one of those is the best move.
+std::optional<int> Tablebase::search(Game& game, bool check_zeroing, bool& zeroing_best) const
+{
+        Board const board = game.board();
+        MoveList const moves = game.valid_moves();
+        int best = -2;
+        int searched = 0;
+        for (Move move : moves) {
+                if (!is_capture(board, move) &&
+                    (!check_zeroing || board[move.from.y][move.from.x].kind != Piece::Kind::pawn)) {
+                        continue;
+                }
+                ++searched;
+                Game::TriedMove tried;
+                game.make_move(move, tried);
+                bool ignored = false;
+                std::optional const child = search(game, false, ignored);
+                game.unmake_move(tried);
+                if (!child)
+                        return std::nullopt;
+                if (-*child > best) {
+                        best = -*child;
+                        if (best == 2) {
+                                zeroing_best = true;
+                                return best;
+                        }
+                }
+        }
+
+        // Stored values can't be trusted once every move was searched,
+        // e.g. with en passant possible, which the tables leave out.
+        bool const all_searched = searched != 0 && searched == moves.size();
+        int value = best;
+        if (!all_searched) {
+                bool other_side = false;
+                std::optional const stored = probe_table(board, side_on_turn(game), false, 0, other_side);
+                if (!stored)
+                        return std::nullopt;
+                value = *stored;
+        }
+        if (best >= value) {
+                zeroing_best = best > 0 || all_searched;
+                return best;
+        }
+        zeroing_best = false;
+        return value;
+}
+
+std::optional<Wdl> Tablebase::probe_wdl(Game& game) const
+{
+        if (has_castling_rights(game.setup()))
+                return std::nullopt;
+        bool zeroing_best = false;
+        std::optional const wdl = search(game, false, zeroing_best);
+        if (!wdl)
+                return std::nullopt;
+        return static_cast<Wdl>(*wdl + 2);
+}
+
+std::optional<int> Tablebase::probe_dtz(Game& game) const
+{
+        if (has_castling_rights(game.setup()))
+                return std::nullopt;
+        bool zeroing_best = false;
+        std::optional const wdl = search(game, true, zeroing_best);
+        if (!wdl)
+                return std::nullopt;
+        if (*wdl == 0)
+                return 0;
+        if (zeroing_best)
+                return dtz_before_zeroing(*wdl);
+
+        Board const board = game.board();
+        bool other_side = false;
+        std::optional const dtz = probe_table(board, side_on_turn(game), true, *wdl, other_side);
+        if (!dtz)
+                return std::nullopt;
+        if (!other_side)
+                return (*dtz + (*wdl == 1 || *wdl == -1 ? 100 : 0)) * sign(*wdl);
+
+        // The table keeps the other side on turn, so the best move is the
+        // one that wins the fastest, or loses the slowest. A capture or a
+        // pawn move counts from the position before it.
+        MoveList const moves = game.valid_moves();
+        int best = 0xffff;
+        for (Move move : moves) {
+                bool const zeroing = is_capture(board, move) ||
+                                     board[move.from.y][move.from.x].kind == Piece::Kind::pawn;
+                Game::TriedMove tried;
+                game.make_move(move, tried);
+                std::optional<int> value;
+                if (zeroing) {
+                        bool ignored = false;
+                        if (std::optional const child = search(game, false, ignored))
+                                value = -dtz_before_zeroing(*child);
+                } else if (std::optional const child = probe_dtz(game)) {
+                        value = -*child;
+                }
+                bool const mate = value == 1 && game.in_check() && game.valid_moves().empty();
+                game.unmake_move(tried);
+                if (!value)
+                        return std::nullopt;
+                if (mate)
+                        best = 1;
+                int const plies = zeroing ? *value : *value + sign(*value);
+                if (plies < best && sign(plies) == sign(*wdl))
+                        best = plies;
+        }
+        return best == 0xffff ? -1 : best;
+}
+
+std::optional<Wdl> Tablebase::probe(Setup const& setup) const
+{
+        Game game(nullptr, setup);
+        return probe_wdl(game);
+}
+
+std::optional<Side> Tablebase::adjudicate(Game const& game) const
+{
+        Side const on_turn = game.on_turn();
+        if (on_turn == Side::none)
+                return std::nullopt;
+        std::optional const wdl = probe(game.setup());
+        if (!wdl)
+                return std::nullopt;
+        switch (*wdl) {
+                case Wdl::win:
+                        return on_turn;
+                case Wdl::loss:
+                        return opposite_side(on_turn);
+                default:
+                        return Side::none;
+        }
+}
+
+}
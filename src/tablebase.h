@@ -0,0 +1,115 @@
+#pragma once
+
+#include "chess.h"
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Chess {
+
+// Win, draw or loss for the side on turn. A cursed win can't be forced
+// before the fifty-move rule allows a draw claim, and a blessed loss is
+// the other side of one.
+enum class Wdl : std::uint8_t {
+        loss,
+        blessed_loss,
+        draw,
+        cursed_win,
+        win,
+        // Not a legal position, e.g. two pieces on a square.
+        invalid
+};
+
+int constexpr min_tablebase_pieces = 3;
+int constexpr max_tablebase_pieces = 6;
+
+// The signature of the table with these pieces, each side's listed like
+// KRP, named the way the Syzygy files are: the side with more pieces
+// first, or else the one with the stronger pieces, like KRvK or KBvKN.
+std::string table_signature(std::string_view light, std::string_view dark);
+
+// Collects the values of a material's positions and writes them as a
+// Syzygy WDL table (.rtbw) and DTZ table (.rtbz). Positions that are
+// mirror images of each other share an entry, the DTZ table only keeps
+// the positions with the first side of the signature on turn, and
+// entries no position was given are filled in to compress well.
+class TableWriter {
+public:
+        // Throws std::invalid_argument unless the signature names 3 to 6
+        // pieces, like KRvK.
+        explicit TableWriter(std::string_view signature);
+        ~TableWriter();
+        TableWriter(TableWriter const&) = delete;
+        TableWriter& operator=(TableWriter const&) = delete;
+
+        // dtz counts plies to the next capture or pawn move, or to mate,
+        // negative when losing, as Tablebase::probe_dtz returns it. It is
+        // ignored for draws. Positions with other pieces, castling rights
+        // or en passant are ignored.
+        void add(Setup const& setup, Wdl wdl, int dtz);
+        void write_wdl(std::ostream& out) const;
+        void write_dtz(std::ostream& out) const;
+
+private:
+        struct Layout;
+        std::unique_ptr<Layout> layout_;
+};
+
+// Syzygy tables of 3 to 6 pieces in a directory, <signature>.rtbw for
+// win/draw/loss and <signature>.rtbz for the distance to zeroing. The
+// directory is listed when the tablebase is created, and a file is only
+// mapped the first time a position of its material is probed. Blocks are
+// decoded in place from the mapping, so a probe never allocates and the
+// page cache is all that holds on to them. Probing is thread-safe.
+class Tablebase {
+public:
+        explicit Tablebase(std::string directory);
+        ~Tablebase();
+        Tablebase(Tablebase const&) = delete;
+        Tablebase& operator=(Tablebase const&) = delete;
+
+        // Win, draw or loss for the side on turn, nothing if the position
+        // has castling rights or no table covers it. The tables leave out
+        // positions where a capture is best, so captures are played on the
+        // game to look past them and taken back again.
+        std::optional<Wdl> probe_wdl(Game& game) const;
+        // Plies to the next capture or pawn move, or to mate, for the side
+        // on turn: positive when winning, negative when losing and 0 for a
+        // draw. Cursed wins and blessed losses count 100 more. A DTZ table
+        // may only keep one side on turn, then the other side's moves are
+        // looked at instead.
+        std::optional<int> probe_dtz(Game& game) const;
+        // probe_wdl for a position without a game to play the captures on.
+        std::optional<Wdl> probe(Setup const& setup) const;
+        // The winner, Side::none for a draw, or nothing if the position
+        // isn't in the tables. Cursed wins are draws.
+        std::optional<Side> adjudicate(Game const& game) const;
+        // The most pieces of any table found, 0 without tables.
+        int max_pieces() const noexcept;
+        // Maps every table file found right away.
+        void preload() const;
+
+private:
+        struct Material;
+        struct Table;
+
+        Material* material(Board const& board, int& pieces, std::uint64_t& key) const noexcept;
+        Table const* table(Material& material, bool dtz) const;
+        std::optional<int> probe_table(Board const& board, Side on_turn, bool dtz, int wdl,
+                                       bool& other_side) const;
+        std::optional<int> search(Game& game, bool check_zeroing, bool& zeroing_best) const;
+
+        std::string directory_;
+        std::vector<std::unique_ptr<Material>> materials_;
+        // By the material key of the position, with either side first.
+        std::unordered_map<std::uint64_t, Material*> by_key_;
+        int max_pieces_ = 0;
+};
+
+}
@@ -0,0 +1,358 @@
+#include "uci.h"
+#include "notation.h"
+#include <charconv>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace Chess {
+
+namespace {
+
+std::string_view next_token(std::string_view& text) noexcept
+{
+        auto const begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string_view::npos) {
+                text = std::string_view();
+                return text;
+        }
+        text.remove_prefix(begin);
+        auto const end = std::min(text.find_first_of(" \t\r"), text.size());
+        auto const token = text.substr(0, end);
+        text.remove_prefix(end);
+        return token;
+}
+
+std::int64_t parse_int(std::string_view text) noexcept
+{
+        std::int64_t value = 0;
+        std::from_chars(text.data(), text.data() + text.size(), value);
+        return value;
+}
+
+std::string score_string(int score)
+{
+        using namespace std::string_literals;
+
+        if (std::abs(score) < mate_score - max_search_depth)
+                return "cp "s + std::to_string(score);
+        int const plies = mate_score - std::abs(score);
+        int const moves = (score > 0) ? (plies + 1) / 2 : -(plies + 1) / 2;
+        return "mate "s + std::to_string(moves);
+}
+
+// Castling can only be told apart on the board it is made on, so the
+// moves are played out on a copy of the game.
+std::string moves_string(Game game, MoveList const& moves)
+{
+        std::string result;
+        for (Move move : moves) {
+                if (!result.empty())
+                        result += ' ';
+                result += to_uci(game.board(), move);
+                game.try_move(move);
+        }
+        return result;
+}
+
+}
+
+UciEngine::UciEngine(std::ostream& out)
+        : out_(out)
+        , game_(nullptr)
+{}
+
+UciEngine::~UciEngine()
+{
+        wait_for_search();
+}
+
+bool UciEngine::command(std::string_view line)
+{
+        std::string_view args = line;
+        auto const name = next_token(args);
+        if (name == "uci") {
+                uci();
+        } else if (name == "isready") {
+                is_ready();
+        } else if (name == "setoption") {
+                set_option(args);
+        } else if (name == "ucinewgame") {
+                new_game();
+        } else if (name == "position") {
+                position(args);
+        } else if (name == "go") {
+                go(args);
+        } else if (name == "stop") {
+                stop();
+        } else if (name == "ponderhit") {
+                ponder_hit();
+        } else if (name == "quit") {
+                wait_for_search();
+                return false;
+        }
+        return true;
+}
+
+void UciEngine::uci()
+{
+        send("id name chess");
+        send("id author chess contributors");
+        send("option name Ponder type check default false");
+        send("option name Move Overhead type spin default 30 min 0 max 5000");
+        send("option name OwnBook type check default false");
+        send("option name Book File type string default <empty>");
+        send("option name TablebasePath type string default <empty>");
+        send("uciok");
+}
+
+void UciEngine::is_ready()
+{
+        send("readyok");
+}
+
+void UciEngine::set_option(std::string_view args)
+{
+        using namespace std::string_literals;
+
+        auto const name_begin = args.find("name ");
+        if (name_begin == std::string_view::npos)
+                return;
+        auto const value_begin = args.find(" value ");
+        auto const name = args.substr(name_begin + 5, value_begin - name_begin - 5);
+        auto const value = (value_begin == std::string_view::npos) ?
+                std::string_view() : args.substr(value_begin + 7);
+        if (name == "Move Overhead") {
+                move_overhead_ = std::chrono::milliseconds(parse_int(value));
+        } else if (name == "OwnBook") {
+                own_book_ = (value == "true");
+        } else if (name == "Book File") {
+                wait_for_search();
+                book_.reset();
+                if (value.empty() || value == "<empty>")
+                        return;
+                try {
+                        book_.emplace(MappedFile(std::string(value)));
+                } catch (std::exception const& error) {
+                        send("info string can't open book: "s + error.what());
+                }
+        } else if (name == "TablebasePath") {
+                wait_for_search();
+                tablebase_.reset();
+                if (!value.empty() && value != "<empty>") {
+                        tablebase_ = std::make_unique<Tablebase>(std::string(value));
+                        tablebase_->preload();
+                }
+        }
+}
+
+void UciEngine::new_game()
+{
+        wait_for_search();
+        game_ = Game(nullptr);
+}
+
+void UciEngine::position(std::string_view args)
+{
+        using namespace std::string_literals;
+
+        wait_for_search();
+        auto const kind = next_token(args);
+        if (kind == "startpos") {
+                game_ = Game(nullptr);
+        } else if (kind == "fen") {
+                auto const moves_begin = args.find(" moves");
+                auto const fen = args.substr(0, moves_begin);
+                std::optional const setup = parse_fen(fen);
+                if (!setup) {
+                        send("info string invalid fen "s + std::string(fen));
+                        return;
+                }
+                game_ = Game(nullptr, *setup);
+                args.remove_prefix(fen.size());
+        } else {
+                return;
+        }
+
+        if (next_token(args) != "moves")
+                return;
+        for (auto token = next_token(args); !token.empty(); token = next_token(args)) {
+                std::optional const move = parse_uci(game_, token);
+                if (!move) {
+                        send("info string illegal move "s + std::string(token));
+                        return;
+                }
+                game_.try_move(*move);
+        }
+}
+
+void UciEngine::go(std::string_view args)
+{
+        using namespace std::chrono;
+        using namespace std::string_literals;
+
+        wait_for_search();
+
+        SearchLimits limits;
+        milliseconds light_time {0};
+        milliseconds dark_time {0};
+        milliseconds light_increment {0};
+        milliseconds dark_increment {0};
+        milliseconds move_time {0};
+        int moves_to_go = 0;
+        int perft_depth = 0;
+        bool ponder = false;
+        bool infinite = false;
+        for (auto token = next_token(args); !token.empty(); token = next_token(args)) {
+                if (token == "ponder")
+                        ponder = true;
+                else if (token == "infinite")
+                        infinite = true;
+                else if (token == "wtime")
+                        light_time = milliseconds(parse_int(next_token(args)));
+                else if (token == "btime")
+                        dark_time = milliseconds(parse_int(next_token(args)));
+                else if (token == "winc")
+                        light_increment = milliseconds(parse_int(next_token(args)));
+                else if (token == "binc")
+                        dark_increment = milliseconds(parse_int(next_token(args)));
+                else if (token == "movestogo")
+                        moves_to_go = parse_int(next_token(args));
+                else if (token == "movetime")
+                        move_time = milliseconds(parse_int(next_token(args)));
+                else if (token == "depth")
+                        limits.depth = parse_int(next_token(args));
+                else if (token == "nodes")
+                        limits.nodes = parse_int(next_token(args));
+                else if (token == "perft")
+                        perft_depth = parse_int(next_token(args));
+        }
+
+        if (perft_depth > 0) {
+                perft_stopped_ = false;
+                worker_ = std::thread(
+                        [this, perft_depth, game = game_]
+                        {
+                                auto const nodes = perft(game, perft_depth, &perft_stopped_);
+                                // A stopped count is only part of the tree.
+                                if (!perft_stopped_)
+                                        send("info string perft "s + std::to_string(nodes));
+                        }
+                );
+                return;
+        }
+
+        if (!ponder && !infinite && play_book_move())
+                return;
+
+        bool const light = (game_.on_turn() == Side::light);
+        milliseconds const remaining = light ? light_time : dark_time;
+        milliseconds const increment = light ? light_increment : dark_increment;
+        if (move_time.count() > 0) {
+                limits.time = move_time - move_overhead_;
+        } else if (remaining.count() > 0) {
+                limits.time = remaining / (moves_to_go > 0 ? moves_to_go : 30) +
+                              increment / 2;
+                limits.time = std::min(limits.time, remaining - move_overhead_);
+        }
+        if (move_time.count() > 0 || remaining.count() > 0)
+                limits.time = std::max(limits.time, milliseconds(1));
+        if (ponder) {
+                ponder_time_ = limits.time;
+                limits.time = milliseconds(0);
+        }
+
+        hold_best_move_ = ponder || infinite;
+        search_ = std::make_unique<Search>(game_);
+        search_->set_tablebase(tablebase_.get());
+        worker_ = std::thread(
+                [this, limits, game = game_]
+                {
+                        auto const report =
+                        [&](SearchInfo const& info)
+                        {
+                                auto const nps = info.nodes * 1000 /
+                                                 std::max<std::int64_t>(info.time.count(), 1);
+                                send("info depth "s + std::to_string(info.depth) +
+                                     " score "s + score_string(info.score) +
+                                     " nodes "s + std::to_string(info.nodes) +
+                                     " nps "s + std::to_string(nps) +
+                                     " time "s + std::to_string(info.time.count()) +
+                                     " pv "s + moves_string(game, info.principal_variation));
+                        };
+
+                        std::optional const best_move = search_->run(limits, report);
+                        {
+                                std::unique_lock lock(mutex_);
+                                waiting_.wait(lock, [this] { return !hold_best_move_; });
+                        }
+                        if (best_move)
+                                send("bestmove "s + to_uci(game.board(), *best_move));
+                        else
+                                send("bestmove 0000");
+                }
+        );
+}
+
+// Book moves are answered right away, without a search.
+bool UciEngine::play_book_move()
+{
+        using namespace std::string_literals;
+
+        if (!own_book_ || !book_)
+                return false;
+        std::optional const move = book_->pick(game_, random_);
+        if (!move)
+                return false;
+        send("bestmove "s + to_uci(game_.board(), *move));
+        return true;
+}
+
+void UciEngine::stop()
+{
+        {
+                std::lock_guard lock(mutex_);
+                hold_best_move_ = false;
+        }
+        waiting_.notify_all();
+        if (search_)
+                search_->stop();
+        perft_stopped_ = true;
+}
+
+void UciEngine::ponder_hit()
+{
+        if (search_ && ponder_time_.count() > 0)
+                search_->set_time_limit(ponder_time_);
+        {
+                std::lock_guard lock(mutex_);
+                hold_best_move_ = false;
+        }
+        waiting_.notify_all();
+}
+
+void UciEngine::wait_for_search()
+{
+        if (worker_.joinable()) {
+                stop();
+                worker_.join();
+        }
+        search_.reset();
+}
+
+void UciEngine::send(std::string_view line)
+{
+        std::lock_guard lock(out_mutex_);
+        out_ << line << '\n' << std::flush;
+}
+
+void run_uci(std::istream& in, std::ostream& out)
+{
+        UciEngine engine(out);
+        std::string line;
+        while (std::getline(in, line) && engine.command(line))
+                ;
+}
+
+}
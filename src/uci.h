@@ -0,0 +1,67 @@
+#pragma once
+
+#include "chess.h"
+#include "engine.h"
+#include "polyglot.h"
+#include "tablebase.h"
+#include <atomic>
+#include <condition_variable>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <thread>
+
+namespace Chess {
+
+// The engine side of the Universal Chess Interface. Searches run on a
+// worker thread, so stop and ponderhit are handled while thinking.
+class UciEngine {
+public:
+        explicit UciEngine(std::ostream& out);
+        ~UciEngine();
+        UciEngine(UciEngine const&) = delete;
+        UciEngine(UciEngine&&) = delete;
+        UciEngine& operator=(UciEngine const&) = delete;
+        UciEngine& operator=(UciEngine&&) = delete;
+
+        // Returns false once the GUI asks the engine to quit.
+        bool command(std::string_view line);
+
+private:
+        void uci();
+        void is_ready();
+        void set_option(std::string_view args);
+        void new_game();
+        void position(std::string_view args);
+        void go(std::string_view args);
+        bool play_book_move();
+        void stop();
+        void ponder_hit();
+        void wait_for_search();
+        void send(std::string_view line);
+
+        std::ostream& out_;
+        std::mutex out_mutex_;
+        Game game_;
+        std::unique_ptr<Search> search_;
+        std::thread worker_;
+        // Set by stop to end a perft count on the worker.
+        std::atomic<bool> perft_stopped_ {false};
+        std::mutex mutex_;
+        std::condition_variable waiting_;
+        // The best move is held back while pondering or searching infinitely.
+        bool hold_best_move_ = false;
+        std::chrono::milliseconds ponder_time_ {0};
+        std::chrono::milliseconds move_overhead_ {30};
+        std::optional<PolyglotBook> book_;
+        bool own_book_ = false;
+        std::mt19937_64 random_ {std::random_device()()};
+        std::unique_ptr<Tablebase> tablebase_;
+};
+
+void run_uci(std::istream& in, std::ostream& out);
+
+}
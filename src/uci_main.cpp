@@ -0,0 +1,7 @@
+#include "uci.h"
+#include <iostream>
+
+int main(int, char**)
+{
+        Chess::run_uci(std::cin, std::cout);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "chess.h"
+#include <cstdint>
+#include <optional>
+
+namespace Chess {
+
+// The random numbers for Zobrist hashing, laid out like Polyglot's so that
+// the same keys find positions in opening books.
+
+// Zero for an empty square.
+std::uint64_t piece_key(Piece piece, Position position) noexcept;
+// Rights numbered in the order of CastlingRights.
+std::uint64_t castling_key(int right) noexcept;
+std::uint64_t en_passant_key(int file) noexcept;
+std::uint64_t light_on_turn_key() noexcept;
+
+// Only when a pawn of the side on turn stands next to the pawn that double
+// stepped, so positions that only differ in a right that can't be used
+// hash the same.
+bool en_passant_counts(Board const& board, Side on_turn,
+                       std::optional<Position> en_passant_position) noexcept;
+
+std::uint64_t zobrist_key(Setup const& setup) noexcept;
+
+}
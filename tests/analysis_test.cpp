@@ -0,0 +1,80 @@
+#include "catch.hpp"
+#include "analysis.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+TEST_CASE("Batch analysis answers every position")
+{
+        using namespace Chess;
+
+        std::string input = "# mate in one\n"
+                            "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1\n"
+                            "\n"
+                            "not a position\n"
+                            "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1\n";
+        for (int i = 0; i < 20; ++i)
+                input += "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1\n";
+        std::istringstream in(input);
+
+        AnalysisOptions options;
+        options.threads = 3;
+        options.limits = SearchLimits {.depth = 2};
+        options.max_in_flight = 2;
+        std::vector<AnalysisResult> results;
+        analyze_positions(in, options,
+                [&](AnalysisResult const& result)
+                {
+                        results.push_back(result);
+                }
+        );
+
+        REQUIRE(results.size() == 23);
+        std::sort(results.begin(), results.end(),
+                [](AnalysisResult const& r1, AnalysisResult const& r2)
+                {
+                        return r1.index < r2.index;
+                }
+        );
+        for (std::size_t i = 0; i < results.size(); ++i)
+                CHECK(results[i].index == i);
+
+        CHECK(results[0].best_move == "a1a8");
+        CHECK(to_json(results[0]) ==
+              "{\"index\": 0, \"fen\": \"6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1\", "
+              "\"bestmove\": \"a1a8\", \"score\": {\"mate\": 1}, \"depth\": 1, "
+              "\"nodes\": " + std::to_string(results[0].nodes) + ", \"time\": " +
+              std::to_string(results[0].time.count()) + ", \"pv\": [\"a1a8\"]}");
+        CHECK(to_json(results[1]) ==
+              "{\"index\": 1, \"fen\": \"not a position\", \"error\": \"invalid FEN\"}");
+        // Stalemate.
+        CHECK(results[2].error == "no legal moves");
+        CHECK(results[3].error.empty());
+        CHECK(results[3].depth == 2);
+}
+
+TEST_CASE("Batch analysis stops reading when the sink throws")
+{
+        using namespace Chess;
+
+        std::string input;
+        for (int i = 0; i < 1000; ++i)
+                input += "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1\n";
+        std::istringstream in(input);
+
+        AnalysisOptions options;
+        options.threads = 2;
+        options.limits = SearchLimits {.depth = 1};
+        options.max_in_flight = 4;
+        int calls = 0;
+        CHECK_THROWS_AS(analyze_positions(in, options,
+                [&](AnalysisResult const&)
+                {
+                        if (++calls == 3)
+                                throw std::runtime_error("full");
+                }
+        ), std::runtime_error);
+        CHECK(calls == 3);
+        // The reader never got more than the bound ahead of the sink.
+        CHECK(in.tellg() <= static_cast<std::streamoff>(9 * 33));
+}
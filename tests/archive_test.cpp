@@ -0,0 +1,159 @@
+#include "catch.hpp"
+#include "archive.h"
+#include "notation.h"
+#include "zobrist.h"
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+auto constexpr pgn_text = R"([Event "First"]
+[White "Light"]
+[Result "1-0"]
+
+1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6 4. Qxf7# 1-0
+
+[Event "Second"]
+[SetUp "1"]
+[FEN "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3"]
+
+3. exf6 e6 4. fxg7 Bd6 5. gxh8=N *
+
+[Event "Illegal"]
+
+1. e4 e5 2. Ke3 *
+)";
+
+}
+
+TEST_CASE("Move codes round trip")
+{
+        using namespace Chess;
+
+        Move const moves[] = {
+                {{0, 0}, {7, 7}},
+                {{4, 7}, {7, 7}},
+                {{6, 1}, {7, 0}, Piece::Kind::knight},
+                {{1, 6}, {1, 7}, Piece::Kind::queen}
+        };
+        for (Move move : moves)
+                CHECK(decode_move(encode_move(move)) == move);
+}
+
+TEST_CASE("Games are archived and read back by index")
+{
+        using namespace Chess;
+
+        std::ostringstream out;
+        ArchiveWriter writer(out);
+        PgnReader reader(pgn_text);
+        PgnGame game;
+        int added = 0;
+        while (reader.next(game))
+                added += writer.add_pgn_game(game);
+        writer.finish();
+        CHECK(added == 2);
+
+        std::string const data = out.str();
+        ArchiveReader const archive(data);
+        REQUIRE(archive.size() == 2);
+
+        ArchivedGame archived;
+        REQUIRE(archive.read(1, archived));
+        CHECK(archived.result == GameResult::unknown);
+        CHECK(archived.fen == "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3");
+        CHECK(archived.moves.size() == 5);
+        REQUIRE(archived.tags.size() == 1);
+        CHECK(archived.tags[0].value == "Second");
+
+        REQUIRE(archive.read(0, archived));
+        CHECK(archived.result == GameResult::light_wins);
+        CHECK(archived.moves.size() == 7);
+        CHECK(archived.fen.empty());
+        CHECK(archived.tags.size() == 3);
+        CHECK(archived.tags[1].name == "White");
+
+        std::optional const first = archive.replay(0);
+        REQUIRE(first);
+        CHECK(first->on_turn() == Side::none);
+        std::optional const second = archive.replay(1);
+        REQUIRE(second);
+        CHECK(to_fen(second->setup()) ==
+              "rnbqk1nN/ppp4p/3bp3/3p4/8/8/PPPP1PPP/RNBQKBNR b KQq - 0 5");
+        CHECK(second->key() == zobrist_key(second->setup()));
+        CHECK(first->winner() == Side::light);
+        CHECK(first->ending() == Ending::checkmate);
+
+        CHECK(!archive.read(2, archived));
+        CHECK(!archive.replay(2));
+}
+
+TEST_CASE("Damaged archives are rejected")
+{
+        using namespace Chess;
+
+        std::ostringstream out;
+        ArchiveWriter writer(out);
+        CHECK(writer.add_game({}, "", {Move {{4, 6}, {4, 4}}}, GameResult::draw) == 0u);
+        CHECK(!writer.add_game({}, "", {Move {{4, 6}, {4, 3}}}, GameResult::draw));
+        writer.finish();
+        std::string data = out.str();
+
+        CHECK_THROWS_AS(ArchiveReader(std::string_view(data).substr(1)), std::runtime_error);
+        CHECK_THROWS_AS(ArchiveReader(std::string_view(data).substr(0, data.size() - 1)),
+                        std::runtime_error);
+
+        // A move index past the legal moves is caught when reading.
+        ArchivedGame archived;
+        REQUIRE(ArchiveReader(data).read(0, archived));
+        REQUIRE(archived.moves.size() == 1);
+        CHECK(archived.moves[0] == Move {{4, 6}, {4, 4}});
+        data[16 + 4] = 20;
+        ArchiveReader const archive(data);
+        CHECK(!archive.read(0, archived));
+        CHECK(!archive.replay(0));
+}
+
+TEST_CASE("Archived games keep every tag whole and a byte per move")
+{
+        using namespace Chess;
+
+        // Tags only point at their text.
+        std::vector<std::string> names;
+        std::vector<std::string> values;
+        for (int i = 0; i < 300; ++i) {
+                names.push_back("Tag" + std::to_string(i));
+                values.push_back(std::string(static_cast<std::size_t>(i), 'x'));
+        }
+        names.push_back(std::string(300, 'N'));
+        values.push_back("long name");
+        std::vector<PgnTag> tags;
+        for (std::size_t i = 0; i < names.size(); ++i)
+                tags.push_back(PgnTag {names[i], values[i]});
+
+        std::vector<Move> const moves {
+                Move {{4, 6}, {4, 4}},
+                Move {{4, 1}, {4, 3}},
+                Move {{6, 7}, {5, 5}},
+                Move {{1, 0}, {2, 2}}
+        };
+        auto const archive = [&](std::vector<PgnTag> const& tags, std::vector<Move> const& moves)
+        {
+                std::ostringstream out;
+                ArchiveWriter writer(out);
+                REQUIRE(writer.add_game(tags, "", moves, GameResult::draw));
+                writer.finish();
+                return out.str();
+        };
+        CHECK(archive({}, moves).size() == archive({}, {}).size() + moves.size());
+
+        std::string const data = archive(tags, moves);
+        ArchivedGame archived;
+        REQUIRE(ArchiveReader(data).read(0, archived));
+        CHECK(archived.moves == moves);
+        REQUIRE(archived.tags.size() == tags.size());
+        for (std::size_t i = 0; i < tags.size(); ++i) {
+                CHECK(archived.tags[i].name == tags[i].name);
+                CHECK(archived.tags[i].value == tags[i].value);
+        }
+}
@@ -0,0 +1,252 @@
+#include "catch.hpp"
+#include "archive.h"
+#include "engine.h"
+#include "ingest.h"
+#include "notation.h"
+#include "pgn.h"
+#include "polyglot.h"
+#include "zobrist.h"
+#include <initializer_list>
+#include <sstream>
+
+namespace {
+
+int draws = 0;
+
+void game_over(Chess::Side winner)
+{
+        if (winner == Chess::Side::none)
+                ++draws;
+}
+
+void play(Chess::Game& game, std::initializer_list<char const*> moves)
+{
+        for (char const* san : moves) {
+                std::optional const move = Chess::parse_san(game, san);
+                REQUIRE(move);
+                REQUIRE(game.try_move(*move));
+        }
+}
+
+}
+
+TEST_CASE("Keys follow the moves")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        CHECK(game.key() == zobrist_key(default_setup()));
+
+        // En passant, castling on both sides and a promotion with capture.
+        char const* const moves[] = {
+                "e4", "Nf6", "e5", "d5", "exd6", "Qxd6", "Nf3", "Bf5", "Be2", "Nc6",
+                "O-O", "O-O-O", "d4", "g5", "c4", "g4", "c5", "gxf3", "cxd6", "fxg2",
+                "dxe7", "gxf1=Q+", "Kxf1", "Nxd4", "exd8=Q+"
+        };
+        for (char const* san : moves) {
+                std::optional const move = parse_san(game, san);
+                REQUIRE(move);
+                REQUIRE(game.try_move(*move));
+                CHECK(game.key() == zobrist_key(game.setup()));
+        }
+        std::uint64_t const final_key = game.key();
+
+        for (std::size_t i = 0; i < std::size(moves); ++i) {
+                game.undo_move();
+                CHECK(game.key() == zobrist_key(game.setup()));
+        }
+        CHECK(game.key() == zobrist_key(default_setup()));
+        for (std::size_t i = 0; i < std::size(moves); ++i)
+                game.redo_move();
+        CHECK(game.key() == final_key);
+}
+
+TEST_CASE("Threefold repetition can be claimed")
+{
+        using namespace Chess;
+
+        draws = 0;
+        Game game(game_over);
+        play(game, {"Nf3", "Nf6", "Ng1", "Ng8"});
+        CHECK(game.repetitions() == 1);
+        CHECK(!game.is_draw());
+        CHECK(!game.claim_draw());
+        play(game, {"Nf3", "Nf6", "Ng1", "Ng8"});
+        CHECK(game.repetitions() == 2);
+        CHECK(game.is_draw());
+        // Nothing ends until a player claims the draw.
+        CHECK(draws == 0);
+        CHECK(game.on_turn() == Side::light);
+        Game claimed = game;
+        CHECK(claimed.claim_draw());
+        CHECK(draws == 1);
+        CHECK(claimed.on_turn() == Side::none);
+        CHECK(claimed.winner() == Side::none);
+        CHECK(claimed.ending() == Ending::threefold_repetition);
+        CHECK(game.ending() == Ending::none);
+        CHECK(!claimed.claim_draw());
+
+        game.undo_move();
+        CHECK(game.on_turn() == Side::dark);
+        CHECK(game.repetitions() == 1);
+
+        // Only positions since the pawn move can come back.
+        game.undo_move();
+        play(game, {"e4", "Ng8", "Ng1", "Nf6", "Nf3"});
+        CHECK(game.halfmove_clock() == 4);
+        CHECK(game.repetitions() == 1);
+
+        std::vector<unsigned char> data;
+        game.serialize(data);
+        Game restored(nullptr);
+        REQUIRE(restored.deserialize(data.data(), data.size()) == data.size());
+        CHECK(restored.key() == game.key());
+        CHECK(restored.halfmove_clock() == 4);
+        CHECK(restored.repetitions() == 1);
+}
+
+TEST_CASE("Fivefold repetition ends the game")
+{
+        using namespace Chess;
+
+        draws = 0;
+        Game game(game_over);
+        for (int i = 0; i < 3; ++i)
+                play(game, {"Nf3", "Nf6", "Ng1", "Ng8"});
+        play(game, {"Nf3", "Nf6", "Ng1"});
+        CHECK(draws == 0);
+        play(game, {"Ng8"});
+        CHECK(game.repetitions() == 4);
+        CHECK(draws == 1);
+        CHECK(game.ending() == Ending::fivefold_repetition);
+        CHECK(game.on_turn() == Side::none);
+        CHECK(game.winner() == Side::none);
+        CHECK(game.valid_moves().empty());
+}
+
+TEST_CASE("Games go on past a draw nobody claimed")
+{
+        using namespace Chess;
+
+        auto constexpr pgn_text = R"([Result "1/2-1/2"]
+
+1. Nf3 Nf6 2. Ng1 Ng8 3. Nf3 Nf6 4. Ng1 Ng8 5. e4 e5 1/2-1/2
+)";
+
+        PgnGame pgn_game;
+        REQUIRE(PgnReader(pgn_text).next(pgn_game));
+        Replay const replayed = replay(pgn_game);
+        CHECK(replayed.complete);
+        CHECK(replayed.plies == 10);
+
+        std::vector<IngestResult> results;
+        ingest_pgn(pgn_text, IngestOptions {},
+                [&](IngestResult const& result)
+                {
+                        results.push_back(result);
+                }
+        );
+        REQUIRE(results.size() == 1);
+        CHECK(results[0].valid);
+        CHECK(results[0].plies == 10);
+
+        std::ostringstream archive;
+        ArchiveWriter writer(archive);
+        CHECK(writer.add_pgn_game(pgn_game));
+        writer.finish();
+
+        std::ostringstream book;
+        CHECK(build_book(pgn_text, BookOptions {}, book) == 6);
+}
+
+TEST_CASE("Fifty moves without a capture or a pawn move can be claimed")
+{
+        using namespace Chess;
+
+        draws = 0;
+        std::optional const setup = parse_fen("4k3/8/8/8/8/8/4P3/R3K3 w - - 98 70");
+        REQUIRE(setup);
+        Game game(game_over, *setup);
+        CHECK(game.halfmove_clock() == 98);
+        play(game, {"Ra2"});
+        CHECK(game.halfmove_clock() == 99);
+        CHECK(game.setup().halfmove_clock == 99);
+        CHECK(!game.is_draw());
+        play(game, {"Kd7"});
+        CHECK(game.is_draw());
+        CHECK(draws == 0);
+        CHECK(game.on_turn() == Side::light);
+        Game claimed = game;
+        claimed.set_game_over(nullptr);
+        CHECK(claimed.claim_draw());
+        CHECK(claimed.ending() == Ending::fifty_move_rule);
+
+        game.undo_move();
+        game.undo_move();
+        play(game, {"e4"});
+        CHECK(game.halfmove_clock() == 0);
+
+        // Seventy-five moves end the game without a claim.
+        Setup late_setup = *setup;
+        late_setup.halfmove_clock = 149;
+        Game late(game_over, late_setup);
+        play(late, {"Ra2"});
+        CHECK(draws == 1);
+        CHECK(late.on_turn() == Side::none);
+        CHECK(late.winner() == Side::none);
+        CHECK(late.ending() == Ending::seventy_five_move_rule);
+}
+
+TEST_CASE("Stalemate ends the game in a draw")
+{
+        using namespace Chess;
+
+        draws = 0;
+        std::optional const setup = parse_fen("7k/8/5Q2/8/8/8/8/K7 w - - 0 1");
+        REQUIRE(setup);
+        Game game(game_over, *setup);
+        play(game, {"Qf7"});
+        CHECK(draws == 1);
+        CHECK(game.on_turn() == Side::none);
+        CHECK(game.winner() == Side::none);
+        CHECK(game.ending() == Ending::stalemate);
+        CHECK(game.valid_moves().empty());
+
+        std::vector<unsigned char> data;
+        game.serialize(data);
+        Game restored(nullptr);
+        REQUIRE(restored.deserialize(data.data(), data.size()) == data.size());
+        CHECK(restored.on_turn() == Side::none);
+        CHECK(restored.winner() == Side::none);
+        CHECK(restored.ending() == Ending::stalemate);
+
+        game.undo_move();
+        CHECK(game.on_turn() == Side::light);
+        CHECK(game.winner() == Side::none);
+        CHECK(!game.valid_moves().empty());
+}
+
+TEST_CASE("Search scores a repetition as a draw")
+{
+        using namespace Chess;
+
+        // Down a queen, light is glad to walk back into a position seen
+        // before.
+        std::optional const setup = parse_fen("3qk3/8/8/8/8/8/8/4K3 w - - 0 1");
+        REQUIRE(setup);
+        Game game(nullptr, *setup);
+        play(game, {"Kf1", "Kf8", "Ke1", "Ke8", "Kf1", "Kf8"});
+        Search search(game);
+        int score = 0;
+        std::optional const move = search.run(SearchLimits {.depth = 2},
+                [&](SearchInfo const& info)
+                {
+                        score = info.score;
+                }
+        );
+        REQUIRE(move);
+        CHECK(score == 0);
+        Game after = game;
+        after.try_move(*move);
+        CHECK(after.repetitions() == 1);
+}
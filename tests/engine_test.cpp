@@ -0,0 +1,75 @@
+#include "catch.hpp"
+#include "engine.h"
+#include "notation.h"
+
+TEST_CASE("Perft counts legal moves")
+{
+        using namespace Chess;
+
+        Game const game(nullptr);
+        CHECK(perft(game, 1) == 20);
+        CHECK(perft(game, 2) == 400);
+
+        std::atomic<bool> const stopped {true};
+        CHECK(perft(game, 4, &stopped) == 0);
+}
+
+TEST_CASE("UCI notation round trips")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        std::optional const move = parse_uci(game, "e2e4");
+        REQUIRE(move);
+        CHECK(*move == Move {.from = {4, 6}, .to = {4, 4}});
+        CHECK(to_uci(game.board(), *move) == "e2e4");
+        CHECK(!parse_uci(game, "e2e5"));
+        CHECK(parse_position("h8") == Position {7, 0});
+        CHECK(to_string(Position {0, 7}) == "a1");
+}
+
+TEST_CASE("Search finds mate in one")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        for (auto const text : {"f2f3", "e7e5", "g2g4"})
+                game.try_move(*parse_uci(game, text));
+
+        Search search(game);
+        int score = 0;
+        std::optional const move = search.run(SearchLimits {.depth = 2},
+                [&](SearchInfo const& info)
+                {
+                        score = info.score;
+                }
+        );
+        REQUIRE(move);
+        CHECK(to_uci(game.board(), *move) == "d8h4");
+        CHECK(score == mate_score - 1);
+}
+
+TEST_CASE("A stopped search can be run again")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        for (auto const text : {"f2f3", "e7e5", "g2g4"})
+                game.try_move(*parse_uci(game, text));
+
+        Search search(game);
+        search.stop();
+        int depth = 0;
+        auto const report =
+        [&](SearchInfo const& info)
+        {
+                depth = info.depth;
+        };
+        // The stop came before the search and still counts.
+        CHECK(search.run(SearchLimits {.depth = 2}, report));
+        CHECK(depth == 0);
+        std::optional const move = search.run(SearchLimits {.depth = 2}, report);
+        REQUIRE(move);
+        CHECK(to_uci(game.board(), *move) == "d8h4");
+        CHECK(depth == 1);
+}
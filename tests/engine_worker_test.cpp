@@ -0,0 +1,81 @@
+#include "catch.hpp"
+#include "engine_worker.h"
+#include "notation.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+TEST_CASE("The single producer queue hands items over in order")
+{
+        using namespace Chess;
+
+        SpscQueue<int, 4> queue;
+        CHECK(!queue.try_pop());
+        for (int i = 0; i < 4; ++i)
+                CHECK(queue.try_push(i));
+        CHECK(!queue.try_push(4));
+        CHECK(queue.try_pop() == 0);
+        CHECK(queue.try_push(4));
+
+        int const count = 20000;
+        std::thread producer([&]
+        {
+                for (int i = 5; i < count; ++i) {
+                        while (!queue.try_push(i))
+                                std::this_thread::yield();
+                }
+        });
+        int expected = 1;
+        while (expected < count) {
+                if (std::optional const item = queue.try_pop()) {
+                        REQUIRE(*item == expected);
+                        ++expected;
+                } else {
+                        std::this_thread::yield();
+                }
+        }
+        producer.join();
+        CHECK(!queue.try_pop());
+}
+
+TEST_CASE("The engine worker reports on the latest position")
+{
+        using namespace Chess;
+
+        std::mutex mutex;
+        std::condition_variable woken;
+        int wakes = 0;
+        EngineWorker worker(SearchLimits {.depth = 3}, [&]
+        {
+                std::lock_guard lock(mutex);
+                ++wakes;
+                woken.notify_one();
+        });
+
+        Game game(nullptr);
+        worker.analyze(snapshot(game));
+        for (auto const text : {"f2f3", "e7e5", "g2g4"})
+                game.try_move(*parse_uci(game, text));
+        std::uint64_t const latest = worker.analyze(snapshot(game));
+
+        // Updates about the first position may still come in. The search of
+        // the latest one ends once it finds the mate.
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        std::optional<EngineUpdate> last;
+        while (!(last && last->score == mate_score - 1) &&
+               std::chrono::steady_clock::now() < deadline) {
+                {
+                        std::unique_lock lock(mutex);
+                        woken.wait_until(lock, deadline, [&] { return wakes > 0; });
+                        wakes = 0;
+                }
+                while (std::optional const update = worker.poll()) {
+                        if (update->position == latest)
+                                last = update;
+                }
+        }
+        REQUIRE(last);
+        CHECK(to_uci(game.board(), last->best_move) == "d8h4");
+        CHECK(last->score == mate_score - 1);
+}
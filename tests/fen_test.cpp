@@ -0,0 +1,69 @@
+#include "catch.hpp"
+#include "engine.h"
+#include "notation.h"
+
+TEST_CASE("FEN round trips")
+{
+        using namespace Chess;
+
+        auto const starting_fen =
+                "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        CHECK(to_fen(default_setup()) == starting_fen);
+        CHECK(to_fen(Game(nullptr).setup()) == starting_fen);
+
+        std::optional const setup = parse_fen(starting_fen);
+        REQUIRE(setup);
+        CHECK(setup->board == default_starting_board());
+
+        Game game(nullptr, *setup);
+        for (auto const text : {"e2e4", "c7c5", "g1f3"})
+                game.try_move(*parse_uci(game, text));
+        CHECK(to_fen(game.setup()) ==
+              "rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2");
+
+        auto const kiwipete =
+                "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+        CHECK(to_fen(*parse_fen(kiwipete)) == kiwipete);
+
+        CHECK(!parse_fen(""));
+        CHECK(!parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBN w KQkq - 0 1"));
+        CHECK(!parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1"));
+        CHECK(!parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkx - 0 1"));
+        CHECK(!parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQQBNR w KQkq - 0 1"));
+        CHECK(parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -"));
+}
+
+TEST_CASE("Castling rights and en passant come from the setup")
+{
+        using namespace Chess;
+
+        // Kiwipete, position 4 and 5 from the usual perft suite
+        Game kiwipete(nullptr, *parse_fen(
+                "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+        CHECK(perft(kiwipete, 1) == 48);
+        CHECK(perft(kiwipete, 2) == 2039);
+
+        Game position_4(nullptr, *parse_fen(
+                "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+        CHECK(perft(position_4, 2) == 264);
+
+        Game position_5(nullptr, *parse_fen(
+                "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"));
+        CHECK(perft(position_5, 2) == 1486);
+
+        auto const en_passant = "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3";
+        Game game(nullptr, *parse_fen(en_passant));
+        CHECK(to_fen(game.setup()) == en_passant);
+        REQUIRE(parse_uci(game, "e5f6"));
+        CHECK(!parse_uci(game, "e5d6"));
+        game.try_move(*parse_uci(game, "e5f6"));
+        CHECK(to_fen(game.setup()) ==
+              "rnbqkbnr/ppp1p1pp/5P2/3p4/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 3");
+        game.undo_move();
+        CHECK(to_fen(game.setup()) == en_passant);
+
+        Game no_castling(nullptr, *parse_fen("r3k2r/8/8/8/8/8/8/R3K2R w Kq - 0 1"));
+        CHECK(to_fen(no_castling.setup()) == "r3k2r/8/8/8/8/8/8/R3K2R w Kq - 0 1");
+        CHECK(parse_uci(no_castling, "e1g1"));
+        CHECK(!parse_uci(no_castling, "e1c1"));
+}
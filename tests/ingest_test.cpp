@@ -0,0 +1,90 @@
+#include "catch.hpp"
+#include "ingest.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+auto constexpr games_text = R"([Event "Scholar"]
+
+1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6 4. Qxf7# 1-0
+
+[Event "Illegal"]
+
+1. e4 e5 2. Ke3 *
+
+[Event "Bad setup"]
+[FEN "8/8/8/8/8/8/8/8 w - - 0 1"]
+
+1. e4 *
+
+)";
+
+}
+
+TEST_CASE("Ingest reports games in order whatever the thread count")
+{
+        using namespace Chess;
+
+        std::string text;
+        for (int i = 0; i < 40; ++i)
+                text += games_text;
+
+        for (unsigned threads : {1u, 3u}) {
+                std::vector<IngestResult> results;
+                IngestOptions options;
+                options.threads = threads;
+                options.batch_size = 4;
+                options.max_batches_in_flight = 2;
+                ingest_pgn(text, options,
+                        [&](IngestResult const& result)
+                        {
+                                results.push_back(result);
+                        }
+                );
+
+                REQUIRE(results.size() == 120);
+                for (std::size_t i = 0; i < results.size(); ++i) {
+                        CHECK(results[i].index == i);
+                        switch (i % 3) {
+                                case 0:
+                                        CHECK(results[i].valid);
+                                        CHECK(results[i].plies == 7);
+                                        CHECK(results[i].fen ==
+                                              "r1bqkb1r/pppp1Qpp/2n2n2/4p3/2B1P3/8/PPPP1PPP/RNB1K1NR b KQkq - 0 4");
+                                        break;
+                                case 1:
+                                        CHECK(!results[i].valid);
+                                        CHECK(results[i].plies == 2);
+                                        CHECK(results[i].error == "illegal move Ke3 at ply 3");
+                                        break;
+                                case 2:
+                                        CHECK(!results[i].valid);
+                                        CHECK(results[i].error.rfind("invalid FEN", 0) == 0);
+                                        break;
+                        }
+                }
+        }
+}
+
+TEST_CASE("Ingest stops when the sink throws")
+{
+        using namespace Chess;
+
+        std::string text;
+        for (int i = 0; i < 100; ++i)
+                text += games_text;
+
+        IngestOptions options;
+        options.threads = 2;
+        options.batch_size = 1;
+        int seen = 0;
+        CHECK_THROWS(ingest_pgn(text, options,
+                [&](IngestResult const&)
+                {
+                        if (++seen == 5)
+                                throw std::runtime_error("enough");
+                }
+        ));
+        CHECK(seen == 5);
+}
@@ -1,5 +1,10 @@
 #include "catch.hpp"
 #include "chess.h"
+#include "engine.h"
+#include "notation.h"
+#include <algorithm>
+#include <optional>
+#include <vector>
 
 TEST_CASE("Move history works")
 {
@@ -12,7 +17,7 @@ TEST_CASE("Move history works")
         };
         Piece const dark_pawn {
                 .kind = Piece::Kind::pawn,
-                .side = Side::light
+                .side = Side::dark
         };
         board[1][1] = light_pawn;
         board[5][5] = dark_pawn;
@@ -25,7 +30,7 @@ TEST_CASE("Move history works")
                                 if (pos == Position {x, y})
                                         CHECK(board[y][x] == piece);
                                 else
-                                        CHECK(board[y][x] == Piece::none());
+                                        CHECK(board[y][x] != piece);
                         }
                 }
         };
@@ -122,10 +127,376 @@ TEST_CASE("Move history works")
 
         CHECK(history.undo_move(board));
         check_light_pawn({1, 1});
-        check_no_dark_pawn();
+        check_dark_pawn({5, 5});
 
         CHECK(!history.undo_move(board));
         check_light_pawn({1, 1});
-        check_no_dark_pawn();
+        check_dark_pawn({5, 5});
+}
+
+
+TEST_CASE("Games are saved and restored with their redo moves")
+{
+        using namespace Chess;
+
+        // Castling, en passant and a promotion, then two moves taken back.
+        Game game(nullptr, *parse_fen("r3k2r/1P6/8/8/3Pp3/8/8/R3K2R b KQkq d3 0 1"));
+        for (auto const uci : {"e4d3", "e1c1", "e8g8", "b7b8q", "d3d2", "c1d2"})
+                REQUIRE(game.try_move(*parse_uci(game, uci)));
+        game.undo_move();
+        game.undo_move();
+
+        std::vector<unsigned char> data;
+        game.serialize(data);
+
+        Game restored(nullptr);
+        REQUIRE(restored.deserialize(data.data(), data.size()) == data.size());
+        CHECK(to_fen(restored.setup()) == to_fen(game.setup()));
+
+        for (int i = 0; i < 2; ++i) {
+                game.redo_move();
+                restored.redo_move();
+                CHECK(to_fen(restored.setup()) == to_fen(game.setup()));
+        }
+        CHECK(restored.on_turn() == game.on_turn());
+        for (int i = 0; i < 6; ++i)
+                restored.undo_move();
+        CHECK(to_fen(restored.setup()) == "r3k2r/1P6/8/8/3Pp3/8/8/R3K2R b KQkq d3 0 1");
+
+        std::string const before = to_fen(restored.setup());
+        for (std::size_t size = 0; size < data.size(); ++size)
+                CHECK(restored.deserialize(data.data(), size) == 0);
+        std::size_t constexpr first_move = 64 + 3 + 1 + 1 + 8 + 1 + 1 + 1 + 1;
+        data[first_move] = 3;
+        CHECK(restored.deserialize(data.data(), data.size()) == 0);
+        CHECK(to_fen(restored.setup()) == before);
+        data[first_move] = 0;
+
+        // Moves that don't fit the board are caught too: en passant made a
+        // plain move taking the light king, and castling made en passant
+        // with no pawn to take.
+        unsigned char const en_passant_kind = data[first_move + 1];
+        data[first_move + 1] = (en_passant_kind & 0x80) | (1 | 1 << 3) << 2;
+        CHECK(restored.deserialize(data.data(), data.size()) == 0);
+        data[first_move + 1] = en_passant_kind;
+        data[first_move + 4 + 1] = (data[first_move + 4 + 1] & 0x80) | 2;
+        CHECK(restored.deserialize(data.data(), data.size()) == 0);
+        CHECK(to_fen(restored.setup()) == before);
+}
+
+TEST_CASE("Piece lists follow captures, castling, en passant and undo")
+{
+        using namespace Chess;
+
+        // The lists kept up to date must always match ones built from scratch.
+        auto const same_squares = [](PieceLists const& kept, PieceLists const& built, Side side)
+        {
+                std::vector<int> a(kept.of(side).begin(), kept.of(side).end());
+                std::vector<int> b(built.of(side).begin(), built.of(side).end());
+                std::sort(a.begin(), a.end());
+                std::sort(b.begin(), b.end());
+                return a == b;
+        };
+
+        Board board = default_starting_board();
+        PieceLists pieces(board);
+        MoveHistory history;
+        CHECK(pieces.of(Side::light).size == 16);
+        CHECK(pieces.king(Side::dark) == Position {4, 0});
+
+        auto const check =
+        [&]
+        {
+                PieceLists const built(board);
+                CHECK(same_squares(pieces, built, Side::light));
+                CHECK(same_squares(pieces, built, Side::dark));
+                CHECK(pieces.king(Side::light) == built.king(Side::light));
+                CHECK(pieces.king(Side::dark) == built.king(Side::dark));
+        };
+
+        auto const play =
+        [&](Move move)
+        {
+                history.add_move(move, move.apply(board, &pieces));
+                check();
+        };
+
+        // 1. e4 d5 2. exd5 e5 3. dxe6 e.p. Nf6 4. Nf3 Bc5 5. O-O
+        play(Move {.from = {4, 6}, .to = {4, 4}});
+        play(Move {.from = {3, 1}, .to = {3, 3}});
+        play(Move {.from = {4, 4}, .to = {3, 3}});
+        CHECK(pieces.of(Side::dark).size == 15);
+        play(Move {.from = {4, 1}, .to = {4, 3}});
+        EnPassantMove const en_passant(Move {.from = {3, 3}, .to = {4, 2}});
+        en_passant.apply(board, &pieces);
+        history.add_en_passant_move(en_passant);
+        check();
+        CHECK(pieces.of(Side::dark).size == 14);
+        play(Move {.from = {6, 0}, .to = {5, 2}});
+        play(Move {.from = {6, 7}, .to = {5, 5}});
+        play(Move {.from = {5, 0}, .to = {2, 3}});
+        board[7][5] = Piece::none();
+        pieces.remove(Position {5, 7});
+        CastlingMove const castling(Move {.from = {4, 7}, .to = {7, 7}});
+        castling.apply(board, &pieces);
+        history.add_castling_move(castling);
+        check();
+        CHECK(pieces.king(Side::light) == Position {6, 7});
+
+        while (history.undo_move(board, &pieces))
+                check();
+        CHECK(pieces.of(Side::dark).size == 16);
+        CHECK(pieces.king(Side::light) == Position {4, 7});
+        while (history.redo_move(board, &pieces))
+                check();
+        CHECK(pieces.king(Side::light) == Position {6, 7});
+}
+
+TEST_CASE("Seeking jumps to any ply of a long game")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        std::vector<Board> boards {game.board()};
+        std::vector<std::uint64_t> keys {game.key()};
+        for (int ply = 0; ply < 120 && game.on_turn() != Side::none; ++ply) {
+                MoveList const moves = game.valid_moves();
+                REQUIRE(game.try_move(moves[(ply * 7) % moves.size()]));
+                boards.push_back(game.board());
+                keys.push_back(game.key());
+        }
+        int const last = static_cast<int>(boards.size()) - 1;
+        REQUIRE(last > 40);
+
+        for (int ply : {0, last, 17, 16, 33, 1, last - 1, 32, 5, last}) {
+                REQUIRE(game.seek(ply));
+                CHECK(game.board() == boards[ply]);
+                CHECK(game.key() == keys[ply]);
+                CHECK(game.setup().on_turn == (ply % 2 == 0 ? Side::light : Side::dark));
+        }
+        CHECK(!game.seek(last + 1));
+        CHECK(!game.seek(-1));
+
+        // A new move starts a variation, which the line follows from then on.
+        REQUIRE(game.seek(20));
+        MoveList const moves = game.valid_moves();
+        Move const other = moves[moves.size() - 1];
+        REQUIRE(game.try_move(other));
+        CHECK(!game.seek(22));
+        REQUIRE(game.seek(0));
+        REQUIRE(game.seek(21));
+        game.undo_move();
+        CHECK(game.board() == boards[20]);
+        game.redo_move();
+        CHECK(game.key() != keys[21]);
+}
+
+TEST_CASE("Seeking stays right once old checkpoints make room")
+{
+        using namespace Chess;
+
+        // A king walking the board row by row and back, for more plies
+        // than the checkpoints cover.
+        std::vector<Position> path;
+        for (int y = 0; y < board_size; ++y) {
+                for (int i = 0; i < board_size; ++i)
+                        path.push_back(Position {y % 2 == 0 ? i : board_size - 1 - i, y});
+        }
+        Board board {};
+        for (auto& row : board)
+                row.fill(Piece::none());
+        board[0][0] = Piece {.kind = Piece::Kind::king, .side = Side::light};
+        MoveHistory history;
+        std::vector<Board> boards {board};
+        std::size_t at = 0;
+        int step = 1;
+        for (int ply = 0; ply < 3000; ++ply) {
+                if (at + step >= path.size())
+                        step = -step;
+                Move const move {.from = path[at], .to = path[at + step]};
+                at += step;
+                move.apply(board);
+                history.add_move(move, Piece::none());
+                history.checkpoint(board);
+                boards.push_back(board);
+        }
+
+        for (int ply : {0, 3000, 17, 2999, 1600, 1024, 31, 2048, 5, 2500, 0}) {
+                REQUIRE(history.seek(board, ply));
+                CHECK(history.plies() == ply);
+                CHECK(board == boards[ply]);
+        }
+}
+
+TEST_CASE("Checkpoints of variations left make room before those of the line")
+{
+        using namespace Chess;
+
+        Board board {};
+        for (auto& row : board)
+                row.fill(Piece::none());
+        board[7][0] = Piece {.kind = Piece::Kind::king, .side = Side::light};
+        MoveHistory history;
+        Position king {0, 7};
+        auto const move_king = [&](Position to)
+        {
+                Move const move {.from = king, .to = to};
+                king = to;
+                move.apply(board);
+                history.add_move(move, Piece::none());
+                history.checkpoint(board);
+        };
+
+        // A king walking the bottom rank to and fro, for a line with
+        // almost all checkpoints taken.
+        int const plies = 60 * 16;
+        history.checkpoint(board);
+        std::vector<Board> boards {board};
+        for (int ply = 0; ply < plies; ++ply) {
+                int const x = ply / (board_size - 1) % 2 == 0 ?
+                              ply % (board_size - 1) + 1 : board_size - 2 - ply % (board_size - 1);
+                move_king(Position {x, 7});
+                boards.push_back(board);
+        }
+
+        // Variations from all over the line, each with a few checkpoints,
+        // are tried and left.
+        for (int branch = 8; branch < plies; branch += 40) {
+                REQUIRE(history.seek(board, branch));
+                king = Position {-1, -1};
+                for (int x = 0; x < board_size; ++x) {
+                        if (board[7][x] != Piece::none())
+                                king = Position {x, 7};
+                }
+                for (int ply = 0; ply < 48; ++ply)
+                        move_king(Position {king.x, ply % 2 == 0 ? 3 : 4});
+                REQUIRE(history.seek(board, branch));
+                REQUIRE(history.select_variation(0));
+        }
+
+        for (int ply = 0; ply <= plies; ply += 16) {
+                CHECK(history.has_checkpoint(ply));
+                REQUIRE(history.seek(board, ply));
+                CHECK(board == boards[ply]);
+        }
+}
+
+TEST_CASE("Lines left by a new move stay as variations")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        auto const play = [&](char const* uci)
+        {
+                std::optional const move = parse_uci(game, uci);
+                REQUIRE(move);
+                REQUIRE(game.try_move(*move));
+        };
+
+        play("e2e4");
+        play("e7e5");
+        play("g1f3");
+        Board const open_game = game.board();
+        std::uint64_t const open_game_key = game.key();
+        game.undo_move();
+        game.undo_move();
+        play("c7c5");
+        play("g1f3");
+        Board const sicilian = game.board();
+
+        // Both replies stay, the one played last is followed.
+        REQUIRE(game.seek(1));
+        CHECK(game.variations() == 2);
+        REQUIRE(game.seek(3));
+        CHECK(game.board() == sicilian);
+        REQUIRE(game.seek(1));
+        REQUIRE(game.select_variation(0));
+        CHECK(!game.select_variation(2));
+        REQUIRE(game.seek(3));
+        CHECK(game.board() == open_game);
+        CHECK(game.key() == open_game_key);
+
+        // Playing a move again goes back into its variation.
+        game.undo_move();
+        game.undo_move();
+        play("c7c5");
+        game.undo_move();
+        CHECK(game.variations() == 2);
+
+        game.redo_move();
+        game.promote_line();
+        game.undo_move();
+        REQUIRE(game.select_variation(0));
+        game.redo_move();
+        game.redo_move();
+        CHECK(game.board() == sicilian);
+
+        std::vector<unsigned char> data;
+        game.serialize(data);
+        Game loaded(nullptr);
+        REQUIRE(loaded.deserialize(data.data(), data.size()) == data.size());
+        CHECK(loaded.board() == sicilian);
+        CHECK(loaded.key() == game.key());
+        REQUIRE(loaded.seek(1));
+        CHECK(loaded.variations() == 2);
+        REQUIRE(loaded.select_variation(1));
+        REQUIRE(loaded.seek(3));
+        CHECK(loaded.board() == open_game);
+        CHECK(loaded.key() == open_game_key);
+}
+
+namespace {
+
+std::uint64_t count_tried(Chess::Game& game, int depth)
+{
+        Chess::MoveList const moves = game.valid_moves();
+        if (depth <= 1)
+                return moves.size();
+        std::uint64_t nodes = 0;
+        for (Chess::Move move : moves) {
+                Chess::Game::TriedMove tried;
+                REQUIRE(game.make_move(move, tried));
+                nodes += count_tried(game, depth - 1);
+                game.unmake_move(tried);
+        }
+        return nodes;
+}
+
 }
 
+TEST_CASE("Moves tried by search leave the history as it was")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        auto const play = [&](char const* uci)
+        {
+                std::optional const move = parse_uci(game, uci);
+                REQUIRE(move);
+                REQUIRE(game.try_move(*move));
+        };
+
+        // Both moves of the line and one off it are tried again.
+        play("e2e4");
+        play("e7e5");
+        game.undo_move();
+        play("c7c5");
+        game.undo_move();
+        REQUIRE(game.select_variation(0));
+        game.undo_move();
+        std::vector<unsigned char> before;
+        game.serialize(before);
+        std::uint64_t const key = game.key();
+
+        CHECK(count_tried(game, 4) == 197281);
+        CHECK(count_tried(game, 3) == perft(game, 3));
+        std::vector<unsigned char> after;
+        game.serialize(after);
+        CHECK(after == before);
+        CHECK(game.key() == key);
+        game.redo_move();
+        CHECK(game.variations() == 2);
+        game.redo_move();
+        CHECK(to_fen(game.setup()) ==
+              "rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e6 0 2");
+}
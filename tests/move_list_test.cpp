@@ -0,0 +1,158 @@
+#include "catch.hpp"
+#include "chess.h"
+
+namespace {
+
+Chess::Side game_winner = Chess::Side::none;
+
+void game_over(Chess::Side winner)
+{
+        game_winner = winner;
+}
+
+}
+
+TEST_CASE("Move list works")
+{
+        using namespace Chess;
+
+        MoveList moves;
+        CHECK(moves.empty());
+
+        for (int x = 0; x < board_size; ++x)
+                moves.push_back(Move {.from = {x, 0}, .to = {x, 1}});
+        CHECK(moves.size() == board_size);
+        CHECK(moves[3].from == Position {3, 0});
+
+        moves.swap_remove(2);
+        CHECK(moves.size() == board_size - 1);
+        CHECK(moves[2].from == Position {7, 0});
+
+        moves.partial_sort(3,
+                [](Move m1, Move m2) noexcept
+                {
+                        return m1.from.x > m2.from.x;
+                }
+        );
+        CHECK(moves[0].from == Position {7, 0});
+        CHECK(moves[1].from == Position {6, 0});
+        CHECK(moves[2].from == Position {5, 0});
+
+        int count = 0;
+        for (Move move : moves) {
+                CHECK(move.to.y == 1);
+                ++count;
+        }
+        CHECK(count == moves.size());
+
+        moves.clear();
+        CHECK(moves.empty());
+}
+
+TEST_CASE("Valid moves are enumerated")
+{
+        using namespace Chess;
+
+        game_winner = Side::none;
+        Game game(game_over);
+        CHECK(game.valid_moves().size() == 20);
+
+        // Fool's mate
+        CHECK(game.try_move(Move {.from = {5, 6}, .to = {5, 5}}));
+        CHECK(game.try_move(Move {.from = {4, 1}, .to = {4, 3}}));
+        CHECK(game.try_move(Move {.from = {6, 6}, .to = {6, 4}}));
+        CHECK(game.valid_moves().size() == 30);
+        CHECK(game.try_move(Move {.from = {3, 0}, .to = {7, 4}}));
+
+        CHECK(game_winner == Side::dark);
+        CHECK(game.on_turn() == Side::none);
+        CHECK(game.valid_moves().empty());
+
+        game.undo_move();
+        CHECK(game.on_turn() == Side::dark);
+        CHECK(game.valid_moves().size() == 30);
+}
+
+TEST_CASE("Games share their rule sets")
+{
+        using namespace Chess;
+
+        Game const first(nullptr);
+        Game const second(nullptr);
+        CHECK(first.rules() == second.rules());
+        CHECK(first.rules() == standard_rules());
+        Game const copy = first;
+        CHECK(copy.rules() == standard_rules());
+
+        // Everything but castling.
+        std::vector<Rule> rules = default_rules();
+        rules.pop_back();
+        RuleSet const no_castling = make_rule_set(std::move(rules));
+        Setup setup = default_setup();
+        setup.board[7][5] = Piece::none();
+        setup.board[7][6] = Piece::none();
+        Move const castle {.from = {4, 7}, .to = {7, 7}};
+        CHECK(Game(nullptr, setup).is_legal(castle));
+        Game const custom(nullptr, setup, no_castling);
+        CHECK(!custom.is_legal(castle));
+        CHECK(custom.rules() == no_castling);
+        CHECK(no_castling.use_count() == 2);
+}
+
+TEST_CASE("Legal destinations come from one table per position")
+{
+        using namespace Chess;
+
+        auto const bit = [](int x, int y)
+        {
+                return std::uint64_t(1) << (y * board_size + x);
+        };
+
+        Setup setup = default_setup();
+        setup.board[7][5] = Piece::none();
+        setup.board[7][6] = Piece::none();
+        Game game(nullptr, setup);
+        // Kf1 and castling, from the king and from the rook.
+        CHECK(game.legal_destinations(Position {4, 7}) == (bit(5, 7) | bit(7, 7)));
+        CHECK(game.legal_destinations(Position {7, 7}) == (bit(4, 7) | bit(5, 7) | bit(6, 7)));
+        CHECK(game.legal_destinations(Position {4, 0}) == 0);
+        CHECK(game.is_legal(Move {.from = {7, 7}, .to = {4, 7}}));
+        CHECK(!game.is_legal(Move {.from = {4, 6}, .to = {4, 4}, .promotion = Piece::Kind::queen}));
+        CHECK(!game.is_legal(Move {.from = {4, 6}, .to = {4, 8}}));
+
+        int listed = 0;
+        for (Move move : game.valid_moves()) {
+                CHECK(game.is_legal(move));
+                ++listed;
+        }
+        CHECK(listed == 22);
+
+        // The table follows the game through undo and redo.
+        REQUIRE(game.try_move(Move {.from = {4, 6}, .to = {4, 4}}));
+        CHECK(game.legal_destinations(Position {4, 1}) == (bit(4, 2) | bit(4, 3)));
+        game.undo_move();
+        CHECK(game.legal_destinations(Position {4, 6}) == (bit(4, 5) | bit(4, 4)));
+        game.redo_move();
+        CHECK(game.legal_destinations(Position {4, 6}) == 0);
+        CHECK(game.valid_moves().size() == 20);
+
+        // Undo works the table out again.
+        REQUIRE(game.try_move(Move {.from = {4, 1}, .to = {4, 3}}));
+        game.undo_move();
+        game.undo_move();
+        CHECK(game.legal_destinations(Position {4, 6}) == (bit(4, 5) | bit(4, 4)));
+        CHECK(game.valid_moves().size() == 22);
+        game.redo_move();
+        game.redo_move();
+        CHECK(game.legal_destinations(Position {4, 6}) == 0);
+        CHECK(game.legal_destinations(Position {4, 7}) == (bit(4, 6) | bit(5, 7) | bit(7, 7)));
+
+        // Unmaking gets it back from the tried move, which keeps it
+        // rather than the game.
+        Game::TriedMove tried;
+        REQUIRE(game.make_move(Move {.from = {4, 7}, .to = {4, 6}}, tried));
+        CHECK(game.legal_destinations(Position {4, 7}) == 0);
+        game.unmake_move(tried);
+        CHECK(game.legal_destinations(Position {4, 7}) == (bit(4, 6) | bit(5, 7) | bit(7, 7)));
+        CHECK(sizeof(Game) < sizeof(Game::DestinationMasks) * 3);
+}
@@ -0,0 +1,111 @@
+#include "catch.hpp"
+#include "notation.h"
+#include "pgn.h"
+#include <sstream>
+
+namespace {
+
+auto constexpr pgn_text = R"([Event "Test \"quoted\""]
+[Site "?"]
+[Result "1-0"]
+
+1. e4 e5 2. Nf3 {A comment} Nc6 3. Bb5 $1 a6 (3... Nf6 4. O-O) 4. Ba4 Nf6
+5. O-O!? Be7 ; A line comment
+6. Re1 b5 7. Bb3 d6 8. c3 O-O 1-0
+
+[Event "Second"]
+[SetUp "1"]
+[FEN "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3"]
+
+3. exf6 e6 4. fxg7 Bd6 5.gxh8=Q *
+
+[Event "Illegal"]
+
+1. e4 e5 2. Ke3 Nc6 *
+)";
+
+void check_games(Chess::PgnReader& reader)
+{
+        using namespace Chess;
+
+        PgnGame game;
+        REQUIRE(reader.next(game));
+        CHECK(game.tag("Event") == R"(Test \"quoted\")");
+        CHECK(game.tag("Site") == "?");
+        CHECK(game.tag("Round").empty());
+        CHECK(game.result == "1-0");
+        CHECK(game.main_line.size() == 16);
+        CHECK(game.main_line.front() == "e4");
+        CHECK(game.main_line.back() == "O-O");
+        auto const count = [&](PgnToken::Kind kind)
+        {
+                return std::count_if(game.movetext.cbegin(), game.movetext.cend(),
+                        [&](PgnToken const& token)
+                        {
+                                return token.kind == kind;
+                        }
+                );
+        };
+        CHECK(count(PgnToken::Kind::move) == 18);
+        CHECK(count(PgnToken::Kind::comment) == 2);
+        CHECK(count(PgnToken::Kind::nag) == 2);
+        CHECK(count(PgnToken::Kind::variation_start) == 1);
+        CHECK(count(PgnToken::Kind::variation_end) == 1);
+
+        Replay first = replay(game);
+        CHECK(first.complete);
+        CHECK(first.plies == 16);
+
+        REQUIRE(reader.next(game));
+        CHECK(game.tag("Event") == "Second");
+        CHECK(game.result == "*");
+        Replay second = replay(game);
+        CHECK(second.complete);
+        CHECK(second.plies == 5);
+        CHECK(to_fen(second.game.setup()) ==
+              "rnbqk1nQ/ppp4p/3bp3/3p4/8/8/PPPP1PPP/RNBQKBNR b KQq - 0 5");
+
+        REQUIRE(reader.next(game));
+        Replay illegal = replay(game);
+        CHECK(!illegal.complete);
+        CHECK(illegal.plies == 2);
+
+        CHECK(!reader.next(game));
+}
+
+}
+
+TEST_CASE("PGN is read from memory")
+{
+        Chess::PgnReader reader(pgn_text);
+        check_games(reader);
+}
+
+TEST_CASE("PGN is read from a stream in chunks")
+{
+        std::istringstream in(pgn_text);
+        Chess::PgnReader reader(in, 7);
+        check_games(reader);
+}
+
+TEST_CASE("SAN round trips")
+{
+        using namespace Chess;
+
+        Game game(nullptr);
+        for (auto const text : {"Nf3", "d5", "d3", "e5", "Nbd2", "e4", "dxe4"}) {
+                std::optional const move = parse_san(game, text);
+                REQUIRE(move);
+                CHECK(to_san(game, *move) == text);
+                game.try_move(*move);
+        }
+        CHECK(!parse_san(game, "Nd2"));
+        CHECK(!parse_san(game, "e5"));
+
+        Game mate(nullptr);
+        for (auto const text : {"e4", "f6", "d4", "g5"})
+                mate.try_move(*parse_san(mate, text));
+        CHECK(to_san(mate, *parse_san(mate, "Qh5")) == "Qh5#");
+        CHECK(to_san(mate, *parse_san(mate, "Bb5")) == "Bb5");
+        CHECK(to_san(mate, *parse_san(mate, "Ba6")) == "Ba6");
+}
@@ -0,0 +1,131 @@
+#include "catch.hpp"
+#include "notation.h"
+#include "polyglot.h"
+#include <sstream>
+#include <vector>
+
+namespace {
+
+auto constexpr pgn_text = R"([Result "1-0"]
+
+1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 1-0
+
+[Result "0-1"]
+
+1. e4 c5 2. Nf3 d6 0-1
+
+[Result "1/2-1/2"]
+
+1. d4 d5 2. c4 e6 1/2-1/2
+
+[Result "1-0"]
+
+1. e4 e5 2. Nf3 Nf6 1-0
+)";
+
+std::string build(unsigned threads)
+{
+        std::ostringstream out;
+        Chess::BookOptions options;
+        options.threads = threads;
+        Chess::build_book(pgn_text, options, out);
+        return out.str();
+}
+
+}
+
+TEST_CASE("Polyglot move codes")
+{
+        using namespace Chess;
+
+        // e2e4: from file 4 rank 1, to file 4 rank 3.
+        Move const e4 {{4, 6}, {4, 4}};
+        CHECK(to_polyglot_move(e4) == (4 | 3 << 3 | 4 << 6 | 1 << 9));
+        CHECK(from_polyglot_move(to_polyglot_move(e4)) == e4);
+        // Castling is the king taking its rook, e1h1.
+        Move const castling {{4, 7}, {7, 7}};
+        CHECK(from_polyglot_move(to_polyglot_move(castling)) == castling);
+        Move const promotion {{0, 1}, {0, 0}, Piece::Kind::knight};
+        CHECK(to_polyglot_move(promotion) >> 12 == 1);
+        CHECK(from_polyglot_move(to_polyglot_move(promotion)) == promotion);
+}
+
+TEST_CASE("Polyglot keys match the published ones")
+{
+        using namespace Chess;
+
+        struct Line {
+                std::vector<char const*> moves;
+                std::uint64_t key;
+        };
+        // From the Polyglot book format description.
+        Line const lines[] = {
+                {{}, 0x463b96181691fc9c},
+                {{"e2e4"}, 0x823c9b50fd114196},
+                {{"e2e4", "d7d5"}, 0x0756b94461c50fb0},
+                {{"e2e4", "d7d5", "e4e5"}, 0x662fafb965db29d4},
+                {{"e2e4", "d7d5", "e4e5", "f7f5"}, 0x22a48b5a8e47ff78},
+                {{"e2e4", "d7d5", "e4e5", "f7f5", "e1e2"}, 0x652a607ca3f242c1},
+                {{"e2e4", "d7d5", "e4e5", "f7f5", "e1e2", "e8f7"}, 0x00fdd303c946bdd9},
+                {{"a2a4", "b7b5", "h2h4", "b5b4", "c2c4"}, 0x3c8123ea7b067637},
+                {{"a2a4", "b7b5", "h2h4", "b5b4", "c2c4", "b4c3", "a1a3"}, 0x5c3f9b829b279560}
+        };
+        for (Line const& line : lines) {
+                Game game(nullptr);
+                for (char const* uci : line.moves)
+                        REQUIRE(game.try_move(*parse_uci(game, uci)));
+                CHECK(polyglot_key(game.setup()) == line.key);
+                CHECK(game.key() == line.key);
+        }
+}
+
+TEST_CASE("Polyglot keys count en passant only when it can be taken")
+{
+        using namespace Chess;
+
+        auto const key = [](char const* fen) { return polyglot_key(*parse_fen(fen)); };
+        CHECK(key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1") ==
+              key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1"));
+        CHECK(key("rnbqkbnr/ppp1pppp/8/8/3pP3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1") !=
+              key("rnbqkbnr/ppp1pppp/8/8/3pP3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1"));
+        CHECK(key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1") !=
+              key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 1"));
+        CHECK(key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1") !=
+              key("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b Kkq - 0 1"));
+}
+
+TEST_CASE("Books are built from PGN and probed")
+{
+        using namespace Chess;
+
+        std::string const data = build(1);
+        CHECK(build(3) == data);
+
+        PolyglotBook const book(data);
+        std::vector<BookEntry> entries;
+        book.find(polyglot_key(default_setup()), entries);
+        // 1. e4 scored two wins and a loss, 1. d4 a draw.
+        REQUIRE(entries.size() == 2);
+        CHECK(entries[0].move == Move {{4, 6}, {4, 4}});
+        CHECK(entries[0].weight == 4);
+        CHECK(entries[1].move == Move {{3, 6}, {3, 4}});
+        CHECK(entries[1].weight == 1);
+
+        Game game(nullptr);
+        std::mt19937_64 random(1);
+        for (int i = 0; i < 20; ++i) {
+                std::optional const move = book.pick(game, random);
+                REQUIRE(move);
+                CHECK((*move == entries[0].move || *move == entries[1].move));
+        }
+
+        // Only dark's winning reply to 1. e4 is kept.
+        game.try_move(Move {{4, 6}, {4, 4}});
+        book.find(polyglot_key(game.setup()), entries);
+        REQUIRE(entries.size() == 1);
+        CHECK(entries[0].move == Move {{2, 1}, {2, 3}});
+        CHECK(entries[0].weight == 2);
+
+        REQUIRE(game.try_move(Move {{3, 1}, {3, 3}}));
+        CHECK(!book.pick(game, random));
+}
@@ -0,0 +1,103 @@
+#include "catch.hpp"
+#include "notation.h"
+#include "retrograde.h"
+#include <algorithm>
+
+TEST_CASE("Retrograde analysis solves bare kings the same on any number of threads")
+{
+        using namespace Chess;
+
+        SolvedTables serial;
+        REQUIRE(solve_table("KvK", RetrogradeOptions {1, nullptr}, serial));
+        SolvedTables parallel;
+        int passes = 0;
+        RetrogradeOptions options {3, [&](std::string_view, int, std::uint64_t) { ++passes; }};
+        REQUIRE(solve_table("KvK", options, parallel));
+        CHECK(passes == 2);
+
+        std::vector<Wdl> const& values = serial.at("KvK").values;
+        CHECK(values == parallel.at("KvK").values);
+        // Kings on the same or neighbouring squares, either side to move.
+        CHECK(std::count(values.cbegin(), values.cend(), Wdl::invalid) == 2 * (64 + 420));
+        CHECK(std::count(values.cbegin(), values.cend(), Wdl::draw) == 8192 - 2 * (64 + 420));
+}
+
+TEST_CASE("Retrograde analysis solves king and queen against king")
+{
+        using namespace Chess;
+
+        SolvedTables solved;
+        int last_pass = 0;
+        RetrogradeOptions options {0, [&](std::string_view signature, int pass, std::uint64_t decided)
+        {
+                if (signature == "KQvK" && decided != 0)
+                        last_pass = pass;
+        }};
+        REQUIRE(solve_table("KQvK", options, solved));
+        // The longest win is mate in ten: 19 plies for the queen's side on
+        // turn, 20 for the other.
+        CHECK(last_pass == 20);
+
+        SolvedTable const& table = solved.at("KQvK");
+        auto const index = [&](char const* fen)
+        {
+                std::optional const index = table_index(*parse_fen(fen));
+                REQUIRE(index);
+                REQUIRE(index->signature == "KQvK");
+                return index->index;
+        };
+        auto const value = [&](char const* fen)
+        {
+                return table.values[index(fen)];
+        };
+        // Mate in one, and the mate itself.
+        CHECK(value("k7/8/1K6/8/8/8/8/6Q1 w - - 0 1") == Wdl::win);
+        CHECK(table.dtz[index("k7/8/1K6/8/8/8/8/6Q1 w - - 0 1")] == 1);
+        CHECK(value("k6Q/8/1K6/8/8/8/8/8 b - - 0 1") == Wdl::loss);
+        CHECK(table.dtz[index("k6Q/8/1K6/8/8/8/8/8 b - - 0 1")] == 1);
+        // Without pawns to move the distance to zeroing is the one to mate.
+        CHECK(*std::max_element(table.dtz.cbegin(), table.dtz.cend()) == 20);
+        // Stalemate.
+        CHECK(value("k7/2Q5/1K6/8/8/8/8/8 b - - 0 1") == Wdl::draw);
+        // An undefended queen next to the king is taken.
+        CHECK(value("8/8/8/8/8/2k5/3Q4/7K b - - 0 1") == Wdl::draw);
+        CHECK(value("8/8/8/4k3/8/8/8/KQ6 w - - 0 1") == Wdl::win);
+        // The side that just moved can't be in check.
+        CHECK(value("k7/8/8/8/8/8/8/Q6K w - - 0 1") == Wdl::invalid);
+        // With the colours swapped.
+        CHECK(value("8/8/8/8/8/2K5/2q5/7k w - - 0 1") == Wdl::draw);
+        CHECK(value("4K3/8/8/8/8/8/8/kq6 w - - 0 1") == Wdl::loss);
+}
+
+TEST_CASE("Table indexes round trip with colours swapped")
+{
+        using namespace Chess;
+
+        Setup const setup = *parse_fen("8/8/8/3k4/8/8/1q6/6K1 w - - 0 1");
+        std::optional const index = table_index(setup);
+        REQUIRE(index);
+        CHECK(index->signature == "KQvK");
+        CHECK(index->index % 2 == 1);
+
+        // The table's position has the colours and ranks swapped.
+        std::optional const flipped = table_setup(index->signature, index->index);
+        REQUIRE(flipped);
+        CHECK(to_fen(*flipped) == "6k1/1Q6/8/8/3K4/8/8/8 b - - 0 1");
+        CHECK(table_index(*flipped)->index == index->index);
+
+        CHECK(!table_index(default_setup()));
+        CHECK(table_size("KRvK") == 2u << 18);
+        CHECK(table_size("KvRK") == 0);
+        CHECK(table_size("QKvK") == 0);
+}
+
+TEST_CASE("Retrograde analysis rejects what the tables can't hold")
+{
+        using namespace Chess;
+
+        SolvedTables solved;
+        CHECK(!solve_table("KPvKP", RetrogradeOptions(), solved));
+        CHECK(!solve_table("KQRvKR", RetrogradeOptions(), solved));
+        CHECK(!solve_table("KvQ", RetrogradeOptions(), solved));
+        CHECK(solved.empty());
+}
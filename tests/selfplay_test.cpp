@@ -0,0 +1,96 @@
+#include "catch.hpp"
+#include "notation.h"
+#include "pgn.h"
+#include "selfplay.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+TEST_CASE("Openings are read from EPD and PGN")
+{
+        using namespace Chess;
+
+        auto const epd = "# comment\n"
+                         "4k3/8/8/8/8/8/4P3/4K3 w - - bm e4; id \"pawn\";\n"
+                         "\n"
+                         "not a position\n"
+                         "4k3/8/8/8/8/8/8/R3K3 b Q -\n";
+        std::vector const from_epd = read_openings(epd);
+        REQUIRE(from_epd.size() == 2);
+        CHECK(to_fen(from_epd[0].setup) == "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1");
+        CHECK(from_epd[1].setup.on_turn == Side::dark);
+        CHECK(from_epd[1].moves.empty());
+
+        auto const pgn = "[Event \"a\"]\n\n1. e4 e5 2. Nf3 *\n\n"
+                         "[Event \"illegal\"]\n\n1. e5 *\n\n"
+                         "[FEN \"4k3/8/8/8/8/8/4P3/4K3 w - - 0 1\"]\n\n1. e4 *\n";
+        std::vector const from_pgn = read_openings(pgn);
+        REQUIRE(from_pgn.size() == 2);
+        CHECK(from_pgn[0].moves.size() == 3);
+        CHECK(from_pgn[1].setup.board[6][4].kind == Piece::Kind::pawn);
+        CHECK(from_pgn[1].moves.size() == 1);
+}
+
+TEST_CASE("Elo and SPRT follow the score")
+{
+        using namespace Chess;
+
+        EloEstimate const even = estimate_elo(Score {10, 10, 20});
+        CHECK(std::abs(even.elo) < 1e-9);
+        CHECK(even.lower < 0);
+        CHECK(even.upper > 0);
+
+        // 70% is 147 Elo.
+        EloEstimate const ahead = estimate_elo(Score {60, 20, 20});
+        CHECK(std::abs(ahead.elo - 147.2) < 0.1);
+        CHECK(ahead.lower < ahead.elo);
+        CHECK(ahead.upper > ahead.elo);
+        CHECK(estimate_elo(Score {600, 200, 200}).lower > ahead.lower);
+
+        Sprt const sprt {.elo0 = 0, .elo1 = 10, .alpha = 0.05, .beta = 0.05};
+        SprtStatus const won = sprt_status(Score {600, 200, 200}, sprt);
+        CHECK(won.llr > won.upper);
+        CHECK(std::abs(won.lower + 2.944) < 0.001);
+        SprtStatus const lost = sprt_status(Score {200, 600, 200}, sprt);
+        CHECK(lost.llr < lost.lower);
+}
+
+TEST_CASE("Selfplay plays every game and writes them as PGN")
+{
+        using namespace Chess;
+
+        std::vector const openings = read_openings("4k3/8/8/8/8/8/8/RQ2K3 w - -\n"
+                                                   "4k3/8/8/8/8/8/8/4K2R w - -\n");
+        SelfplayOptions options;
+        options.concurrency = 2;
+        options.games = 4;
+        options.max_plies = 30;
+        options.first = PlayerOptions {"deep", SearchLimits {.depth = 2}, {}};
+        options.second = PlayerOptions {"shallow", SearchLimits {.depth = 1}, {}};
+
+        std::ostringstream pgn;
+        std::vector<bool> seen(options.games);
+        Score const score = run_selfplay(openings, options,
+                [&](PlayedGame const& game, Score const& score)
+                {
+                        CHECK(game.result != GameResult::unknown);
+                        CHECK(game.first_is_light == (game.index % 2 == 0));
+                        seen.at(game.index) = true;
+                        CHECK(score.games() <= options.games);
+                        write_played_game(pgn, game, options);
+                }
+        );
+        CHECK(score.games() == 4);
+        CHECK(std::count(seen.cbegin(), seen.cend(), true) == 4);
+
+        std::string const text = pgn.str();
+        PgnReader reader(text);
+        PgnGame game;
+        int games = 0;
+        while (reader.next(game)) {
+                ++games;
+                CHECK(!game.tag("Termination").empty());
+                CHECK(replay(game).complete);
+        }
+        CHECK(games == 4);
+}
@@ -0,0 +1,88 @@
+#include "catch.hpp"
+#include "server.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Sends requests one at a time and waits for each reply.
+class Client {
+public:
+        explicit Client(Chess::GameServer& server)
+                : server_(server)
+        {}
+
+        std::string request(std::string const& line)
+        {
+                std::unique_lock lock(mutex_);
+                reply_.clear();
+                lock.unlock();
+                server_.submit("t " + line, [this](std::string const& reply)
+                {
+                        std::lock_guard lock(mutex_);
+                        reply_ = reply;
+                        answered_.notify_one();
+                });
+                lock.lock();
+                answered_.wait(lock, [this] { return !reply_.empty(); });
+                return reply_;
+        }
+
+private:
+        Chess::GameServer& server_;
+        std::mutex mutex_;
+        std::condition_variable answered_;
+        std::string reply_;
+};
+
+std::string id_of(std::string const& reply)
+{
+        REQUIRE(reply.rfind("t ok ", 0) == 0);
+        return reply.substr(5);
+}
+
+}
+
+TEST_CASE("The game server plays games on its shards")
+{
+        using namespace Chess;
+
+        GameServer server(3);
+        Client client(server);
+
+        std::vector<std::string> ids;
+        for (int i = 0; i < 5; ++i)
+                ids.push_back(id_of(client.request("new")));
+        CHECK(server.games() == 5);
+
+        std::string const& id = ids[4];
+        CHECK(client.request("move " + id + " f2f3") == "t ok dark");
+        CHECK(client.request("move " + id + " e2e4") == "t error illegal move");
+        CHECK(client.request("move " + id + " e7e5") == "t ok light");
+        CHECK(client.request("move " + id + " g2g4") == "t ok dark");
+        CHECK(client.request("move " + id + " d8h4") == "t ok 0-1");
+        CHECK(client.request("moves " + id) == "t ok");
+        CHECK(client.request("undo " + id) == "t ok dark");
+        CHECK(client.request("fen " + id) ==
+              "t ok rnbqkbnr/pppp1ppp/8/4p3/6P1/5P2/PPPPP2P/RNBQKBNR b KQkq g3 0 2");
+
+        std::string const fen = "7k/8/8/8/8/8/8/K6R w - - 0 1";
+        std::string const other = id_of(client.request("new " + fen));
+        CHECK(client.request("fen " + other) == "t ok " + fen);
+        CHECK(client.request("state " + ids[0]) == "t ok light");
+
+        // A closed game's slot is reused under a new ID.
+        CHECK(client.request("close " + ids[0]) == "t ok");
+        CHECK(client.request("state " + ids[0]) == "t error unknown game");
+        std::string const reused = id_of(client.request("new"));
+        CHECK(reused != ids[0]);
+        CHECK(client.request("state " + ids[0]) == "t error unknown game");
+        CHECK(client.request("state " + reused) == "t ok light");
+        CHECK(server.games() == 6);
+
+        CHECK(client.request("new nonsense") == "t error invalid FEN");
+        CHECK(client.request("fly " + id) == "t error unknown command");
+        CHECK(client.request("fen 12x") == "t error unknown game");
+}
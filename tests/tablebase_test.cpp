@@ -0,0 +1,350 @@
+#include "catch.hpp"
+#include "notation.h"
+#include "retrograde.h"
+#include "tablebase.h"
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+using namespace Chess;
+
+// A temporary directory, removed with the tables in it.
+class TableDirectory {
+public:
+        TableDirectory()
+        {
+                REQUIRE(mkdtemp(path_));
+        }
+
+        ~TableDirectory()
+        {
+                for (std::string const& file : files_)
+                        std::remove((std::string(path_) + '/' + file).c_str());
+                rmdir(path_);
+        }
+
+        std::string path() const
+        {
+                return path_;
+        }
+
+        void add(std::string_view signature)
+        {
+                files_.push_back(std::string(signature) + ".rtbw");
+                files_.push_back(std::string(signature) + ".rtbz");
+        }
+
+private:
+        char path_[32] = "/tmp/chess_tablebase_XXXXXX";
+        std::vector<std::string> files_;
+};
+
+int signed_dtz(SolvedTable const& table, std::uint64_t index)
+{
+        switch (table.values[index]) {
+                case Wdl::win:
+                case Wdl::cursed_win:
+                        return table.dtz[index];
+                case Wdl::loss:
+                case Wdl::blessed_loss:
+                        return -table.dtz[index];
+                default:
+                        return 0;
+        }
+}
+
+// A value the Syzygy encoding must keep for any mirror image of the
+// position and with the colours swapped: how far the pieces are from the
+// centre, how far the pawns got and how far apart the kings are, each
+// from the point of view of the side on turn.
+Wdl symmetric_value(Setup const& setup)
+{
+        int value = 0;
+        int kings[2][2] = {};
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        Piece const piece = setup.board[y][x];
+                        if (piece == Piece::none())
+                                continue;
+                        bool const own = piece.side == setup.on_turn;
+                        int const ring = std::max(std::abs(2 * x - 7), std::abs(2 * y - 7));
+                        value += own ? ring : 2 * ring;
+                        if (piece.kind == Piece::Kind::pawn)
+                                value += 3 * (piece.side == Side::light ? 6 - y : y - 1);
+                        if (piece.kind == Piece::Kind::king) {
+                                kings[own][0] = x;
+                                kings[own][1] = y;
+                        }
+                }
+        }
+        value += std::max(std::abs(kings[0][0] - kings[1][0]), std::abs(kings[0][1] - kings[1][1]));
+        return static_cast<Wdl>(value % 5);
+}
+
+Piece::Kind kind_of(char letter) noexcept
+{
+        switch (letter) {
+                case 'K':
+                        return Piece::Kind::king;
+                case 'Q':
+                        return Piece::Kind::queen;
+                case 'R':
+                        return Piece::Kind::rook;
+                case 'B':
+                        return Piece::Kind::bishop;
+                case 'N':
+                        return Piece::Kind::knight;
+                default:
+                        return Piece::Kind::pawn;
+        }
+}
+
+// The pieces on random squares, with the side on turn unable to capture,
+// so that probing reads the table rather than searching. Pawns stay off
+// the back ranks and the kings apart.
+std::optional<Setup> random_setup(std::string_view signature, std::mt19937& random)
+{
+        Setup setup {
+                .board = Board {Piece::none()},
+                .on_turn = random() % 2 ? Side::light : Side::dark,
+                .castling_rights = {false, false, false, false},
+                .en_passant_position = std::nullopt,
+                .halfmove_clock = 0,
+                .fullmove_number = 1
+        };
+        Side side = Side::light;
+        Position kings[2];
+        for (char letter : signature) {
+                if (letter == 'v') {
+                        side = Side::dark;
+                        continue;
+                }
+                Piece const piece {.kind = kind_of(letter), .side = side};
+                Position square;
+                do {
+                        square = Position {static_cast<int>(random() % 8), static_cast<int>(random() % 8)};
+                } while (setup.board[square.y][square.x] != Piece::none() ||
+                         (piece.kind == Piece::Kind::pawn && (square.y == 0 || square.y == 7)));
+                setup.board[square.y][square.x] = piece;
+                if (piece.kind == Piece::Kind::king)
+                        kings[side == Side::dark] = square;
+        }
+        if (std::abs(kings[0].x - kings[1].x) <= 1 && std::abs(kings[0].y - kings[1].y) <= 1)
+                return std::nullopt;
+        Game const game(nullptr, setup);
+        for (Move move : game.valid_moves()) {
+                if (setup.board[move.to.y][move.to.x] != Piece::none())
+                        return std::nullopt;
+        }
+        return setup;
+}
+
+Setup mirrored(Setup setup, bool files, bool ranks, bool diagonal)
+{
+        Board const board = setup.board;
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        int const from_x = files ? 7 - x : x;
+                        int const from_y = ranks ? 7 - y : y;
+                        setup.board[y][x] = diagonal ? board[from_x][from_y] : board[from_y][from_x];
+                }
+        }
+        return setup;
+}
+
+// Syzygy orders the pieces by where the leading ones are, so when those
+// are on the axis of a mirror, like light pawns on both sides of the
+// board or kings on a long diagonal, the mirror images are kept apart.
+bool on_mirror_axis(Setup const& setup, bool pawns)
+{
+        Position kings[2];
+        for (int y = 0; y < board_size; ++y) {
+                for (int x = 0; x < board_size; ++x) {
+                        Piece const piece = setup.board[y][x];
+                        if (pawns && piece == Piece {.kind = Piece::Kind::pawn, .side = Side::light} &&
+                            setup.board[y][7 - x] == piece) {
+                                return true;
+                        }
+                        if (piece.kind == Piece::Kind::king)
+                                kings[piece.side == Side::dark] = Position {x, y};
+                }
+        }
+        auto const [x1, y1] = kings[0];
+        auto const [x2, y2] = kings[1];
+        return !pawns && ((x1 == y1 && x2 == y2) || (x1 + y1 == 7 && x2 + y2 == 7));
+}
+
+Setup colours_swapped(Setup setup)
+{
+        setup = mirrored(setup, false, true, false);
+        for (auto& row : setup.board) {
+                for (Piece& piece : row) {
+                        if (piece != Piece::none())
+                                piece.side = opposite_side(piece.side);
+                }
+        }
+        setup.on_turn = opposite_side(setup.on_turn);
+        return setup;
+}
+
+}
+
+TEST_CASE("Syzygy tables written from a solved table probe the same, concurrently")
+{
+        SolvedTables solved;
+        REQUIRE(solve_table("KRvK", RetrogradeOptions(), solved));
+        TableDirectory directory;
+        directory.add("KRvK");
+        REQUIRE(write_solved_table(directory.path(), "KRvK", solved.at("KRvK")));
+        // Bare kings need no table.
+        REQUIRE(write_solved_table(directory.path(), "KvK", solved.at("KvK")));
+        // The magic numbers real Syzygy files start with.
+        for (auto const& [extension, magic] : {std::pair {".rtbw", "\x71\xe8\x23\x5d"},
+                                               std::pair {".rtbz", "\xd7\x66\x0c\xa5"}}) {
+                char start[4] = {};
+                std::ifstream(directory.path() + "/KRvK" + extension, std::ios::binary).read(start, 4);
+                CHECK(std::string_view(start, 4) == magic);
+        }
+
+        // Every position, each thread its own share, with the table only
+        // mapped by whichever probes first.
+        Tablebase const tablebase(directory.path());
+        CHECK(tablebase.max_pieces() == 3);
+        SolvedTable const& table = solved.at("KRvK");
+        std::vector<std::thread> threads;
+        std::atomic<int> wrong {0};
+        // Each thread's share has one side on turn, by the parity of t.
+        std::array<int, 4> longest {};
+        for (int t = 0; t < 4; ++t) {
+                threads.emplace_back([&, t]
+                {
+                        for (std::uint64_t i = t; i < table.values.size(); i += 4) {
+                                if (table.values[i] == Wdl::invalid)
+                                        continue;
+                                Game game(nullptr, *table_setup("KRvK", i));
+                                int const dtz = signed_dtz(table, i);
+                                if (tablebase.probe_wdl(game) != table.values[i] ||
+                                    tablebase.probe_dtz(game) != dtz) {
+                                        ++wrong;
+                                }
+                                longest[t] = std::max(longest[t], std::abs(dtz));
+                        }
+                });
+        }
+        for (std::thread& thread : threads)
+                thread.join();
+        CHECK(wrong == 0);
+        // Mate in sixteen at most.
+        CHECK(std::max(longest[0], longest[2]) == 31);
+        CHECK(std::max(longest[1], longest[3]) == 32);
+
+        Game mate(nullptr, *parse_fen("k7/8/1K6/8/8/8/8/7R w - - 0 1"));
+        CHECK(tablebase.probe_dtz(mate) == 1);
+        Game mated(nullptr, *parse_fen("R1k5/8/2K5/8/8/8/8/8 b - - 0 1"));
+        CHECK(tablebase.probe_wdl(mated) == Wdl::loss);
+        CHECK(tablebase.probe_dtz(mated) == -1);
+        // The rook is taken.
+        Game hanging(nullptr, *parse_fen("8/8/8/8/8/2k5/3r4/7K b - - 0 1"));
+        CHECK(tablebase.probe_wdl(hanging) == Wdl::win);
+        Game taken(nullptr, *parse_fen("8/8/8/8/8/2k5/3R4/7K b - - 0 1"));
+        CHECK(tablebase.probe_wdl(taken) == Wdl::draw);
+        CHECK(tablebase.probe_dtz(taken) == 0);
+
+        Game const adjudicated(nullptr, *parse_fen("8/8/8/3k4/8/8/1R6/6K1 b - - 0 1"));
+        CHECK(tablebase.adjudicate(adjudicated) == Side::light);
+        CHECK(!tablebase.probe(*parse_fen("8/8/8/3k4/8/8/1Q6/6K1 b - - 0 1")));
+        CHECK(!tablebase.probe(default_setup()));
+}
+
+TEST_CASE("Syzygy tables keep mirror images and swapped colours together")
+{
+        for (char const* signature : {"KPvK", "KPPvK", "KPvKP", "KRRvK", "KBvKN"}) {
+                INFO(signature);
+                std::mt19937 random(7);
+                std::vector<Setup> setups;
+                while (setups.size() < 2000) {
+                        if (std::optional const setup = random_setup(signature, random))
+                                setups.push_back(*setup);
+                }
+                TableWriter writer(signature);
+                for (Setup const& setup : setups)
+                        writer.add(setup, symmetric_value(setup), 1);
+                TableDirectory directory;
+                directory.add(signature);
+                std::ofstream wdl(directory.path() + '/' + signature + ".rtbw", std::ios::binary);
+                writer.write_wdl(wdl);
+                wdl.close();
+
+                Tablebase const tablebase(directory.path());
+                bool const pawns = std::string_view(signature).find('P') != std::string_view::npos;
+                int wrong = 0;
+                for (Setup const& setup : setups) {
+                        Wdl const expected = symmetric_value(setup);
+                        int const mirror = pawns ? 1 : 8;
+                        for (int image = 0; image < (pawns ? 4 : 16); ++image) {
+                                if ((image & mirror) && on_mirror_axis(setup, pawns))
+                                        continue;
+                                Setup probed = mirrored(setup, image & 1, image & 4, image & 8);
+                                if (image & 2)
+                                        probed = colours_swapped(probed);
+                                if (tablebase.probe(probed) != expected)
+                                        ++wrong;
+                        }
+                }
+                CHECK(wrong == 0);
+        }
+}
+
+TEST_CASE("Syzygy tables that are missing or damaged aren't probed")
+{
+        TableDirectory directory;
+        directory.add("KQvK");
+        std::ofstream(directory.path() + "/KQvK.rtbw", std::ios::binary) << "not a table";
+        Tablebase const tablebase(directory.path());
+        CHECK(tablebase.max_pieces() == 3);
+        CHECK(!tablebase.probe(*parse_fen("8/8/8/3k4/8/8/1Q6/6K1 b - - 0 1")));
+        CHECK(!tablebase.probe(*parse_fen("8/8/8/3k4/8/8/1R6/6K1 b - - 0 1")));
+        CHECK_THROWS_AS(TableWriter("KvK"), std::invalid_argument);
+        CHECK_THROWS_AS(TableWriter("KQRBvKQR"), std::invalid_argument);
+}
+
+// Real Syzygy tables, like the published 3-4-5 piece set, are looked for
+// in CHESS_SYZYGY_PATH and probed against the solver, which knows nothing
+// of the file format. Tables that count moves rather than plies may give
+// a DTZ one more than the solver's.
+TEST_CASE("Real Syzygy tables probe the same as the solver")
+{
+        char const* const path = std::getenv("CHESS_SYZYGY_PATH");
+        if (!path) {
+                WARN("CHESS_SYZYGY_PATH isn't set, so no real tables are probed");
+                return;
+        }
+        Tablebase const tablebase(path);
+        for (char const* signature : {"KQvK", "KRvK", "KBvK", "KNvK", "KPvK"}) {
+                INFO(signature);
+                SolvedTables solved;
+                REQUIRE(solve_table(signature, RetrogradeOptions(), solved));
+                SolvedTable const& table = solved.at(signature);
+                int wrong = 0;
+                for (std::uint64_t i = 0; i < table.values.size(); ++i) {
+                        if (table.values[i] == Wdl::invalid)
+                                continue;
+                        Game game(nullptr, *table_setup(signature, i));
+                        int const expected = signed_dtz(table, i);
+                        std::optional const dtz = tablebase.probe_dtz(game);
+                        if (tablebase.probe_wdl(game) != table.values[i] || !dtz ||
+                            (*dtz > 0) != (expected > 0) || (*dtz < 0) != (expected < 0) ||
+                            std::abs(*dtz - expected) > 1) {
+                                ++wrong;
+                        }
+                }
+                CHECK(wrong == 0);
+        }
+}